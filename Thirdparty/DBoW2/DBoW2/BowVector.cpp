@@ -31,11 +31,38 @@ BowVector::~BowVector(void)
 
 // --------------------------------------------------------------------------
 
+static inline bool WordIdLess(const BowVector::value_type &a, WordId id)
+{
+  return a.first < id;
+}
+
+static inline bool EntryLess(const BowVector::value_type &a,
+  const BowVector::value_type &b)
+{
+  return a.first < b.first;
+}
+
+// --------------------------------------------------------------------------
+
+BowVector::iterator BowVector::lower_bound(WordId id)
+{
+  return std::lower_bound(this->begin(), this->end(), id, WordIdLess);
+}
+
+// --------------------------------------------------------------------------
+
+BowVector::const_iterator BowVector::lower_bound(WordId id) const
+{
+  return std::lower_bound(this->begin(), this->end(), id, WordIdLess);
+}
+
+// --------------------------------------------------------------------------
+
 void BowVector::addWeight(WordId id, WordValue v)
 {
   BowVector::iterator vit = this->lower_bound(id);
   
-  if(vit != this->end() && !(this->key_comp()(id, vit->first)))
+  if(vit != this->end() && vit->first == id)
   {
     vit->second += v;
   }
@@ -51,7 +78,7 @@ void BowVector::addIfNotExist(WordId id, WordValue v)
 {
   BowVector::iterator vit = this->lower_bound(id);
   
-  if(vit == this->end() || (this->key_comp()(id, vit->first)))
+  if(vit == this->end() || vit->first != id)
   {
     this->insert(vit, BowVector::value_type(id, v));
   }
@@ -59,6 +86,31 @@ void BowVector::addIfNotExist(WordId id, WordValue v)
 
 // --------------------------------------------------------------------------
 
+void BowVector::mergeDuplicates(bool accumulate)
+{
+  if(this->empty()) return;
+
+  // the vocabulary gives the same value to every entry of a word, so their
+  // order after sorting does not change the accumulated sum
+  std::sort(this->begin(), this->end(), EntryLess);
+
+  BowVector::iterator out = this->begin();
+  for(BowVector::iterator vit = this->begin() + 1; vit != this->end(); ++vit)
+  {
+    if(vit->first == out->first)
+    {
+      if(accumulate) out->second += vit->second;
+    }
+    else
+    {
+      *(++out) = *vit;
+    }
+  }
+  this->erase(out + 1, this->end());
+}
+
+// --------------------------------------------------------------------------
+
 void BowVector::normalize(LNorm norm_type)
 {
   double norm = 0.0; 
@@ -11,7 +11,7 @@
 #define __D_T_BOW_VECTOR__
 
 #include <iostream>
-#include <map>
+#include <utility>
 #include <vector>
 
 namespace DBoW2 {
@@ -52,9 +52,10 @@ enum ScoringType
   DOT_PRODUCT,
 };
 
-/// Vector of words to represent images
+/// Vector of words to represent images, kept sorted by word id in a
+/// contiguous array
 class BowVector: 
-	public std::map<WordId, WordValue>
+	public std::vector<std::pair<WordId, WordValue> >
 {
 public:
 
@@ -83,6 +84,22 @@ public:
 	 */
 	void addIfNotExist(WordId id, WordValue v);
 
+	/**
+	 * Sorts entries appended with push_back by word id and merges the
+	 * entries of the same word, so the vector can be built from a whole
+	 * image with a single allocation
+	 * @param accumulate if true, merged values are added (as in addWeight);
+	 *   otherwise the first value is kept (as in addIfNotExist)
+	 */
+	void mergeDuplicates(bool accumulate);
+
+	/**
+	 * Returns the first entry whose word id is not less than id
+	 * @param id word id to look for
+	 */
+	iterator lower_bound(WordId id);
+	const_iterator lower_bound(WordId id) const;
+
 	/**
 	 * L1-Normalizes the values in the vector 
 	 * @param norm_type norm used
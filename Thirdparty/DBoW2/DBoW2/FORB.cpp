@@ -14,6 +14,12 @@
 #include <string>
 #include <sstream>
 #include <stdint-gcc.h>
+#include <cstring>
+#include <limits>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #include "FORB.h"
 
@@ -100,6 +106,80 @@ int FORB::distance(const FORB::TDescriptor &a,
   return dist;
 }
 
+// --------------------------------------------------------------------------
+
+#ifdef __AVX2__
+// Per-64-bit-lane popcount of a^b (4 lanes, each <= 64)
+static inline __m256i HammingLanes(const __m256i &a, const unsigned char *pb)
+{
+  const __m256i lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                       0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+
+  const __m256i x = _mm256_xor_si256(a,
+    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pb)));
+  const __m256i c = _mm256_add_epi8(
+    _mm256_shuffle_epi8(lut, _mm256_and_si256(x, low)),
+    _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), low)));
+  return _mm256_sad_epu8(c, _mm256_setzero_si256());
+}
+#endif
+
+int FORB::nearest(const FORB::TDescriptor &a, const unsigned char *pb, int n)
+{
+  const unsigned char *pa = a.ptr<unsigned char>();
+
+  int best = 0;
+  int best_d = std::numeric_limits<int>::max();
+  int i = 0;
+
+#ifdef __AVX2__
+  // Four candidates at a time: their lane counts are packed into 16-bit
+  // fields of each 64-bit lane and reduced together (the sum of a field
+  // is at most 256)
+  const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pa));
+  for(; i + 4 <= n; i += 4, pb += 4*FORB::L)
+  {
+    __m256i s = HammingLanes(va, pb);
+    s = _mm256_or_si256(s, _mm256_slli_epi64(HammingLanes(va, pb + FORB::L), 16));
+    s = _mm256_or_si256(s, _mm256_slli_epi64(HammingLanes(va, pb + 2*FORB::L), 32));
+    s = _mm256_or_si256(s, _mm256_slli_epi64(HammingLanes(va, pb + 3*FORB::L), 48));
+
+    __m128i h = _mm_add_epi64(_mm256_castsi256_si128(s),
+                              _mm256_extracti128_si256(s, 1));
+    h = _mm_add_epi64(h, _mm_unpackhi_epi64(h, h));
+    const uint64_t packed = (uint64_t)_mm_cvtsi128_si64(h);
+
+    for(int j = 0; j < 4; ++j)
+    {
+      const int d = (int)((packed >> (16*j)) & 0xffff);
+      if(d < best_d)
+      {
+        best_d = d;
+        best = i + j;
+      }
+    }
+  }
+#endif
+
+  uint64_t qa[4];
+  memcpy(qa, pa, sizeof(qa));
+  for(; i < n; ++i, pb += FORB::L)
+  {
+    uint64_t qb[4];
+    memcpy(qb, pb, sizeof(qb));
+    const int d = __builtin_popcountll(qa[0] ^ qb[0]) + __builtin_popcountll(qa[1] ^ qb[1]) +
+                  __builtin_popcountll(qa[2] ^ qb[2]) + __builtin_popcountll(qa[3] ^ qb[3]);
+    if(d < best_d)
+    {
+      best_d = d;
+      best = i;
+    }
+  }
+
+  return best;
+}
+
 // --------------------------------------------------------------------------
   
 std::string FORB::toString(const FORB::TDescriptor &a)
@@ -136,6 +216,21 @@ void FORB::fromString(FORB::TDescriptor &a, const std::string &s)
 
 // --------------------------------------------------------------------------
 
+void FORB::toArray(const FORB::TDescriptor &a, unsigned char *p)
+{
+  const unsigned char *d = a.ptr<unsigned char>();
+  std::copy(d, d+FORB::L, p);
+}
+
+// --------------------------------------------------------------------------
+
+void FORB::fromArray(FORB::TDescriptor &a, const unsigned char *p)
+{
+  a = cv::Mat(1, FORB::L, CV_8U, const_cast<unsigned char*>(p));
+}
+
+// --------------------------------------------------------------------------
+
 void FORB::toMat32F(const std::vector<TDescriptor> &descriptors, 
   cv::Mat &mat)
 {
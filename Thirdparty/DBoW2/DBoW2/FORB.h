@@ -46,6 +46,17 @@ public:
    */
   static int distance(const TDescriptor &a, const TDescriptor &b);
 
+  /**
+   * Returns the index of the descriptor closest to a among n descriptors
+   * stored contiguously (L bytes each). Ties go to the lowest index, as
+   * when comparing with distance() one by one
+   * @param a
+   * @param pb first of the n descriptors
+   * @param n number of descriptors (> 0)
+   * @return index of the nearest descriptor
+   */
+  static int nearest(const TDescriptor &a, const unsigned char *pb, int n);
+
   /**
    * Returns a string version of the descriptor
    * @param a descriptor
@@ -60,6 +71,21 @@ public:
    */
   static void fromString(TDescriptor &a, const std::string &s);
 
+  /**
+   * Copies the L bytes of a descriptor into a raw buffer
+   * @param a descriptor
+   * @param p (out) buffer of at least L bytes
+   */
+  static void toArray(const TDescriptor &a, unsigned char *p);
+
+  /**
+   * Returns a descriptor that wraps L bytes of external memory without
+   * copying them. The memory must outlive the descriptor
+   * @param a (out) descriptor
+   * @param p buffer of L bytes
+   */
+  static void fromArray(TDescriptor &a, const unsigned char *p);
+
   /**
    * Returns a mat with the descriptors in float format
    * @param descriptors
@@ -8,15 +8,15 @@
  */
 
 #include "FeatureVector.h"
-#include <map>
 #include <vector>
 #include <iostream>
+#include <algorithm>
 
 namespace DBoW2 {
 
 // ---------------------------------------------------------------------------
 
-FeatureVector::FeatureVector(void)
+FeatureVector::FeatureVector(void): m_nodes(0)
 {
 }
 
@@ -28,53 +28,119 @@ FeatureVector::~FeatureVector(void)
 
 // ---------------------------------------------------------------------------
 
+void FeatureVector::clear()
+{
+  m_data.clear();
+  m_nodes = 0;
+}
+
+// ---------------------------------------------------------------------------
+
+void FeatureVector::release()
+{
+  std::vector<unsigned int>().swap(m_data);
+  m_nodes = 0;
+}
+
+// ---------------------------------------------------------------------------
+
+FeatureVector::const_iterator FeatureVector::lower_bound(NodeId id) const
+{
+  if(m_nodes == 0) return end();
+
+  const unsigned int *ids = &m_data[0];
+  return const_iterator(this, std::lower_bound(ids, ids + m_nodes, id) - ids);
+}
+
+// ---------------------------------------------------------------------------
+
 void FeatureVector::addFeature(NodeId id, unsigned int i_feature)
 {
-  FeatureVector::iterator vit = this->lower_bound(id);
-  
-  if(vit != this->end() && vit->first == id)
+  const unsigned int K = m_nodes;
+
+  if(K == 0)
+  {
+    m_data.resize(4);
+    m_data[0] = id;
+    m_data[1] = 0;
+    m_data[2] = 1;
+    m_data[3] = i_feature;
+    m_nodes = 1;
+    return;
+  }
+
+  const unsigned int k = std::lower_bound(&m_data[0], &m_data[0] + K, id) - &m_data[0];
+
+  if(k < K && m_data[k] == id)
   {
-    vit->second.push_back(i_feature);
+    // append to node k and shift the following offsets
+    m_data.insert(m_data.begin() + 2*K + 1 + m_data[K + k + 1], i_feature);
+    for(unsigned int j = k + 1; j <= K; ++j) ++m_data[K + j];
   }
   else
   {
-    vit = this->insert(vit, FeatureVector::value_type(id, 
-      std::vector<unsigned int>() ));
-    vit->second.push_back(i_feature);
+    // new node k with one feature, starting where the previous one ends
+    const unsigned int start = m_data[K + k];
+    m_data.insert(m_data.begin() + 2*K + 1 + start, i_feature);
+    m_data.insert(m_data.begin() + K + k, start);
+    for(unsigned int j = k + 1; j <= K + 1; ++j) ++m_data[K + j];
+    m_data.insert(m_data.begin() + k, id);
+    ++m_nodes;
   }
 }
 
 // ---------------------------------------------------------------------------
 
+void FeatureVector::create(std::vector<std::pair<NodeId, unsigned int> > &pairs)
+{
+  clear();
+  if(pairs.empty()) return;
+
+  std::sort(pairs.begin(), pairs.end());
+
+  unsigned int K = 1;
+  for(size_t i = 1; i < pairs.size(); ++i)
+    if(pairs[i].first != pairs[i-1].first) ++K;
+
+  m_data.resize(2*K + 1 + pairs.size());
+  m_nodes = K;
+
+  unsigned int *ids = &m_data[0];
+  unsigned int *offsets = ids + K;
+  unsigned int *features = offsets + K + 1;
+
+  unsigned int k = 0;
+  for(size_t i = 0; i < pairs.size(); ++i)
+  {
+    if(i == 0 || pairs[i].first != pairs[i-1].first)
+    {
+      ids[k] = pairs[i].first;
+      offsets[k] = i;
+      ++k;
+    }
+    features[i] = pairs[i].second;
+  }
+  offsets[K] = pairs.size();
+}
+
+// ---------------------------------------------------------------------------
+
 std::ostream& operator<<(std::ostream &out, 
   const FeatureVector &v)
 {
-  if(!v.empty())
+  FeatureVector::const_iterator vit;
+  for(vit = v.begin(); vit != v.end(); ++vit)
   {
-    FeatureVector::const_iterator vit = v.begin();
-    
-    const std::vector<unsigned int>* f = &vit->second;
+    const FeatureVector::Indices &f = vit->second;
 
+    if(vit != v.begin()) out << ", ";
     out << "<" << vit->first << ": [";
-    if(!f->empty()) out << (*f)[0];
-    for(unsigned int i = 1; i < f->size(); ++i)
+    if(!f.empty()) out << f[0];
+    for(unsigned int i = 1; i < f.size(); ++i)
     {
-      out << ", " << (*f)[i];
+      out << ", " << f[i];
     }
     out << "]>";
-    
-    for(++vit; vit != v.end(); ++vit)
-    {
-      f = &vit->second;
-      
-      out << ", <" << vit->first << ": [";
-      if(!f->empty()) out << (*f)[0];
-      for(unsigned int i = 1; i < f->size(); ++i)
-      {
-        out << ", " << (*f)[i];
-      }
-      out << "]>";
-    }
   }
   
   return out;  
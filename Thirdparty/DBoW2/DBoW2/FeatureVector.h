@@ -11,18 +11,90 @@
 #define __D_T_FEATURE_VECTOR__
 
 #include "BowVector.h"
-#include <map>
+#include <utility>
 #include <vector>
 #include <iostream>
 
 namespace DBoW2 {
 
-/// Vector of nodes with indexes of local features
-class FeatureVector: 
-  public std::map<NodeId, std::vector<unsigned int> >
+/// Vector of nodes with indexes of local features, stored in compressed
+/// sparse row form in a single buffer:
+///   [ node ids (K) | offsets (K+1) | feature indexes ]
+/// Nodes are sorted by id and the features of node k are the indexes
+/// [offsets[k], offsets[k+1]) of the feature array
+class FeatureVector
 {
 public:
 
+  /// Features of a node (view into the feature vector)
+  class Indices
+  {
+  public:
+    Indices(): m_p(NULL), m_n(0){}
+    Indices(const unsigned int *p, unsigned int n): m_p(p), m_n(n){}
+
+    inline size_t size() const { return m_n; }
+    inline bool empty() const { return m_n == 0; }
+    inline unsigned int operator[](size_t i) const { return m_p[i]; }
+    inline const unsigned int* begin() const { return m_p; }
+    inline const unsigned int* end() const { return m_p + m_n; }
+
+  private:
+    const unsigned int *m_p;
+    unsigned int m_n;
+  };
+
+  /// Node entry, with the same member names as a map pair
+  struct value_type
+  {
+    NodeId first;
+    Indices second;
+  };
+
+  /// Forward iterator over the nodes
+  class const_iterator
+  {
+  public:
+    const_iterator(): m_fv(NULL), m_k(0){}
+    const_iterator(const FeatureVector *fv, unsigned int k): m_fv(fv), m_k(k)
+    {
+      load();
+    }
+
+    inline const value_type& operator*() const { return m_value; }
+    inline const value_type* operator->() const { return &m_value; }
+
+    inline const_iterator& operator++()
+    {
+      ++m_k;
+      load();
+      return *this;
+    }
+
+    inline const_iterator operator++(int)
+    {
+      const_iterator it(*this);
+      ++(*this);
+      return it;
+    }
+
+    inline bool operator==(const const_iterator &it) const { return m_k == it.m_k; }
+    inline bool operator!=(const const_iterator &it) const { return m_k != it.m_k; }
+
+  private:
+    inline void load()
+    {
+      if(m_fv != NULL && m_k < m_fv->m_nodes)
+        m_value = m_fv->entry(m_k);
+    }
+
+    const FeatureVector *m_fv;
+    unsigned int m_k;
+    value_type m_value;
+  };
+
+  typedef const_iterator iterator;
+
   /**
    * Constructor
    */
@@ -35,18 +107,73 @@ public:
   
   /**
    * Adds a feature to an existing node, or adds a new node with an initial
-   * feature
+   * feature. This shifts the buffer; use create to build a whole vector
    * @param id node id to add or to modify
    * @param i_feature index of feature to add to the given node
    */
   void addFeature(NodeId id, unsigned int i_feature);
 
+  /**
+   * Replaces the content with the given (node id, feature index) pairs,
+   * with a single allocation. The pairs are sorted in place
+   * @param pairs
+   */
+  void create(std::vector<std::pair<NodeId, unsigned int> > &pairs);
+
+  /**
+   * Removes all the nodes
+   */
+  void clear();
+
+  /**
+   * Removes all the nodes and frees their storage
+   */
+  void release();
+
+  /**
+   * Returns the number of nodes
+   */
+  inline size_t size() const { return m_nodes; }
+
+  /**
+   * Returns whether there are no nodes
+   */
+  inline bool empty() const { return m_nodes == 0; }
+
+  inline const_iterator begin() const { return const_iterator(this, 0); }
+  inline const_iterator end() const { return const_iterator(this, m_nodes); }
+
+  /**
+   * Returns the first node whose id is not less than id
+   * @param id node id to look for
+   */
+  const_iterator lower_bound(NodeId id) const;
+
   /**
    * Sends a string versions of the feature vector through the stream
    * @param out stream
    * @param v feature vector
    */
   friend std::ostream& operator<<(std::ostream &out, const FeatureVector &v);
+
+protected:
+
+  /// Returns the entry of the k-th node
+  inline value_type entry(unsigned int k) const
+  {
+    const unsigned int *offsets = &m_data[m_nodes];
+    value_type v;
+    v.first = m_data[k];
+    v.second = Indices(&m_data[2*m_nodes + 1] + offsets[k],
+      offsets[k+1] - offsets[k]);
+    return v;
+  }
+
+  /// Node ids, offsets and feature indexes
+  std::vector<unsigned int> m_data;
+
+  /// Number of nodes
+  unsigned int m_nodes;
     
 };
 
@@ -22,39 +22,33 @@ const double GeneralScoring::LOG_EPS = log(DBL_EPSILON); // FLT_EPSILON
 
 double L1Scoring::score(const BowVector &v1, const BowVector &v2) const
 {
-  BowVector::const_iterator v1_it, v2_it;
-  const BowVector::const_iterator v1_end = v1.end();
-  const BowVector::const_iterator v2_end = v2.end();
-  
-  v1_it = v1.begin();
-  v2_it = v2.begin();
+  // merge join of the two sorted arrays
+  const BowVector::value_type *p1 = v1.empty() ? NULL : &v1[0];
+  const BowVector::value_type *p2 = v2.empty() ? NULL : &v2[0];
+  const BowVector::value_type *p1_end = p1 + v1.size();
+  const BowVector::value_type *p2_end = p2 + v2.size();
   
   double score = 0;
   
-  while(v1_it != v1_end && v2_it != v2_end)
+  while(p1 != p1_end && p2 != p2_end)
   {
-    const WordValue& vi = v1_it->second;
-    const WordValue& wi = v2_it->second;
-    
-    if(v1_it->first == v2_it->first)
+    if(p1->first == p2->first)
     {
+      const WordValue vi = p1->second;
+      const WordValue wi = p2->second;
       score += fabs(vi - wi) - fabs(vi) - fabs(wi);
       
       // move v1 and v2 forward
-      ++v1_it;
-      ++v2_it;
+      ++p1;
+      ++p2;
     }
-    else if(v1_it->first < v2_it->first)
+    else if(p1->first < p2->first)
     {
-      // move v1 forward
-      v1_it = v1.lower_bound(v2_it->first);
-      // v1_it = (first element >= v2_it.id)
+      ++p1;
     }
     else
     {
-      // move v2 forward
-      v2_it = v2.lower_bound(v1_it->first);
-      // v2_it = (first element >= v1_it.id)
+      ++p2;
     }
   }
   
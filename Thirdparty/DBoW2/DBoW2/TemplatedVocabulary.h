@@ -26,6 +26,20 @@
 #include <algorithm>
 #include <opencv2/core/core.hpp>
 #include <limits>
+#include <iostream>
+#include <cstring>
+#include <stdint.h>
+
+#include <random>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "FeatureVector.h"
 #include "BowVector.h"
@@ -37,6 +51,62 @@ using namespace std;
 
 namespace DBoW2 {
 
+/// Header of the binary vocabulary format. The header is followed by the
+/// flat tree, as arrays each starting on an 8-byte boundary:
+///   double   weight[nNodes]
+///   uint32_t parent[nNodes]       (parent of the root is 0)
+///   uint32_t nodeWord[nNodes]     (word id of each leaf, ~0 otherwise)
+///   uint32_t wordNode[nWords]     (node id of each word)
+///   uint32_t childFirst[nNodes+1] (children of node i occupy the child
+///                                  slots [childFirst[i], childFirst[i+1]))
+///   uint32_t child[nNodes-1]      (node id of each child slot)
+///   uint8_t  descriptor[(nNodes-1)*descriptorBytes] (of each child slot)
+/// The vocabulary is searched directly on these arrays, in the mapped file
+/// or in the same image built in memory
+struct BinaryVocabularyHeader
+{
+  char magic[8];
+  uint32_t version;
+  int32_t k;
+  int32_t L;
+  int32_t scoring;
+  int32_t weighting;
+  uint32_t descriptorBytes;
+  uint64_t nNodes;
+  uint64_t nWords;
+  uint64_t reserved[2];
+};
+
+/// Offsets of the arrays of a binary vocabulary
+struct BinaryVocabularyLayout
+{
+  size_t weights;
+  size_t parents;
+  size_t nodeWords;
+  size_t wordNodes;
+  size_t childFirst;
+  size_t children;
+  size_t descriptors;
+  size_t end;
+
+  BinaryVocabularyLayout(size_t nNodes, size_t nWords, size_t descriptorBytes)
+  {
+    weights = align(sizeof(BinaryVocabularyHeader));
+    parents = align(weights + nNodes*sizeof(double));
+    nodeWords = align(parents + nNodes*sizeof(uint32_t));
+    wordNodes = align(nodeWords + nNodes*sizeof(uint32_t));
+    childFirst = align(wordNodes + nWords*sizeof(uint32_t));
+    children = align(childFirst + (nNodes+1)*sizeof(uint32_t));
+    descriptors = align(children + (nNodes-1)*sizeof(uint32_t));
+    end = descriptors + (nNodes-1)*descriptorBytes;
+  }
+
+  static inline size_t align(size_t offset)
+  {
+    return (offset + 7) & ~(size_t)7;
+  }
+};
+
 /// @param TDescriptor class of descriptor
 /// @param F class of descriptor functions
 template<class TDescriptor, class F>
@@ -246,6 +316,22 @@ public:
    */
   void saveToTextFile(const std::string &filename) const;  
 
+  /**
+   * Loads the vocabulary from a binary file written by saveToBinaryFile.
+   * The file is memory-mapped read-only and searched in place, no node is
+   * built, so processes loading the same file share its pages
+   * @param filename
+   * @return false if the file could not be mapped or is not valid
+   */
+  bool loadFromBinaryFile(const std::string &filename);
+
+  /**
+   * Saves the vocabulary into a binary file
+   * @param filename
+   * @return false if the file could not be written
+   */
+  bool saveToBinaryFile(const std::string &filename) const;
+
   /**
    * Saves the vocabulary into a file
    * @param filename
@@ -288,6 +374,25 @@ public:
    */
   virtual int stopWords(double minWeight);
 
+  /**
+   * Sets the number of threads used by create
+   * @param n number of threads (<= 0: all hardware threads)
+   */
+  inline void setTrainingThreads(int n) { m_training_threads = n; }
+
+  /**
+   * Removes the words that are hit fewer than minHits times by the given
+   * features, together with the branches that are left without words.
+   * Features that fell into a removed word go to the nearest remaining
+   * sibling afterwards
+   * @param features features of a set of images
+   * @param minHits minimum number of features a word must receive
+   * @param reweight if true, the word weights are recomputed from features
+   * @return number of words removed
+   */
+  unsigned int prune(const vector<vector<TDescriptor> > &features,
+    unsigned int minHits = 1, bool reweight = false);
+
 protected:
 
   /// Pointer to descriptor
@@ -362,15 +467,42 @@ protected:
    */
   virtual void transform(const TDescriptor &feature, WordId &id) const;
       
+  /// Cluster of the tree under construction, before node ids are assigned
+  struct ClusterNode
+  {
+    TDescriptor descriptor;
+    vector<unsigned int> children;
+  };
+
   /**
-   * Creates a level in the tree, under the parent, by running kmeans with
-   * a descriptor set, and recursively creates the subsequent levels too
-   * @param parent_id id of parent node
+   * Builds the tree under the root by running kmeans hierarchically. The
+   * clusters of different branches are computed in parallel, and the nodes
+   * are then numbered depth first
+   * @param descriptors training descriptors
+   */
+  void HKmeans(const vector<pDescriptor> &descriptors);
+
+  /**
+   * Runs kmeans on a descriptor set
    * @param descriptors descriptors to run the kmeans on
-   * @param current_level current level in the tree
+   * @param clusters (out) cluster centres
+   * @param groups (out) indices of the descriptors of each cluster
+   * @param rng random generator for the seeding
+   * @param nThreads threads used to associate descriptors to clusters
+   */
+  void KmeansStep(const vector<pDescriptor> &descriptors,
+    vector<TDescriptor> &clusters, vector<vector<unsigned int> > &groups,
+    std::mt19937 &rng, int nThreads) const;
+
+  /**
+   * Creates the nodes of the children of a cluster, then of their children
+   * (same numbering as a depth-first recursion)
+   * @param clusters clusters computed by HKmeans
+   * @param cluster cluster whose children are added
+   * @param parent_id node id of the cluster
    */
-  void HKmeansStep(NodeId parent_id, const vector<pDescriptor> &descriptors, 
-    int current_level);
+  void addClusterNodes(const std::deque<ClusterNode> &clusters,
+    unsigned int cluster, NodeId parent_id);
 
   /**
    * Creates k clusters from the given descriptors with some seeding algorithm.
@@ -378,16 +510,34 @@ protected:
    *   overriden by inherited classes.
    */
   virtual void initiateClusters(const vector<pDescriptor> &descriptors,
-    vector<TDescriptor> &clusters) const;
+    vector<TDescriptor> &clusters, std::mt19937 &rng) const;
   
   /**
    * Creates k clusters from the given descriptor sets by running the
    * initial step of kmeans++
    * @param descriptors 
    * @param clusters resulting clusters
+   * @param rng random generator
    */
   void initiateClustersKMpp(const vector<pDescriptor> &descriptors, 
-    vector<TDescriptor> &clusters) const;
+    vector<TDescriptor> &clusters, std::mt19937 &rng) const;
+
+  /**
+   * Returns the seed of the i-th child of a branch (splitmix64)
+   */
+  static inline uint64_t mixSeed(uint64_t seed, unsigned int i)
+  {
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL * (i + 1);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  /**
+   * Runs f(begin, end) over [0, n) split in nThreads contiguous ranges
+   */
+  template<class Func>
+  static void parallelRanges(size_t n, int nThreads, Func f);
   
   /**
    * Create the words of the vocabulary once the tree has been built
@@ -395,12 +545,46 @@ protected:
   void createWords();
   
   /**
-   * Sets the weights of the nodes of tree according to the given features.
-   * Before calling this function, the nodes and the words must be already
-   * created (by calling HKmeansStep and createWords)
+   * Sets the weights of the words according to the given features.
+   * Before calling this function, the flat tree must be already created
+   * (by calling HKmeans, createWords and createFlatTree)
    * @param features
    */
   void setNodeWeights(const vector<vector<TDescriptor> > &features);
+
+  /**
+   * Builds the flat tree image from m_nodes and m_words, which are then
+   * cleared. Must be called whenever the tree structure changes
+   */
+  void createFlatTree();
+
+  /**
+   * Rebuilds m_nodes and m_words from the flat tree, to edit the tree
+   */
+  void createNodesFromFlatTree();
+
+  /**
+   * Points the flat tree arrays into a vocabulary image (NULL: empty)
+   * @param image binary vocabulary, already validated
+   * @param size bytes of the image
+   */
+  void setFlatTree(const unsigned char *image, size_t size);
+
+  /**
+   * Unmaps or frees the flat tree image
+   */
+  void releaseFlatTree();
+
+  /**
+   * Returns the node weights in an owned image, copying the mapped file
+   * first if needed
+   */
+  double* mutableWeights();
+
+  /**
+   * Returns the descriptor of a node other than the root
+   */
+  const unsigned char* nodeDescriptor(NodeId nid) const;
   
 protected:
 
@@ -415,16 +599,45 @@ protected:
   
   /// Scoring method
   ScoringType m_scoring;
+
+  /// Threads used by create (<= 0: all hardware threads)
+  int m_training_threads;
   
   /// Object for computing scores
   GeneralScoring* m_scoring_object;
   
-  /// Tree nodes
+  /// Tree nodes, only while the tree is built or edited (create, prune,
+  /// text and yml loading). Queries run on the flat tree
   std::vector<Node> m_nodes;
   
-  /// Words of the vocabulary (tree leaves)
+  /// Words of the vocabulary (tree leaves), with m_nodes
   /// this condition holds: m_words[wid]->word_id == wid
   std::vector<Node*> m_words;
+
+  /// Binary file mapping holding the flat tree (NULL if none)
+  void *m_mapping;
+
+  /// Size in bytes of m_mapping
+  size_t m_mapping_size;
+
+  /// Flat tree image, laid out as a binary vocabulary file. Points into
+  /// m_mapping or m_flat_storage
+  const unsigned char *m_flat;
+  size_t m_flat_size;
+  size_t m_flat_nodes;
+  size_t m_flat_words;
+
+  /// Arrays of the flat tree image (see BinaryVocabularyHeader)
+  const double *m_flat_weights;
+  const uint32_t *m_flat_parents;
+  const uint32_t *m_flat_node_words;
+  const uint32_t *m_flat_word_nodes;
+  const uint32_t *m_flat_first;
+  const uint32_t *m_flat_children;
+  const unsigned char *m_flat_descriptors;
+
+  /// Owned image when the vocabulary is not mapped from a file
+  std::vector<unsigned char> m_flat_storage;
   
 };
 
@@ -434,8 +647,9 @@ template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
   (int k, int L, WeightingType weighting, ScoringType scoring)
   : m_k(k), m_L(L), m_weighting(weighting), m_scoring(scoring),
-  m_scoring_object(NULL)
+  m_training_threads(0), m_scoring_object(NULL), m_mapping(NULL), m_mapping_size(0)
 {
+  setFlatTree(NULL, 0);
   createScoringObject();
 }
 
@@ -443,8 +657,10 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const std::string &filename): m_scoring_object(NULL)
+  (const std::string &filename): m_training_threads(0), m_scoring_object(NULL), m_mapping(NULL),
+  m_mapping_size(0)
 {
+  setFlatTree(NULL, 0);
   load(filename);
 }
 
@@ -452,8 +668,10 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const char *filename): m_scoring_object(NULL)
+  (const char *filename): m_training_threads(0), m_scoring_object(NULL), m_mapping(NULL),
+  m_mapping_size(0)
 {
+  setFlatTree(NULL, 0);
   load(filename);
 }
 
@@ -516,8 +734,9 @@ void TemplatedVocabulary<TDescriptor,F>::setWeightingType(WeightingType type)
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary(
   const TemplatedVocabulary<TDescriptor, F> &voc)
-  : m_scoring_object(NULL)
+  : m_training_threads(0), m_scoring_object(NULL), m_mapping(NULL), m_mapping_size(0)
 {
+  setFlatTree(NULL, 0);
   *this = voc;
 }
 
@@ -527,6 +746,200 @@ template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::~TemplatedVocabulary()
 {
   delete m_scoring_object;
+
+  m_words.clear();
+  m_nodes.clear();
+  releaseFlatTree();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::setFlatTree(const unsigned char *image,
+  size_t size)
+{
+  m_flat = image;
+  m_flat_size = size;
+
+  if(image == NULL)
+  {
+    m_flat_nodes = 0;
+    m_flat_words = 0;
+    m_flat_weights = NULL;
+    m_flat_parents = NULL;
+    m_flat_node_words = NULL;
+    m_flat_word_nodes = NULL;
+    m_flat_first = NULL;
+    m_flat_children = NULL;
+    m_flat_descriptors = NULL;
+    return;
+  }
+
+  BinaryVocabularyHeader header;
+  memcpy(&header, image, sizeof(header));
+  m_flat_nodes = header.nNodes;
+  m_flat_words = header.nWords;
+
+  const BinaryVocabularyLayout layout(m_flat_nodes, m_flat_words, F::L);
+  m_flat_weights = reinterpret_cast<const double*>(image + layout.weights);
+  m_flat_parents = reinterpret_cast<const uint32_t*>(image + layout.parents);
+  m_flat_node_words = reinterpret_cast<const uint32_t*>(image + layout.nodeWords);
+  m_flat_word_nodes = reinterpret_cast<const uint32_t*>(image + layout.wordNodes);
+  m_flat_first = reinterpret_cast<const uint32_t*>(image + layout.childFirst);
+  m_flat_children = reinterpret_cast<const uint32_t*>(image + layout.children);
+  m_flat_descriptors = image + layout.descriptors;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::releaseFlatTree()
+{
+  setFlatTree(NULL, 0);
+  m_flat_storage.clear();
+  m_flat_storage.shrink_to_fit();
+
+  if(m_mapping != NULL)
+  {
+    munmap(m_mapping, m_mapping_size);
+    m_mapping = NULL;
+    m_mapping_size = 0;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+double* TemplatedVocabulary<TDescriptor,F>::mutableWeights()
+{
+  if(m_mapping != NULL)
+  {
+    // copy on write, the mapping is read-only
+    vector<unsigned char> image(m_flat, m_flat + m_flat_size);
+    releaseFlatTree();
+    m_flat_storage.swap(image);
+    setFlatTree(&m_flat_storage[0], m_flat_storage.size());
+  }
+
+  if(m_flat_storage.empty()) return NULL;
+
+  const BinaryVocabularyLayout layout(m_flat_nodes, m_flat_words, F::L);
+  return reinterpret_cast<double*>(&m_flat_storage[0] + layout.weights);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+const unsigned char* TemplatedVocabulary<TDescriptor,F>::nodeDescriptor(
+  NodeId nid) const
+{
+  // the node is one of the child slots of its parent
+  const uint32_t pid = m_flat_parents[nid];
+  uint32_t slot = m_flat_first[pid];
+  while(m_flat_children[slot] != nid) ++slot;
+  return m_flat_descriptors + (size_t)slot * F::L;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::createFlatTree()
+{
+  const size_t nNodes = m_nodes.size();
+  const size_t nWords = m_words.size();
+
+  // an empty vocabulary (nothing trained) has no image
+  vector<unsigned char> image;
+  if(nNodes >= 2 && nWords >= 1)
+  {
+    const BinaryVocabularyLayout layout(nNodes, nWords, F::L);
+    image.resize(layout.end, 0);
+    unsigned char *base = &image[0];
+
+    BinaryVocabularyHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "DBOW2VOC", 8);
+    header.version = 2;
+    header.descriptorBytes = F::L;
+    header.nNodes = nNodes;
+    header.nWords = nWords;
+    memcpy(base, &header, sizeof(header));
+
+    double *weights = reinterpret_cast<double*>(base + layout.weights);
+    uint32_t *parents = reinterpret_cast<uint32_t*>(base + layout.parents);
+    uint32_t *nodeWords = reinterpret_cast<uint32_t*>(base + layout.nodeWords);
+    uint32_t *wordNodes = reinterpret_cast<uint32_t*>(base + layout.wordNodes);
+    uint32_t *first = reinterpret_cast<uint32_t*>(base + layout.childFirst);
+    uint32_t *children = reinterpret_cast<uint32_t*>(base + layout.children);
+    unsigned char *descriptors = base + layout.descriptors;
+
+    uint32_t slot = 0;
+    for(size_t nid = 0; nid < nNodes; ++nid)
+    {
+      const Node &node = m_nodes[nid];
+      weights[nid] = node.weight;
+      parents[nid] = nid > 0 ? node.parent : 0;
+      nodeWords[nid] = nid > 0 && node.isLeaf() ? node.word_id : ~(uint32_t)0;
+
+      first[nid] = slot;
+      for(size_t i = 0; i < node.children.size(); ++i, ++slot)
+      {
+        children[slot] = node.children[i];
+        const TDescriptor &d = m_nodes[node.children[i]].descriptor;
+        if(!d.empty())
+          F::toArray(d, descriptors + (size_t)slot * F::L);
+      }
+    }
+    first[nNodes] = slot;
+
+    for(size_t wid = 0; wid < nWords; ++wid)
+      wordNodes[wid] = m_words[wid]->id;
+  }
+
+  releaseFlatTree();
+  m_flat_storage.swap(image);
+  if(!m_flat_storage.empty())
+    setFlatTree(&m_flat_storage[0], m_flat_storage.size());
+
+  // queries only use the flat tree
+  m_words.clear();
+  m_nodes.clear();
+  m_nodes.shrink_to_fit();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::createNodesFromFlatTree()
+{
+  m_nodes.clear();
+  m_words.clear();
+
+  m_nodes.resize(m_flat_nodes);
+  for(size_t nid = 0; nid < m_flat_nodes; ++nid)
+  {
+    Node &node = m_nodes[nid];
+    node.id = nid;
+    node.weight = m_flat_weights[nid];
+    node.parent = m_flat_parents[nid];
+    node.children.assign(m_flat_children + m_flat_first[nid],
+      m_flat_children + m_flat_first[nid+1]);
+
+    // descriptors are copied, the image is replaced after editing
+    for(size_t i = 0; i < node.children.size(); ++i)
+    {
+      TDescriptor d;
+      F::fromArray(d, m_flat_descriptors + (size_t)(m_flat_first[nid] + i) * F::L);
+      m_nodes[node.children[i]].descriptor = d.clone();
+    }
+  }
+
+  m_words.resize(m_flat_words);
+  for(size_t wid = 0; wid < m_flat_words; ++wid)
+  {
+    m_nodes[m_flat_word_nodes[wid]].word_id = wid;
+    m_words[wid] = &m_nodes[m_flat_word_nodes[wid]];
+  }
 }
 
 // --------------------------------------------------------------------------
@@ -540,14 +953,20 @@ TemplatedVocabulary<TDescriptor,F>::operator=
   this->m_L = voc.m_L;
   this->m_scoring = voc.m_scoring;
   this->m_weighting = voc.m_weighting;
+  this->m_training_threads = voc.m_training_threads;
 
   this->createScoringObject();
   
   this->m_nodes.clear();
   this->m_words.clear();
-  
-  this->m_nodes = voc.m_nodes;
-  this->createWords();
+  this->releaseFlatTree();
+
+  // do not share the other vocabulary's file mapping
+  if(voc.m_flat != NULL)
+  {
+    this->m_flat_storage.assign(voc.m_flat, voc.m_flat + voc.m_flat_size);
+    this->setFlatTree(&this->m_flat_storage[0], this->m_flat_storage.size());
+  }
   
   return *this;
 }
@@ -560,6 +979,7 @@ void TemplatedVocabulary<TDescriptor,F>::create(
 {
   m_nodes.clear();
   m_words.clear();
+  releaseFlatTree();
   
   // expected_nodes = Sum_{i=0..L} ( k^i )
 	int expected_nodes = 
@@ -576,10 +996,11 @@ void TemplatedVocabulary<TDescriptor,F>::create(
   m_nodes.push_back(Node(0)); // root
   
   // create the tree
-  HKmeansStep(0, features, 1);
+  HKmeans(features);
 
   // create the words
   createWords();
+  createFlatTree();
 
   // and set the weight of each node of the tree
   setNodeWeights(training_features);
@@ -639,24 +1060,175 @@ void TemplatedVocabulary<TDescriptor,F>::getFeatures(
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class F>
-void TemplatedVocabulary<TDescriptor,F>::HKmeansStep(NodeId parent_id, 
-  const vector<pDescriptor> &descriptors, int current_level)
+template<class Func>
+void TemplatedVocabulary<TDescriptor,F>::parallelRanges(size_t n, int nThreads,
+  Func f)
+{
+  if(nThreads <= 1 || n < 2 * (size_t)nThreads)
+  {
+    f(0, n);
+    return;
+  }
+
+  vector<std::thread> threads;
+  threads.reserve(nThreads - 1);
+  const size_t chunk = (n + nThreads - 1) / nThreads;
+  for(int t = 1; t < nThreads; ++t)
+  {
+    const size_t b = std::min(n, t * chunk);
+    const size_t e = std::min(n, b + chunk);
+    threads.push_back(std::thread(f, b, e));
+  }
+  f(0, std::min(n, chunk));
+
+  for(size_t t = 0; t < threads.size(); ++t) threads[t].join();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::HKmeans(
+  const vector<pDescriptor> &descriptors)
 {
   if(descriptors.empty()) return;
-        
-  // features associated to each cluster
-  vector<TDescriptor> clusters;
-	vector<vector<unsigned int> > groups; // groups[i] = [j1, j2, ...]
-	// j1, j2, ... indices of descriptors associated to cluster i
+
+  struct Task
+  {
+    unsigned int cluster;
+    int level;
+    uint64_t seed;
+    vector<pDescriptor> descriptors;
+  };
+
+  int nThreads = m_training_threads;
+  if(nThreads <= 0) nThreads = std::thread::hardware_concurrency();
+  if(nThreads <= 0) nThreads = 1;
+
+  // each branch gets its own generator, derived from its parent's seed, so
+  // the result does not depend on the scheduling of the threads
+  DUtils::Random::SeedRandOnce();
+  const uint64_t root_seed = DUtils::Random::RandomInt(0, 1 << 30);
+
+  std::deque<ClusterNode> clusters(1); // root
+  vector<Task> tasks(1);
+  tasks[0].cluster = 0;
+  tasks[0].level = 1;
+  tasks[0].seed = root_seed;
+  tasks[0].descriptors = descriptors;
+
+  const size_t nTotal = descriptors.size();
+  int nActive = 0;
+  std::mutex mutex;
+  std::condition_variable cond;
+
+  auto worker = [&]()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true)
+    {
+      cond.wait(lock, [&]{ return !tasks.empty() || nActive == 0; });
+      if(tasks.empty()) break;
+
+      Task task;
+      std::swap(task, tasks.back());
+      tasks.pop_back();
+      ++nActive;
+      lock.unlock();
+
+      // large sets (the first levels) also split the association step
+      const int nAssocThreads = std::max<int>(1,
+        (int)((uint64_t)nThreads * task.descriptors.size() / nTotal));
+
+      std::mt19937 rng((uint32_t)(task.seed ^ (task.seed >> 32)));
+      vector<TDescriptor> centres;
+      vector<vector<unsigned int> > groups;
+      KmeansStep(task.descriptors, centres, groups, rng, nAssocThreads);
+
+      vector<Task> children;
+      if(task.level < m_L)
+      {
+        children.resize(centres.size());
+        for(unsigned int i = 0; i < centres.size(); ++i)
+        {
+          children[i].level = task.level + 1;
+          children[i].seed = mixSeed(task.seed, i);
+          children[i].descriptors.reserve(groups[i].size());
+          for(size_t j = 0; j < groups[i].size(); ++j)
+            children[i].descriptors.push_back(task.descriptors[groups[i][j]]);
+        }
+      }
+      vector<pDescriptor>().swap(task.descriptors);
+
+      lock.lock();
+      for(unsigned int i = 0; i < centres.size(); ++i)
+      {
+        const unsigned int id = clusters.size();
+        clusters.push_back(ClusterNode());
+        clusters.back().descriptor = centres[i];
+        clusters[task.cluster].children.push_back(id);
+
+        if(i < children.size() && children[i].descriptors.size() > 1)
+        {
+          children[i].cluster = id;
+          tasks.push_back(Task());
+          std::swap(tasks.back(), children[i]);
+        }
+      }
+      --nActive;
+      cond.notify_all();
+    }
+  };
+
+  vector<std::thread> threads;
+  for(int t = 1; t < nThreads; ++t) threads.push_back(std::thread(worker));
+  worker();
+  for(size_t t = 0; t < threads.size(); ++t) threads[t].join();
+
+  addClusterNodes(clusters, 0, 0);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::addClusterNodes(
+  const std::deque<ClusterNode> &clusters, unsigned int cluster, NodeId parent_id)
+{
+  const vector<unsigned int> &children = clusters[cluster].children;
+  const NodeId first_id = m_nodes.size();
+
+  // create nodes
+  for(unsigned int i = 0; i < children.size(); ++i)
+  {
+    NodeId id = m_nodes.size();
+    m_nodes.push_back(Node(id));
+    m_nodes.back().descriptor = clusters[children[i]].descriptor;
+    m_nodes.back().parent = parent_id;
+    m_nodes[parent_id].children.push_back(id);
+  }
+
+  // go on with the next level
+  for(unsigned int i = 0; i < children.size(); ++i)
+  {
+    if(!clusters[children[i]].children.empty())
+      addClusterNodes(clusters, children[i], first_id + i);
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::KmeansStep(
+  const vector<pDescriptor> &descriptors, vector<TDescriptor> &clusters,
+  vector<vector<unsigned int> > &groups, std::mt19937 &rng, int nThreads) const
+{
+  clusters.clear();
+  groups.clear();
+
+  if(descriptors.empty()) return;
 
   clusters.reserve(m_k);
 	groups.reserve(m_k);
   
-  //const int msizes[] = { m_k, descriptors.size() };
-  //cv::SparseMat assoc(2, msizes, CV_8U);
-  //cv::SparseMat last_assoc(2, msizes, CV_8U);  
-  //// assoc.row(cluster_idx).col(descriptor_idx) = 1 iif associated
-  
   if((int)descriptors.size() <= m_k)
   {
     // trivial case: one cluster per feature
@@ -667,76 +1239,64 @@ void TemplatedVocabulary<TDescriptor,F>::HKmeansStep(NodeId parent_id,
       groups[i].push_back(i);
       clusters.push_back(*descriptors[i]);
     }
+    return;
   }
-  else
+
+  // select clusters and groups with kmeans
+  
+  bool first_time = true;
+  bool goon = true;
+  
+  // to check if clusters move after iterations
+  vector<int> last_association, current_association;
+
+  while(goon)
   {
-    // select clusters and groups with kmeans
-    
-    bool first_time = true;
-    bool goon = true;
-    
-    // to check if clusters move after iterations
-    vector<int> last_association, current_association;
+    // 1. Calculate clusters
 
-    while(goon)
+    if(first_time)
     {
-      // 1. Calculate clusters
+      // random sample 
+      initiateClusters(descriptors, clusters, rng);
+    }
+    else
+    {
+      // calculate cluster centres
 
-			if(first_time)
-			{
-        // random sample 
-        initiateClusters(descriptors, clusters);
-      }
-      else
+      for(unsigned int c = 0; c < clusters.size(); ++c)
       {
-        // calculate cluster centres
+        // a cluster left without descriptors keeps its centre
+        if(groups[c].empty()) continue;
 
-        for(unsigned int c = 0; c < clusters.size(); ++c)
+        vector<pDescriptor> cluster_descriptors;
+        cluster_descriptors.reserve(groups[c].size());
+        
+        vector<unsigned int>::const_iterator vit;
+        for(vit = groups[c].begin(); vit != groups[c].end(); ++vit)
         {
-          vector<pDescriptor> cluster_descriptors;
-          cluster_descriptors.reserve(groups[c].size());
-          
-          /*
-          for(unsigned int d = 0; d < descriptors.size(); ++d)
-          {
-            if( assoc.find<unsigned char>(c, d) )
-            {
-              cluster_descriptors.push_back(descriptors[d]);
-            }
-          }
-          */
-          
-          vector<unsigned int>::const_iterator vit;
-          for(vit = groups[c].begin(); vit != groups[c].end(); ++vit)
-          {
-            cluster_descriptors.push_back(descriptors[*vit]);
-          }
-          
-          
-          F::meanValue(cluster_descriptors, clusters[c]);
+          cluster_descriptors.push_back(descriptors[*vit]);
         }
         
-      } // if(!first_time)
-
-      // 2. Associate features with clusters
+        F::meanValue(cluster_descriptors, clusters[c]);
+      }
+      
+    } // if(!first_time)
 
-      // calculate distances to cluster centers
-      groups.clear();
-      groups.resize(clusters.size(), vector<unsigned int>());
-      current_association.resize(descriptors.size());
+    // 2. Associate features with clusters
 
-      //assoc.clear();
+    // calculate distances to cluster centers
+    current_association.resize(descriptors.size());
 
-      typename vector<pDescriptor>::const_iterator fit;
-      //unsigned int d = 0;
-      for(fit = descriptors.begin(); fit != descriptors.end(); ++fit)//, ++d)
+    parallelRanges(descriptors.size(), nThreads, [&](size_t b, size_t e)
+    {
+      for(size_t i = b; i < e; ++i)
       {
-        double best_dist = F::distance(*(*fit), clusters[0]);
+        double best_dist = F::distance(*descriptors[i], clusters[0]);
         unsigned int icluster = 0;
         
         for(unsigned int c = 1; c < clusters.size(); ++c)
         {
-          double dist = F::distance(*(*fit), clusters[c]);
+          double dist = F::distance(*descriptors[i], clusters[c]);
           if(dist < best_dist)
           {
             best_dist = dist;
@@ -744,94 +1304,66 @@ void TemplatedVocabulary<TDescriptor,F>::HKmeansStep(NodeId parent_id,
           }
         }
 
-        //assoc.ref<unsigned char>(icluster, d) = 1;
-
-        groups[icluster].push_back(fit - descriptors.begin());
-        current_association[ fit - descriptors.begin() ] = icluster;
+        current_association[i] = icluster;
       }
-      
-      // kmeans++ ensures all the clusters has any feature associated with them
+    });
 
-      // 3. check convergence
-      if(first_time)
-      {
-        first_time = false;
-      }
-      else
-      {
-        //goon = !eqUChar(last_assoc, assoc);
-        
-        goon = false;
-        for(unsigned int i = 0; i < current_association.size(); i++)
-        {
-          if(current_association[i] != last_association[i]){
-            goon = true;
-            break;
-          }
-        }
-      }
+    groups.clear();
+    groups.resize(clusters.size(), vector<unsigned int>());
+    for(unsigned int i = 0; i < current_association.size(); ++i)
+      groups[current_association[i]].push_back(i);
 
-			if(goon)
-			{
-				// copy last feature-cluster association
-				last_association = current_association;
-				//last_assoc = assoc.clone();
-			}
-			
-		} // while(goon)
-    
-  } // if must run kmeans
-  
-  // create nodes
-  for(unsigned int i = 0; i < clusters.size(); ++i)
-  {
-    NodeId id = m_nodes.size();
-    m_nodes.push_back(Node(id));
-    m_nodes.back().descriptor = clusters[i];
-    m_nodes.back().parent = parent_id;
-    m_nodes[parent_id].children.push_back(id);
-  }
-  
-  // go on with the next level
-  if(current_level < m_L)
-  {
-    // iterate again with the resulting clusters
-    const vector<NodeId> &children_ids = m_nodes[parent_id].children;
-    for(unsigned int i = 0; i < clusters.size(); ++i)
+    // 3. check convergence
+    if(first_time)
     {
-      NodeId id = children_ids[i];
-
-      vector<pDescriptor> child_features;
-      child_features.reserve(groups[i].size());
+      first_time = false;
+    }
+    else
+    {
+      goon = current_association != last_association;
+    }
 
-      vector<unsigned int>::const_iterator vit;
-      for(vit = groups[i].begin(); vit != groups[i].end(); ++vit)
-      {
-        child_features.push_back(descriptors[*vit]);
-      }
+    if(goon)
+    {
+      // copy last feature-cluster association
+      last_association = current_association;
+    }
+    
+  } // while(goon)
 
-      if(child_features.size() > 1)
-      {
-        HKmeansStep(id, child_features, current_level + 1);
-      }
+  // duplicated seeds leave clusters without descriptors, which would become
+  // words no feature can reach first
+  unsigned int n = 0;
+  for(unsigned int c = 0; c < clusters.size(); ++c)
+  {
+    if(groups[c].empty()) continue;
+    if(n != c)
+    {
+      clusters[n] = clusters[c];
+      groups[n].swap(groups[c]);
     }
+    ++n;
   }
+  clusters.resize(n);
+  groups.resize(n);
 }
 
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor, F>::initiateClusters
-  (const vector<pDescriptor> &descriptors, vector<TDescriptor> &clusters) const
+  (const vector<pDescriptor> &descriptors, vector<TDescriptor> &clusters,
+   std::mt19937 &rng) const
 {
-  initiateClustersKMpp(descriptors, clusters);  
+  initiateClustersKMpp(descriptors, clusters, rng);  
 }
 
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::initiateClustersKMpp(
-  const vector<pDescriptor> &pfeatures, vector<TDescriptor> &clusters) const
+  const vector<pDescriptor> &pfeatures, vector<TDescriptor> &clusters,
+  std::mt19937 &rng) const
 {
   // Implements kmeans++ seeding algorithm
   // Algorithm:
@@ -844,15 +1376,13 @@ void TemplatedVocabulary<TDescriptor,F>::initiateClustersKMpp(
   // 5. Now that the initial centers have been chosen, proceed using standard k-means 
   //    clustering.
 
-  DUtils::Random::SeedRandOnce();
-
   clusters.resize(0);
   clusters.reserve(m_k);
   vector<double> min_dists(pfeatures.size(), std::numeric_limits<double>::max());
   
   // 1.
   
-  int ifeature = DUtils::Random::RandomInt(0, pfeatures.size()-1);
+  int ifeature = std::uniform_int_distribution<int>(0, pfeatures.size()-1)(rng);
   
   // create first cluster
   clusters.push_back(*pfeatures[ifeature]);
@@ -887,7 +1417,7 @@ void TemplatedVocabulary<TDescriptor,F>::initiateClustersKMpp(
       double cut_d;
       do
       {
-        cut_d = DUtils::Random::RandomValue<double>(0, dist_sum);
+        cut_d = std::uniform_real_distribution<double>(0, dist_sum)(rng);
       } while(cut_d == 0.0);
 
       double d_up_now = 0;
@@ -943,14 +1473,17 @@ template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::setNodeWeights
   (const vector<vector<TDescriptor> > &training_features)
 {
-  const unsigned int NWords = m_words.size();
+  const unsigned int NWords = m_flat_words;
   const unsigned int NDocs = training_features.size();
 
+  double *weights = mutableWeights();
+  if(weights == NULL) return;
+
   if(m_weighting == TF || m_weighting == BINARY)
   {
     // idf part must be 1 always
     for(unsigned int i = 0; i < NWords; i++)
-      m_words[i]->weight = 1;
+      weights[m_flat_word_nodes[i]] = 1;
   }
   else if(m_weighting == IDF || m_weighting == TF_IDF)
   {
@@ -987,7 +1520,7 @@ void TemplatedVocabulary<TDescriptor,F>::setNodeWeights
     {
       if(Ni[i] > 0)
       {
-        m_words[i]->weight = log((double)NDocs / (double)Ni[i]);
+        weights[m_flat_word_nodes[i]] = log((double)NDocs / (double)Ni[i]);
       }// else // This cannot occur if using kmeans++
     }
   
@@ -1000,7 +1533,7 @@ void TemplatedVocabulary<TDescriptor,F>::setNodeWeights
 template<class TDescriptor, class F>
 inline unsigned int TemplatedVocabulary<TDescriptor,F>::size() const
 {
-  return m_words.size();
+  return m_flat_words;
 }
 
 // --------------------------------------------------------------------------
@@ -1008,7 +1541,7 @@ inline unsigned int TemplatedVocabulary<TDescriptor,F>::size() const
 template<class TDescriptor, class F>
 inline bool TemplatedVocabulary<TDescriptor,F>::empty() const
 {
-  return m_words.empty();
+  return m_flat_words == 0;
 }
 
 // --------------------------------------------------------------------------
@@ -1017,15 +1550,14 @@ template<class TDescriptor, class F>
 float TemplatedVocabulary<TDescriptor,F>::getEffectiveLevels() const
 {
   long sum = 0;
-  typename std::vector<Node*>::const_iterator wit;
-  for(wit = m_words.begin(); wit != m_words.end(); ++wit)
+  for(size_t wid = 0; wid < m_flat_words; ++wid)
   {
-    const Node *p = *wit;
+    NodeId nid = m_flat_word_nodes[wid];
     
-    for(; p->id != 0; sum++) p = &m_nodes[p->parent];
+    for(; nid != 0; sum++) nid = m_flat_parents[nid];
   }
   
-  return (float)((double)sum / (double)m_words.size());
+  return (float)((double)sum / (double)m_flat_words);
 }
 
 // --------------------------------------------------------------------------
@@ -1033,7 +1565,9 @@ float TemplatedVocabulary<TDescriptor,F>::getEffectiveLevels() const
 template<class TDescriptor, class F>
 TDescriptor TemplatedVocabulary<TDescriptor,F>::getWord(WordId wid) const
 {
-  return m_words[wid]->descriptor;
+  TDescriptor d;
+  F::fromArray(d, nodeDescriptor(m_flat_word_nodes[wid]));
+  return d.clone();
 }
 
 // --------------------------------------------------------------------------
@@ -1041,7 +1575,7 @@ TDescriptor TemplatedVocabulary<TDescriptor,F>::getWord(WordId wid) const
 template<class TDescriptor, class F>
 WordValue TemplatedVocabulary<TDescriptor, F>::getWordWeight(WordId wid) const
 {
-  return m_words[wid]->weight;
+  return m_flat_weights[m_flat_word_nodes[wid]];
 }
 
 // --------------------------------------------------------------------------
@@ -1079,19 +1613,23 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
 
 	typename vector<TDescriptor>::const_iterator fit;
 
+  // collect all the words and merge them at once
+  v.reserve(features.size());
+  for(fit = features.begin(); fit < features.end(); ++fit)
+  {
+    WordId id;
+    WordValue w; 
+    // w is the idf value if TF_IDF or IDF, 1 if TF or BINARY
+    
+    transform(*fit, id, w);
+    
+    // not stopped
+    if(w > 0) v.push_back(BowVector::value_type(id, w));
+  }
+
   if(m_weighting == TF || m_weighting == TF_IDF)
   {
-    for(fit = features.begin(); fit < features.end(); ++fit)
-    {
-      WordId id;
-      WordValue w; 
-      // w is the idf value if TF_IDF, 1 if TF
-      
-      transform(*fit, id, w);
-      
-      // not stopped
-      if(w > 0) v.addWeight(id, w);
-    }
+    v.mergeDuplicates(true);
     
     if(!v.empty() && !must)
     {
@@ -1104,18 +1642,7 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   }
   else // IDF || BINARY
   {
-    for(fit = features.begin(); fit < features.end(); ++fit)
-    {
-      WordId id;
-      WordValue w;
-      // w is idf if IDF, or 1 if BINARY
-      
-      transform(*fit, id, w);
-      
-      // not stopped
-      if(w > 0) v.addIfNotExist(id, w);
-      
-    } // if add_features
+    v.mergeDuplicates(false);
   } // if m_weighting == ...
   
   if(must) v.normalize(norm);
@@ -1141,25 +1668,34 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   bool must = m_scoring_object->mustNormalize(norm);
   
   typename vector<TDescriptor>::const_iterator fit;
+
+  // collect all the words and nodes and build both vectors at once
+  vector<pair<NodeId, unsigned int> > vNodeFeatures;
+  vNodeFeatures.reserve(features.size());
+  v.reserve(features.size());
+
+  unsigned int i_feature = 0;
+  for(fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
+  {
+    WordId id;
+    NodeId nid;
+    WordValue w; 
+    // w is the idf value if TF_IDF or IDF, 1 if TF or BINARY
+    
+    transform(*fit, id, w, &nid, levelsup);
+    
+    if(w > 0) // not stopped
+    { 
+      v.push_back(BowVector::value_type(id, w));
+      vNodeFeatures.push_back(make_pair(nid, i_feature));
+    }
+  }
+
+  fv.create(vNodeFeatures);
   
   if(m_weighting == TF || m_weighting == TF_IDF)
   {
-    unsigned int i_feature = 0;
-    for(fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
-    {
-      WordId id;
-      NodeId nid;
-      WordValue w; 
-      // w is the idf value if TF_IDF, 1 if TF
-      
-      transform(*fit, id, w, &nid, levelsup);
-      
-      if(w > 0) // not stopped
-      { 
-        v.addWeight(id, w);
-        fv.addFeature(nid, i_feature);
-      }
-    }
+    v.mergeDuplicates(true);
     
     if(!v.empty() && !must)
     {
@@ -1172,22 +1708,7 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   }
   else // IDF || BINARY
   {
-    unsigned int i_feature = 0;
-    for(fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
-    {
-      WordId id;
-      NodeId nid;
-      WordValue w;
-      // w is idf if IDF, or 1 if BINARY
-      
-      transform(*fit, id, w, &nid, levelsup);
-      
-      if(w > 0) // not stopped
-      {
-        v.addIfNotExist(id, w);
-        fv.addFeature(nid, i_feature);
-      }
-    }
+    v.mergeDuplicates(false);
   } // if m_weighting == ...
   
   if(must) v.normalize(norm);
@@ -1218,9 +1739,9 @@ template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature, 
   WordId &word_id, WordValue &weight, NodeId *nid, int levelsup) const
 { 
-  // propagate the feature down the tree
-  vector<NodeId> nodes;
-  typename vector<NodeId>::const_iterator nit;
+  // propagate the feature down the flat tree, comparing it with all the
+  // children of a node at once
+  const uint32_t *first = m_flat_first;
 
   // level at which the node must be stored in nid, if given
   const int nid_level = m_L - levelsup;
@@ -1232,30 +1753,19 @@ void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature,
   do
   {
     ++current_level;
-    nodes = m_nodes[final_id].children;
-    final_id = nodes[0];
- 
-    double best_d = F::distance(feature, m_nodes[final_id].descriptor);
-
-    for(nit = nodes.begin() + 1; nit != nodes.end(); ++nit)
-    {
-      NodeId id = *nit;
-      double d = F::distance(feature, m_nodes[id].descriptor);
-      if(d < best_d)
-      {
-        best_d = d;
-        final_id = id;
-      }
-    }
+    const uint32_t slot = first[final_id];
+    const int best = F::nearest(feature, m_flat_descriptors + (size_t)slot * F::L,
+      first[final_id+1] - slot);
+    final_id = m_flat_children[slot + best];
     
     if(nid != NULL && current_level == nid_level)
       *nid = final_id;
     
-  } while( !m_nodes[final_id].isLeaf() );
+  } while( first[final_id+1] != first[final_id] ); // !isLeaf
 
   // turn node id into word id
-  word_id = m_nodes[final_id].word_id;
-  weight = m_nodes[final_id].weight;
+  word_id = m_flat_node_words[final_id];
+  weight = m_flat_weights[final_id];
 }
 
 // --------------------------------------------------------------------------
@@ -1264,11 +1774,11 @@ template<class TDescriptor, class F>
 NodeId TemplatedVocabulary<TDescriptor,F>::getParentNode
   (WordId wid, int levelsup) const
 {
-  NodeId ret = m_words[wid]->id; // node id
+  NodeId ret = m_flat_word_nodes[wid]; // node id
   while(levelsup > 0 && ret != 0) // ret == 0 --> root
   {
     --levelsup;
-    ret = m_nodes[ret].parent;
+    ret = m_flat_parents[ret];
   }
   return ret;
 }
@@ -1281,9 +1791,9 @@ void TemplatedVocabulary<TDescriptor,F>::getWordsFromNode
 {
   words.clear();
   
-  if(m_nodes[nid].isLeaf())
+  if(m_flat_first[nid] == m_flat_first[nid+1]) // leaf
   {
-    words.push_back(m_nodes[nid].word_id);
+    words.push_back(m_flat_node_words[nid]);
   }
   else
   {
@@ -1297,17 +1807,14 @@ void TemplatedVocabulary<TDescriptor,F>::getWordsFromNode
       NodeId parentid = parents.back();
       parents.pop_back();
       
-      const vector<NodeId> &child_ids = m_nodes[parentid].children;
-      vector<NodeId>::const_iterator cit;
-      
-      for(cit = child_ids.begin(); cit != child_ids.end(); ++cit)
+      for(uint32_t slot = m_flat_first[parentid]; slot < m_flat_first[parentid+1]; ++slot)
       {
-        const Node &child_node = m_nodes[*cit];
+        const NodeId child = m_flat_children[slot];
         
-        if(child_node.isLeaf())
-          words.push_back(child_node.word_id);
+        if(m_flat_first[child] == m_flat_first[child+1])
+          words.push_back(m_flat_node_words[child]);
         else
-          parents.push_back(*cit);
+          parents.push_back(child);
         
       } // for each child
     } // while !parents.empty
@@ -1316,17 +1823,97 @@ void TemplatedVocabulary<TDescriptor,F>::getWordsFromNode
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+unsigned int TemplatedVocabulary<TDescriptor,F>::prune(
+  const vector<vector<TDescriptor> > &features, unsigned int minHits, bool reweight)
+{
+  if(empty()) return 0;
+
+  vector<unsigned int> hits(m_flat_words, 0);
+  for(size_t i = 0; i < features.size(); ++i)
+  {
+    for(size_t j = 0; j < features[i].size(); ++j)
+    {
+      WordId wid;
+      transform(features[i][j], wid);
+      ++hits[wid];
+    }
+  }
+
+  // keep the used words and their ancestors
+  createNodesFromFlatTree();
+  vector<bool> keep(m_nodes.size(), false);
+  keep[0] = true;
+  unsigned int nKeptWords = 0;
+  for(WordId wid = 0; wid < m_words.size(); ++wid)
+  {
+    if(hits[wid] < minHits) continue;
+    ++nKeptWords;
+    for(NodeId nid = m_words[wid]->id; !keep[nid]; nid = m_nodes[nid].parent)
+      keep[nid] = true;
+  }
+
+  if(nKeptWords == 0)
+  {
+    m_words.clear();
+    m_nodes.clear();
+    return 0;
+  }
+
+  const unsigned int nRemoved = m_words.size() - nKeptWords;
+
+  vector<NodeId> new_ids(m_nodes.size(), 0);
+  NodeId next_id = 0;
+  for(NodeId nid = 0; nid < m_nodes.size(); ++nid)
+    if(keep[nid]) new_ids[nid] = next_id++;
+
+  // siblings had consecutive ids, so the kept ones still have
+  vector<Node> nodes;
+  nodes.reserve(next_id);
+  for(NodeId nid = 0; nid < m_nodes.size(); ++nid)
+  {
+    if(!keep[nid]) continue;
+
+    const Node &old_node = m_nodes[nid];
+    nodes.push_back(Node(new_ids[nid]));
+    Node &node = nodes.back();
+    node.weight = old_node.weight;
+    node.parent = nid == 0 ? 0 : new_ids[old_node.parent];
+    node.descriptor = old_node.descriptor;
+
+    for(size_t i = 0; i < old_node.children.size(); ++i)
+      if(keep[old_node.children[i]])
+        node.children.push_back(new_ids[old_node.children[i]]);
+  }
+
+  m_words.clear();
+  m_nodes.swap(nodes);
+  nodes.clear();
+
+  createWords();
+  createFlatTree();
+
+  if(reweight) setNodeWeights(features);
+
+  return nRemoved;
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 int TemplatedVocabulary<TDescriptor,F>::stopWords(double minWeight)
 {
+  double *weights = mutableWeights();
+  if(weights == NULL) return 0;
+
   int c = 0;
-  typename vector<Node*>::iterator wit;
-  for(wit = m_words.begin(); wit != m_words.end(); ++wit)
+  for(size_t wid = 0; wid < m_flat_words; ++wid)
   {
-    if((*wit)->weight < minWeight)
+    double &weight = weights[m_flat_word_nodes[wid]];
+    if(weight < minWeight)
     {
       ++c;
-      (*wit)->weight = 0;
+      weight = 0;
     }
   }
   return c;
@@ -1345,6 +1932,7 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &fil
 
     m_words.clear();
     m_nodes.clear();
+    releaseFlatTree();
 
     string s;
     getline(f,s);
@@ -1373,6 +1961,10 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &fil
 
     m_words.reserve(pow((double)m_k, (double)m_L + 1));
 
+    // word pointers are set at the end, m_nodes may still reallocate
+    vector<NodeId> vWordNodes;
+    vWordNodes.reserve(m_words.capacity());
+
     m_nodes.resize(1);
     m_nodes[0].id = 0;
     while(!f.eof())
@@ -1407,11 +1999,8 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &fil
 
         if(nIsLeaf>0)
         {
-            int wid = m_words.size();
-            m_words.resize(wid+1);
-
-            m_nodes[nid].word_id = wid;
-            m_words[wid] = &m_nodes[nid];
+            m_nodes[nid].word_id = vWordNodes.size();
+            vWordNodes.push_back(nid);
         }
         else
         {
@@ -1419,6 +2008,12 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &fil
         }
     }
 
+    m_words.resize(vWordNodes.size());
+    for(size_t wid = 0; wid < vWordNodes.size(); ++wid)
+        m_words[wid] = &m_nodes[vWordNodes[wid]];
+
+    createFlatTree();
+
     return true;
 
 }
@@ -1432,17 +2027,17 @@ void TemplatedVocabulary<TDescriptor,F>::saveToTextFile(const std::string &filen
     f.open(filename.c_str(),ios_base::out);
     f << m_k << " " << m_L << " " << " " << m_scoring << " " << m_weighting << endl;
 
-    for(size_t i=1; i<m_nodes.size();i++)
+    for(size_t i=1; i<m_flat_nodes;i++)
     {
-        const Node& node = m_nodes[i];
-
-        f << node.parent << " ";
-        if(node.isLeaf())
+        f << m_flat_parents[i] << " ";
+        if(m_flat_first[i] == m_flat_first[i+1])
             f << 1 << " ";
         else
             f << 0 << " ";
 
-        f << F::toString(node.descriptor) << " " << (double)node.weight << endl;
+        TDescriptor d;
+        F::fromArray(d, nodeDescriptor(i));
+        f << F::toString(d) << " " << m_flat_weights[i] << endl;
     }
 
     f.close();
@@ -1450,6 +2045,139 @@ void TemplatedVocabulary<TDescriptor,F>::saveToTextFile(const std::string &filen
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+bool TemplatedVocabulary<TDescriptor,F>::loadFromBinaryFile(const std::string &filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BinaryVocabularyHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    const size_t size = st.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+        return false;
+
+    const unsigned char *base = static_cast<const unsigned char*>(mapping);
+    BinaryVocabularyHeader header;
+    memcpy(&header, base, sizeof(header));
+
+    bool bValid = memcmp(header.magic, "DBOW2VOC", 8) == 0 && header.version == 2 &&
+       header.descriptorBytes == (uint32_t)F::L &&
+       header.k>=0 && header.k<=20 && header.L>=1 && header.L<=10 &&
+       header.scoring>=0 && header.scoring<=5 && header.weighting>=0 && header.weighting<=3;
+
+    // The counts are bounded by the file size before the array offsets are
+    // computed from them, so that the offsets cannot overflow. A tree has at
+    // least the root and one word, and no more words than nodes.
+    const size_t nodeBytes = sizeof(double) + 4*sizeof(uint32_t) + F::L;
+    bValid = bValid && header.nNodes >= 2 && header.nNodes <= size/nodeBytes &&
+       header.nWords >= 1 && header.nWords <= header.nNodes;
+
+    const size_t nNodes = bValid ? header.nNodes : 2;
+    const size_t nWords = bValid ? header.nWords : 1;
+    const BinaryVocabularyLayout layout(nNodes, nWords, F::L);
+    bValid = bValid && layout.end <= size;
+
+    const uint32_t *parents = reinterpret_cast<const uint32_t*>(base + layout.parents);
+    const uint32_t *nodeWords = reinterpret_cast<const uint32_t*>(base + layout.nodeWords);
+    const uint32_t *wordNodes = reinterpret_cast<const uint32_t*>(base + layout.wordNodes);
+    const uint32_t *first = reinterpret_cast<const uint32_t*>(base + layout.childFirst);
+    const uint32_t *children = reinterpret_cast<const uint32_t*>(base + layout.children);
+
+    // Tree structure, so that transform can not leave the arrays: every
+    // parent is stored before its children (the ids are in range and there
+    // are no cycles), the child slots of each node list exactly its
+    // children, every leaf is a word and every word a leaf
+    if(bValid)
+    {
+        bValid = first[0] == 0 && first[nNodes] == nNodes-1 && first[1] > 0;
+        for(size_t nid = 1; bValid && nid < nNodes; ++nid)
+            bValid = parents[nid] < nid && first[nid] <= first[nid+1];
+
+        vector<char> vbSeen(nNodes, 0);
+        for(size_t nid = 0; bValid && nid < nNodes; ++nid)
+        {
+            for(uint32_t slot = first[nid]; bValid && slot < first[nid+1]; ++slot)
+            {
+                const uint32_t child = children[slot];
+                bValid = child > 0 && child < nNodes && parents[child] == nid && !vbSeen[child];
+                if(bValid) vbSeen[child] = 1;
+            }
+        }
+
+        for(size_t nid = 1; bValid && nid < nNodes; ++nid)
+        {
+            if(first[nid] == first[nid+1])
+                bValid = nodeWords[nid] < nWords && wordNodes[nodeWords[nid]] == nid;
+        }
+
+        for(size_t wid = 0; bValid && wid < nWords; ++wid)
+        {
+            const uint32_t nid = wordNodes[wid];
+            bValid = nid > 0 && nid < nNodes && first[nid] == first[nid+1] && nodeWords[nid] == wid;
+        }
+    }
+
+    if(!bValid)
+    {
+        std::cerr << "Vocabulary loading failure: This is not a correct binary file!" << endl;
+        munmap(mapping, size);
+        return false;
+    }
+
+    m_words.clear();
+    m_nodes.clear();
+    releaseFlatTree();
+    m_mapping = mapping;
+    m_mapping_size = size;
+
+    m_k = header.k;
+    m_L = header.L;
+    m_scoring = (ScoringType)header.scoring;
+    m_weighting = (WeightingType)header.weighting;
+    createScoringObject();
+
+    // searched in place
+    setFlatTree(base, size);
+
+    return true;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+bool TemplatedVocabulary<TDescriptor,F>::saveToBinaryFile(const std::string &filename) const
+{
+    if(m_flat == NULL)
+        return false;
+
+    // the arrays are written as they are, the header with the current settings
+    BinaryVocabularyHeader header;
+    memcpy(&header, m_flat, sizeof(header));
+    header.version = 2;
+    header.k = m_k;
+    header.L = m_L;
+    header.scoring = m_scoring;
+    header.weighting = m_weighting;
+
+    ofstream f(filename.c_str(), ios_base::out | ios_base::binary);
+    if(!f.is_open())
+        return false;
+    f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    f.write(reinterpret_cast<const char*>(m_flat + sizeof(header)), m_flat_size - sizeof(header));
+    return f.good();
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::save(const std::string &filename) const
 {
@@ -1513,35 +2241,33 @@ void TemplatedVocabulary<TDescriptor,F>::save(cv::FileStorage &f,
   
   // tree
   f << "nodes" << "[";
-  vector<NodeId> parents, children;
-  vector<NodeId>::const_iterator pit;
+  vector<NodeId> parents;
 
-  parents.push_back(0); // root
+  if(m_flat_nodes > 0) parents.push_back(0); // root
 
   while(!parents.empty())
   {
     NodeId pid = parents.back();
     parents.pop_back();
 
-    const Node& parent = m_nodes[pid];
-    children = parent.children;
-
-    for(pit = children.begin(); pit != children.end(); pit++)
+    for(uint32_t slot = m_flat_first[pid]; slot < m_flat_first[pid+1]; ++slot)
     {
-      const Node& child = m_nodes[*pit];
+      const NodeId child = m_flat_children[slot];
+      TDescriptor d;
+      F::fromArray(d, m_flat_descriptors + (size_t)slot * F::L);
 
       // save node data
       f << "{:";
-      f << "nodeId" << (int)child.id;
+      f << "nodeId" << (int)child;
       f << "parentId" << (int)pid;
-      f << "weight" << (double)child.weight;
-      f << "descriptor" << F::toString(child.descriptor);
+      f << "weight" << (double)m_flat_weights[child];
+      f << "descriptor" << F::toString(d);
       f << "}";
       
       // add to parent list
-      if(!child.isLeaf())
+      if(m_flat_first[child] != m_flat_first[child+1])
       {
-        parents.push_back(*pit);
+        parents.push_back(child);
       }
     }
   }
@@ -1551,13 +2277,11 @@ void TemplatedVocabulary<TDescriptor,F>::save(cv::FileStorage &f,
   // words
   f << "words" << "[";
   
-  typename vector<Node*>::const_iterator wit;
-  for(wit = m_words.begin(); wit != m_words.end(); wit++)
+  for(size_t wid = 0; wid < m_flat_words; wid++)
   {
-    WordId id = wit - m_words.begin();
     f << "{:";
-    f << "wordId" << (int)id;
-    f << "nodeId" << (int)(*wit)->id;
+    f << "wordId" << (int)wid;
+    f << "nodeId" << (int)m_flat_word_nodes[wid];
     f << "}";
   }
   
@@ -1575,6 +2299,7 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
 {
   m_words.clear();
   m_nodes.clear();
+  releaseFlatTree();
   
   cv::FileNode fvoc = fs[name];
   
@@ -1619,6 +2344,8 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
     m_nodes[nid].word_id = wid;
     m_words[wid] = &m_nodes[nid];
   }
+
+  createFlatTree();
 }
 
 // --------------------------------------------------------------------------
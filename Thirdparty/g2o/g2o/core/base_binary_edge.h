@@ -102,6 +102,10 @@ namespace g2o {
       using BaseEdge<D,E>::_vertices;
       using BaseEdge<D,E>::_dimension;
 
+      //! locks the quadratic forms of both vertices, always in the same order so that edges sharing vertices do not deadlock
+      void lockVertices();
+      void unlockVertices();
+
       bool _hessianRowMajor;
       HessianBlockType _hessian;
       HessianBlockTransposedType _hessianTransposed;
@@ -66,10 +66,7 @@ void BaseBinaryEdge<D, E, VertexXiType, VertexXjType>::constructQuadraticForm()
   bool toNotFixed = !(to->fixed());
 
   if (fromNotFixed || toNotFixed) {
-#ifdef G2O_OPENMP
-    from->lockQuadraticForm();
-    to->lockQuadraticForm();
-#endif
+    lockVertices();
     const InformationType& omega = _information;
     Matrix<double, D, 1> omega_r = - omega * _error;
     if (this->robustKernel() == 0) {
@@ -112,10 +109,7 @@ void BaseBinaryEdge<D, E, VertexXiType, VertexXjType>::constructQuadraticForm()
         to->A().noalias() += B.transpose() * weightedOmega * B;
       }
     }
-#ifdef G2O_OPENMP
-    to->unlockQuadraticForm();
-    from->unlockQuadraticForm();
-#endif
+    unlockVertices();
   }
 }
 
@@ -139,10 +133,7 @@ void BaseBinaryEdge<D, E, VertexXiType, VertexXjType>::linearizeOplus()
   if (!iNotFixed && !jNotFixed)
     return;
 
-#ifdef G2O_OPENMP
-  vi->lockQuadraticForm();
-  vj->lockQuadraticForm();
-#endif
+  lockVertices();
 
   const double delta = 1e-9;
   const double scalar = 1.0 / (2*delta);
@@ -198,10 +189,28 @@ void BaseBinaryEdge<D, E, VertexXiType, VertexXjType>::linearizeOplus()
   } // end dimension
 
   _error = errorBeforeNumeric;
-#ifdef G2O_OPENMP
-  vj->unlockQuadraticForm();
-  vi->unlockQuadraticForm();
-#endif
+  unlockVertices();
+}
+
+template <int D, typename E, typename VertexXiType, typename VertexXjType>
+void BaseBinaryEdge<D, E, VertexXiType, VertexXjType>::lockVertices()
+{
+  OptimizableGraph::Vertex* vi = static_cast<OptimizableGraph::Vertex*>(_vertices[0]);
+  OptimizableGraph::Vertex* vj = static_cast<OptimizableGraph::Vertex*>(_vertices[1]);
+  if (vi < vj) {
+    vi->lockQuadraticForm();
+    vj->lockQuadraticForm();
+  } else {
+    vj->lockQuadraticForm();
+    vi->lockQuadraticForm();
+  }
+}
+
+template <int D, typename E, typename VertexXiType, typename VertexXjType>
+void BaseBinaryEdge<D, E, VertexXiType, VertexXjType>::unlockVertices()
+{
+  static_cast<OptimizableGraph::Vertex*>(_vertices[0])->unlockQuadraticForm();
+  static_cast<OptimizableGraph::Vertex*>(_vertices[1])->unlockQuadraticForm();
 }
 
 template <int D, typename E, typename VertexXiType, typename VertexXjType>
@@ -30,6 +30,7 @@
 #include <iostream>
 #include <iomanip>
 #include <limits>
+#include <algorithm>
 
 #include <Eigen/StdVector>
 
@@ -102,6 +103,10 @@ namespace g2o {
 
       void computeQuadraticForm(const InformationType& omega, const ErrorVector& weightedError);
 
+      //! locks the quadratic forms of all vertices, always in the same order so that edges sharing vertices do not deadlock
+      void lockVertices();
+      void unlockVertices();
+
     public:
       EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   };
@@ -35,6 +35,7 @@ namespace internal {
 template <int D, typename E>
 void BaseMultiEdge<D, E>::constructQuadraticForm()
 {
+  lockVertices();
   if (this->robustKernel()) {
     double error = this->chi2();
     Eigen::Vector3d rho;
@@ -45,6 +46,7 @@ void BaseMultiEdge<D, E>::constructQuadraticForm()
   } else {
     computeQuadraticForm(_information, - _information * _error);
   }
+  unlockVertices();
 }
 
 
@@ -62,12 +64,7 @@ void BaseMultiEdge<D, E>::linearizeOplus(JacobianWorkspace& jacobianWorkspace)
 template <int D, typename E>
 void BaseMultiEdge<D, E>::linearizeOplus()
 {
-#ifdef G2O_OPENMP
-  for (size_t i = 0; i < _vertices.size(); ++i) {
-    OptimizableGraph::Vertex* v = static_cast<OptimizableGraph::Vertex*>(_vertices[i]);
-    v->lockQuadraticForm();
-  }
-#endif
+  lockVertices();
 
   const double delta = 1e-9;
   const double scalar = 1.0 / (2*delta);
@@ -115,14 +112,25 @@ void BaseMultiEdge<D, E>::linearizeOplus()
 #endif
   }
   _error = errorBeforeNumeric;
+  unlockVertices();
+}
 
-#ifdef G2O_OPENMP
-  for (int i = (int)(_vertices.size()) - 1; i >= 0; --i) {
-    OptimizableGraph::Vertex* v = static_cast<OptimizableGraph::Vertex*>(_vertices[i]);
-    v->unlockQuadraticForm();
-  }
-#endif
+template <int D, typename E>
+void BaseMultiEdge<D, E>::lockVertices()
+{
+  std::vector<OptimizableGraph::Vertex*> vertices(_vertices.size());
+  for (size_t i = 0; i < _vertices.size(); ++i)
+    vertices[i] = static_cast<OptimizableGraph::Vertex*>(_vertices[i]);
+  std::sort(vertices.begin(), vertices.end());
+  for (size_t i = 0; i < vertices.size(); ++i)
+    vertices[i]->lockQuadraticForm();
+}
 
+template <int D, typename E>
+void BaseMultiEdge<D, E>::unlockVertices()
+{
+  for (size_t i = 0; i < _vertices.size(); ++i)
+    static_cast<OptimizableGraph::Vertex*>(_vertices[i])->unlockQuadraticForm();
 }
 
 template <int D, typename E>
@@ -184,18 +192,12 @@ void BaseMultiEdge<D, E>::computeQuadraticForm(const InformationType& omega, con
       Eigen::Map<VectorXd> fromB(from->bData(), fromDim);
 
       // ii block in the hessian
-#ifdef G2O_OPENMP
-      from->lockQuadraticForm();
-#endif
       fromMap.noalias() += AtO * A;
       fromB.noalias() += A.transpose() * weightedError;
 
       // compute the off-diagonal blocks ij for all j
       for (size_t j = i+1; j < _vertices.size(); ++j) {
         OptimizableGraph::Vertex* to = static_cast<OptimizableGraph::Vertex*>(_vertices[j]);
-#ifdef G2O_OPENMP
-        to->lockQuadraticForm();
-#endif
         bool jstatus = !(to->fixed());
         if (jstatus) {
           const MatrixXd& B = _jacobianOplus[j];
@@ -208,14 +210,7 @@ void BaseMultiEdge<D, E>::computeQuadraticForm(const InformationType& omega, con
             hhelper.matrix.noalias() += AtO * B;
           }
         }
-#ifdef G2O_OPENMP
-        to->unlockQuadraticForm();
-#endif
       }
-
-#ifdef G2O_OPENMP
-      from->unlockQuadraticForm();
-#endif
     }
 
   }
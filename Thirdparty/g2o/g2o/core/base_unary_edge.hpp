@@ -50,9 +50,7 @@ void BaseUnaryEdge<D, E, VertexXiType>::constructQuadraticForm()
 
   bool istatus = !from->fixed();
   if (istatus) {
-#ifdef G2O_OPENMP
     from->lockQuadraticForm();
-#endif
     if (this->robustKernel()) {
       double error = this->chi2();
       Eigen::Vector3d rho;
@@ -65,9 +63,7 @@ void BaseUnaryEdge<D, E, VertexXiType>::constructQuadraticForm()
       from->b().noalias() -= A.transpose() * omega * _error;
       from->A().noalias() += A.transpose() * omega * A;
     }
-#ifdef G2O_OPENMP
     from->unlockQuadraticForm();
-#endif
   }
 }
 
@@ -87,9 +83,7 @@ void BaseUnaryEdge<D, E, VertexXiType>::linearizeOplus()
   if (vi->fixed())
     return;
 
-#ifdef G2O_OPENMP
   vi->lockQuadraticForm();
-#endif
 
   const double delta = 1e-9;
   const double scalar = 1.0 / (2*delta);
@@ -117,9 +111,7 @@ void BaseUnaryEdge<D, E, VertexXiType>::linearizeOplus()
   } // end dimension
 
   _error = errorBeforeNumeric;
-#ifdef G2O_OPENMP
   vi->unlockQuadraticForm();
-#endif
 }
 
 template <int D, typename E, typename VertexXiType>
@@ -31,6 +31,7 @@
 #include "linear_solver.h"
 #include "sparse_block_matrix.h"
 #include "sparse_block_matrix_diagonal.h"
+#include "optimizable_graph.h"
 #include "openmp_mutex.h"
 #include "../../config.h"
 
@@ -147,6 +148,12 @@ namespace g2o {
 
       void deallocate();
 
+      //! Schur complement terms of one landmark, landmarks can be processed in parallel
+      void marginalizeLandmark(int landmarkIndex);
+
+      //! linearizes e and adds it to the system using the given workspace, edges can be processed in parallel
+      void linearizeEdge(OptimizableGraph::Edge* e, JacobianWorkspace& jacobianWorkspace);
+
       SparseBlockMatrix<PoseMatrixType>* _Hpp;
       SparseBlockMatrix<LandmarkMatrixType>* _Hll;
       SparseBlockMatrix<PoseLandmarkMatrixType>* _Hpl;
@@ -162,9 +169,7 @@ namespace g2o {
       std::vector<PoseVectorType, Eigen::aligned_allocator<PoseVectorType> > _diagonalBackupPose;
       std::vector<LandmarkVectorType, Eigen::aligned_allocator<LandmarkVectorType> > _diagonalBackupLandmark;
 
-#    ifdef G2O_OPENMP
       std::vector<OpenMPMutex> _coefficientsMutex;
-#    endif
 
       bool _doSchur;
 
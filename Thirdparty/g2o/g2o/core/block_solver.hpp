@@ -85,9 +85,7 @@ void BlockSolver<Traits>::resize(int* blockPoseIndices, int numPoseBlocks,
     _Hpl=new PoseLandmarkHessianType(blockPoseIndices, blockLandmarkIndices, numPoseBlocks, numLandmarkBlocks);
     _HplCCS = new SparseBlockMatrixCCS<PoseLandmarkMatrixType>(_Hpl->rowBlockIndices(), _Hpl->colBlockIndices());
     _HschurTransposedCCS = new SparseBlockMatrixCCS<PoseMatrixType>(_Hschur->colBlockIndices(), _Hschur->rowBlockIndices());
-#ifdef G2O_OPENMP
     _coefficientsMutex.resize(numPoseBlocks);
-#endif
   }
 }
 
@@ -350,6 +348,59 @@ bool BlockSolver<Traits>::updateStructure(const std::vector<HyperGraph::Vertex*>
   return true;
 }
 
+template <typename Traits>
+void BlockSolver<Traits>::marginalizeLandmark(int landmarkIndex)
+{
+  const typename SparseBlockMatrix<LandmarkMatrixType>::IntBlockMap& marginalizeColumn = _Hll->blockCols()[landmarkIndex];
+  assert(marginalizeColumn.size() == 1 && "more than one block in _Hll column");
+
+  // calculate inverse block for the landmark
+  const LandmarkMatrixType * D = marginalizeColumn.begin()->second;
+  assert (D && D->rows()==D->cols() && "Error in landmark matrix");
+  LandmarkMatrixType& Dinv = _DInvSchur->diagonal()[landmarkIndex];
+  Dinv = D->inverse();
+
+  LandmarkVectorType  db(D->rows());
+  for (int j=0; j<D->rows(); ++j) {
+    db[j]=_b[_Hll->rowBaseOfBlock(landmarkIndex) + _sizePoses + j];
+  }
+  db=Dinv*db;
+
+  assert((size_t)landmarkIndex < _HplCCS->blockCols().size() && "Index out of bounds");
+  const typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn& landmarkColumn = _HplCCS->blockCols()[landmarkIndex];
+
+  for (typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn::const_iterator it_outer = landmarkColumn.begin();
+      it_outer != landmarkColumn.end(); ++it_outer) {
+    int i1 = it_outer->row;
+
+    const PoseLandmarkMatrixType* Bi = it_outer->block;
+    assert(Bi);
+
+    PoseLandmarkMatrixType BDinv = (*Bi)*(Dinv);
+    assert(_HplCCS->rowBaseOfBlock(i1) < _sizePoses && "Index out of bounds");
+    typename PoseVectorType::MapType Bb(&_coefficients[_HplCCS->rowBaseOfBlock(i1)], Bi->rows());
+    ScopedOpenMPMutex mutexLock(&_coefficientsMutex[i1]);
+    Bb.noalias() += (*Bi)*db;
+
+    assert(i1 >= 0 && i1 < static_cast<int>(_HschurTransposedCCS->blockCols().size()) && "Index out of bounds");
+    typename SparseBlockMatrixCCS<PoseMatrixType>::SparseColumn::iterator targetColumnIt = _HschurTransposedCCS->blockCols()[i1].begin();
+
+    typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::RowBlock aux(i1, 0);
+    typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn::const_iterator it_inner = lower_bound(landmarkColumn.begin(), landmarkColumn.end(), aux);
+    for (; it_inner != landmarkColumn.end(); ++it_inner) {
+      int i2 = it_inner->row;
+      const PoseLandmarkMatrixType* Bj = it_inner->block;
+      assert(Bj); 
+      while (targetColumnIt->row < i2 /*&& targetColumnIt != _HschurTransposedCCS->blockCols()[i1].end()*/)
+        ++targetColumnIt;
+      assert(targetColumnIt != _HschurTransposedCCS->blockCols()[i1].end() && targetColumnIt->row == i2 && "invalid iterator, something wrong with the matrix structure");
+      PoseMatrixType* Hi1i2 = targetColumnIt->block;//_Hschur->block(i1,i2);
+      assert(Hi1i2);
+      (*Hi1i2).noalias() -= BDinv*Bj->transpose();
+    }
+  }
+}
+
 template <typename Traits>
 bool BlockSolver<Traits>::solve(){
   //cerr << __PRETTY_FUNCTION__ << endl;
@@ -375,61 +426,17 @@ bool BlockSolver<Traits>::solve(){
 
   //_DInvSchur->clear();
   memset (_coefficients, 0, _sizePoses*sizeof(double));
+  const int numLandmarks = static_cast<int>(_Hll->blockCols().size());
 # ifdef G2O_OPENMP
 # pragma omp parallel for default (shared) schedule(dynamic, 10)
+  for (int landmarkIndex = 0; landmarkIndex < numLandmarks; ++landmarkIndex)
+    marginalizeLandmark(landmarkIndex);
+# else
+  _optimizer->forEachRange(numLandmarks, 100, [this](int begin, int end, int) {
+    for (int landmarkIndex = begin; landmarkIndex < end; ++landmarkIndex)
+      marginalizeLandmark(landmarkIndex);
+  });
 # endif
-  for (int landmarkIndex = 0; landmarkIndex < static_cast<int>(_Hll->blockCols().size()); ++landmarkIndex) {
-    const typename SparseBlockMatrix<LandmarkMatrixType>::IntBlockMap& marginalizeColumn = _Hll->blockCols()[landmarkIndex];
-    assert(marginalizeColumn.size() == 1 && "more than one block in _Hll column");
-
-    // calculate inverse block for the landmark
-    const LandmarkMatrixType * D = marginalizeColumn.begin()->second;
-    assert (D && D->rows()==D->cols() && "Error in landmark matrix");
-    LandmarkMatrixType& Dinv = _DInvSchur->diagonal()[landmarkIndex];
-    Dinv = D->inverse();
-
-    LandmarkVectorType  db(D->rows());
-    for (int j=0; j<D->rows(); ++j) {
-      db[j]=_b[_Hll->rowBaseOfBlock(landmarkIndex) + _sizePoses + j];
-    }
-    db=Dinv*db;
-
-    assert((size_t)landmarkIndex < _HplCCS->blockCols().size() && "Index out of bounds");
-    const typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn& landmarkColumn = _HplCCS->blockCols()[landmarkIndex];
-
-    for (typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn::const_iterator it_outer = landmarkColumn.begin();
-        it_outer != landmarkColumn.end(); ++it_outer) {
-      int i1 = it_outer->row;
-
-      const PoseLandmarkMatrixType* Bi = it_outer->block;
-      assert(Bi);
-
-      PoseLandmarkMatrixType BDinv = (*Bi)*(Dinv);
-      assert(_HplCCS->rowBaseOfBlock(i1) < _sizePoses && "Index out of bounds");
-      typename PoseVectorType::MapType Bb(&_coefficients[_HplCCS->rowBaseOfBlock(i1)], Bi->rows());
-#    ifdef G2O_OPENMP
-      ScopedOpenMPMutex mutexLock(&_coefficientsMutex[i1]);
-#    endif
-      Bb.noalias() += (*Bi)*db;
-
-      assert(i1 >= 0 && i1 < static_cast<int>(_HschurTransposedCCS->blockCols().size()) && "Index out of bounds");
-      typename SparseBlockMatrixCCS<PoseMatrixType>::SparseColumn::iterator targetColumnIt = _HschurTransposedCCS->blockCols()[i1].begin();
-
-      typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::RowBlock aux(i1, 0);
-      typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn::const_iterator it_inner = lower_bound(landmarkColumn.begin(), landmarkColumn.end(), aux);
-      for (; it_inner != landmarkColumn.end(); ++it_inner) {
-        int i2 = it_inner->row;
-        const PoseLandmarkMatrixType* Bj = it_inner->block;
-        assert(Bj); 
-        while (targetColumnIt->row < i2 /*&& targetColumnIt != _HschurTransposedCCS->blockCols()[i1].end()*/)
-          ++targetColumnIt;
-        assert(targetColumnIt != _HschurTransposedCCS->blockCols()[i1].end() && targetColumnIt->row == i2 && "invalid iterator, something wrong with the matrix structure");
-        PoseMatrixType* Hi1i2 = targetColumnIt->block;//_Hschur->block(i1,i2);
-        assert(Hi1i2);
-        (*Hi1i2).noalias() -= BDinv*Bj->transpose();
-      }
-    }
-  }
   //cerr << "Solve [marginalize] = " <<  get_monotonic_time()-t << endl;
 
   // _bschur = _b for calling solver, and not touching _b
@@ -498,6 +505,25 @@ bool BlockSolver<Traits>::computeMarginals(SparseBlockMatrix<MatrixXd>& spinv, c
   return ok;
 }
 
+template <typename Traits>
+void BlockSolver<Traits>::linearizeEdge(OptimizableGraph::Edge* e, JacobianWorkspace& jacobianWorkspace)
+{
+  e->linearizeOplus(jacobianWorkspace); // jacobian of the nodes' oplus (manifold)
+  e->constructQuadraticForm();
+#  ifndef NDEBUG
+  for (size_t i = 0; i < e->vertices().size(); ++i) {
+    const OptimizableGraph::Vertex* v = static_cast<const OptimizableGraph::Vertex*>(e->vertex(i));
+    if (! v->fixed()) {
+      bool hasANan = arrayHasNaN(jacobianWorkspace.workspaceForVertex(i), e->dimension() * v->dimension());
+      if (hasANan) {
+        cerr << "buildSystem(): NaN within Jacobian for edge " << e << " for vertex " << i << endl;
+        break;
+      }
+    }
+  }
+#  endif
+}
+
 template <typename Traits>
 bool BlockSolver<Traits>::buildSystem()
 {
@@ -519,30 +545,21 @@ bool BlockSolver<Traits>::buildSystem()
   // resetting the terms for the pairwise constraints
   // built up the current system by storing the Hessian blocks in the edges and vertices
 # ifndef G2O_OPENMP
-  // no threading, we do not need to copy the workspace
-  JacobianWorkspace& jacobianWorkspace = _optimizer->jacobianWorkspace();
+  // the first worker uses the workspace of the optimizer, the others need their own copy
+  const SparseOptimizer::EdgeContainer& activeEdges = _optimizer->activeEdges();
+  std::vector<JacobianWorkspace> workspaces(_optimizer->numWorkers()-1, _optimizer->jacobianWorkspace());
+  _optimizer->forEachRange(activeEdges.size(), 100, [&](int begin, int end, int worker) {
+    JacobianWorkspace& jacobianWorkspace = worker == 0 ? _optimizer->jacobianWorkspace() : workspaces[worker-1];
+    for (int k = begin; k < end; ++k)
+      linearizeEdge(activeEdges[k], jacobianWorkspace);
+  });
 # else
   // if running with threads need to produce copies of the workspace for each thread
   JacobianWorkspace jacobianWorkspace = _optimizer->jacobianWorkspace();
 # pragma omp parallel for default (shared) firstprivate(jacobianWorkspace) if (_optimizer->activeEdges().size() > 100)
+  for (int k = 0; k < static_cast<int>(_optimizer->activeEdges().size()); ++k)
+    linearizeEdge(_optimizer->activeEdges()[k], jacobianWorkspace);
 # endif
-  for (int k = 0; k < static_cast<int>(_optimizer->activeEdges().size()); ++k) {
-    OptimizableGraph::Edge* e = _optimizer->activeEdges()[k];
-    e->linearizeOplus(jacobianWorkspace); // jacobian of the nodes' oplus (manifold)
-    e->constructQuadraticForm();
-#  ifndef NDEBUG
-    for (size_t i = 0; i < e->vertices().size(); ++i) {
-      const OptimizableGraph::Vertex* v = static_cast<const OptimizableGraph::Vertex*>(e->vertex(i));
-      if (! v->fixed()) {
-        bool hasANan = arrayHasNaN(jacobianWorkspace.workspaceForVertex(i), e->dimension() * v->dimension());
-        if (hasANan) {
-          cerr << "buildSystem(): NaN within Jacobian for edge " << e << " for vertex " << i << endl;
-          break;
-        }
-      }
-    }
-#  endif
-  }
 
   // flush the current system in a sparse block matrix
 # ifdef G2O_OPENMP
@@ -148,6 +148,14 @@ namespace g2o {
   {
   }
 
+  void HyperGraph::release()
+  {
+    for (VertexIDMap::iterator it=_vertices.begin(); it!=_vertices.end(); ++it)
+      it->second->edges().clear();
+    _vertices.clear();
+    _edges.clear();
+  }
+
   void HyperGraph::clear()
   {
     for (VertexIDMap::iterator it=_vertices.begin(); it!=_vertices.end(); ++it)
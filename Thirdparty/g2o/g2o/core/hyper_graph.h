@@ -172,6 +172,8 @@ namespace g2o {
       virtual bool removeEdge(Edge* e);
       //! clears the graph and empties all structures.
       virtual void clear();
+      //! empties the graph without deleting its vertices and edges, the caller takes their ownership
+      virtual void release();
 
       //! @returns the map <i>id -> vertex</i> where the vertices are stored
       const VertexIDMap& vertices() const {return _vertices;}
@@ -32,7 +32,8 @@
 #ifdef G2O_OPENMP
 #include <omp.h>
 #else
-#include <cassert>
+#include <atomic>
+#include <thread>
 #endif
 
 namespace g2o {
@@ -56,24 +57,23 @@ namespace g2o {
 #else
 
   /*
-   * dummy which does nothing in case we don't have OpenMP support.
-   * In debug mode, the mutex allows to verify the correct lock and unlock behavior
+   * Spin lock. Without OpenMP the optimizer can still evaluate the edges from several threads
+   * (see SparseOptimizer::setParallelFor), the critical sections are a few small matrix products.
    */
   class OpenMPMutex
   {
     public:
-#ifdef NDEBUG
-      OpenMPMutex() {}
-#else
-      OpenMPMutex() : _cnt(0) {}
-#endif
-      ~OpenMPMutex() { assert(_cnt == 0 && "Freeing locked mutex");}
-      void lock() { assert(++_cnt == 1 && "Locking already locked mutex");}
-      void unlock() { assert(--_cnt == 0 && "Trying to unlock a mutex which is not locked");}
+      OpenMPMutex() { _lock.clear(); }
+      OpenMPMutex(const OpenMPMutex&) { _lock.clear(); }
+      OpenMPMutex& operator=(const OpenMPMutex&) { return *this; }
+      void lock()
+      {
+        while (_lock.test_and_set(std::memory_order_acquire))
+          std::this_thread::yield();
+      }
+      void unlock() { _lock.clear(std::memory_order_release); }
     protected:
-#ifndef NDEBUG
-      char _cnt;
-#endif
+      std::atomic_flag _lock;
   };
 
 #endif
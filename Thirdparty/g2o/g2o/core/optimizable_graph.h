@@ -634,6 +634,12 @@ namespace g2o {
      */
     virtual void clearParameters();
 
+    /**
+     * empties the graph without deleting its vertices and edges, which can be
+     * added again to this or another graph
+     */
+    virtual void release();
+
     bool addParameter(Parameter* p) {
       return _parameters.addParameter(p);
     }
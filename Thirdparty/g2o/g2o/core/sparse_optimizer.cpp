@@ -48,7 +48,7 @@ namespace g2o{
 
 
   SparseOptimizer::SparseOptimizer() :
-    _forceStopFlag(0), _verbose(false), _algorithm(0), _computeBatchStatistics(false)
+    _forceStopFlag(0), _verbose(false), _algorithm(0), _computeBatchStatistics(false), _numWorkers(1)
   {
     _graphActions.resize(AT_NUM_ELEMENTS);
   }
@@ -69,11 +69,16 @@ namespace g2o{
 
 #   ifdef G2O_OPENMP
 #   pragma omp parallel for default (shared) if (_activeEdges.size() > 50)
-#   endif
     for (int k = 0; k < static_cast<int>(_activeEdges.size()); ++k) {
       OptimizableGraph::Edge* e = _activeEdges[k];
       e->computeError();
     }
+#   else
+    forEachRange(_activeEdges.size(), 1000, [this](int begin, int end, int) {
+      for (int k = begin; k < end; ++k)
+        _activeEdges[k]->computeError();
+    });
+#   endif
 
 #  ifndef NDEBUG
     for (int k = 0; k < static_cast<int>(_activeEdges.size()); ++k) {
@@ -493,6 +498,14 @@ namespace g2o{
     OptimizableGraph::clear();
   }
 
+  void SparseOptimizer::release() {
+    clearIndexMapping();
+    _ivMap.clear();
+    _activeVertices.clear();
+    _activeEdges.clear();
+    OptimizableGraph::release();
+  }
+
   SparseOptimizer::VertexContainer::const_iterator SparseOptimizer::findActiveVertex(const OptimizableGraph::Vertex* v) const
   {
     VertexContainer::const_iterator lower = lower_bound(_activeVertices.begin(), _activeVertices.end(), v, VertexIDCompare());
@@ -571,6 +584,26 @@ namespace g2o{
     return _algorithm->computeMarginals(spinv, blockIndices);
   }
 
+  void SparseOptimizer::setParallelFor(const ParallelFor& parallelFor, int numWorkers)
+  {
+    _parallelFor = parallelFor;
+    _numWorkers = std::max(1, numWorkers);
+  }
+
+  void SparseOptimizer::forEachRange(int n, int minRange, const std::function<void(int, int, int)>& f) const
+  {
+    if (n <= 0)
+      return;
+    const int numRanges = std::max(1, std::min(numWorkers(), n / std::max(1, minRange)));
+    if (numRanges == 1) {
+      f(0, n, 0);
+      return;
+    }
+    _parallelFor(numRanges, [&](int r) {
+      f(static_cast<long>(n) * r / numRanges, static_cast<long>(n) * (r+1) / numRanges, r);
+    });
+  }
+
   void SparseOptimizer::setForceStopFlag(bool* flag)
   {
     _forceStopFlag=flag;
@@ -34,6 +34,7 @@
 #include "batch_stats.h"
 
 #include <map>
+#include <functional>
 
 namespace g2o {
 
@@ -187,6 +188,23 @@ namespace g2o {
     //! if external stop flag is given, return its state. False otherwise
     bool terminate() {return _forceStopFlag ? (*_forceStopFlag) : false; }
 
+    //! calls f(i) for every i in [0,n), possibly from several threads, and returns when all calls have finished
+    typedef std::function<void(int, const std::function<void(int)>&)> ParallelFor;
+
+    /**
+     * evaluates the errors and the Jacobians of the active edges and builds the Schur complement
+     * in up to numWorkers tasks run through parallelFor (e.g. a thread pool). Without parallelFor
+     * or with numWorkers<=1 the optimization is serial.
+     */
+    void setParallelFor(const ParallelFor& parallelFor, int numWorkers);
+    int numWorkers() const { return _parallelFor ? _numWorkers : 1; }
+
+    /**
+     * splits [0,n) in contiguous ranges of at least minRange elements, at most one per worker,
+     * and calls f(begin, end, worker) for each of them (serially if there is a single range)
+     */
+    void forEachRange(int n, int minRange, const std::function<void(int, int, int)>& f) const;
+
     //! the index mapping of the vertices
     const VertexContainer& indexMapping() const {return _ivMap;}
     //! the vertices active in the current optimization
@@ -244,6 +262,11 @@ namespace g2o {
      */
     virtual void clear();
 
+    /**
+     * empties the graph as clear(), but the vertices and edges are not deleted
+     */
+    virtual void release();
+
     /**
      * computes the error vectors of all edges in the activeSet, and caches them
      */
@@ -306,6 +329,9 @@ namespace g2o {
 
     BatchStatisticsContainer _batchStatistics;   ///< global statistics of the optimizer, e.g., timing, num-non-zeros
     bool _computeBatchStatistics;
+
+    ParallelFor _parallelFor;
+    int _numWorkers;
   };
 } // end namespace
 
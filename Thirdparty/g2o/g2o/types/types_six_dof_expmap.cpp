@@ -102,7 +102,10 @@ bool EdgeSE3ProjectXYZ::write(std::ostream& os) const {
 
 void EdgeSE3ProjectXYZ::linearizeOplus() {
   VertexSE3Expmap * vj = static_cast<VertexSE3Expmap *>(_vertices[1]);
-  SE3Quat T(vj->estimate());
+  linearizeOplusAt(vj->estimate());
+}
+
+void EdgeSE3ProjectXYZ::linearizeOplusAt(const SE3Quat & T) {
   VertexSBAPointXYZ* vi = static_cast<VertexSBAPointXYZ*>(_vertices[0]);
   Vector3d xyz = vi->estimate();
   Vector3d xyz_trans = T.map(xyz);
@@ -187,7 +190,10 @@ bool EdgeStereoSE3ProjectXYZ::write(std::ostream& os) const {
 
 void EdgeStereoSE3ProjectXYZ::linearizeOplus() {
   VertexSE3Expmap * vj = static_cast<VertexSE3Expmap *>(_vertices[1]);
-  SE3Quat T(vj->estimate());
+  linearizeOplusAt(vj->estimate());
+}
+
+void EdgeStereoSE3ProjectXYZ::linearizeOplusAt(const SE3Quat & T) {
   VertexSBAPointXYZ* vi = static_cast<VertexSBAPointXYZ*>(_vertices[0]);
   Vector3d xyz = vi->estimate();
   Vector3d xyz_trans = T.map(xyz);
@@ -364,4 +370,63 @@ void EdgeStereoSE3ProjectXYZOnlyPose::linearizeOplus() {
 }
 
 
+EdgeSE3LinearPrior::EdgeSE3LinearPrior() : BaseMultiEdge<6, Vector6d>() {
+  r0.setZero();
+  information().setIdentity();
+}
+
+bool EdgeSE3LinearPrior::read(std::istream& is){
+  size_t n;
+  is >> n;
+  resize(n);
+  for (int i=0; i<6; i++)
+    is >> r0[i];
+  for (size_t k=0; k<n; k++){
+    Vector7d est;
+    for (int i=0; i<7; i++)
+      is >> est[i];
+    T0[k].fromVector(est);
+    for (int i=0; i<6; i++)
+      for (int j=0; j<6; j++)
+        is >> J[k](i,j);
+  }
+  return true;
+}
+
+bool EdgeSE3LinearPrior::write(std::ostream& os) const {
+  os << J.size() << " ";
+  for (int i=0; i<6; i++)
+    os << r0[i] << " ";
+  for (size_t k=0; k<J.size(); k++){
+    Vector7d est = T0[k].toVector();
+    for (int i=0; i<7; i++)
+      os << est[i] << " ";
+    for (int i=0; i<6; i++)
+      for (int j=0; j<6; j++)
+        os << J[k](i,j) << " ";
+  }
+  return os.good();
+}
+
+void EdgeSE3LinearPrior::resize(size_t size) {
+  BaseMultiEdge<6, Vector6d>::resize(size);
+  J.resize(size, Matrix6d::Zero());
+  T0.resize(size);
+}
+
+void EdgeSE3LinearPrior::computeError() {
+  _error = r0;
+  for (size_t i=0; i<_vertices.size(); i++){
+    const VertexSE3Expmap* v = static_cast<const VertexSE3Expmap*>(_vertices[i]);
+    _error += J[i]*(v->estimate()*T0[i].inverse()).log();
+  }
+}
+
+void EdgeSE3LinearPrior::linearizeOplus() {
+  // The update is left-multiplied, log(exp(u)*T*T0^-1) ~ u + log(T*T0^-1) near the linearization point
+  for (size_t i=0; i<_vertices.size(); i++)
+    _jacobianOplus[i] = J[i];
+}
+
+
 } // end namespace
@@ -37,6 +37,7 @@
 #include "../core/base_vertex.h"
 #include "../core/base_binary_edge.h"
 #include "../core/base_unary_edge.h"
+#include "../core/base_multi_edge.h"
 #include "se3_ops.h"
 #include "se3quat.h"
 #include "types_sba.h"
@@ -103,11 +104,29 @@ public:
 
   virtual void linearizeOplus();
 
+  // Jacobians with the pose of the camera taken as T instead of its current estimate
+  void linearizeOplusAt(const SE3Quat & T);
+
   Vector2d cam_project(const Vector3d & trans_xyz) const;
 
   double fx, fy, cx, cy;
 };
 
+/**
+ * \brief EdgeSE3ProjectXYZ with the Jacobians evaluated at a fixed pose of the camera.
+ *
+ * Used for the cameras of a marginalization prior, whose Jacobians must stay at the prior's
+ * linearization point (first estimate Jacobians). The error uses the current estimates.
+ */
+class  EdgeSE3ProjectXYZFEJ: public  EdgeSE3ProjectXYZ{
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  virtual void linearizeOplus() { linearizeOplusAt(Tlin); }
+
+  SE3Quat Tlin;
+};
+
 
 class  EdgeStereoSE3ProjectXYZ: public  BaseBinaryEdge<3, Vector3d, VertexSBAPointXYZ, VertexSE3Expmap>{
 public:
@@ -135,11 +154,26 @@ public:
 
   virtual void linearizeOplus();
 
+  // Jacobians with the pose of the camera taken as T instead of its current estimate
+  void linearizeOplusAt(const SE3Quat & T);
+
   Vector3d cam_project(const Vector3d & trans_xyz, const float &bf) const;
 
   double fx, fy, cx, cy, bf;
 };
 
+/**
+ * \brief EdgeStereoSE3ProjectXYZ with the Jacobians evaluated at a fixed pose of the camera.
+ */
+class  EdgeStereoSE3ProjectXYZFEJ: public  EdgeStereoSE3ProjectXYZ{
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  virtual void linearizeOplus() { linearizeOplusAt(Tlin); }
+
+  SE3Quat Tlin;
+};
+
 class  EdgeSE3ProjectXYZOnlyPose: public  BaseUnaryEdge<2, Vector2d, VertexSE3Expmap>{
 public:
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -202,6 +236,34 @@ public:
 };
 
 
+/**
+ * \brief Six rows of a linear prior on several poses, as left by marginalization.
+ *
+ * error = r0 + sum_i J[i]*log(T_i*T0[i]^-1), where T_i is the estimate of vertex i and T0[i] its
+ * linearization point. The rows are already whitened, the information is the identity.
+ */
+class  EdgeSE3LinearPrior: public  BaseMultiEdge<6, Vector6d>{
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  EdgeSE3LinearPrior();
+
+  bool read(std::istream& is);
+
+  bool write(std::ostream& os) const;
+
+  virtual void resize(size_t size);
+
+  void computeError();
+
+  virtual void linearizeOplus();
+
+  std::vector<Matrix6d, aligned_allocator<Matrix6d> > J;
+  std::vector<SE3Quat, aligned_allocator<SE3Quat> > T0;
+  Vector6d r0;
+};
+
+
 
 } // end namespace
 
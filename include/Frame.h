@@ -29,6 +29,7 @@
 #include "ORBVocabulary.h"
 #include "KeyFrame.h"
 #include "ORBextractor.h"
+#include "FrameArena.h"
 
 #include <opencv2/opencv.hpp>
 
@@ -89,6 +90,10 @@ public:
     // given a certain point (x, y) this function searches all grid cells in the vicinity of it with a the windowsize r
     vector<size_t> GetFeaturesInArea(const float &x, const float  &y, const float  &r, const int minLevel=-1, const int maxLevel=-1) const;
 
+    // Same search into a scratch vector of the caller (cleared first), for the per-point loops of the matcher
+    void GetFeaturesInArea(const float &x, const float  &y, const float  &r, const int minLevel, const int maxLevel,
+                           ArenaVector<size_t> &vIndices) const;
+
     // Search a match for each keypoint in the left image to a keypoint in the right image.
     // If there is a match, depth is computed and the right coordinate associated to the left keypoint is stored.
     void ComputeStereoMatches();
@@ -203,6 +208,9 @@ private:
     // Assign keypoints to the grid for speed up feature matching (called in the constructor).
     void AssignFeaturesToGrid();
 
+    template<class V>
+    void FeaturesInArea(const float &x, const float  &y, const float  &r, const int minLevel, const int maxLevel, V &vIndices) const;
+
     // Rotation, translation and camera center
     cv::Mat mRcw;
     cv::Mat mtcw;
@@ -0,0 +1,163 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAMEARENA_H
+#define FRAMEARENA_H
+
+#include <vector>
+#include <map>
+#include <functional>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace ORB_SLAM2
+{
+
+// Per-thread bump allocator for the scratch containers of the hot paths (matching histograms,
+// candidate lists, feature searches). Memory is taken from blocks that are kept for the life of
+// the thread, deallocation does nothing (except for the last allocation, so a growing vector
+// reuses its space), and everything allocated inside a Scope is released when the Scope ends.
+// Tracking opens a Scope per frame, so in steady state the blocks are reused and the heap is not
+// touched. Containers using the arena must be destroyed before the Scope they were created in.
+class FrameArena
+{
+public:
+
+    // Releases on destruction everything allocated since construction. Scopes nest.
+    class Scope
+    {
+    public:
+        Scope(): mArena(FrameArena::ThreadInstance()), mnBlock(mArena.mnBlock), mnOffset(mArena.mnOffset) {}
+        ~Scope() { mArena.mnBlock = mnBlock; mArena.mnOffset = mnOffset; }
+
+    private:
+        Scope(const Scope&);
+        Scope& operator=(const Scope&);
+
+        FrameArena &mArena;
+        size_t mnBlock;
+        size_t mnOffset;
+    };
+
+    static FrameArena& ThreadInstance()
+    {
+        static thread_local FrameArena arena;
+        return arena;
+    }
+
+    FrameArena(): mnBlock(0), mnOffset(0) {}
+
+    ~FrameArena()
+    {
+        for(size_t i=0; i<mvBlocks.size(); i++)
+            free(mvBlocks[i].pData);
+    }
+
+    void* Allocate(const size_t n)
+    {
+        const size_t size = Align(n);
+        while(mnBlock<mvBlocks.size())
+        {
+            Block &block = mvBlocks[mnBlock];
+            if(mnOffset+size<=block.size)
+            {
+                void* p = block.pData+mnOffset;
+                mnOffset += size;
+                return p;
+            }
+            // The rest of this block is skipped until the enclosing scope ends
+            mnBlock++;
+            mnOffset = 0;
+        }
+
+        // Blocks double in size, so a thread needs only a few of them
+        size_t blockSize = mvBlocks.empty() ? BLOCK_SIZE : 2*mvBlocks.back().size;
+        while(blockSize<size)
+            blockSize *= 2;
+
+        Block block;
+        block.pData = static_cast<char*>(malloc(blockSize));
+        if(!block.pData)
+            throw std::bad_alloc();
+        block.size = blockSize;
+        mvBlocks.push_back(block);
+
+        mnBlock = mvBlocks.size()-1;
+        mnOffset = size;
+        return block.pData;
+    }
+
+    void Deallocate(void* p, const size_t n)
+    {
+        // Only the most recent allocation can be given back
+        const size_t size = Align(n);
+        if(mnBlock<mvBlocks.size() && mnOffset>=size && static_cast<char*>(p)==mvBlocks[mnBlock].pData+mnOffset-size)
+            mnOffset -= size;
+    }
+
+private:
+    FrameArena(const FrameArena&);
+    FrameArena& operator=(const FrameArena&);
+
+    static const size_t BLOCK_SIZE = 1<<20;
+    static const size_t ALIGNMENT = 16;
+
+    static size_t Align(const size_t n) { return (n+ALIGNMENT-1) & ~(ALIGNMENT-1); }
+
+    struct Block
+    {
+        char* pData;
+        size_t size;
+    };
+
+    std::vector<Block> mvBlocks;
+    size_t mnBlock;
+    size_t mnOffset;
+};
+
+// STL allocator on the arena of the thread that creates the container
+template<class T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    ArenaAllocator(): mpArena(&FrameArena::ThreadInstance()) {}
+    template<class U> ArenaAllocator(const ArenaAllocator<U> &other): mpArena(other.mpArena) {}
+
+    T* allocate(const size_t n) { return static_cast<T*>(mpArena->Allocate(n*sizeof(T))); }
+    void deallocate(T* p, const size_t n) { mpArena->Deallocate(p,n*sizeof(T)); }
+
+    template<class U> bool operator==(const ArenaAllocator<U> &other) const { return mpArena==other.mpArena; }
+    template<class U> bool operator!=(const ArenaAllocator<U> &other) const { return mpArena!=other.mpArena; }
+
+    FrameArena* mpArena;
+};
+
+template<class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+
+template<class K, class V>
+using ArenaMap = std::map<K, V, std::less<K>, ArenaAllocator<std::pair<const K, V> > >;
+
+} //namespace ORB_SLAM
+
+#endif // FRAMEARENA_H
@@ -28,6 +28,7 @@
 #include "ORBextractor.h"
 #include "Frame.h"
 #include "KeyFrameDatabase.h"
+#include "SeqLock.h"
 
 #include <mutex>
 
@@ -39,13 +40,23 @@ class Map;
 class MapPoint;
 class Frame;
 class KeyFrameDatabase;
+class MapReader;
+class MapWriter;
+class LocalizationTileCache;
 
 class KeyFrame
 {
+    friend class MapSerializer;
+
 public:
     KeyFrame(Frame &F, Map* pMap, KeyFrameDatabase* pKFDB);
 
-    // Pose functions
+    // Restores a keyframe written by Write(). Links to map points and other keyframes
+    // are restored by MapSerializer once the whole map has been read.
+    KeyFrame(MapReader &reader, Map* pMap, KeyFrameDatabase* pKFDB, ORBVocabulary* pVoc);
+    void Write(MapWriter &writer);
+
+    // Pose functions. The getters read a snapshot without locking (see SeqLock).
     void SetPose(const cv::Mat &Tcw);
     cv::Mat GetPose();
     cv::Mat GetPoseInverse();
@@ -87,6 +98,17 @@ public:
     void ReplaceMapPointMatch(const size_t &idx, MapPoint* pMP);
     std::set<MapPoint*> GetMapPoints();
     std::vector<MapPoint*> GetMapPointMatches();
+    // Changes whenever a map point match is added, erased or replaced
+    long unsigned int GetMatchesVersion();
+    // Call f on every map point match (NULL included) with the features locked, without copying them.
+    // f must not call back into this keyframe. Returns the matches version they belong to.
+    template<class Func> long unsigned int ForEachMapPointMatch(Func f)
+    {
+        std::unique_lock<std::mutex> lock(mMutexFeatures);
+        for(size_t i=0, iend=mvpMapPoints.size(); i<iend; i++)
+            f(mvpMapPoints[i]);
+        return mnMatchesVersion;
+    }
     int TrackedMapPoints(const int &minObs);
     MapPoint* GetMapPoint(const size_t &idx);
 
@@ -108,6 +130,12 @@ public:
     // Compute Scene Depth (q=2 median). Used in monocular.
     float ComputeSceneMedianDepth(const int q);
 
+    // Keypoints, descriptors, grid and feature vector can be paged out to a LocalizationTileCache (in
+    // localization mode only). They must be paged in again before they are used.
+    void PageOut(LocalizationTileCache* pCache);
+    void PageIn();
+    bool IsPagedOut();
+
     static bool weightComp( int a, int b){
         return a>b;
     }
@@ -140,14 +168,6 @@ public:
     long unsigned int mnBALocalForKF;
     long unsigned int mnBAFixedForKF;
 
-    // Variables used by the keyframe database
-    long unsigned int mnLoopQuery;
-    int mnLoopWords;
-    float mLoopScore;
-    long unsigned int mnRelocQuery;
-    int mnRelocWords;
-    float mRelocScore;
-
     // Variables used by loop closing
     cv::Mat mTcwGBA;
     cv::Mat mTcwBefGBA;
@@ -160,11 +180,12 @@ public:
     const int N;
 
     // KeyPoints, stereo coordinate and descriptors (all associated by an index)
-    const std::vector<cv::KeyPoint> mvKeys;
-    const std::vector<cv::KeyPoint> mvKeysUn;
-    const std::vector<float> mvuRight; // negative value for monocular points
-    const std::vector<float> mvDepth; // negative value for monocular points
-    const cv::Mat mDescriptors;
+    // Never change, but are released while the keyframe is paged out.
+    std::vector<cv::KeyPoint> mvKeys;
+    std::vector<cv::KeyPoint> mvKeysUn;
+    std::vector<float> mvuRight; // negative value for monocular points
+    std::vector<float> mvDepth; // negative value for monocular points
+    cv::Mat mDescriptors;
 
     //BoW
     DBoW2::BowVector mBowVec;
@@ -201,8 +222,18 @@ protected:
 
     cv::Mat Cw; // Stereo middel point. Only for visualization
 
+    // Pose as seen by the readers, written by SetPose with mMutexPose locked
+    struct PoseSnapshot
+    {
+        float Tcw[12];
+        float Twc[12];
+        float Cw[3];
+    };
+    SeqLock<PoseSnapshot> mPoseSnapshot;
+
     // MapPoints associated to keypoints
     std::vector<MapPoint*> mvpMapPoints;
+    long unsigned int mnMatchesVersion;
 
     // BoW
     KeyFrameDatabase* mpKeyFrameDB;
@@ -230,9 +261,20 @@ protected:
 
     Map* mpMap;
 
+    // Paging. The features are stored once in the cache (they never change), paging out again only
+    // releases them.
+    void WriteFeatures(MapWriter &writer);
+    void ReadFeatures(MapReader &reader);
+    void ReleaseFeatures();
+    bool LoadFeatures();
+    LocalizationTileCache* mpPageCache; // not NULL while paged out
+    int64_t mnPageOffset;
+    uint64_t mnPageSize;
+
     std::mutex mMutexPose;
     std::mutex mMutexConnections;
     std::mutex mMutexFeatures;
+    std::mutex mMutexPage;
 };
 
 } //namespace ORB_SLAM
@@ -23,13 +23,16 @@
 
 #include <vector>
 #include <list>
+#include <algorithm>
 #include <set>
+#include <stdint.h>
 
 #include "KeyFrame.h"
 #include "Frame.h"
 #include "ORBVocabulary.h"
 
 #include<mutex>
+#include<boost/thread/shared_mutex.hpp>
 
 
 namespace ORB_SLAM2
@@ -57,16 +60,100 @@ public:
    // Relocalization
    std::vector<KeyFrame*> DetectRelocalizationCandidates(Frame* F);
 
+   // Relocalization restricted to keyframes whose camera center is closer than maxDistance to Ow.
+   // Candidates are sorted by increasing distance to Ow. The query leaves no state in the keyframes, so a
+   // global query for the same frame still finds the keyframes rejected here.
+   std::vector<KeyFrame*> DetectRelocalizationCandidates(Frame* F, const cv::Mat &Ow, const float maxDistance);
+
 protected:
 
+  // Per-query scratch space, indexed by keyframe id. It is kept per thread and reused across queries:
+  // an entry is only valid if its stamp is the generation of the current query, stale entries are reset
+  // the first time they are visited, so a query costs the posting lists it walks and not the map size.
+  struct QueryScratch
+  {
+      QueryScratch(): mnGeneration(0) {}
+
+      enum eState{
+          UNVISITED=0,
+          CANDIDATE=1,
+          EXCLUDED=2
+      };
+
+      // Starts a new query over nKFs keyframe ids
+      void Begin(size_t nKFs)
+      {
+          if(vnStamp.size()<nKFs)
+          {
+              vnWords.resize(nKFs,0);
+              vScore.resize(nKFs,0);
+              vnState.resize(nKFs,UNVISITED);
+              vnStamp.resize(nKFs,0);
+          }
+          if(++mnGeneration==0)
+          {
+              std::fill(vnStamp.begin(),vnStamp.end(),0);
+              mnGeneration = 1;
+          }
+      }
+
+      // State of id in the current query, reset if it was left by a previous one
+      char& Visit(const size_t id)
+      {
+          if(vnStamp[id]!=mnGeneration)
+          {
+              vnStamp[id] = mnGeneration;
+              vnWords[id] = 0;
+              vScore[id] = 0;
+              vnState[id] = UNVISITED;
+          }
+          return vnState[id];
+      }
+
+      bool IsCandidate(const size_t id) const
+      {
+          return id<vnStamp.size() && vnStamp[id]==mnGeneration && vnState[id]==CANDIDATE;
+      }
+
+      static QueryScratch& ThreadInstance()
+      {
+          static thread_local QueryScratch scratch;
+          return scratch;
+      }
+
+      std::vector<int> vnWords;
+      std::vector<float> vScore;
+      std::vector<char> vnState;
+      std::vector<uint32_t> vnStamp;
+      uint32_t mnGeneration;
+  };
+
+  // Walks the posting lists of the query words. Returns the keyframes sharing words with the query,
+  // with the shared word count in the scratch space, which must have been started with Begin(). Keyframes in spExcluded or farther than
+  // maxDistance from Ow (if given) are not returned. Must be called with mMutex locked (shared).
+  std::vector<KeyFrame*> SearchSharingWords(const DBoW2::BowVector &BowVec, QueryScratch &scratch,
+                                            const std::set<KeyFrame*> &spExcluded,
+                                            const cv::Mat &Ow, const float maxDistance);
+
+  // Removes the ids of erased keyframes from the posting lists that contain them.
+  void Compact();
+
   // Associated vocabulary
   const ORBVocabulary* mpVoc;
 
-  // Inverted file
-  std::vector<list<KeyFrame*> > mvInvertedFile;
+  // Inverted file: for each word, the ids (KeyFrame::mnId) of the keyframes that contain it
+  std::vector<std::vector<uint32_t> > mvInvertedFile;
+
+  // Keyframe for each id. Erased keyframes leave a NULL tombstone, their ids are removed from the
+  // posting lists by Compact() once enough of them have accumulated.
+  std::vector<KeyFrame*> mvpKeyFrames;
+  std::vector<unsigned int> mvDirtyWords;
+  size_t mnEntries;
+  size_t mnTombstoneEntries;
 
-  // Mutex
-  std::mutex mMutex;
+  // Queries (loop closing and relocalization) take it shared and run concurrently, only add/erase/clear
+  // take it exclusively. All per-query state lives in QueryScratch.
+  boost::shared_mutex mMutex;
 };
 
 } //namespace ORB_SLAM
@@ -27,6 +27,8 @@
 #include "Tracking.h"
 #include "KeyFrameDatabase.h"
 #include "Parameter.h"
+#include "ThreadPool.h"
+#include "SlidingWindow.h"
 
 #include <mutex>
 
@@ -47,6 +49,11 @@ public:
 
     void SetTracker(Tracking* pTracker);
 
+    void SetThreadPool(ThreadPool* pThreadPool);
+
+    // Use the sliding-window local BA instead of the covisibility local BA
+    void EnableSlidingWindow(const int nSize, const int nIterations);
+
     // Main function
     void Run();
 
@@ -83,6 +90,7 @@ protected:
     void SearchInNeighbors();
 
     void KeyFrameCulling();
+    bool IsRedundantKeyFrame(KeyFrame* pKF);
 
     cv::Mat ComputeF12(KeyFrame* &pKF1, KeyFrame* &pKF2);
 
@@ -105,6 +113,10 @@ protected:
     LoopClosing* mpLoopCloser;
     Tracking* mpTracker;
 
+    ThreadPool* mpThreadPool;
+
+    SlidingWindow* mpSlidingWindow;
+
     std::list<KeyFrame*> mlNewKeyFrames;
 
     KeyFrame* mpCurrentKeyFrame;
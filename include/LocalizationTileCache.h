@@ -0,0 +1,96 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOCALIZATIONTILECACHE_H
+#define LOCALIZATIONTILECACHE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM2
+{
+
+class Map;
+class KeyFrame;
+
+// Disk-backed cache of keyframe features for localization in large maps. It only works in
+// localization mode: while mapping, Local Mapping and Loop Closing read the features of any
+// keyframe (triangulation, fusion, loop detection) without going through Tracking, so nothing is
+// paged out then and the resident memory of a map being built still grows with the map.
+// Space is divided in cubic tiles. Keyframes whose camera center lies more than nRadius tiles away from the camera have their
+// keypoints, descriptors, grid and feature vector paged out to a file, so resident memory follows
+// the working set instead of the map size. The keyframe skeleton (pose, graph, map points, BoW
+// vector for the keyframe database) stays in memory.
+// Features are only read by Tracking while Local Mapping is stopped, so paging is driven by
+// Tracking: Update() when the camera moves, KeyFrame::PageIn() before a keyframe is matched (the
+// reference keyframe and relocalization candidates) and PageInAll() before mapping resumes.
+class LocalizationTileCache
+{
+public:
+    // The file is removed right away, it only lives while it is open
+    LocalizationTileCache(Map* pMap, const std::string &filename, const float tileSize, const int nRadius);
+    ~LocalizationTileCache();
+
+    bool good() const { return mFd>=0; }
+
+    // Pages out the keyframes outside the tiles around the camera center and pages in the ones
+    // inside. Does nothing until the camera enters another tile.
+    void Update(const cv::Mat &Ow);
+
+    void PageInAll();
+
+    // The map was cleared, the stored features are dropped
+    void Reset();
+
+    // Called by KeyFrame. Features are stored once, they never change.
+    bool Store(const std::vector<char> &vData, int64_t &nOffset);
+    bool Fetch(const int64_t nOffset, const uint64_t nSize, std::vector<char> &vData);
+
+protected:
+
+    struct Tile
+    {
+        int x, y, z;
+        bool operator==(const Tile &t) const { return x==t.x && y==t.y && z==t.z; }
+    };
+
+    Tile TileOf(const cv::Mat &Ow) const;
+    bool IsNear(const Tile &t1, const Tile &t2) const;
+
+    Map* mpMap;
+
+    float mfTileSize;
+    int mnRadius;
+
+    bool mbHasTile;
+    Tile mCurrentTile;
+
+    int mFd;
+    int64_t mnFileSize;
+    std::mutex mMutexFile;
+};
+
+} //namespace ORB_SLAM
+
+#endif // LOCALIZATIONTILECACHE_H
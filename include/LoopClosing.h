@@ -28,9 +28,12 @@
 #include "Tracking.h"
 #include "KeyFrameDatabase.h"
 #include "Parameter.h"
+#include "ThreadPool.h"
 
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <set>
 #include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
 
 namespace ORB_SLAM2
@@ -57,6 +60,11 @@ public:
 
     void SetLocalMapper(LocalMapping* pLocalMapper);
 
+    void SetThreadPool(ThreadPool* pThreadPool);
+
+    // The global BA after a loop closure only optimizes the keyframes disturbed by the correction
+    void EnableIncrementalGBA();
+
     // Main function
     void Run();
 
@@ -80,6 +88,9 @@ public:
 
     bool isFinished();
 
+    // No keyframe is queued or being processed (a global BA may still be running)
+    bool isIdle();
+
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
 protected:
@@ -90,6 +101,11 @@ protected:
 
     bool ComputeSim3();
 
+    // Runs the Sim3 verification of one consistent candidate. Gives up as soon as a candidate with a lower
+    // index has been accepted (nAccepted holds the lowest accepted index).
+    bool VerifyLoopCandidate(const int nCandidate, std::atomic<int> &nAccepted,
+                             std::vector<MapPoint*> &vpMatches, g2o::Sim3 &gScm);
+
     void SearchAndFuse(const KeyFrameAndPose &CorrectedPosesMap);
 
     void CorrectLoop();
@@ -112,7 +128,10 @@ protected:
 
     LocalMapping *mpLocalMapper;
 
+    ThreadPool* mpThreadPool;
+
     std::list<KeyFrame*> mlpLoopKeyFrameQueue;
+    bool mbProcessingKeyFrame;
 
     std::mutex mMutexLoopQueue;
 
@@ -138,12 +157,17 @@ protected:
     bool mbStopGBA;
     std::mutex mMutexGBA;
     std::thread* mpThreadGBA;
+    bool mbIncrementalGBA;
+
+    // Keyframes to optimize in the incremental global BA. If the BA is aborted by a new loop its solution
+    // is discarded and only this set is kept, merged into the set of the next BA.
+    std::set<KeyFrame*> mspGBAKeyFrames;
 
     // Fix scale in the stereo/RGB-D case
     bool mbFixScale;
 
 
-    bool mnFullBAIdx;
+    int mnFullBAIdx;
 
     Parameter<bool> mVisualizeLoopClosing;
 };
@@ -24,6 +24,8 @@
 #include "MapPoint.h"
 #include "KeyFrame.h"
 #include <set>
+#include <vector>
+#include <unordered_map>
 
 #include <mutex>
 
@@ -34,6 +36,9 @@ namespace ORB_SLAM2
 
 class MapPoint;
 class KeyFrame;
+class MapJournal;
+class MapPointIndex;
+class Frame;
 
 class Map
 {
@@ -50,6 +55,22 @@ public:
 
     std::vector<KeyFrame*> GetAllKeyFrames();
     std::vector<MapPoint*> GetAllMapPoints();
+
+    // Call f on every keyframe (map point) with the map locked, without copying the arrays.
+    // f must be short and must not call back into the Map.
+    template<class Func> void ForEachKeyFrame(Func f)
+    {
+        std::unique_lock<std::mutex> lock(mMutexMap);
+        for(size_t i=0, iend=mKeyFrames.mvpItems.size(); i<iend; i++)
+            f(mKeyFrames.mvpItems[i]);
+    }
+
+    template<class Func> void ForEachMapPoint(Func f)
+    {
+        std::unique_lock<std::mutex> lock(mMutexMap);
+        for(size_t i=0, iend=mMapPoints.mvpItems.size(); i<iend; i++)
+            f(mMapPoints.mvpItems[i]);
+    }
     std::vector<MapPoint*> GetReferenceMapPoints();
 
     long unsigned int MapPointsInMap();
@@ -57,8 +78,28 @@ public:
 
     long unsigned int GetMaxKFid();
 
+    // Lookup by id, NULL if not in the map
+    KeyFrame* GetKeyFrame(const long unsigned int nId);
+    MapPoint* GetMapPoint(const long unsigned int nId);
+
     void clear();
 
+    // Changes are forwarded to the journal, if any. Keyframes and map points call these when
+    // their pose, position or links change.
+    void SetJournal(MapJournal* pJournal);
+    void InformChanged(KeyFrame* pKF);
+    void InformChanged(MapPoint* pMP);
+
+    // Spatial index over the map point positions, off unless enabled. The current points are
+    // indexed when it is enabled. MapPoint::SetWorldPos informs the map of every move.
+    void EnableSpatialIndex(const float voxelSize);
+    bool HasSpatialIndex() const { return mpSpatialIndex!=NULL; }
+    void InformMoved(MapPoint* pMP, const cv::Mat &Pos);
+
+    // Geometric queries, empty without spatial index. Bad points may be returned.
+    std::vector<MapPoint*> GetMapPointsInRadius(const cv::Mat &x3Dw, const float r);
+    std::vector<MapPoint*> GetMapPointsInFrustum(const Frame &F, const float maxDepth);
+
     vector<KeyFrame*> mvpKeyFrameOrigins;
 
     std::mutex mMutexMapUpdate;
@@ -67,8 +108,53 @@ public:
     std::mutex mMutexPointCreation;
 
 protected:
-    std::set<MapPoint*> mspMapPoints;
-    std::set<KeyFrame*> mspKeyFrames;
+    // Entities in a contiguous array plus the slot of each id. Erasing moves the last entity into
+    // the freed slot, so insertion, erasure and lookup are O(1) and GetAll* copies a single array.
+    template<class T> class DenseSet
+    {
+    public:
+        bool insert(T* p)
+        {
+            if(!mSlots.insert(std::make_pair(p->mnId,mvpItems.size())).second)
+                return false;
+            mvpItems.push_back(p);
+            return true;
+        }
+
+        bool erase(T* p)
+        {
+            typename std::unordered_map<long unsigned int,size_t>::iterator it = mSlots.find(p->mnId);
+            if(it==mSlots.end() || mvpItems[it->second]!=p)
+                return false;
+            const size_t slot = it->second;
+            mSlots.erase(it);
+            if(slot+1<mvpItems.size())
+            {
+                mvpItems[slot] = mvpItems.back();
+                mSlots[mvpItems[slot]->mnId] = slot;
+            }
+            mvpItems.pop_back();
+            return true;
+        }
+
+        T* find(const long unsigned int nId) const
+        {
+            typename std::unordered_map<long unsigned int,size_t>::const_iterator it = mSlots.find(nId);
+            return it==mSlots.end() ? static_cast<T*>(NULL) : mvpItems[it->second];
+        }
+
+        void clear()
+        {
+            mvpItems.clear();
+            mSlots.clear();
+        }
+
+        std::vector<T*> mvpItems;
+        std::unordered_map<long unsigned int,size_t> mSlots;
+    };
+
+    DenseSet<MapPoint> mMapPoints;
+    DenseSet<KeyFrame> mKeyFrames;
 
     std::vector<MapPoint*> mvpReferenceMapPoints;
 
@@ -77,6 +163,10 @@ protected:
     // Index related to a big change in the map (loop closure, global BA)
     int mnBigChangeIdx;
 
+    MapJournal* mpJournal;
+
+    MapPointIndex* mpSpatialIndex;
+
     std::mutex mMutexMap;
 };
 
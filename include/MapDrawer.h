@@ -56,6 +56,9 @@ private:
 
     cv::Mat mCameraPose;
 
+    // Positions of the points drawn in the last frame, reused across frames
+    std::vector<float> mvPointPositions;
+
     std::mutex mMutexCamera;
 };
 
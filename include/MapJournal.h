@@ -0,0 +1,149 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPJOURNAL_H
+#define MAPJOURNAL_H
+
+#include <string>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "MapSerializer.h"
+
+namespace ORB_SLAM2
+{
+
+class Map;
+class KeyFrame;
+class MapPoint;
+class KeyFrameDatabase;
+
+// Incremental checkpointing of the map. The map notifies which keyframes and map points were
+// added or changed (a pointer insertion, nothing is copied on the mapping threads). A background
+// thread periodically writes the dirty entities as one batch to an append-only journal, and every
+// snapshot interval copies the whole map under mMutexMapUpdate, writes it and starts a new journal.
+// The directory holds
+//   snapshot_<seq>.bin  map file (MapSerializer format)
+//   journal_<seq>.bin   batches written after snapshot <seq>
+// and Recover() rebuilds the map from the latest snapshot and the journals that follow it.
+// Batches are flushed to the OS, so they survive a crash of the process but not of the machine.
+class MapJournal
+{
+public:
+    MapJournal(Map* pMap, KeyFrameDatabase* pKFDB, ORBVocabulary* pVoc, const int sensor,
+               const std::string &strDirectory, const float flushInterval, const float snapshotInterval);
+
+    // Main function
+    void Run();
+
+    // Called by the Map
+    void InformKeyFrameAdded(KeyFrame* pKF);
+    void InformMapPointAdded(MapPoint* pMP);
+    void InformChanged(KeyFrame* pKF);
+    void InformChanged(MapPoint* pMP);
+
+    // Called before the map deletes its content. Waits for a batch being written.
+    void InformMapCleared();
+
+    // Saves a snapshot at the next iteration (e.g. after a map was loaded)
+    void RequestSnapshot();
+
+    // Writes the pending changes and finishes
+    void RequestFinish();
+    bool isFinished();
+
+    // Files of previous sessions found at startup have lower sequence numbers
+    unsigned long FirstSequence() const { return mnFirstSeq; }
+
+    // Loads into the (empty) map the latest snapshot in the directory and replays the journals
+    // written after it, ignoring files with sequence number nEndSeq or higher.
+    static bool Recover(const std::string &strDirectory, MapSerializer &serializer, const int sensor,
+                        const unsigned long nEndSeq);
+
+protected:
+
+    enum eRecord
+    {
+        KEYFRAME=1,
+        KEYFRAME_UPDATE=2,
+        KEYFRAME_ERASE=3,
+        MAPPOINT=4,
+        MAPPOINT_ERASE=5,
+        CLEAR=6
+    };
+
+    void Flush();
+    void Snapshot();
+
+    // Writes the dirty entities as one batch to the journal, with mMutexWrite locked
+    void WriteBatch();
+
+    bool OpenJournal();
+    void CloseJournal();
+
+    std::string FileName(const char* prefix, const unsigned long nSeq) const;
+    void RemoveOlderThan(const unsigned long nSeq);
+
+    static bool ReplayJournal(const std::string &filename, MapSerializer &serializer, const int sensor,
+                              MapSerializer::Staging &staging);
+
+    void SetFinish();
+
+    Map* mpMap;
+    MapSerializer mSerializer;
+    int mSensor;
+
+    std::string mStrDirectory;
+    std::chrono::milliseconds mFlushInterval;
+    std::chrono::milliseconds mSnapshotInterval;
+
+    // Dirty entities since the last batch
+    std::set<KeyFrame*> mspNewKeyFrames;
+    std::set<MapPoint*> mspNewMapPoints;
+    std::set<KeyFrame*> mspChangedKeyFrames;
+    std::set<MapPoint*> mspChangedMapPoints;
+    std::mutex mMutexChanges;
+
+    // Entities written to the journal. Only these are ever dereferenced: a changed pointer that was
+    // never added to the map may be a temporal point that is already deleted.
+    std::set<KeyFrame*> mspKnownKeyFrames;
+    std::set<MapPoint*> mspKnownMapPoints;
+    bool mbCleared;
+
+    MapWriter* mpJournalFile;
+    MapWriter mBatch;
+    unsigned long mnFirstSeq;
+    unsigned long mnSeq;
+    // Files older than the last snapshot, removed once the first batch after it is flushed
+    unsigned long mnObsoleteSeq;
+    std::mutex mMutexWrite;
+
+    bool mbSnapshotRequested;
+    bool mbFinishRequested;
+    bool mbFinished;
+    std::condition_variable mcvRequests;
+    std::mutex mMutexFinish;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPJOURNAL_H
@@ -25,8 +25,11 @@
 #include"Frame.h"
 #include"Map.h"
 
+#include"SeqLock.h"
+
 #include<opencv2/core/core.hpp>
 #include<mutex>
+#include<atomic>
 
 namespace ORB_SLAM2
 {
@@ -34,21 +37,39 @@ namespace ORB_SLAM2
 class KeyFrame;
 class Map;
 class Frame;
+class MapReader;
+class MapWriter;
 
 
 class MapPoint
 {
+    friend class MapSerializer;
+
 public:
     MapPoint(const cv::Mat &Pos, KeyFrame* pRefKF, Map* pMap);
     MapPoint(const cv::Mat &Pos,  Map* pMap, Frame* pFrame, const int &idxF);
 
+    // Restores a map point written by Write(). Observations and the reference keyframe
+    // are restored by MapSerializer once the whole map has been read.
+    MapPoint(MapReader &reader, Map* pMap);
+    void Write(MapWriter &writer);
+
     void SetWorldPos(const cv::Mat &Pos);
+    // Position and normal are read without locking (see SeqLock)
     cv::Mat GetWorldPos();
 
     cv::Mat GetNormal();
     KeyFrame* GetReferenceKeyFrame();
 
     std::map<KeyFrame*,size_t> GetObservations();
+    // Call f(pKF,idx) on every observation with the features locked, without copying them.
+    // f must not call back into this point.
+    template<class Func> void ForEachObservation(Func f)
+    {
+        std::unique_lock<std::mutex> lock(mMutexFeatures);
+        for(std::map<KeyFrame*,size_t>::const_iterator it=mObservations.begin(), itend=mObservations.end(); it!=itend; it++)
+            f(it->first,it->second);
+    }
     int Observations();
 
     void AddObservation(KeyFrame* pKF,size_t idx);
@@ -72,6 +93,9 @@ public:
 
     void ComputeDistinctiveDescriptors();
 
+    // Number of other keyframes that see the point at the same or finer scale than pKF (-1 if not observed in pKF)
+    int GetRedundantObservations(KeyFrame* pKF);
+
     cv::Mat GetDescriptor();
 
     void UpdateNormalAndDepth();
@@ -79,7 +103,7 @@ public:
     float GetMinDistanceInvariance();
     float GetMaxDistanceInvariance();
     int PredictScale(const float &currentDist, KeyFrame*pKF);
-    int PredictScale(const float &currentDist, Frame* pF);
+    int PredictScale(const float &currentDist, const Frame* pF);
 
 public:
     long unsigned int mnId;
@@ -110,10 +134,37 @@ public:
     long unsigned int mnBAGlobalForKF;
 
 
-    static std::mutex mGlobalMutex;
+    // Optimizations write their results (point positions and keyframe poses) inside a batch, which
+    // publishes them as one epoch. The epoch is odd while a batch is written. Readers that need a
+    // consistent set of positions, like the pose optimization of the tracking, read them again if
+    // the epoch changed meanwhile, so they never wait for the mapping threads.
+    // Batches are serialized and do not nest.
+    class PositionBatch
+    {
+    public:
+        PositionBatch();
+        ~PositionBatch();
+    private:
+        PositionBatch(const PositionBatch&);
+        PositionBatch& operator=(const PositionBatch&);
+    };
+
+    static unsigned long GetPositionEpoch();
 
 protected:
 
+     static std::mutex mMutexPositionBatch;
+     static std::atomic<unsigned long> mnPositionEpoch;
+
+     // Copies mWorldPos and mNormalVector for the readers. Called with mMutexPos locked.
+     void PublishPosition();
+
+     // Keep the per-observation arrays (descriptors, distance sums, redundancy counters) in sync
+     // with mObservations. Must be called with mMutexFeatures locked.
+     void AddObservationSlot(KeyFrame* pKF, size_t idx);
+     void EraseObservationSlot(KeyFrame* pKF);
+     void ClearObservationSlots();
+
      // Position in absolute coordinates
      cv::Mat mWorldPos;
 
@@ -123,9 +174,27 @@ protected:
      // Mean viewing direction
      cv::Mat mNormalVector;
 
+     // Position and normal as seen by the readers
+     struct PositionSnapshot
+     {
+         float pos[3];
+         float normal[3];
+     };
+     SeqLock<PositionSnapshot> mPositionSnapshot;
+
      // Best descriptor to fast matching
      cv::Mat mDescriptor;
 
+     // Per-observation data, one entry per keyframe in mvpObsKFs. Updated in O(N) when an observation
+     // is added or erased:
+     // - descriptor and sum of its Hamming distances to the other observations
+     // - scale level and number of other observations at the same or finer scale (level<=level+1)
+     cv::Mat mObsDescriptors;
+     std::vector<KeyFrame*> mvpObsKFs;
+     std::vector<int> mvObsDistanceSum;
+     std::vector<int> mvObsLevels;
+     std::vector<int> mvObsRedundancy;
+
      // Reference KeyFrame
      KeyFrame* mpRefKF;
 
@@ -0,0 +1,110 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPPOINTINDEX_H
+#define MAPPOINTINDEX_H
+
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM2
+{
+
+class MapPoint;
+
+// Voxel hash over the positions of the map points, for geometric queries that do not depend on the
+// covisibility graph. The Map keeps it up to date: points are inserted and erased with the map and
+// moved when their position is set (triangulation refinement, bundle adjustment, loop correction).
+// The index keeps its own copy of the positions, so queries never lock a map point and can run
+// from any thread.
+class MapPointIndex
+{
+public:
+    MapPointIndex(const float voxelSize);
+
+    void Insert(MapPoint* pMP, const cv::Mat &Pos);
+    void Erase(MapPoint* pMP);
+    // Points that are not indexed (e.g. temporal points of the tracking) are ignored
+    void Move(MapPoint* pMP, const cv::Mat &Pos);
+    void Clear();
+
+    size_t Size();
+
+    // Points within distance r of x3Dw
+    std::vector<MapPoint*> GetPointsInRadius(const cv::Mat &x3Dw, const float r);
+
+    // Points in front of a camera with pose Tcw, up to maxDepth, that project inside the image bounds
+    std::vector<MapPoint*> GetPointsInFrustum(const cv::Mat &Tcw, const float fx, const float fy,
+                                              const float cx, const float cy, const float minX,
+                                              const float minY, const float maxX, const float maxY,
+                                              const float maxDepth);
+
+protected:
+
+    // Voxels are compared on their full coordinates, the hash only spreads them over the buckets
+    struct VoxelKey
+    {
+        int x, y, z;
+        bool operator==(const VoxelKey &other) const { return x==other.x && y==other.y && z==other.z; }
+        bool operator!=(const VoxelKey &other) const { return !(*this==other); }
+    };
+
+    struct VoxelKeyHash
+    {
+        size_t operator()(const VoxelKey &key) const;
+    };
+
+    struct Entry
+    {
+        MapPoint* pMP;
+        float x, y, z;
+    };
+
+    struct Voxel
+    {
+        std::vector<Entry> vEntries;
+    };
+
+    int Cell(const float v) const;
+    static VoxelKey Key(const int x, const int y, const int z);
+
+    // Removes pMP from the voxel, the voxel is dropped when it becomes empty
+    void EraseFromVoxel(const VoxelKey key, MapPoint* pMP);
+
+    // Calls test on every point of the voxels that intersect the box [min,max]
+    template<class Test>
+    void Collect(const float min[3], const float max[3], Test test, std::vector<MapPoint*> &vpMPs);
+
+    float mfVoxelSize;
+    float mfInvVoxelSize;
+
+    std::unordered_map<VoxelKey,Voxel,VoxelKeyHash> mVoxels;
+    std::unordered_map<MapPoint*,VoxelKey> mPointVoxels;
+
+    std::mutex mMutex;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPPOINTINDEX_H
@@ -0,0 +1,240 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPSERIALIZER_H
+#define MAPSERIALIZER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <cstring>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "Thirdparty/DBoW2/DBoW2/BowVector.h"
+#include "Thirdparty/DBoW2/DBoW2/FeatureVector.h"
+#include "ORBVocabulary.h"
+
+namespace ORB_SLAM2
+{
+
+class Map;
+class KeyFrame;
+class MapPoint;
+class KeyFrameDatabase;
+
+// Sequential little-endian writer, either over a buffered file stream or into memory (e.g. to
+// assemble a journal batch). Records are written as they are visited, the map is never copied.
+class MapWriter
+{
+public:
+    // Writes into memory, the bytes are available with Data()
+    MapWriter();
+    // Streams into a file (truncated)
+    MapWriter(const std::string &filename);
+
+    bool good() const { return mbGood; }
+    bool Flush();
+    bool Close();
+
+    const std::vector<char>& Data() const { return mvData; }
+    void Clear() { mvData.clear(); }
+
+    void WriteBytes(const void* p, size_t n);
+
+    template<typename T> void Write(const T &v) { WriteBytes(&v,sizeof(T)); }
+
+    template<typename T> void WriteVector(const std::vector<T> &v)
+    {
+        Write<uint32_t>(v.size());
+        if(!v.empty())
+            WriteBytes(&v[0],v.size()*sizeof(T));
+    }
+
+    void WriteMat(const cv::Mat &M);
+    void WriteKeyPoints(const std::vector<cv::KeyPoint> &vKeys);
+    void WriteBowVector(const DBoW2::BowVector &v);
+    void WriteFeatureVector(const DBoW2::FeatureVector &v);
+
+protected:
+    std::ofstream mFile;
+    std::vector<char> mvBuffer;
+    std::vector<char> mvData;
+    bool mbGood;
+};
+
+// Sequential reader over a read-only memory mapping of the whole file, or over a buffer. Reading
+// past the end returns zeros and empty containers and clears good(), so records can be read without
+// checking every field and the load is validated once per record.
+class MapReader
+{
+public:
+    MapReader(const std::string &filename);
+    // Reads from a buffer owned by the caller
+    MapReader(const char* pData, size_t size);
+    ~MapReader();
+
+    bool good() const { return mbGood; }
+    bool AtEnd() const { return mnPos==mnSize; }
+    size_t Tell() const { return mnPos; }
+    size_t Remaining() const { return mnSize-mnPos; }
+
+    bool ReadBytes(void* p, size_t n);
+
+    template<typename T> T Read()
+    {
+        T v;
+        if(!ReadBytes(&v,sizeof(T)))
+            memset(&v,0,sizeof(T));
+        return v;
+    }
+
+    template<typename T> std::vector<T> ReadVector()
+    {
+        const uint32_t n = Read<uint32_t>();
+        std::vector<T> v;
+        if(!Require(n,sizeof(T)))
+            return v;
+        v.resize(n);
+        if(n>0)
+            ReadBytes(&v[0],n*sizeof(T));
+        return v;
+    }
+
+    cv::Mat ReadMat();
+    std::vector<cv::KeyPoint> ReadKeyPoints();
+    void ReadBowVector(DBoW2::BowVector &v);
+    void ReadFeatureVector(DBoW2::FeatureVector &v);
+
+protected:
+    // Checks that n elements of the given size remain in the file
+    bool Require(size_t n, size_t size);
+
+    const unsigned char* mpData;
+    size_t mnSize;
+    size_t mnPos;
+    bool mbGood;
+    bool mbMapped;
+};
+
+// Binary map format (version 2):
+//   header
+//   keyframes   (calibration, keypoints, descriptors, BoW, pose, spanning tree parent, covisibility
+//                weights and loop edges)
+//   map points  (position, normal, descriptor, scale limits, counters, reference keyframe and
+//                observations)
+//   keyframe origins
+// Records refer to each other by id. They are read into a Staging area and only linked by
+// Publish(), so the same records can be replayed from a journal in any order (see MapJournal).
+class MapSerializer
+{
+public:
+    struct StagedKeyFrame
+    {
+        KeyFrame* pKF;
+        int64_t nParentId;
+        std::vector<std::pair<uint64_t,int32_t> > vConnections;
+        std::vector<uint64_t> vLoopEdges;
+    };
+
+    struct StagedMapPoint
+    {
+        MapPoint* pMP;
+        int64_t nRefKFId;
+        std::vector<std::pair<uint64_t,uint32_t> > vObservations;
+    };
+
+    // Keyframes and map points read but not linked yet, indexed by id. Owns them until published.
+    struct Staging
+    {
+        Staging(): bSameVocabulary(true) {}
+        ~Staging() { Clear(); }
+        void Clear();
+        void EraseKeyFrame(uint64_t nId);
+        void EraseMapPoint(uint64_t nId);
+
+        std::map<uint64_t,StagedKeyFrame> mKeyFrames;
+        std::map<uint64_t,StagedMapPoint> mMapPoints;
+        std::vector<uint64_t> vOrigins;
+        bool bSameVocabulary;
+    };
+
+    MapSerializer(Map* pMap, KeyFrameDatabase* pKFDB, ORBVocabulary* pVoc);
+
+    // Writes every keyframe and map point in the map. Changes made while saving may or may not be
+    // included, a consistent file requires a map that does not change (or a journal on top).
+    bool Save(const std::string &filename, const int sensor);
+
+    // Same into a writer. With a memory writer the map can be copied under mMutexMapUpdate and the
+    // file written after the lock is released.
+    bool Save(MapWriter &writer, const int sensor);
+
+    // Loads the map into an empty Map and adds its keyframes to the keyframe database.
+    // BoW vectors are recomputed if the map was saved with a different vocabulary.
+    bool Load(const std::string &filename, const int sensor);
+
+    // Reads a map file into the staging area
+    bool Read(const std::string &filename, const int sensor, Staging &staging);
+
+    // Links the staged keyframes and map points and moves them into the (empty) map and the
+    // keyframe database. References to ids that were not staged are dropped.
+    void Publish(Staging &staging);
+
+    // File header shared by map files and journals
+    void WriteHeader(MapWriter &writer, const char* magic, const int sensor, uint64_t nKeyFrames, uint64_t nMapPoints);
+    bool ReadHeader(MapReader &reader, const char* magic, const int sensor, uint64_t &nKeyFrames, uint64_t &nMapPoints,
+                    Staging &staging);
+
+    // Keyframe and map point records, including their links. Reading a record replaces the staged
+    // one with the same id.
+    void WriteKeyFrame(MapWriter &writer, KeyFrame* pKF);
+    void WriteMapPoint(MapWriter &writer, MapPoint* pMP);
+    bool ReadKeyFrame(MapReader &reader, Staging &staging);
+    bool ReadMapPoint(MapReader &reader, Staging &staging);
+
+    // Pose and links of a keyframe that was already written
+    void WriteKeyFrameUpdate(MapWriter &writer, KeyFrame* pKF);
+    bool ReadKeyFrameUpdate(MapReader &reader, Staging &staging);
+
+protected:
+    void WriteKeyFrameLinks(MapWriter &writer, KeyFrame* pKF);
+    void ReadKeyFrameLinks(MapReader &reader, StagedKeyFrame &skf);
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        int32_t sensor;
+        uint32_t vocabularyWords;
+        int32_t vocabularyLevels;
+        uint64_t nKeyFrames;
+        uint64_t nMapPoints;
+    };
+
+    Map* mpMap;
+    KeyFrameDatabase* mpKeyFrameDB;
+    ORBVocabulary* mpVocabulary;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPSERIALIZER_H
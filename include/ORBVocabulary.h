@@ -25,12 +25,22 @@
 #include"Thirdparty/DBoW2/DBoW2/FORB.h"
 #include"Thirdparty/DBoW2/DBoW2/TemplatedVocabulary.h"
 
+#include<algorithm>
+
 namespace ORB_SLAM2
 {
 
 typedef DBoW2::TemplatedVocabulary<DBoW2::FORB::TDescriptor, DBoW2::FORB>
   ORBVocabulary;
 
+// Levels up from the leaves of the nodes that group the features in a FeatureVector (the direct index
+// used by SearchByBoW). The 6-level ORBvoc uses 4, i.e. level 2 from the root; shallower vocabularies
+// keep level 2 (level 1 for 2 levels), grouping at the root would match every feature against all others.
+inline int FeatureVectorLevelsUp(const ORBVocabulary* pVoc)
+{
+    return std::max(1,pVoc->getDepthLevels()-2);
+}
+
 } //namespace ORB_SLAM
 
 #endif // ORBVOCABULARY_H
@@ -29,6 +29,7 @@
 #include"MapPoint.h"
 #include"KeyFrame.h"
 #include"Frame.h"
+#include"FrameArena.h"
 
 
 namespace ORB_SLAM2
@@ -43,6 +44,9 @@ public:
     // Computes the Hamming distance between two ORB descriptors
     static int DescriptorDistance(const cv::Mat &a, const cv::Mat &b);
 
+    // Computes the Hamming distance between one ORB descriptor and every row of a descriptor matrix
+    static void DescriptorDistances(const cv::Mat &a, const cv::Mat &B, std::vector<int> &vDistances);
+
     // Search matches between Frame keypoints and projected MapPoints. Returns number of matches
     // Used to track the local map (Tracking)
     int SearchByProjection(Frame &F, const std::vector<MapPoint*> &vpMapPoints, const float th=3);
@@ -51,9 +55,10 @@ public:
     // Used to track from previous frame (Tracking)
     int SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame, const float th, const bool bMono);
 
-    // Project MapPoints seen in KeyFrame into the Frame and search matches.
-    // Used in relocalisation (Tracking)
-    int SearchByProjection(Frame &CurrentFrame, KeyFrame* pKF, const std::set<MapPoint*> &sAlreadyFound, const float th, const int ORBdist);
+    // Project MapPoints seen in KeyFrame into the Frame at pose Tcw and search matches, added to vpMatches.
+    // Used in relocalisation (Tracking), the frame is only read
+    int SearchByProjection(const Frame &CurrentFrame, const cv::Mat &Tcw, std::vector<MapPoint*> &vpMatches, KeyFrame* pKF,
+                           const std::set<MapPoint*> &sAlreadyFound, const float th, const int ORBdist);
 
     // Project MapPoints using a Similarity Transformation and search matches.
     // Used in loop detection (Loop Closing)
@@ -95,7 +100,7 @@ protected:
 
     float RadiusByViewingCos(const float &viewCos);
 
-    void ComputeThreeMaxima(std::vector<int>* histo, const int L, int &ind1, int &ind2, int &ind3);
+    void ComputeThreeMaxima(ArenaVector<int>* histo, const int L, int &ind1, int &ind2, int &ind3);
 
     float mfNNratio;
     bool mbCheckOrientation;
@@ -26,7 +26,10 @@
 #include "KeyFrame.h"
 #include "LoopClosing.h"
 #include "Frame.h"
+#include "ThreadPool.h"
+#include "SlidingWindow.h"
 
+#include "Thirdparty/g2o/g2o/core/sparse_optimizer.h"
 #include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
 
 namespace ORB_SLAM2
@@ -37,14 +40,39 @@ class LoopClosing;
 class Optimizer
 {
 public:
+    // If pspFreeKFs is given, only those keyframes are optimized, the others are fixed.
+    // Observations from keyframes not in vpKF are ignored.
     void static BundleAdjustment(const std::vector<KeyFrame*> &vpKF, const std::vector<MapPoint*> &vpMP,
                                  int nIterations = 5, bool *pbStopFlag=NULL, const unsigned long nLoopKF=0,
-                                 const bool bRobust = true);
+                                 const bool bRobust = true, const std::set<KeyFrame*> *pspFreeKFs=NULL);
     void static GlobalBundleAdjustemnt(Map* pMap, int nIterations=5, bool *pbStopFlag=NULL,
                                        const unsigned long nLoopKF=0, const bool bRobust = true);
+
+    // Global BA restricted to the part of the map disturbed by a loop correction: the affected keyframes,
+    // their best covisibles and the points they observe are optimized. The other keyframes observing
+    // those points are fixed, the rest of the map is left out of the graph. The graph is built and solved
+    // from scratch on every call (no reuse of a previous factorization as in iSAM2).
+    // Returns false if there is nothing to optimize.
+    bool static IncrementalBundleAdjustment(Map* pMap, const std::set<KeyFrame*> &spAffectedKFs, int nIterations=5,
+                                            bool *pbStopFlag=NULL, const unsigned long nLoopKF=0,
+                                            const bool bRobust = true);
+
+    // Adds the keyframes whose observations no longer agree with the map (a significant fraction of
+    // their reprojection errors above the chi2 threshold), as left by a loop correction.
+    // Every keyframe of the map is checked, so this is O(map) on each loop (in parallel, not incremental).
+    void static DetectAffectedKeyFrames(Map* pMap, std::set<KeyFrame*> &spAffectedKFs);
     void static LocalBundleAdjustment(KeyFrame* pKF, bool *pbStopFlag, Map *pMap);
+
+    // Local BA over the last keyframes of the window (pKF is added to it) with the prior of the
+    // keyframes that left, a bounded number of iterations from the current estimates
+    void static SlidingWindowBundleAdjustment(KeyFrame* pKF, SlidingWindow &window, Map *pMap);
     int static PoseOptimization(Frame* pFrame);
 
+    // Same on the matches vpMapPoints of the frame F, starting from the pose Tcw. Tcw is then
+    // assigned the optimized pose as a new matrix. The frame is only read, so several poses can
+    // be optimized concurrently on the same frame.
+    int static PoseOptimization(const Frame &F, cv::Mat &Tcw, std::vector<MapPoint*> &vpMapPoints, std::vector<bool> &vbOutlier);
+
     // if bFixScale is true, 6DoF optimization (stereo,rgbd), 7DoF otherwise (mono)
     void static OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
@@ -55,6 +83,18 @@ public:
     // if bFixScale is true, optimize SE3 (stereo,rgbd), Sim3 otherwise (mono)
     static int OptimizeSim3(KeyFrame* pKF1, KeyFrame* pKF2, std::vector<MapPoint *> &vpMatches1,
                             g2o::Sim3 &g2oS12, const float th2, const bool bFixScale);
+
+    // Bundle adjustments and the essential graph evaluate their edges and build the Schur complement
+    // in nWorkers tasks run on the pool (nWorkers<=1 or no pool runs them in the calling thread)
+    void static SetThreadPool(ThreadPool* pThreadPool, const int nWorkers);
+
+protected:
+
+    // Lets the g2o optimizer run its edges on the pool
+    void static SetParallel(g2o::SparseOptimizer &optimizer);
+
+    static ThreadPool* mpThreadPool;
+    static int mnWorkers;
 };
 
 } //namespace ORB_SLAM
@@ -0,0 +1,200 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OPTIMIZERCONTEXT_H
+#define OPTIMIZERCONTEXT_H
+
+#include <vector>
+#include <map>
+#include <typeindex>
+#include <cassert>
+
+#include "Thirdparty/g2o/g2o/core/sparse_optimizer.h"
+#include "Thirdparty/g2o/g2o/core/optimization_algorithm_levenberg.h"
+#include "Thirdparty/g2o/g2o/core/robust_kernel_impl.h"
+
+namespace ORB_SLAM2
+{
+
+// Per-thread g2o optimizer that is kept between optimizations of the same kind (local BA,
+// essential graph, Sim3), together with pools of the vertices and edges of its graphs.
+// An optimization opens a Session, takes its vertices and edges from it instead of allocating them,
+// and when the Session ends the graph is emptied and its objects go back to the pools, so in steady
+// state a call neither builds a solver nor allocates the graph. The sparse block structure is still
+// built by g2o at every initializeOptimization, as the graph changes between calls.
+template<class BlockSolverType, class LinearSolverType>
+class OptimizerContext
+{
+public:
+
+    // One optimization. Only one Session of a context can be open at a time.
+    class Session
+    {
+    public:
+        Session(): mContext(OptimizerContext::ThreadInstance()) { mContext.Begin(); }
+        ~Session() { mContext.End(); }
+
+        g2o::SparseOptimizer& Optimizer() { return mContext.mOptimizer; }
+        g2o::OptimizationAlgorithmLevenberg* Algorithm() { return mContext.mpAlgorithm; }
+
+        // A vertex not fixed nor marginalized, or an edge at level 0. The id, estimate, measurement,
+        // information, vertices and camera parameters must be set as for a new object.
+        template<class T>
+        T* New() { return mContext.template GetPool<T>().Get(); }
+
+    private:
+        Session(const Session&);
+        Session& operator=(const Session&);
+
+        OptimizerContext &mContext;
+    };
+
+    static OptimizerContext& ThreadInstance()
+    {
+        static thread_local OptimizerContext context;
+        return context;
+    }
+
+    // Recycled edges keep their robust kernel, which is reused if it is a Huber kernel
+    static void SetHuber(g2o::OptimizableGraph::Edge* pEdge, const double delta)
+    {
+        g2o::RobustKernelHuber* rk = dynamic_cast<g2o::RobustKernelHuber*>(pEdge->robustKernel());
+        if(!rk)
+        {
+            rk = new g2o::RobustKernelHuber;
+            pEdge->setRobustKernel(rk);
+        }
+        rk->setDelta(delta);
+    }
+
+    OptimizerContext(): mbInUse(false)
+    {
+        LinearSolverType* linearSolver = new LinearSolverType();
+        BlockSolverType* solver_ptr = new BlockSolverType(linearSolver);
+        mpAlgorithm = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
+        mOptimizer.setAlgorithm(mpAlgorithm);
+    }
+
+    ~OptimizerContext()
+    {
+        // The pools own the vertices and edges, the optimizer must not delete them
+        mOptimizer.release();
+        for(typename std::map<std::type_index,PoolBase*>::iterator mit=mPools.begin(); mit!=mPools.end(); mit++)
+            delete mit->second;
+    }
+
+protected:
+
+    class PoolBase
+    {
+    public:
+        virtual ~PoolBase() {}
+        virtual void Recycle() = 0;
+    };
+
+    template<class T>
+    class Pool : public PoolBase
+    {
+    public:
+        Pool(): mnUsed(0) {}
+
+        ~Pool()
+        {
+            for(size_t i=0; i<mvpObjects.size(); i++)
+                delete mvpObjects[i];
+        }
+
+        T* Get()
+        {
+            T* pObject;
+            if(mnUsed<mvpObjects.size())
+            {
+                pObject = mvpObjects[mnUsed];
+                Reset(pObject);
+            }
+            else
+            {
+                pObject = new T();
+                mvpObjects.push_back(pObject);
+            }
+            mnUsed++;
+            return pObject;
+        }
+
+        void Recycle() { mnUsed = 0; }
+
+    private:
+        std::vector<T*> mvpObjects;
+        size_t mnUsed;
+    };
+
+    static void Reset(g2o::OptimizableGraph::Vertex* pVertex)
+    {
+        pVertex->setFixed(false);
+        pVertex->setMarginalized(false);
+        pVertex->setHessianIndex(-1);
+    }
+
+    static void Reset(g2o::OptimizableGraph::Edge* pEdge)
+    {
+        pEdge->setLevel(0);
+    }
+
+    template<class T>
+    Pool<T>& GetPool()
+    {
+        PoolBase* &pPool = mPools[std::type_index(typeid(T))];
+        if(!pPool)
+            pPool = new Pool<T>();
+        return *static_cast<Pool<T>*>(pPool);
+    }
+
+    void Begin()
+    {
+        assert(!mbInUse);
+        mbInUse = true;
+        mOptimizer.setForceStopFlag(0);
+        mpAlgorithm->setUserLambdaInit(0);
+    }
+
+    void End()
+    {
+        mOptimizer.release();
+        for(typename std::map<std::type_index,PoolBase*>::iterator mit=mPools.begin(); mit!=mPools.end(); mit++)
+            mit->second->Recycle();
+        mOptimizer.setForceStopFlag(0);
+        mbInUse = false;
+    }
+
+    g2o::SparseOptimizer mOptimizer;
+    g2o::OptimizationAlgorithmLevenberg* mpAlgorithm;
+
+    std::map<std::type_index,PoolBase*> mPools;
+
+    bool mbInUse;
+
+private:
+    OptimizerContext(const OptimizerContext&);
+    OptimizerContext& operator=(const OptimizerContext&);
+};
+
+} //namespace ORB_SLAM
+
+#endif // OPTIMIZERCONTEXT_H
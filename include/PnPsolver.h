@@ -52,6 +52,7 @@
 #define PNPSOLVER_H
 
 #include <opencv2/core/core.hpp>
+#include <random>
 #include "MapPoint.h"
 #include "Frame.h"
 
@@ -60,7 +61,9 @@ namespace ORB_SLAM2
 
 class PnPsolver {
  public:
-  PnPsolver(const Frame &F, const vector<MapPoint*> &vpMapPointMatches);
+  // RANSAC samples are drawn from a generator owned by the solver and seeded with nSeed, so solvers can
+  // run concurrently and each one gives the same result for the same seed
+  PnPsolver(const Frame &F, const vector<MapPoint*> &vpMapPointMatches, const unsigned int nSeed = 0);
 
   ~PnPsolver();
 
@@ -169,6 +172,7 @@ class PnPsolver {
 
   // Indices for random selection [0 .. N-1]
   vector<size_t> mvAllIndices;
+  std::mt19937 mRandom;
 
   // RANSAC probability
   double mRansacProb;
@@ -0,0 +1,89 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef POSESOLVER_H
+#define POSESOLVER_H
+
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+namespace ORB_SLAM2
+{
+
+// Motion-only bundle adjustment: the pose of a camera observing fixed points. It minimizes the same
+// cost as the g2o graph of a VertexSE3Expmap with EdgeSE3ProjectXYZOnlyPose and
+// EdgeStereoSE3ProjectXYZOnlyPose edges (reprojection error weighted by the inverse level sigma,
+// Huber kernel, left-multiplied exponential update) with the same Levenberg-Marquardt steps and
+// stopping rules. There is a single 6x6 block, so the normal equations are accumulated directly:
+// observations are stored as flat arrays and the residuals are computed in plain loops over them,
+// which the compiler vectorizes.
+class PoseSolver
+{
+public:
+    PoseSolver(const double fx, const double fy, const double cx, const double cy, const double bf);
+
+    void Reserve(const size_t n);
+
+    // ur<0 for a monocular observation. Huber thresholds are the ones used by the tracking.
+    void AddObservation(const double X, const double Y, const double Z, const double u, const double v,
+                        const double ur, const double invSigma2);
+
+    size_t Size() const { return mvX.size(); }
+
+    // Only active observations take part in the optimization (level 0 edges in g2o)
+    void SetActive(const size_t i, const bool bActive) { mvActive[i] = bActive ? 1.0 : 0.0; }
+    void SetRobust(const bool bRobust) { mbRobust = bRobust; }
+
+    // Runs at most nIterations iterations starting from (q,t)
+    void Optimize(Eigen::Quaterniond &q, Eigen::Vector3d &t, const int nIterations);
+
+    // Chi2 of every observation at (q,t), without robust kernel
+    void ComputeChi2(const Eigen::Quaterniond &q, const Eigen::Vector3d &t, std::vector<double> &vChi2);
+
+protected:
+
+    // Errors of all observations at (q,t), returns the robust chi2 of the active ones
+    double ComputeErrors(const Eigen::Quaterniond &q, const Eigen::Vector3d &t);
+
+    // Normal equations of the active observations from the last computed errors
+    void BuildSystem(Eigen::Matrix<double,6,6> &H, Eigen::Matrix<double,6,1> &b) const;
+
+    double fx, fy, cx, cy, bf;
+    bool mbRobust;
+
+    // Observations
+    std::vector<double> mvX, mvY, mvZ;
+    std::vector<double> mvU, mvV, mvUr;
+    std::vector<double> mvInfo;
+    std::vector<double> mvStereo;
+    std::vector<double> mvDelta2;
+    std::vector<double> mvActive;
+
+    // Point in camera coordinates and errors at the last evaluated pose
+    std::vector<double> mvXc, mvYc, mvInvZ;
+    std::vector<double> mvEu, mvEv, mvEr;
+    std::vector<double> mvChi2;
+};
+
+} //namespace ORB_SLAM
+
+#endif // POSESOLVER_H
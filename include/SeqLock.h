@@ -0,0 +1,91 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <atomic>
+#include <cstring>
+#include <stdint.h>
+
+namespace ORB_SLAM2
+{
+
+// Sequence lock over a small plain struct (poses, positions). Readers never take a lock: they copy
+// the value and retry if a write happened meanwhile, which only spins for the duration of the copy.
+// Writers must be serialized by the caller (e.g. the mutex of the owning object).
+// The value is stored as relaxed atomic words, so concurrent copies are not data races.
+template<class T>
+class SeqLock
+{
+public:
+    SeqLock(): mSeq(0)
+    {
+        for(size_t i=0; i<NWORDS; i++)
+            mWords[i].store(0,std::memory_order_relaxed);
+    }
+
+    void Store(const T &value)
+    {
+        uint32_t words[NWORDS] = {};
+        memcpy(words,&value,sizeof(T));
+
+        const unsigned int seq = mSeq.load(std::memory_order_relaxed);
+        mSeq.store(seq+1,std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for(size_t i=0; i<NWORDS; i++)
+            mWords[i].store(words[i],std::memory_order_relaxed);
+
+        mSeq.store(seq+2,std::memory_order_release);
+    }
+
+    T Load() const
+    {
+        uint32_t words[NWORDS];
+        unsigned int seq1, seq2;
+        do
+        {
+            seq1 = mSeq.load(std::memory_order_acquire);
+            for(size_t i=0; i<NWORDS; i++)
+                words[i] = mWords[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            seq2 = mSeq.load(std::memory_order_relaxed);
+        }
+        while((seq1 & 1) || seq1!=seq2);
+
+        T value;
+        memcpy(&value,words,sizeof(T));
+        return value;
+    }
+
+private:
+    SeqLock(const SeqLock&);
+    SeqLock& operator=(const SeqLock&);
+
+    static const size_t NWORDS = (sizeof(T)+sizeof(uint32_t)-1)/sizeof(uint32_t);
+
+    std::atomic<uint32_t> mWords[NWORDS];
+    std::atomic<unsigned int> mSeq;
+};
+
+} //namespace ORB_SLAM
+
+#endif // SEQLOCK_H
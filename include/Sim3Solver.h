@@ -24,6 +24,7 @@
 
 #include <opencv2/opencv.hpp>
 #include <vector>
+#include <random>
 
 #include "KeyFrame.h"
 
@@ -36,7 +37,10 @@ class Sim3Solver
 {
 public:
 
-    Sim3Solver(KeyFrame* pKF1, KeyFrame* pKF2, const std::vector<MapPoint*> &vpMatched12, const bool bFixScale = true);
+    // RANSAC samples are drawn from a generator owned by the solver and seeded with nSeed, so solvers can
+    // run concurrently and each one gives the same result for the same seed
+    Sim3Solver(KeyFrame* pKF1, KeyFrame* pKF2, const std::vector<MapPoint*> &vpMatched12, const bool bFixScale = true,
+               const unsigned int nSeed = 0);
 
     void SetRansacParameters(double probability = 0.99, int minInliers = 6 , int maxIterations = 300);
 
@@ -104,6 +108,7 @@ protected:
 
     // Indices for random selection
     std::vector<size_t> mvAllIndices;
+    std::mt19937 mRandom;
 
     // Projections
     std::vector<cv::Mat> mvP1im1;
@@ -0,0 +1,127 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SLIDINGWINDOW_H
+#define SLIDINGWINDOW_H
+
+#include <vector>
+#include <set>
+#include <map>
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+
+#include "Thirdparty/g2o/g2o/types/se3quat.h"
+
+namespace ORB_SLAM2
+{
+
+class KeyFrame;
+class MapPoint;
+class Map;
+
+// State of the sliding-window local bundle adjustment, used by the Local Mapping thread only.
+// The window holds the last keyframes processed by the local mapping. When a keyframe leaves it,
+// the points it observes are marginalized together with all their observations in the window, then
+// the keyframe itself, and the result is kept as a linear prior on the poses of the window
+// (Schur complement of the linearized reprojection errors). Those observations are not used again
+// by the window, their information is in the prior. A marginalized point is a constant afterwards:
+// its later observations constrain the poses only, so its old observations are not counted twice.
+// It is free again once no keyframe of the window has a marginalized observation of it.
+// The reprojection Jacobians of the prior keyframes are evaluated at the prior's linearization
+// point (first estimate Jacobians), both when marginalizing and in the window optimization.
+class SlidingWindow
+{
+public:
+    typedef std::vector<g2o::SE3Quat,Eigen::aligned_allocator<g2o::SE3Quat> > PoseVector;
+
+    // nSize keyframes, optimized with nIterations Levenberg-Marquardt iterations
+    SlidingWindow(const int nSize, const int nIterations, const bool bMonocular);
+
+    // Drops the keyframes that became bad, adds pKF and marginalizes the oldest keyframes while the
+    // window is larger than its size. The window starts again if the map had a big change (loop closure).
+    void Update(KeyFrame* pKF, Map* pMap);
+
+    void Reset();
+
+    // Oldest first
+    const std::vector<KeyFrame*>& KeyFrames() const { return mvpKeyFrames; }
+
+    // The oldest keyframes are fixed to remove the gauge freedom (two in monocular, for the scale)
+    size_t FixedKeyFrames() const { return mbMonocular ? 2 : 1; }
+
+    int Iterations() const { return mnIterations; }
+
+    // True if the observation is already summarized in the prior
+    bool IsMarginalized(KeyFrame* pKF, MapPoint* pMP) const;
+
+    // True if the point was marginalized and a keyframe of the window still has a marginalized
+    // observation of it, it must be kept fixed
+    bool IsMarginalized(MapPoint* pMP) const;
+
+    // Prior as whitened residual rows r = J*delta+r0, with delta the stacked log(Tcw*Tcw0^-1) of the
+    // prior keyframes and Tcw0 their linearization points. Returns false if there is no prior.
+    bool GetPrior(std::vector<KeyFrame*> &vpKFs, PoseVector &vT0, Eigen::MatrixXd &J, Eigen::VectorXd &r0) const;
+
+    // Damping at the end of the last optimization, the next one starts from it (0 if none)
+    double Lambda() const { return mLambda; }
+    void SetLambda(const double lambda) { mLambda = lambda; }
+
+protected:
+
+    // Marginalizes the oldest keyframe and the points it observes
+    void MarginalizeOldest();
+
+    // Removes a bad keyframe from the window, and from the prior (without its observations, they are gone)
+    void Remove(KeyFrame* pKF);
+
+    // Adds an observation to the marginalized set
+    void AddMarginalizedObservation(KeyFrame* pKF, MapPoint* pMP);
+
+    // Removes the observations of a keyframe that left the window from the marginalized set, and
+    // the points left without any
+    void ForgetObservations(KeyFrame* pKF);
+
+    // Schur complement of block i (6x6) of a quadratic form H, g
+    static void MarginalizeBlock(Eigen::MatrixXd &H, Eigen::VectorXd &g, const int i);
+
+    int mnSize;
+    int mnIterations;
+    bool mbMonocular;
+
+    std::vector<KeyFrame*> mvpKeyFrames;
+
+    // Prior: 0.5*delta'*mH*delta + mg'*delta over mvpPriorKFs, linearized at mvT0
+    std::vector<KeyFrame*> mvpPriorKFs;
+    PoseVector mvT0;
+    Eigen::MatrixXd mH;
+    Eigen::VectorXd mg;
+
+    std::set<std::pair<KeyFrame*,MapPoint*> > msMarginalizedObs;
+    // Marginalized points, with their number of marginalized observations in the window
+    std::map<MapPoint*,int> mMarginalizedPoints;
+
+    int mnLastBigChangeIdx;
+    double mLambda;
+};
+
+} //namespace ORB_SLAM
+
+#endif // SLIDINGWINDOW_H
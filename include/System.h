@@ -35,6 +35,7 @@
 #include "KeyFrameDatabase.h"
 #include "ORBVocabulary.h"
 #include "Viewer.h"
+#include "ThreadPool.h"
 
 namespace ORB_SLAM2
 {
@@ -45,6 +46,7 @@ class Map;
 class Tracking;
 class LocalMapping;
 class LoopClosing;
+class MapJournal;
 
 class System
 {
@@ -112,9 +114,17 @@ public:
     // See format details at: http://www.cvlibs.net/datasets/kitti/eval_odometry.php
     void SaveTrajectoryKITTI(const string &filename);
 
-    // TODO: Save/Load functions
-    // SaveMap(const string &filename);
-    // LoadMap(const string &filename);
+    // Save the map (keyframes, map points, covisibility graph and spanning tree) in binary format.
+    // This method works for all sensor input.
+    // Call first Shutdown()
+    bool SaveMap(const string &filename);
+
+    // Load a map saved with SaveMap, replacing the current one. The keyframe database is rebuilt and
+    // tracking starts lost, so the first frames relocalize in the loaded map. Combine with
+    // ActivateLocalizationMode() to localize against a prebuilt map without extending it.
+    // Given a journal directory (Journal.Directory), it recovers the map of a previous session.
+    // Call it from the thread that passes the images (e.g. before the first TrackMonocular).
+    bool LoadMap(const string &filename);
 
     // Information from most recent processed frame
     // You can call this right after TrackMonocular (or stereo or RGBD)
@@ -161,11 +171,18 @@ private:
     FrameDrawer* mpFrameDrawer;
     MapDrawer* mpMapDrawer;
 
+    // Worker threads shared by Tracking, Local Mapping and Loop Closing for data-parallel work.
+    ThreadPool* mpThreadPool;
+
+    // Background checkpointing of the map (NULL if Journal.Directory is not set).
+    MapJournal* mpJournal;
+
     // System threads: Local Mapping, Loop Closing, Viewer.
     // The Tracking thread "lives" in the main execution thread that creates the System object.
     std::thread* mptLocalMapping;
     std::thread* mptLoopClosing;
     std::thread* mptViewer;
+    std::thread* mptJournal;
 
     // Reset flag
     std::mutex mMutexReset;
@@ -0,0 +1,63 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace ORB_SLAM2
+{
+
+// Fixed set of worker threads shared by the Tracking, Local Mapping and Loop Closing threads
+// to run data-parallel work (one ParallelFor call per batch).
+class ThreadPool
+{
+public:
+    // nThreads<=0 uses one worker per hardware thread
+    ThreadPool(int nThreads);
+    ~ThreadPool();
+
+    // Calls f(i) for every i in [0,n). The calling thread also takes indices, so nested calls
+    // from a worker cannot deadlock. Returns when all calls have finished.
+    void ParallelFor(size_t n, const std::function<void(size_t)> &f);
+
+    int NumThreads() const;
+
+protected:
+
+    void Run();
+
+    std::vector<std::thread> mvThreads;
+
+    std::queue<std::function<void()> > mqTasks;
+    std::mutex mMutexTasks;
+    std::condition_variable mCondTasks;
+    bool mbFinish;
+};
+
+} //namespace ORB_SLAM
+
+#endif // THREADPOOL_H
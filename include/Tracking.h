@@ -38,8 +38,12 @@
 #include "Initializer.h"
 #include "MapDrawer.h"
 #include "System.h"
+#include "ThreadPool.h"
+#include "LocalizationTileCache.h"
 
 #include <mutex>
+#include <unordered_map>
+#include <atomic>
 
 namespace ORB_SLAM2
 {
@@ -66,6 +70,7 @@ public:
     void SetLocalMapper(LocalMapping* pLocalMapper);
     void SetLoopClosing(LoopClosing* pLoopClosing);
     void SetViewer(Viewer* pViewer);
+    void SetThreadPool(ThreadPool* pThreadPool);
 
     // Load new settings
     // The focal lenght should be similar or scale prediction will fail when projecting points
@@ -75,6 +80,9 @@ public:
     // Use this function if you have deactivated local mapping and you only want to localize the camera.
     void InformOnlyTracking(const bool &flag);
 
+    // Use this function after loading a map. Tracking starts lost and relocalizes in the loaded map.
+    void InformMapLoaded();
+
 
 public:
 
@@ -134,9 +142,18 @@ protected:
     bool TrackWithMotionModel();
 
     bool Relocalization();
+    bool RelocalizeWithCandidates(const std::vector<KeyFrame*> &vpCandidateKFs);
+
+    // Verifies one relocalization candidate against the current frame (BoW matching, PnP RANSAC,
+    // pose optimization and guided matching), working on its own pose, matches and outlier flags.
+    // Gives up as soon as a candidate with a lower index has been accepted (nAccepted holds the
+    // lowest accepted index). On success returns the pose and matches found.
+    bool VerifyRelocalizationCandidate(KeyFrame* pKF, const int nCandidate, std::atomic<int> &nAccepted,
+                                       cv::Mat &Tcw, std::vector<MapPoint*> &vpMapPoints, std::vector<bool> &vbOutlier);
 
     void UpdateLocalMap();
     void UpdateLocalPoints();
+    void AddSpatialLocalPoints();
     void UpdateLocalKeyFrames();
 
     bool TrackLocalMap();
@@ -155,6 +172,8 @@ protected:
     LocalMapping* mpLocalMapper;
     LoopClosing* mpLoopClosing;
 
+    ThreadPool* mpThreadPool;
+
     //ORB
     ORBextractor* mpORBextractorLeft, *mpORBextractorRight;
     ORBextractor* mpIniORBextractor;
@@ -171,6 +190,26 @@ protected:
     std::vector<KeyFrame*> mvpLocalKeyFrames;
     std::vector<MapPoint*> mvpLocalMapPoints;
 
+    // Map point matches of the local keyframes, kept across frames and read again only when the
+    // matches of a keyframe change. The local points are rebuilt only if the local keyframes or
+    // their matches differ from the previous frame.
+    struct LocalKeyFrame
+    {
+        long unsigned int nVersion;
+        long unsigned int nLastFrame;
+        std::vector<MapPoint*> vpMapPoints;
+    };
+    std::unordered_map<KeyFrame*,LocalKeyFrame> mLocalKeyFrameCache;
+    // Leading part of mvpLocalMapPoints that comes from the local keyframes, the rest is taken
+    // from the map's spatial index every frame
+    size_t mnCovisibleLocalMapPoints;
+    // Frame in which the covisible points were rebuilt, they keep it as their track reference
+    long unsigned int mnLocalMapPointsFrame;
+    // Median scene depth of the reference keyframe, the spatial depth unit for monocular
+    KeyFrame* mpSpatialDepthKF;
+    float mfSpatialDepthScale;
+    std::vector<KeyFrame*> mvpLastLocalKeyFrames;
+
     // System
     System* mpSystem;
 
@@ -182,6 +221,9 @@ protected:
     //Map
     Map* mpMap;
 
+    //Pages out the features of far keyframes in localization mode (NULL if Localization.TileCache.File is not set)
+    LocalizationTileCache* mpTileCache;
+
     //Calibration matrix
     cv::Mat mK;
     cv::Mat mDistCoef;
@@ -211,6 +253,11 @@ protected:
     //Motion Model
     cv::Mat mVelocity;
 
+    //Motion prior for relocalization: camera center, time stamp and speed of the last tracked frame
+    cv::Mat mLastTrackedCenter;
+    double mdLastTrackedTimeStamp;
+    float mfLastTrackedSpeed;
+
     //Color order (true RGB, false BGR, ignored if grayscale)
     bool mbRGB;
 
@@ -225,6 +272,17 @@ protected:
     Parameter<bool> mTriggerRelocalization;
     Parameter<bool> mVisualizeTracking;
     Parameter<bool> mVisualizeRelocalization;
+    //restrict relocalization candidates to an area around the last tracked pose that grows with the time lost,
+    //the min radius is in meters (in median scene depths for monocular)
+    Parameter<bool> mUseRelocalizationPrior;
+    Parameter<float> mfRelocalizationPriorRadius;
+    Parameter<float> mfRelocalizationPriorTimeout;
+    //bound the local map searched every frame, the keyframes sharing more points are kept first
+    Parameter<int> mnMaxLocalKeyFrames;
+    Parameter<int> mnMaxLocalMapPoints;
+    //with the map's spatial index, also search the map points in the camera frustum up to this depth,
+    //in meters (in median scene depths of the reference keyframe for monocular)
+    Parameter<float> mfSpatialLocalMapDepth;
 };
 
 } //namespace ORB_SLAM
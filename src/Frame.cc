@@ -328,25 +328,39 @@ vector<size_t> Frame::GetFeaturesInArea(const float &x, const float  &y, const f
 {
     vector<size_t> vIndices;
     vIndices.reserve(N);
+    FeaturesInArea(x,y,r,minLevel,maxLevel,vIndices);
+    return vIndices;
+}
+
+void Frame::GetFeaturesInArea(const float &x, const float  &y, const float  &r, const int minLevel, const int maxLevel,
+                              ArenaVector<size_t> &vIndices) const
+{
+    vIndices.clear();
+    FeaturesInArea(x,y,r,minLevel,maxLevel,vIndices);
+}
+
+template<class V>
+void Frame::FeaturesInArea(const float &x, const float  &y, const float  &r, const int minLevel, const int maxLevel, V &vIndices) const
+{
     // FRAME_GRID_COLS = 64
     // FRAME_GRID_COLS = 48
 
     // DLOG(INFO) << "Looking for features in vicinity of : (" << x << ", " << y << ")";
     const int nMinCellX = max(0,(int)floor((x-mnMinX-r)*mfGridElementWidthInv));
     if(nMinCellX>=FRAME_GRID_COLS)
-        return vIndices;
+        return;
 
     const int nMaxCellX = min((int)FRAME_GRID_COLS-1,(int)ceil((x-mnMinX+r)*mfGridElementWidthInv));
     if(nMaxCellX<0)
-        return vIndices;
+        return;
 
     const int nMinCellY = max(0,(int)floor((y-mnMinY-r)*mfGridElementHeightInv));
     if(nMinCellY>=FRAME_GRID_ROWS)
-        return vIndices;
+        return;
 
     const int nMaxCellY = min((int)FRAME_GRID_ROWS-1,(int)ceil((y-mnMinY+r)*mfGridElementHeightInv));
     if(nMaxCellY<0)
-        return vIndices;
+        return;
 
     // DLOG(INFO) << "minCellX: " << nMinCellX << ", minCellY: " << nMinCellY << ", maxCellX: " << nMaxCellX << ", maxCellY: " << nMaxCellY;
     const bool bCheckLevels = (minLevel>0) || (maxLevel>=0);
@@ -355,7 +369,7 @@ vector<size_t> Frame::GetFeaturesInArea(const float &x, const float  &y, const f
     {
         for(int iy = nMinCellY; iy<=nMaxCellY; iy++)
         {
-            const vector<size_t> vCell = mGrid[ix][iy];
+            const vector<size_t> &vCell = mGrid[ix][iy];
             if(vCell.empty())
                 continue;
 
@@ -381,8 +395,6 @@ vector<size_t> Frame::GetFeaturesInArea(const float &x, const float  &y, const f
             }
         }
     }
-
-    return vIndices;
 }
 
 bool Frame::PosInGrid(const cv::KeyPoint &kp, int &posX, int &posY)
@@ -403,7 +415,7 @@ void Frame::ComputeBoW()
     if(mBowVec.empty())
     {
         vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(mDescriptors);
-        mpORBvocabulary->transform(vCurrentDesc,mBowVec,mFeatVec,4);
+        mpORBvocabulary->transform(vCurrentDesc,mBowVec,mFeatVec,FeatureVectorLevelsUp(mpORBvocabulary));
     }
 }
 
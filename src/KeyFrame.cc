@@ -21,6 +21,8 @@
 #include "KeyFrame.h"
 #include "Converter.h"
 #include "ORBmatcher.h"
+#include "MapSerializer.h"
+#include "LocalizationTileCache.h"
 #include<mutex>
 
 namespace ORB_SLAM2
@@ -32,16 +34,17 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
     mnFrameId(F.mnId),  mTimeStamp(F.mTimeStamp), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
     mfGridElementWidthInv(F.mfGridElementWidthInv), mfGridElementHeightInv(F.mfGridElementHeightInv),
     mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0),
-    mnLoopQuery(0), mnLoopWords(0), mnRelocQuery(0), mnRelocWords(0), mnBAGlobalForKF(0),
+    mnBAGlobalForKF(0),
     fx(F.fx), fy(F.fy), cx(F.cx), cy(F.cy), invfx(F.invfx), invfy(F.invfy),
     mbf(F.mbf), mb(F.mb), mThDepth(F.mThDepth), N(F.N), mvKeys(F.mvKeys), mvKeysUn(F.mvKeysUn),
     mvuRight(F.mvuRight), mvDepth(F.mvDepth), mDescriptors(F.mDescriptors.clone()),
     mBowVec(F.mBowVec), mFeatVec(F.mFeatVec), mnScaleLevels(F.mnScaleLevels), mfScaleFactor(F.mfScaleFactor),
     mfLogScaleFactor(F.mfLogScaleFactor), mvScaleFactors(F.mvScaleFactors), mvLevelSigma2(F.mvLevelSigma2),
     mvInvLevelSigma2(F.mvInvLevelSigma2), mnMinX(F.mnMinX), mnMinY(F.mnMinY), mnMaxX(F.mnMaxX),
-    mnMaxY(F.mnMaxY), mK(F.mK), mbIsRelocalizationCandidate(false), mvpMapPoints(F.mvpMapPoints),
+    mnMaxY(F.mnMaxY), mK(F.mK), mbIsRelocalizationCandidate(false), mvpMapPoints(F.mvpMapPoints), mnMatchesVersion(0),
     mpKeyFrameDB(pKFDB), mpORBvocabulary(F.mpORBvocabulary), mbFirstConnection(true), mpParent(NULL),
-    mbNotErase(false), mbToBeErased(false), mbBad(false), mHalfBaseline(F.mb/2), mpMap(pMap)
+    mbNotErase(false), mbToBeErased(false), mbBad(false), mHalfBaseline(F.mb/2), mpMap(pMap),
+    mpPageCache(static_cast<LocalizationTileCache*>(NULL)), mnPageOffset(-1), mnPageSize(0)
 {
     mnId=nNextId++;
 
@@ -56,14 +59,204 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
     SetPose(F.mTcw);
 }
 
+KeyFrame::KeyFrame(MapReader &reader, Map *pMap, KeyFrameDatabase *pKFDB, ORBVocabulary *pVoc):
+    mnId(reader.Read<uint64_t>()), mnFrameId(reader.Read<uint64_t>()), mTimeStamp(reader.Read<double>()),
+    mnGridCols(reader.Read<int32_t>()), mnGridRows(reader.Read<int32_t>()),
+    mfGridElementWidthInv(reader.Read<float>()), mfGridElementHeightInv(reader.Read<float>()),
+    mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0),
+    mnBAGlobalForKF(0),
+    fx(reader.Read<float>()), fy(reader.Read<float>()), cx(reader.Read<float>()), cy(reader.Read<float>()),
+    invfx(1.0f/fx), invfy(1.0f/fy), mbf(reader.Read<float>()), mb(reader.Read<float>()), mThDepth(reader.Read<float>()),
+    N(reader.Read<int32_t>()), mvKeys(reader.ReadKeyPoints()), mvKeysUn(reader.ReadKeyPoints()),
+    mvuRight(reader.ReadVector<float>()), mvDepth(reader.ReadVector<float>()), mDescriptors(reader.ReadMat()),
+    mnScaleLevels(reader.Read<int32_t>()), mfScaleFactor(reader.Read<float>()), mfLogScaleFactor(log(mfScaleFactor)),
+    mvScaleFactors(reader.ReadVector<float>()), mvLevelSigma2(reader.ReadVector<float>()),
+    mvInvLevelSigma2(reader.ReadVector<float>()), mnMinX(reader.Read<int32_t>()), mnMinY(reader.Read<int32_t>()),
+    mnMaxX(reader.Read<int32_t>()), mnMaxY(reader.Read<int32_t>()), mK(reader.ReadMat()),
+    mbIsRelocalizationCandidate(false), mvpMapPoints(mvKeysUn.size(),static_cast<MapPoint*>(NULL)), mnMatchesVersion(0),
+    mpKeyFrameDB(pKFDB), mpORBvocabulary(pVoc), mbFirstConnection(false), mpParent(NULL),
+    mbNotErase(false), mbToBeErased(false), mbBad(false), mHalfBaseline(mb/2), mpMap(pMap),
+    mpPageCache(static_cast<LocalizationTileCache*>(NULL)), mnPageOffset(-1), mnPageSize(0)
+{
+    // The members above are read in declaration order, the rest in the order of Write()
+    for(int i=0; i<mnGridCols && reader.good(); i++)
+    {
+        mGrid.push_back(vector<vector<size_t> >(mnGridRows));
+        for(int j=0; j<mnGridRows; j++)
+        {
+            const vector<uint32_t> vCell = reader.ReadVector<uint32_t>();
+            mGrid[i][j].assign(vCell.begin(),vCell.end());
+        }
+    }
+
+    reader.ReadBowVector(mBowVec);
+    reader.ReadFeatureVector(mFeatVec);
+
+    const cv::Mat Tcw_ = reader.ReadMat();
+    if(Tcw_.rows==4 && Tcw_.cols==4 && Tcw_.type()==CV_32F)
+        SetPose(Tcw_);
+}
+
+void KeyFrame::Write(MapWriter &writer)
+{
+    // A paged out keyframe is read back for the duration of the write
+    unique_lock<mutex> lockPage(mMutexPage);
+    LocalizationTileCache* pCache = mpPageCache;
+    if(pCache && !LoadFeatures())
+        return;
+
+    writer.Write<uint64_t>(mnId);
+    writer.Write<uint64_t>(mnFrameId);
+    writer.Write<double>(mTimeStamp);
+    writer.Write<int32_t>(mnGridCols);
+    writer.Write<int32_t>(mnGridRows);
+    writer.Write<float>(mfGridElementWidthInv);
+    writer.Write<float>(mfGridElementHeightInv);
+    writer.Write<float>(fx);
+    writer.Write<float>(fy);
+    writer.Write<float>(cx);
+    writer.Write<float>(cy);
+    writer.Write<float>(mbf);
+    writer.Write<float>(mb);
+    writer.Write<float>(mThDepth);
+    writer.Write<int32_t>(N);
+    writer.WriteKeyPoints(mvKeys);
+    writer.WriteKeyPoints(mvKeysUn);
+    writer.WriteVector(mvuRight);
+    writer.WriteVector(mvDepth);
+    writer.WriteMat(mDescriptors);
+    writer.Write<int32_t>(mnScaleLevels);
+    writer.Write<float>(mfScaleFactor);
+    writer.WriteVector(mvScaleFactors);
+    writer.WriteVector(mvLevelSigma2);
+    writer.WriteVector(mvInvLevelSigma2);
+    writer.Write<int32_t>(mnMinX);
+    writer.Write<int32_t>(mnMinY);
+    writer.Write<int32_t>(mnMaxX);
+    writer.Write<int32_t>(mnMaxY);
+    writer.WriteMat(mK);
+
+    for(int i=0; i<mnGridCols; i++)
+    {
+        for(int j=0; j<mnGridRows; j++)
+        {
+            const vector<uint32_t> vCell(mGrid[i][j].begin(),mGrid[i][j].end());
+            writer.WriteVector(vCell);
+        }
+    }
+
+    writer.WriteBowVector(mBowVec);
+    writer.WriteFeatureVector(mFeatVec);
+    writer.WriteMat(GetPose());
+
+    if(pCache)
+        ReleaseFeatures();
+}
+
+void KeyFrame::PageOut(LocalizationTileCache* pCache)
+{
+    unique_lock<mutex> lock(mMutexPage);
+    if(mpPageCache)
+        return;
+
+    if(mnPageOffset<0)
+    {
+        MapWriter writer;
+        WriteFeatures(writer);
+        if(!pCache->Store(writer.Data(),mnPageOffset))
+            return;
+        mnPageSize = writer.Data().size();
+    }
+
+    ReleaseFeatures();
+    mpPageCache = pCache;
+}
+
+void KeyFrame::PageIn()
+{
+    unique_lock<mutex> lock(mMutexPage);
+    if(mpPageCache && LoadFeatures())
+        mpPageCache = static_cast<LocalizationTileCache*>(NULL);
+}
+
+bool KeyFrame::IsPagedOut()
+{
+    unique_lock<mutex> lock(mMutexPage);
+    return mpPageCache!=NULL;
+}
+
+void KeyFrame::WriteFeatures(MapWriter &writer)
+{
+    writer.WriteKeyPoints(mvKeys);
+    writer.WriteKeyPoints(mvKeysUn);
+    writer.WriteVector(mvuRight);
+    writer.WriteVector(mvDepth);
+    writer.WriteMat(mDescriptors);
+    for(int i=0; i<mnGridCols; i++)
+    {
+        for(int j=0; j<mnGridRows; j++)
+        {
+            const vector<uint32_t> vCell(mGrid[i][j].begin(),mGrid[i][j].end());
+            writer.WriteVector(vCell);
+        }
+    }
+    writer.WriteFeatureVector(mFeatVec);
+}
+
+void KeyFrame::ReadFeatures(MapReader &reader)
+{
+    mvKeys = reader.ReadKeyPoints();
+    mvKeysUn = reader.ReadKeyPoints();
+    mvuRight = reader.ReadVector<float>();
+    mvDepth = reader.ReadVector<float>();
+    mDescriptors = reader.ReadMat();
+    mGrid.assign(mnGridCols,vector<vector<size_t> >(mnGridRows));
+    for(int i=0; i<mnGridCols; i++)
+    {
+        for(int j=0; j<mnGridRows; j++)
+        {
+            const vector<uint32_t> vCell = reader.ReadVector<uint32_t>();
+            mGrid[i][j].assign(vCell.begin(),vCell.end());
+        }
+    }
+    reader.ReadFeatureVector(mFeatVec);
+}
+
+void KeyFrame::ReleaseFeatures()
+{
+    vector<cv::KeyPoint>().swap(mvKeys);
+    vector<cv::KeyPoint>().swap(mvKeysUn);
+    vector<float>().swap(mvuRight);
+    vector<float>().swap(mvDepth);
+    mDescriptors.release();
+    vector<vector<vector<size_t> > >().swap(mGrid);
+    mFeatVec.release();
+}
+
+bool KeyFrame::LoadFeatures()
+{
+    vector<char> vData;
+    if(!mpPageCache->Fetch(mnPageOffset,mnPageSize,vData))
+        return false;
+
+    MapReader reader(vData.data(),vData.size());
+    ReadFeatures(reader);
+    if(!reader.good() || (int)mvKeysUn.size()!=N)
+    {
+        cerr << "Failed to page in keyframe " << mnId << endl;
+        ReleaseFeatures();
+        return false;
+    }
+    return true;
+}
+
 void KeyFrame::ComputeBoW()
 {
     if(mBowVec.empty() || mFeatVec.empty())
     {
         vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(mDescriptors);
-        // Feature vector associate features with nodes in the 4th level (from leaves up)
-        // We assume the vocabulary tree has 6 levels, change the 4 otherwise
-        mpORBvocabulary->transform(vCurrentDesc,mBowVec,mFeatVec,4); //param
+        // Feature vector associate features with nodes in the 2nd level (from the root)
+        mpORBvocabulary->transform(vCurrentDesc,mBowVec,mFeatVec,FeatureVectorLevelsUp(mpORBvocabulary));
     }
 }
 
@@ -81,43 +274,67 @@ void KeyFrame::SetPose(const cv::Mat &Tcw_)
     Ow.copyTo(Twc.rowRange(0,3).col(3));
     cv::Mat center = (cv::Mat_<float>(4,1) << mHalfBaseline, 0 , 0, 1);
     Cw = Twc*center;
+
+    PoseSnapshot snapshot;
+    for(int i=0; i<3; i++)
+    {
+        for(int j=0; j<4; j++)
+        {
+            snapshot.Tcw[4*i+j] = Tcw.at<float>(i,j);
+            snapshot.Twc[4*i+j] = Twc.at<float>(i,j);
+        }
+        snapshot.Cw[i] = Cw.at<float>(i);
+    }
+    mPoseSnapshot.Store(snapshot);
+
+    mpMap->InformChanged(this);
+}
+
+// Builds a 4x4 transform from its first three rows
+static cv::Mat ToTransform(const float* T)
+{
+    cv::Mat M = cv::Mat::eye(4,4,CV_32F);
+    for(int i=0; i<3; i++)
+        for(int j=0; j<4; j++)
+            M.at<float>(i,j) = T[4*i+j];
+    return M;
 }
 
 cv::Mat KeyFrame::GetPose()
 {
-    unique_lock<mutex> lock(mMutexPose);
-    return Tcw.clone();
+    return ToTransform(mPoseSnapshot.Load().Tcw);
 }
 
 cv::Mat KeyFrame::GetPoseInverse()
 {
-    unique_lock<mutex> lock(mMutexPose);
-    return Twc.clone();
+    return ToTransform(mPoseSnapshot.Load().Twc);
 }
 
 cv::Mat KeyFrame::GetCameraCenter()
 {
-    unique_lock<mutex> lock(mMutexPose);
-    return Ow.clone();
+    const PoseSnapshot snapshot = mPoseSnapshot.Load();
+    return (cv::Mat_<float>(3,1) << snapshot.Twc[3], snapshot.Twc[7], snapshot.Twc[11]);
 }
 
 cv::Mat KeyFrame::GetStereoCenter()
 {
-    unique_lock<mutex> lock(mMutexPose);
-    return Cw.clone();
+    const PoseSnapshot snapshot = mPoseSnapshot.Load();
+    return (cv::Mat_<float>(4,1) << snapshot.Cw[0], snapshot.Cw[1], snapshot.Cw[2], 1.0f);
 }
 
 
 cv::Mat KeyFrame::GetRotation()
 {
-    unique_lock<mutex> lock(mMutexPose);
-    return Tcw.rowRange(0,3).colRange(0,3).clone();
+    const PoseSnapshot snapshot = mPoseSnapshot.Load();
+    return (cv::Mat_<float>(3,3) << snapshot.Tcw[0], snapshot.Tcw[1], snapshot.Tcw[2],
+                                    snapshot.Tcw[4], snapshot.Tcw[5], snapshot.Tcw[6],
+                                    snapshot.Tcw[8], snapshot.Tcw[9], snapshot.Tcw[10]);
 }
 
 cv::Mat KeyFrame::GetTranslation()
 {
-    unique_lock<mutex> lock(mMutexPose);
-    return Tcw.rowRange(0,3).col(3).clone();
+    const PoseSnapshot snapshot = mPoseSnapshot.Load();
+    return (cv::Mat_<float>(3,1) << snapshot.Tcw[3], snapshot.Tcw[7], snapshot.Tcw[11]);
 }
 
 void KeyFrame::AddConnection(KeyFrame *pKF, const int &weight)
@@ -154,6 +371,8 @@ void KeyFrame::UpdateBestCovisibles()
 
     mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
     mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());
+
+    mpMap->InformChanged(this);
 }
 
 set<KeyFrame*> KeyFrame::GetConnectedKeyFrames()
@@ -211,25 +430,33 @@ void KeyFrame::AddMapPoint(MapPoint *pMP, const size_t &idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
     mvpMapPoints[idx]=pMP;
+    mnMatchesVersion++;
 }
 
 void KeyFrame::EraseMapPointMatch(const size_t &idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
     mvpMapPoints[idx]=static_cast<MapPoint*>(NULL);
+    mnMatchesVersion++;
 }
 
 void KeyFrame::EraseMapPointMatch(MapPoint* pMP)
 {
     int idx = pMP->GetIndexInKeyFrame(this);
     if(idx>=0)
+    {
+        unique_lock<mutex> lock(mMutexFeatures);
         mvpMapPoints[idx]=static_cast<MapPoint*>(NULL);
+        mnMatchesVersion++;
+    }
 }
 
 
 void KeyFrame::ReplaceMapPointMatch(const size_t &idx, MapPoint* pMP)
 {
+    unique_lock<mutex> lock(mMutexFeatures);
     mvpMapPoints[idx]=pMP;
+    mnMatchesVersion++;
 }
 
 set<MapPoint*> KeyFrame::GetMapPoints()
@@ -280,6 +507,12 @@ vector<MapPoint*> KeyFrame::GetMapPointMatches()
     return mvpMapPoints;
 }
 
+long unsigned int KeyFrame::GetMatchesVersion()
+{
+    unique_lock<mutex> lock(mMutexFeatures);
+    return mnMatchesVersion;
+}
+
 MapPoint* KeyFrame::GetMapPoint(const size_t &idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
@@ -377,6 +610,8 @@ void KeyFrame::UpdateConnections()
         }
 
     }
+
+    mpMap->InformChanged(this);
 }
 
 void KeyFrame::AddChild(KeyFrame *pKF)
@@ -396,6 +631,7 @@ void KeyFrame::ChangeParent(KeyFrame *pKF)
     unique_lock<mutex> lockCon(mMutexConnections);
     mpParent = pKF;
     pKF->AddChild(this);
+    mpMap->InformChanged(this);
 }
 
 set<KeyFrame*> KeyFrame::GetChilds()
@@ -421,6 +657,7 @@ void KeyFrame::AddLoopEdge(KeyFrame *pKF)
     unique_lock<mutex> lockCon(mMutexConnections);
     mbNotErase = true;
     mspLoopEdges.insert(pKF);
+    mpMap->InformChanged(this);
 }
 
 set<KeyFrame*> KeyFrame::GetLoopEdges()
@@ -592,7 +829,7 @@ vector<size_t> KeyFrame::GetFeaturesInArea(const float &x, const float &y, const
     {
         for(int iy = nMinCellY; iy<=nMaxCellY; iy++)
         {
-            const vector<size_t> vCell = mGrid[ix][iy];
+            const vector<size_t> &vCell = mGrid[ix][iy];
             for(size_t j=0, jend=vCell.size(); j<jend; j++)
             {
                 const cv::KeyPoint &kpUn = mvKeysUn[vCell[j]];
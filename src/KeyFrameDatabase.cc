@@ -24,6 +24,8 @@
 #include "Thirdparty/DBoW2/DBoW2/BowVector.h"
 
 #include<mutex>
+#include<algorithm>
+#include<boost/thread/locks.hpp>
 
 using namespace std;
 
@@ -31,7 +33,7 @@ namespace ORB_SLAM2
 {
 
 KeyFrameDatabase::KeyFrameDatabase (const ORBVocabulary &voc):
-    mpVoc(&voc)
+    mpVoc(&voc), mnEntries(0), mnTombstoneEntries(0)
 {
     mvInvertedFile.resize(voc.size());
 }
@@ -39,82 +41,134 @@ KeyFrameDatabase::KeyFrameDatabase (const ORBVocabulary &voc):
 
 void KeyFrameDatabase::add(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutex);
+    boost::unique_lock<boost::shared_mutex> lock(mMutex);
+
+    const uint32_t id = pKF->mnId;
+    if(id>=mvpKeyFrames.size())
+        mvpKeyFrames.resize(id+1,static_cast<KeyFrame*>(NULL));
+    mvpKeyFrames[id] = pKF;
 
     for(DBoW2::BowVector::const_iterator vit= pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
-        mvInvertedFile[vit->first].push_back(pKF);
+        mvInvertedFile[vit->first].push_back(id);
+    mnEntries += pKF->mBowVec.size();
 }
 
 void KeyFrameDatabase::erase(KeyFrame* pKF)
 {
-    unique_lock<mutex> lock(mMutex);
+    boost::unique_lock<boost::shared_mutex> lock(mMutex);
+
+    // Leave a tombstone, the posting lists are cleaned in batch
+    const uint32_t id = pKF->mnId;
+    if(id>=mvpKeyFrames.size() || mvpKeyFrames[id]!=pKF)
+        return;
+    mvpKeyFrames[id] = NULL;
 
-    // Erase elements in the Inverse File for the entry
     for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
-    {
-        // List of keyframes that share the word
-        list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
+        mvDirtyWords.push_back(vit->first);
+    mnTombstoneEntries += pKF->mBowVec.size();
+
+    if(mnTombstoneEntries*4>mnEntries) //param
+        Compact();
+}
+
+void KeyFrameDatabase::Compact()
+{
+    sort(mvDirtyWords.begin(),mvDirtyWords.end());
+    mvDirtyWords.erase(unique(mvDirtyWords.begin(),mvDirtyWords.end()),mvDirtyWords.end());
 
-        for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+    for(size_t i=0, iend=mvDirtyWords.size(); i<iend; i++)
+    {
+        vector<uint32_t> &vIds = mvInvertedFile[mvDirtyWords[i]];
+        vector<uint32_t>::iterator vend = vIds.begin();
+        for(vector<uint32_t>::iterator vit=vIds.begin(); vit!=vIds.end(); vit++)
         {
-            if(pKF==*lit)
-            {
-                lKFs.erase(lit);
-                break;
-            }
+            if(mvpKeyFrames[*vit])
+                *vend++ = *vit;
         }
+        vIds.erase(vend,vIds.end());
     }
+
+    mnEntries -= mnTombstoneEntries;
+    mnTombstoneEntries = 0;
+    mvDirtyWords.clear();
 }
 
 void KeyFrameDatabase::clear()
 {
+    boost::unique_lock<boost::shared_mutex> lock(mMutex);
+
     mvInvertedFile.clear();
     mvInvertedFile.resize(mpVoc->size());
+    mvpKeyFrames.clear();
+    mvDirtyWords.clear();
+    mnEntries = 0;
+    mnTombstoneEntries = 0;
 }
 
-
-vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float minScore)
+vector<KeyFrame*> KeyFrameDatabase::SearchSharingWords(const DBoW2::BowVector &BowVec, QueryScratch &scratch,
+                                                       const set<KeyFrame*> &spExcluded,
+                                                       const cv::Mat &Ow, const float maxDistance)
 {
-    set<KeyFrame*> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
-    list<KeyFrame*> lKFsSharingWords;
+    const bool bPrior = !Ow.empty() && maxDistance>=0;
 
-    // Search all keyframes that share a word with current keyframes
-    // Discard keyframes connected to the query keyframe
+    vector<KeyFrame*> vpKFsSharingWords;
+
+    for(DBoW2::BowVector::const_iterator vit=BowVec.begin(), vend=BowVec.end(); vit != vend; vit++)
     {
-        unique_lock<mutex> lock(mMutex);
+        const vector<uint32_t> &vIds = mvInvertedFile[vit->first];
 
-        for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit != vend; vit++)
+        for(vector<uint32_t>::const_iterator lit=vIds.begin(), lend= vIds.end(); lit!=lend; lit++)
         {
-            list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
-
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+            const uint32_t id = *lit;
+            char &state = scratch.Visit(id);
+            if(state==QueryScratch::UNVISITED)
             {
-                KeyFrame* pKFi=*lit;
-                if(pKFi->mnLoopQuery!=pKF->mnId)
+                KeyFrame* pKFi = mvpKeyFrames[id];
+                // Tombstone, excluded or (if a prior is given) too far away.
+                // Keyframes are only checked the first time they are found.
+                if(!pKFi || spExcluded.count(pKFi) ||
+                   (bPrior && cv::norm(pKFi->GetCameraCenter()-Ow)>maxDistance))
                 {
-                    pKFi->mnLoopWords=0;
-                    if(!spConnectedKeyFrames.count(pKFi))
-                    {
-                        pKFi->mnLoopQuery=pKF->mnId;
-                        lKFsSharingWords.push_back(pKFi);
-                    }
+                    state = QueryScratch::EXCLUDED;
+                    continue;
                 }
-                pKFi->mnLoopWords++;
+                state = QueryScratch::CANDIDATE;
+                vpKFsSharingWords.push_back(pKFi);
             }
+            else if(state==QueryScratch::EXCLUDED)
+                continue;
+
+            scratch.vnWords[id]++;
         }
     }
 
-    if(lKFsSharingWords.empty())
+    return vpKFsSharingWords;
+}
+
+vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float minScore)
+{
+    set<KeyFrame*> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
+    vector<KeyFrame*> vpKFsSharingWords;
+
+    // Search all keyframes that share a word with current keyframes
+    // Discard keyframes connected to the query keyframe
+    boost::shared_lock<boost::shared_mutex> lock(mMutex);
+    QueryScratch &scratch = QueryScratch::ThreadInstance();
+    scratch.Begin(mvpKeyFrames.size());
+    vpKFsSharingWords = SearchSharingWords(pKF->mBowVec,scratch,spConnectedKeyFrames,cv::Mat(),-1);
+    lock.unlock();
+
+    if(vpKFsSharingWords.empty())
         return vector<KeyFrame*>();
 
     list<pair<float,KeyFrame*> > lScoreAndMatch;
 
     // Only compare against those keyframes that share enough words
     int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(vector<KeyFrame*>::iterator lit=vpKFsSharingWords.begin(), lend= vpKFsSharingWords.end(); lit!=lend; lit++)
     {
-        if((*lit)->mnLoopWords>maxCommonWords)
-            maxCommonWords=(*lit)->mnLoopWords;
+        if(scratch.vnWords[(*lit)->mnId]>maxCommonWords)
+            maxCommonWords=scratch.vnWords[(*lit)->mnId];
     }
 
     int minCommonWords = maxCommonWords*0.8f; //param
@@ -122,17 +176,17 @@ vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float mi
     int nscores=0;
 
     // Compute similarity score. Retain the matches whose score is higher than minScore
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(vector<KeyFrame*>::iterator lit=vpKFsSharingWords.begin(), lend= vpKFsSharingWords.end(); lit!=lend; lit++)
     {
         KeyFrame* pKFi = *lit;
 
-        if(pKFi->mnLoopWords>minCommonWords)
+        if(scratch.vnWords[pKFi->mnId]>minCommonWords)
         {
             nscores++;
 
             float si = mpVoc->score(pKF->mBowVec,pKFi->mBowVec);
 
-            pKFi->mLoopScore = si;
+            scratch.vScore[pKFi->mnId] = si;
             if(si>=minScore)
                 lScoreAndMatch.push_back(make_pair(si,pKFi));
         }
@@ -156,13 +210,15 @@ vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float mi
         for(vector<KeyFrame*>::iterator vit=vpNeighs.begin(), vend=vpNeighs.end(); vit!=vend; vit++)
         {
             KeyFrame* pKF2 = *vit;
-            if(pKF2->mnLoopQuery==pKF->mnId && pKF2->mnLoopWords>minCommonWords)
+            const size_t id2 = pKF2->mnId;
+            if(scratch.IsCandidate(id2) &&
+               scratch.vnWords[id2]>minCommonWords)
             {
-                accScore+=pKF2->mLoopScore;
-                if(pKF2->mLoopScore>bestScore)
+                accScore+=scratch.vScore[id2];
+                if(scratch.vScore[id2]>bestScore)
                 {
                     pBestKF=pKF2;
-                    bestScore = pKF2->mLoopScore;
+                    bestScore = scratch.vScore[id2];
                 }
             }
         }
@@ -198,38 +254,31 @@ vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float mi
 
 vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F)
 {
-    list<KeyFrame*> lKFsSharingWords;
+    return DetectRelocalizationCandidates(F,cv::Mat(),-1);
+}
 
-    // Search all keyframes that share a word with current frame
-    {
-        unique_lock<mutex> lock(mMutex);
+vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F, const cv::Mat &Ow, const float maxDistance)
+{
+    const bool bPrior = !Ow.empty() && maxDistance>=0;
 
-        for(DBoW2::BowVector::const_iterator vit=F->mBowVec.begin(), vend=F->mBowVec.end(); vit != vend; vit++)
-        {
-            list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
+    vector<KeyFrame*> vpKFsSharingWords;
 
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
-            {
-                KeyFrame* pKFi=*lit;
-                if(pKFi->mnRelocQuery!=F->mnId)
-                {
-                    pKFi->mnRelocWords=0;
-                    pKFi->mnRelocQuery=F->mnId;
-                    lKFsSharingWords.push_back(pKFi);
-                }
-                pKFi->mnRelocWords++;
-            }
-        }
-    }
-    if(lKFsSharingWords.empty())
+    // Search all keyframes that share a word with current frame
+    boost::shared_lock<boost::shared_mutex> lock(mMutex);
+    QueryScratch &scratch = QueryScratch::ThreadInstance();
+    scratch.Begin(mvpKeyFrames.size());
+    vpKFsSharingWords = SearchSharingWords(F->mBowVec,scratch,set<KeyFrame*>(),Ow,maxDistance);
+    lock.unlock();
+
+    if(vpKFsSharingWords.empty())
         return vector<KeyFrame*>();
 
     // Only compare against those keyframes that share enough words
     int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(vector<KeyFrame*>::iterator lit=vpKFsSharingWords.begin(), lend= vpKFsSharingWords.end(); lit!=lend; lit++)
     {
-        if((*lit)->mnRelocWords>maxCommonWords)
-            maxCommonWords=(*lit)->mnRelocWords;
+        if(scratch.vnWords[(*lit)->mnId]>maxCommonWords)
+            maxCommonWords=scratch.vnWords[(*lit)->mnId];
     }
 
     int minCommonWords = maxCommonWords*0.8f; //param
@@ -239,15 +288,15 @@ vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F)
     int nscores=0;
 
     // Compute similarity score.
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(vector<KeyFrame*>::iterator lit=vpKFsSharingWords.begin(), lend= vpKFsSharingWords.end(); lit!=lend; lit++)
     {
         KeyFrame* pKFi = *lit;
 
-        if(pKFi->mnRelocWords>minCommonWords)
+        if(scratch.vnWords[pKFi->mnId]>minCommonWords)
         {
             nscores++;
             float si = mpVoc->score(F->mBowVec,pKFi->mBowVec);
-            pKFi->mRelocScore=si;
+            scratch.vScore[pKFi->mnId]=si;
             lScoreAndMatch.push_back(make_pair(si,pKFi));
         }
     }
@@ -270,14 +319,15 @@ vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F)
         for(vector<KeyFrame*>::iterator vit=vpNeighs.begin(), vend=vpNeighs.end(); vit!=vend; vit++)
         {
             KeyFrame* pKF2 = *vit;
-            if(pKF2->mnRelocQuery!=F->mnId)
+            const size_t id2 = pKF2->mnId;
+            if(!scratch.IsCandidate(id2))
                 continue;
 
-            accScore+=pKF2->mRelocScore;
-            if(pKF2->mRelocScore>bestScore)
+            accScore+=scratch.vScore[id2];
+            if(scratch.vScore[id2]>bestScore)
             {
                 pBestKF=pKF2;
-                bestScore = pKF2->mRelocScore;
+                bestScore = scratch.vScore[id2];
             }
 
         }
@@ -306,6 +356,18 @@ vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F)
         }
     }
 
+    // Closest candidates to the prior are verified first
+    if(bPrior)
+    {
+        vector<pair<float,KeyFrame*> > vDistAndKF;
+        vDistAndKF.reserve(vpRelocCandidates.size());
+        for(size_t i=0; i<vpRelocCandidates.size(); i++)
+            vDistAndKF.push_back(make_pair(cv::norm(vpRelocCandidates[i]->GetCameraCenter()-Ow),vpRelocCandidates[i]));
+        sort(vDistAndKF.begin(),vDistAndKF.end());
+        for(size_t i=0; i<vDistAndKF.size(); i++)
+            vpRelocCandidates[i] = vDistAndKF[i].second;
+    }
+
     return vpRelocCandidates;
 }
 
@@ -30,7 +30,7 @@ namespace ORB_SLAM2
 
 LocalMapping::LocalMapping(Map *pMap, const float bMonocular):
     mbMonocular(bMonocular), mbResetRequested(false), mbFinishRequested(false), mbFinished(true), mpMap(pMap),
-    mbAbortBA(false), mbStopped(false), mbStopRequested(false), mbNotStop(false), mbAcceptKeyFrames(true)
+    mpThreadPool(NULL), mpSlidingWindow(NULL), mbAbortBA(false), mbStopped(false), mbStopRequested(false), mbNotStop(false), mbAcceptKeyFrames(true)
     , mVisualizeLocalMapping("Show Mapping", false, true, ParameterGroup::MAIN, []{})
 {
 }
@@ -45,6 +45,17 @@ void LocalMapping::SetTracker(Tracking *pTracker)
     mpTracker=pTracker;
 }
 
+void LocalMapping::SetThreadPool(ThreadPool *pThreadPool)
+{
+    mpThreadPool=pThreadPool;
+}
+
+void LocalMapping::EnableSlidingWindow(const int nSize, const int nIterations)
+{
+    delete mpSlidingWindow;
+    mpSlidingWindow = new SlidingWindow(nSize,nIterations,mbMonocular);
+}
+
 void LocalMapping::Run()
 {
     mbFinished = false;
@@ -81,8 +92,13 @@ void LocalMapping::Run()
             {
                 // Local BA
                 if(mpMap->KeyFramesInMap()>2)
+                {
                     DLOG_IF(INFO, mVisualizeLocalMapping()) << "Performing local BA.";
-                    Optimizer::LocalBundleAdjustment(mpCurrentKeyFrame,&mbAbortBA, mpMap);
+                    if(mpSlidingWindow)
+                        Optimizer::SlidingWindowBundleAdjustment(mpCurrentKeyFrame,*mpSlidingWindow,mpMap);
+                    else
+                        Optimizer::LocalBundleAdjustment(mpCurrentKeyFrame,&mbAbortBA, mpMap);
+                }
 
                 // Check redundant local Keyframes
                 KeyFrameCulling();
@@ -542,9 +558,10 @@ void LocalMapping::SearchInNeighbors()
     DLOG_IF(INFO, mVisualizeLocalMapping()) << numMapPointsFused << " duplicate map points fused.";
 
 
-    // Update points
+    // Update points. Each point only touches its own state (guarded by its own mutexes),
+    // so the refresh is split across the thread pool and the result does not depend on the order.
     vpMapPointMatches = mpCurrentKeyFrame->GetMapPointMatches();
-    for(size_t i=0, iend=vpMapPointMatches.size(); i<iend; i++)
+    auto updatePoint = [&vpMapPointMatches](size_t i)
     {
         MapPoint* pMP=vpMapPointMatches[i];
         if(pMP)
@@ -555,7 +572,13 @@ void LocalMapping::SearchInNeighbors()
                 pMP->UpdateNormalAndDepth();
             }
         }
-    }
+    };
+
+    if(mpThreadPool)
+        mpThreadPool->ParallelFor(vpMapPointMatches.size(),updatePoint);
+    else
+        for(size_t i=0, iend=vpMapPointMatches.size(); i<iend; i++)
+            updatePoint(i);
 
     // Update connections in covisibility graph
     mpCurrentKeyFrame->UpdateConnections();
@@ -657,6 +680,41 @@ void LocalMapping::InterruptBA()
     mbAbortBA = true;
 }
 
+bool LocalMapping::IsRedundantKeyFrame(KeyFrame *pKF)
+{
+    const vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();
+
+    const int thObs=3; //param
+    int nRedundantObservations=0;
+    int nMPs=0;
+    for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
+    {
+        MapPoint* pMP = vpMapPoints[i];
+        if(pMP)
+        {
+            if(!pMP->isBad())
+            {
+                if(!mbMonocular)
+                {
+                    if(pKF->mvDepth[i]>pKF->mThDepth || pKF->mvDepth[i]<0)
+                        continue;
+                }
+
+                nMPs++;
+                // check if the mappoint is seen at least three times at the same or finer scale.
+                // The counter is maintained by the MapPoint when observations are added or erased.
+                if(pMP->Observations()>thObs) //param
+                {
+                    if(pMP->GetRedundantObservations(pKF)>=thObs) //param
+                        nRedundantObservations++;
+                }
+            }
+        }
+    }
+
+    return nRedundantObservations>0.9*nMPs; //param
+}
+
 void LocalMapping::KeyFrameCulling()
 {
     // Check redundant keyframes (only local keyframes)
@@ -665,69 +723,37 @@ void LocalMapping::KeyFrameCulling()
     // We only consider close stereo points
     vector<KeyFrame*> vpLocalKeyFrames = mpCurrentKeyFrame->GetVectorCovisibleKeyFrames();
 
+    // Screen all local keyframes in one batch over the thread pool. This only reads the map.
+    vector<char> vbCandidate(vpLocalKeyFrames.size(),false);
+    auto screenKeyFrame = [&](size_t i)
+    {
+        KeyFrame* pKF = vpLocalKeyFrames[i];
+        if(pKF->mnId==0)
+            return;
+        vbCandidate[i] = IsRedundantKeyFrame(pKF);
+    };
+
+    if(mpThreadPool)
+        mpThreadPool->ParallelFor(vpLocalKeyFrames.size(),screenKeyFrame);
+    else
+        for(size_t i=0, iend=vpLocalKeyFrames.size(); i<iend; i++)
+            screenKeyFrame(i);
+
     //TODO : throws out the first keyframe it find that falls into the criteria, doesn't consider whether
     // it might make more sense to get rid of other keyframes first, that e.g. are further away from the current keyframe
+    // Candidates are confirmed in covisibility order, since culling a keyframe reduces the redundancy of the others
     int numRemovedKeyFrames = 0;
-    for(vector<KeyFrame*>::iterator vit=vpLocalKeyFrames.begin(), vend=vpLocalKeyFrames.end(); vit!=vend; vit++)
+    for(size_t i=0, iend=vpLocalKeyFrames.size(); i<iend; i++)
     {
-        KeyFrame* pKF = *vit;
-        if(pKF->mnId==0)
+        if(!vbCandidate[i])
             continue;
-        const vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();
 
-        int nObs = 3;
-        const int thObs=nObs; //param
-        int nRedundantObservations=0;
-        int nMPs=0;
-        for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
-        {
-            MapPoint* pMP = vpMapPoints[i];
-            if(pMP)
-            {
-                if(!pMP->isBad())
-                {
-                    if(!mbMonocular)
-                    {
-                        if(pKF->mvDepth[i]>pKF->mThDepth || pKF->mvDepth[i]<0)
-                            continue;
-                    }
-
-                    nMPs++;
-                    // check if the mappoint is seen at least three times
-                    if(pMP->Observations()>thObs) //param
-                    {
-                        const int &scaleLevel = pKF->mvKeysUn[i].octave;
-                        const map<KeyFrame*, size_t> observations = pMP->GetObservations();
-                        int nObs=0;
-                        // go through the keyframes that see the map point
-                        for(map<KeyFrame*, size_t>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
-                        {
-                            KeyFrame* pKFi = mit->first;
-                            if(pKFi==pKF)
-                                continue;
-                            const int &scaleLeveli = pKFi->mvKeysUn[mit->second].octave;
-
-                            if(scaleLeveli<=scaleLevel+1)
-                            {
-                                nObs++;
-                                if(nObs>=thObs) //param
-                                    break;
-                            }
-                        }
-                        if(nObs>=thObs) //param
-                        {
-                            nRedundantObservations++;
-                        }
-                    }
-                }
-            }
-        }
+        KeyFrame* pKF = vpLocalKeyFrames[i];
+        if(numRemovedKeyFrames>0 && !IsRedundantKeyFrame(pKF))
+            continue;
 
-        if(nRedundantObservations>0.9*nMPs) //param
-        {
-            pKF->SetBadFlag();
-            numRemovedKeyFrames++;
-        }
+        pKF->SetBadFlag();
+        numRemovedKeyFrames++;
     }
     DLOG_IF(INFO, mVisualizeLocalMapping()) << "Removed " << numRemovedKeyFrames
                                             << " keyframes from local map.";
@@ -765,6 +791,8 @@ void LocalMapping::ResetIfRequested()
     {
         mlNewKeyFrames.clear();
         mlpRecentAddedMapPoints.clear();
+        if(mpSlidingWindow)
+            mpSlidingWindow->Reset();
         mbResetRequested=false;
     }
 }
@@ -0,0 +1,150 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LocalizationTileCache.h"
+#include "Map.h"
+#include "KeyFrame.h"
+
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+LocalizationTileCache::LocalizationTileCache(Map* pMap, const string &filename, const float tileSize, const int nRadius):
+    mpMap(pMap), mfTileSize(tileSize), mnRadius(nRadius), mbHasTile(false), mFd(-1), mnFileSize(0)
+{
+    mFd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if(mFd<0)
+    {
+        cerr << "Failed to open tile cache at: " << filename << endl;
+        return;
+    }
+    unlink(filename.c_str());
+}
+
+LocalizationTileCache::~LocalizationTileCache()
+{
+    if(mFd>=0)
+        close(mFd);
+}
+
+LocalizationTileCache::Tile LocalizationTileCache::TileOf(const cv::Mat &Ow) const
+{
+    Tile t;
+    t.x = floor(Ow.at<float>(0)/mfTileSize);
+    t.y = floor(Ow.at<float>(1)/mfTileSize);
+    t.z = floor(Ow.at<float>(2)/mfTileSize);
+    return t;
+}
+
+bool LocalizationTileCache::IsNear(const Tile &t1, const Tile &t2) const
+{
+    return abs(t1.x-t2.x)<=mnRadius && abs(t1.y-t2.y)<=mnRadius && abs(t1.z-t2.z)<=mnRadius;
+}
+
+void LocalizationTileCache::Update(const cv::Mat &Ow)
+{
+    if(Ow.empty() || mFd<0)
+        return;
+
+    const Tile tile = TileOf(Ow);
+    if(mbHasTile && tile==mCurrentTile)
+        return;
+    mCurrentTile = tile;
+    mbHasTile = true;
+
+    const vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(IsNear(TileOf(pKF->GetCameraCenter()),tile))
+            pKF->PageIn();
+        else
+            pKF->PageOut(this);
+    }
+}
+
+void LocalizationTileCache::PageInAll()
+{
+    const vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
+    for(size_t i=0; i<vpKFs.size(); i++)
+        vpKFs[i]->PageIn();
+
+    mbHasTile = false;
+}
+
+void LocalizationTileCache::Reset()
+{
+    unique_lock<mutex> lock(mMutexFile);
+    if(mFd>=0 && ftruncate(mFd,0)!=0)
+        cerr << "Failed to truncate the tile cache" << endl;
+    mnFileSize = 0;
+    mbHasTile = false;
+}
+
+bool LocalizationTileCache::Store(const vector<char> &vData, int64_t &nOffset)
+{
+    unique_lock<mutex> lock(mMutexFile);
+    if(mFd<0)
+        return false;
+
+    size_t nWritten = 0;
+    while(nWritten<vData.size())
+    {
+        const ssize_t n = pwrite(mFd,&vData[nWritten],vData.size()-nWritten,mnFileSize+nWritten);
+        if(n<=0)
+        {
+            cerr << "Failed to write the tile cache" << endl;
+            return false;
+        }
+        nWritten += n;
+    }
+
+    nOffset = mnFileSize;
+    mnFileSize += vData.size();
+    return true;
+}
+
+bool LocalizationTileCache::Fetch(const int64_t nOffset, const uint64_t nSize, vector<char> &vData)
+{
+    // The file only grows, stored ranges can be read without the lock
+    vData.resize(nSize);
+    size_t nRead = 0;
+    while(nRead<nSize)
+    {
+        const ssize_t n = pread(mFd,&vData[nRead],nSize-nRead,nOffset+nRead);
+        if(n<=0)
+        {
+            cerr << "Failed to read the tile cache" << endl;
+            return false;
+        }
+        nRead += n;
+    }
+    return true;
+}
+
+} //namespace ORB_SLAM
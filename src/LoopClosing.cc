@@ -37,11 +37,12 @@ namespace ORB_SLAM2
 
 LoopClosing::LoopClosing(Map *pMap, KeyFrameDatabase *pDB, ORBVocabulary *pVoc, const bool bFixScale):
     mbResetRequested(false), mbFinishRequested(false), mbFinished(true), mpMap(pMap),
-    mpKeyFrameDB(pDB), mpORBVocabulary(pVoc), mpMatchedKF(NULL), mLastLoopKFid(0), mbRunningGBA(false), mbFinishedGBA(true),
-    mbStopGBA(false), mpThreadGBA(NULL), mbFixScale(bFixScale), mnFullBAIdx(0)
+    mpKeyFrameDB(pDB), mpORBVocabulary(pVoc), mpThreadPool(NULL), mpMatchedKF(NULL), mLastLoopKFid(0), mbRunningGBA(false), mbFinishedGBA(true),
+    mbStopGBA(false), mpThreadGBA(NULL), mbIncrementalGBA(false), mbFixScale(bFixScale), mnFullBAIdx(0)
     , mVisualizeLoopClosing("Show Loops", false, true, ParameterGroup::MAIN, []{})
 {
     mnCovisibilityConsistencyTh = 3; //param
+    mbProcessingKeyFrame = false;
 }
 
 void LoopClosing::SetTracker(Tracking *pTracker)
@@ -54,6 +55,16 @@ void LoopClosing::SetLocalMapper(LocalMapping *pLocalMapper)
     mpLocalMapper=pLocalMapper;
 }
 
+void LoopClosing::SetThreadPool(ThreadPool *pThreadPool)
+{
+    mpThreadPool=pThreadPool;
+}
+
+void LoopClosing::EnableIncrementalGBA()
+{
+    mbIncrementalGBA = true;
+}
+
 
 void LoopClosing::Run()
 {
@@ -75,6 +86,9 @@ void LoopClosing::Run()
                    CorrectLoop();
                }
             }
+
+            unique_lock<mutex> lock(mMutexLoopQueue);
+            mbProcessingKeyFrame = false;
         }
 
         ResetIfRequested();
@@ -101,12 +115,19 @@ bool LoopClosing::CheckNewKeyFrames()
     return(!mlpLoopKeyFrameQueue.empty());
 }
 
+bool LoopClosing::isIdle()
+{
+    unique_lock<mutex> lock(mMutexLoopQueue);
+    return mlpLoopKeyFrameQueue.empty() && !mbProcessingKeyFrame;
+}
+
 bool LoopClosing::DetectLoop()
 {
     {
         unique_lock<mutex> lock(mMutexLoopQueue);
         mpCurrentKF = mlpLoopKeyFrameQueue.front();
         mlpLoopKeyFrameQueue.pop_front();
+        mbProcessingKeyFrame = true;
         // Avoid that a keyframe can be erased while it is being process by this thread
         mpCurrentKF->SetNotErase();
     }
@@ -254,136 +275,131 @@ bool LoopClosing::DetectLoop()
     return false;
 }
 
-bool LoopClosing::ComputeSim3()
+bool LoopClosing::VerifyLoopCandidate(const int nCandidate, atomic<int> &nAccepted,
+                                      vector<MapPoint*> &vpMatches, g2o::Sim3 &gScm)
 {
-    // For each consistent loop candidate we try to compute a Sim3
-
-    const int nInitialCandidates = mvpEnoughConsistentCandidates.size();
-    DLOG_IF(INFO, mVisualizeLoopClosing()) << "Using consistent candidates to compute Sim3.";
+    KeyFrame* pKF = mvpEnoughConsistentCandidates[nCandidate];
+    if(pKF->isBad())
+        return false;
 
-    // We compute first ORB matches for each candidate
+    // We compute first ORB matches for the candidate
     // If enough matches are found, we setup a Sim3Solver
     ORBmatcher matcher(0.75,true); //param
 
-    vector<Sim3Solver*> vpSim3Solvers;
-    vpSim3Solvers.resize(nInitialCandidates);
-
-    vector<vector<MapPoint*> > vvpMapPointMatches;
-    vvpMapPointMatches.resize(nInitialCandidates);
+    vector<MapPoint*> vpMapPointMatches;
+    int nmatches = matcher.SearchByBoW(mpCurrentKF,pKF,vpMapPointMatches);
 
-    vector<bool> vbDiscarded;
-    vbDiscarded.resize(nInitialCandidates);
+    if(nmatches<20) //param
+    {
+        DLOG_IF(INFO, mVisualizeLoopClosing()) << "Candidate " << nCandidate
+                                               << " has " << nmatches
+                                               << " matches with current keyframe. -> Discarded!";
+        return false;
+    }
 
-    int nCandidates=0; //candidates with enough matches
+    DLOG_IF(INFO, mVisualizeLoopClosing()) << "Candidate " << nCandidate
+                                           << " has " << nmatches
+                                           << " matches with current keyframe. -> Using it!";
+    // Seeded with the candidate index: the RANSAC of a candidate does not depend on the scheduling
+    Sim3Solver solver(mpCurrentKF,pKF,vpMapPointMatches,mbFixScale,nCandidate);
+    solver.SetRansacParameters(0.99,20,300); //param
 
-    for(int i=0; i<nInitialCandidates; i++)
+    // Perform RANSAC iterations until succesful, exhausted, or a better ranked candidate was accepted
+    bool bNoMore = false;
+    while(!bNoMore && nAccepted>nCandidate)
     {
-        KeyFrame* pKF = mvpEnoughConsistentCandidates[i];
+        // Perform 5 Ransac Iterations
+        vector<bool> vbInliers;
+        int nInliers;
 
-        // avoid that local mapping erase it while it is being processed in this thread
-        pKF->SetNotErase();
+        cv::Mat Scm  = solver.iterate(5,bNoMore,vbInliers,nInliers); //param
 
-        if(pKF->isBad())
+        // If RANSAC returns a Sim3, perform a guided matching and optimize with all correspondences
+        if(!Scm.empty())
         {
-            vbDiscarded[i] = true;
-            continue;
-        }
+            DLOG_IF(INFO, mVisualizeLoopClosing()) << "Found Sim(3) for candidate " << nCandidate
+                                                   << " trying to optimize it.";
+            vpMatches = vector<MapPoint*>(vpMapPointMatches.size(), static_cast<MapPoint*>(NULL));
+            for(size_t j=0, jend=vbInliers.size(); j<jend; j++)
+            {
+                if(vbInliers[j])
+                   vpMatches[j]=vpMapPointMatches[j];
+            }
 
-        int nmatches = matcher.SearchByBoW(mpCurrentKF,pKF,vvpMapPointMatches[i]);
+            cv::Mat R = solver.GetEstimatedRotation();
+            cv::Mat t = solver.GetEstimatedTranslation();
+            const float s = solver.GetEstimatedScale();
+            matcher.SearchBySim3(mpCurrentKF,pKF,vpMatches,s,R,t,7.5); //param
 
-        if(nmatches<20) //param
-        {
-            DLOG_IF(INFO, mVisualizeLoopClosing()) << "Candidate " << i
-                                                   << " has " << nmatches
-                                                   << " matches with current keyframe. -> Discarded!";
-            vbDiscarded[i] = true;
-            continue;
+            gScm = g2o::Sim3(Converter::toMatrix3d(R),Converter::toVector3d(t),s);
+            const int nInliers = Optimizer::OptimizeSim3(mpCurrentKF, pKF, vpMatches, gScm, 10, mbFixScale); //param
+
+            DLOG_IF(INFO, mVisualizeLoopClosing()) << nInliers << " matches after optimization.";
+            // If optimization is succesful stop ransacs and continue
+            if(nInliers>=20) //param
+            {
+                DLOG_IF(INFO, mVisualizeLoopClosing()) << "Thats enough,"
+                                                       << " candidate " << nCandidate << " passed.";
+                return true;
+            }
         }
         else
         {
-            DLOG_IF(INFO, mVisualizeLoopClosing()) << "Candidate " << i
-                                                   << " has " << nmatches
-                                                   << " matches with current keyframe. -> Using it!";
-            Sim3Solver* pSolver = new Sim3Solver(mpCurrentKF,pKF,vvpMapPointMatches[i],mbFixScale);
-            pSolver->SetRansacParameters(0.99,20,300); //param
-            vpSim3Solvers[i] = pSolver;
+            DLOG_IF(INFO, mVisualizeLoopClosing()) << "Couldn't find Sim(3) for candidate " << nCandidate;
         }
-
-        nCandidates++;
     }
 
-    bool bMatch = false;
-
-    // Perform alternatively RANSAC iterations for each candidate
-    // until one is succesful or all fail
-    while(nCandidates>0 && !bMatch)
-    {
-        for(int i=0; i<nInitialCandidates; i++)
-        {
-            if(vbDiscarded[i])
-                continue;
+    return false;
+}
 
-            KeyFrame* pKF = mvpEnoughConsistentCandidates[i];
+bool LoopClosing::ComputeSim3()
+{
+    // For each consistent loop candidate we try to compute a Sim3
 
-            // Perform 5 Ransac Iterations
-            vector<bool> vbInliers;
-            int nInliers;
-            bool bNoMore;
+    const int nInitialCandidates = mvpEnoughConsistentCandidates.size();
+    DLOG_IF(INFO, mVisualizeLoopClosing()) << "Using consistent candidates to compute Sim3.";
 
-            Sim3Solver* pSolver = vpSim3Solvers[i];
-            cv::Mat Scm  = pSolver->iterate(5,bNoMore,vbInliers,nInliers); //param
+    // avoid that local mapping erase them while they are being processed in this thread
+    for(int i=0; i<nInitialCandidates; i++)
+        mvpEnoughConsistentCandidates[i]->SetNotErase();
 
-            // If Ransac reachs max. iterations discard keyframe
-            if(bNoMore)
-            {
-                vbDiscarded[i]=true;
-                nCandidates--;
-            }
+    // The candidates are verified concurrently on the thread pool. When a candidate passes, the ones
+    // with a higher index stop, so the accepted loop is always the lowest-index candidate that passes.
+    vector<vector<MapPoint*> > vvpMapPointMatches(nInitialCandidates);
+    vector<g2o::Sim3, Eigen::aligned_allocator<g2o::Sim3> > vgScm(nInitialCandidates);
+    atomic<int> nAccepted(nInitialCandidates);
 
-            // If RANSAC returns a Sim3, perform a guided matching and optimize with all correspondences
-            if(!Scm.empty())
-            {
-                DLOG_IF(INFO, mVisualizeLoopClosing()) << "Found Sim(3) for candidate " << i
-                                                       << " trying to optimize it.";
-                vector<MapPoint*> vpMapPointMatches(vvpMapPointMatches[i].size(), static_cast<MapPoint*>(NULL));
-                for(size_t j=0, jend=vbInliers.size(); j<jend; j++)
-                {
-                    if(vbInliers[j])
-                       vpMapPointMatches[j]=vvpMapPointMatches[i][j];
-                }
+    auto verifyCandidate = [&](size_t i)
+    {
+        const int nCandidate = i;
+        if(!VerifyLoopCandidate(nCandidate,nAccepted,vvpMapPointMatches[i],vgScm[i]))
+            return;
 
-                cv::Mat R = pSolver->GetEstimatedRotation();
-                cv::Mat t = pSolver->GetEstimatedTranslation();
-                const float s = pSolver->GetEstimatedScale();
-                int nmatchesSim3 = matcher.SearchBySim3(mpCurrentKF,pKF,vpMapPointMatches,s,R,t,7.5); //param
+        int nPrevious = nAccepted;
+        while(nCandidate<nPrevious && !nAccepted.compare_exchange_weak(nPrevious,nCandidate))
+            ;
+    };
 
-                g2o::Sim3 gScm(Converter::toMatrix3d(R),Converter::toVector3d(t),s);
-                const int nInliers = Optimizer::OptimizeSim3(mpCurrentKF, pKF, vpMapPointMatches, gScm, 10, mbFixScale); //param
+    if(mpThreadPool)
+        mpThreadPool->ParallelFor(nInitialCandidates,verifyCandidate);
+    else
+        for(int i=0; i<nInitialCandidates && nAccepted==nInitialCandidates; i++)
+            verifyCandidate(i);
 
-                DLOG_IF(INFO, mVisualizeLoopClosing()) << nInliers << " matches after optimization.";
-                // If optimization is succesful stop ransacs and continue
-                if(nInliers>=20) //param
-                {
-                    DLOG_IF(INFO, mVisualizeLoopClosing()) << "Thats enough,"
-                                                           << " candidate accepted for last test!";
-                    bMatch = true;
-                    mpMatchedKF = pKF;
-                    g2o::Sim3 gSmw(Converter::toMatrix3d(pKF->GetRotation()),Converter::toVector3d(pKF->GetTranslation()),1.0);
-                    mg2oScw = gScm*gSmw;
-                    mScw = Converter::toCvMat(mg2oScw);
-
-                    mvpCurrentMatchedPoints = vpMapPointMatches;
-                    //TODO : If there is another candidate that performs better than the first one
-                    // accepted here and the one accepted here should be rejected later the one
-                    // rejected here will not be considered anymore
-                    break;
-                }
-            }
-            else
-            {
-                DLOG_IF(INFO, mVisualizeLoopClosing()) << "Couldn't find Sim(3) for candidate " << i;
-            }
-        }
+    const bool bMatch = nAccepted<nInitialCandidates;
+    if(bMatch)
+    {
+        const int nBest = nAccepted;
+        DLOG_IF(INFO, mVisualizeLoopClosing()) << "Candidate " << nBest << " accepted for last test!";
+        mpMatchedKF = mvpEnoughConsistentCandidates[nBest];
+        g2o::Sim3 gSmw(Converter::toMatrix3d(mpMatchedKF->GetRotation()),Converter::toVector3d(mpMatchedKF->GetTranslation()),1.0);
+        mg2oScw = vgScm[nBest]*gSmw;
+        mScw = Converter::toCvMat(mg2oScw);
+
+        mvpCurrentMatchedPoints = vvpMapPointMatches[nBest];
+        //TODO : If there is another candidate that performs better than the first one
+        // accepted here and the one accepted here should be rejected later the one
+        // rejected here will not be considered anymore
     }
 
     if(!bMatch)
@@ -420,6 +436,7 @@ bool LoopClosing::ComputeSim3()
     }
 
     // Find more matches projecting with the computed Sim3
+    ORBmatcher matcher(0.75,true); //param
     int nmatchesProj = matcher.SearchByProjection(mpCurrentKF, mScw, mvpLoopMapPoints, mvpCurrentMatchedPoints,10); //param
 
     // If enough matches accept Loop
@@ -528,51 +545,56 @@ void LoopClosing::CorrectLoop()
             NonCorrectedSim3[pKFi]=g2oSiw;
         }
 
-        // Correct all MapPoints obsrved by current keyframe and neighbors, so that they align with the other side of the loop
-        for(KeyFrameAndPose::iterator mit=CorrectedSim3.begin(), mend=CorrectedSim3.end(); mit!=mend; mit++)
+        // Corrected poses and points are published as one epoch
         {
-            KeyFrame* pKFi = mit->first;
-            g2o::Sim3 g2oCorrectedSiw = mit->second;
-            g2o::Sim3 g2oCorrectedSwi = g2oCorrectedSiw.inverse();
+            MapPoint::PositionBatch batch;
 
-            g2o::Sim3 g2oSiw =NonCorrectedSim3[pKFi];
-
-            vector<MapPoint*> vpMPsi = pKFi->GetMapPointMatches();
-            for(size_t iMP=0, endMPi = vpMPsi.size(); iMP<endMPi; iMP++)
+            // Correct all MapPoints obsrved by current keyframe and neighbors, so that they align with the other side of the loop
+            for(KeyFrameAndPose::iterator mit=CorrectedSim3.begin(), mend=CorrectedSim3.end(); mit!=mend; mit++)
             {
-                MapPoint* pMPi = vpMPsi[iMP];
-                if(!pMPi)
-                    continue;
-                if(pMPi->isBad())
-                    continue;
-                if(pMPi->mnCorrectedByKF==mpCurrentKF->mnId)
-                    continue;
+                KeyFrame* pKFi = mit->first;
+                g2o::Sim3 g2oCorrectedSiw = mit->second;
+                g2o::Sim3 g2oCorrectedSwi = g2oCorrectedSiw.inverse();
 
-                // Project with non-corrected pose and project back with corrected pose
-                cv::Mat P3Dw = pMPi->GetWorldPos();
-                Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(P3Dw);
-                Eigen::Matrix<double,3,1> eigCorrectedP3Dw = g2oCorrectedSwi.map(g2oSiw.map(eigP3Dw));
+                g2o::Sim3 g2oSiw =NonCorrectedSim3[pKFi];
 
-                cv::Mat cvCorrectedP3Dw = Converter::toCvMat(eigCorrectedP3Dw);
-                pMPi->SetWorldPos(cvCorrectedP3Dw);
-                pMPi->mnCorrectedByKF = mpCurrentKF->mnId;
-                pMPi->mnCorrectedReference = pKFi->mnId;
-                pMPi->UpdateNormalAndDepth();
-            }
+                vector<MapPoint*> vpMPsi = pKFi->GetMapPointMatches();
+                for(size_t iMP=0, endMPi = vpMPsi.size(); iMP<endMPi; iMP++)
+                {
+                    MapPoint* pMPi = vpMPsi[iMP];
+                    if(!pMPi)
+                        continue;
+                    if(pMPi->isBad())
+                        continue;
+                    if(pMPi->mnCorrectedByKF==mpCurrentKF->mnId)
+                        continue;
+
+                    // Project with non-corrected pose and project back with corrected pose
+                    cv::Mat P3Dw = pMPi->GetWorldPos();
+                    Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(P3Dw);
+                    Eigen::Matrix<double,3,1> eigCorrectedP3Dw = g2oCorrectedSwi.map(g2oSiw.map(eigP3Dw));
+
+                    cv::Mat cvCorrectedP3Dw = Converter::toCvMat(eigCorrectedP3Dw);
+                    pMPi->SetWorldPos(cvCorrectedP3Dw);
+                    pMPi->mnCorrectedByKF = mpCurrentKF->mnId;
+                    pMPi->mnCorrectedReference = pKFi->mnId;
+                    pMPi->UpdateNormalAndDepth();
+                }
 
-            // Update keyframe pose with corrected Sim3. First transform Sim3 to SE3 (scale translation)
-            Eigen::Matrix3d eigR = g2oCorrectedSiw.rotation().toRotationMatrix();
-            Eigen::Vector3d eigt = g2oCorrectedSiw.translation();
-            double s = g2oCorrectedSiw.scale();
+                // Update keyframe pose with corrected Sim3. First transform Sim3 to SE3 (scale translation)
+                Eigen::Matrix3d eigR = g2oCorrectedSiw.rotation().toRotationMatrix();
+                Eigen::Vector3d eigt = g2oCorrectedSiw.translation();
+                double s = g2oCorrectedSiw.scale();
 
-            eigt *=(1./s); //[R t/s;0 1]
+                eigt *=(1./s); //[R t/s;0 1]
 
-            cv::Mat correctedTiw = Converter::toCvSE3(eigR,eigt);
+                cv::Mat correctedTiw = Converter::toCvSE3(eigR,eigt);
 
-            pKFi->SetPose(correctedTiw);
+                pKFi->SetPose(correctedTiw);
 
-            // Make sure connections are updated
-            pKFi->UpdateConnections();
+                // Make sure connections are updated
+                pKFi->UpdateConnections();
+            }
         }
 
         // Start Loop Fusion
@@ -702,6 +724,10 @@ void LoopClosing::ResetIfRequested()
     {
         mlpLoopKeyFrameQueue.clear();
         mLastLoopKFid=0;
+        {
+            unique_lock<mutex> lock2(mMutexGBA);
+            mspGBAKeyFrames.clear();
+        }
         mbResetRequested=false;
     }
 }
@@ -711,7 +737,39 @@ void LoopClosing::RunGlobalBundleAdjustment(unsigned long nLoopKF)
     cout << "Starting Global Bundle Adjustment" << endl;
 
     int idx =  mnFullBAIdx;
-    Optimizer::GlobalBundleAdjustemnt(mpMap,10,&mbStopGBA,nLoopKF,false); //param
+    if(mbIncrementalGBA)
+    {
+        // Keyframes disturbed by this loop, and those of a global BA aborted by it
+        set<KeyFrame*> spAffectedKFs;
+        Optimizer::DetectAffectedKeyFrames(mpMap,spAffectedKFs);
+        {
+            unique_lock<mutex> lock(mMutexGBA);
+            mspGBAKeyFrames.insert(spAffectedKFs.begin(),spAffectedKFs.end());
+            for(set<KeyFrame*>::iterator sit=mspGBAKeyFrames.begin(); sit!=mspGBAKeyFrames.end(); )
+            {
+                if((*sit)->isBad())
+                    mspGBAKeyFrames.erase(sit++);
+                else
+                    sit++;
+            }
+            spAffectedKFs = mspGBAKeyFrames;
+        }
+
+        if(!Optimizer::IncrementalBundleAdjustment(mpMap,spAffectedKFs,10,&mbStopGBA,nLoopKF,false)) //param
+        {
+            cout << "Global Bundle Adjustment not needed, the map is consistent" << endl;
+            unique_lock<mutex> lock(mMutexGBA);
+            if(idx==mnFullBAIdx)
+            {
+                mspGBAKeyFrames.clear();
+                mbFinishedGBA = true;
+                mbRunningGBA = false;
+            }
+            return;
+        }
+    }
+    else
+        Optimizer::GlobalBundleAdjustemnt(mpMap,10,&mbStopGBA,nLoopKF,false); //param
 
     // Update all MapPoints and KeyFrames
     // Local Mapping was active during BA, that means that there might be new keyframes
@@ -738,6 +796,9 @@ void LoopClosing::RunGlobalBundleAdjustment(unsigned long nLoopKF)
             // Get Map Mutex
             unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
 
+            // Corrected poses and points are published as one epoch
+            MapPoint::PositionBatch batch;
+
             // Correct keyframes starting at map first keyframe
             DLOG_IF(INFO, mVisualizeLoopClosing()) << "Updating keyframes and Map points accordingly";
             list<KeyFrame*> lpKFtoCheck(mpMap->mvpKeyFrameOrigins.begin(),mpMap->mvpKeyFrameOrigins.end());
@@ -804,6 +865,8 @@ void LoopClosing::RunGlobalBundleAdjustment(unsigned long nLoopKF)
 
             mpMap->InformNewBigChange();
 
+            mspGBAKeyFrames.clear();
+
             mpLocalMapper->Release();
 
             cout << "Map updated!" << endl;
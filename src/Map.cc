@@ -19,34 +19,54 @@
 */
 
 #include "Map.h"
+#include "MapJournal.h"
+#include "MapPointIndex.h"
+#include "Frame.h"
 
 #include<mutex>
 
 namespace ORB_SLAM2
 {
 
-Map::Map():mnMaxKFid(0),mnBigChangeIdx(0)
+Map::Map():mnMaxKFid(0),mnBigChangeIdx(0),mpJournal(static_cast<MapJournal*>(NULL)),
+    mpSpatialIndex(static_cast<MapPointIndex*>(NULL))
 {
 }
 
 void Map::AddKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexMap);
-    mspKeyFrames.insert(pKF);
+    mKeyFrames.insert(pKF);
     if(pKF->mnId>mnMaxKFid)
         mnMaxKFid=pKF->mnId;
+
+    if(mpJournal)
+        mpJournal->InformKeyFrameAdded(pKF);
 }
 
 void Map::AddMapPoint(MapPoint *pMP)
 {
     unique_lock<mutex> lock(mMutexMap);
-    mspMapPoints.insert(pMP);
+    mMapPoints.insert(pMP);
+
+    if(mpJournal)
+        mpJournal->InformMapPointAdded(pMP);
+
+    // Points are added by the thread that created them, before other threads can move them
+    if(mpSpatialIndex)
+        mpSpatialIndex->Insert(pMP,pMP->GetWorldPos());
 }
 
 void Map::EraseMapPoint(MapPoint *pMP)
 {
     unique_lock<mutex> lock(mMutexMap);
-    mspMapPoints.erase(pMP);
+    mMapPoints.erase(pMP);
+
+    if(mpJournal)
+        mpJournal->InformChanged(pMP);
+
+    if(mpSpatialIndex)
+        mpSpatialIndex->Erase(pMP);
 
     // TODO: This only erase the pointer.
     // Delete the MapPoint
@@ -55,7 +75,10 @@ void Map::EraseMapPoint(MapPoint *pMP)
 void Map::EraseKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexMap);
-    mspKeyFrames.erase(pKF);
+    mKeyFrames.erase(pKF);
+
+    if(mpJournal)
+        mpJournal->InformChanged(pKF);
 
     // TODO: This only erase the pointer.
     // Delete the MapPoint
@@ -82,25 +105,25 @@ int Map::GetLastBigChangeIdx()
 vector<KeyFrame*> Map::GetAllKeyFrames()
 {
     unique_lock<mutex> lock(mMutexMap);
-    return vector<KeyFrame*>(mspKeyFrames.begin(),mspKeyFrames.end());
+    return mKeyFrames.mvpItems;
 }
 
 vector<MapPoint*> Map::GetAllMapPoints()
 {
     unique_lock<mutex> lock(mMutexMap);
-    return vector<MapPoint*>(mspMapPoints.begin(),mspMapPoints.end());
+    return mMapPoints.mvpItems;
 }
 
 long unsigned int Map::MapPointsInMap()
 {
     unique_lock<mutex> lock(mMutexMap);
-    return mspMapPoints.size();
+    return mMapPoints.mvpItems.size();
 }
 
 long unsigned int Map::KeyFramesInMap()
 {
     unique_lock<mutex> lock(mMutexMap);
-    return mspKeyFrames.size();
+    return mKeyFrames.mvpItems.size();
 }
 
 vector<MapPoint*> Map::GetReferenceMapPoints()
@@ -115,16 +138,82 @@ long unsigned int Map::GetMaxKFid()
     return mnMaxKFid;
 }
 
+KeyFrame* Map::GetKeyFrame(const long unsigned int nId)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    return mKeyFrames.find(nId);
+}
+
+MapPoint* Map::GetMapPoint(const long unsigned int nId)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    return mMapPoints.find(nId);
+}
+
+void Map::SetJournal(MapJournal* pJournal)
+{
+    mpJournal = pJournal;
+}
+
+void Map::InformChanged(KeyFrame* pKF)
+{
+    if(mpJournal)
+        mpJournal->InformChanged(pKF);
+}
+
+void Map::InformChanged(MapPoint* pMP)
+{
+    if(mpJournal)
+        mpJournal->InformChanged(pMP);
+}
+
+void Map::EnableSpatialIndex(const float voxelSize)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    if(mpSpatialIndex)
+        return;
+
+    mpSpatialIndex = new MapPointIndex(voxelSize);
+    for(size_t i=0; i<mMapPoints.mvpItems.size(); i++)
+        mpSpatialIndex->Insert(mMapPoints.mvpItems[i],mMapPoints.mvpItems[i]->GetWorldPos());
+}
+
+void Map::InformMoved(MapPoint* pMP, const cv::Mat &Pos)
+{
+    if(mpSpatialIndex)
+        mpSpatialIndex->Move(pMP,Pos);
+}
+
+vector<MapPoint*> Map::GetMapPointsInRadius(const cv::Mat &x3Dw, const float r)
+{
+    if(!mpSpatialIndex)
+        return vector<MapPoint*>();
+    return mpSpatialIndex->GetPointsInRadius(x3Dw,r);
+}
+
+vector<MapPoint*> Map::GetMapPointsInFrustum(const Frame &F, const float maxDepth)
+{
+    if(!mpSpatialIndex || F.mTcw.empty())
+        return vector<MapPoint*>();
+    return mpSpatialIndex->GetPointsInFrustum(F.mTcw,F.fx,F.fy,F.cx,F.cy,F.mnMinX,F.mnMinY,F.mnMaxX,F.mnMaxY,maxDepth);
+}
+
 void Map::clear()
 {
-    for(set<MapPoint*>::iterator sit=mspMapPoints.begin(), send=mspMapPoints.end(); sit!=send; sit++)
-        delete *sit;
+    if(mpJournal)
+        mpJournal->InformMapCleared();
+
+    if(mpSpatialIndex)
+        mpSpatialIndex->Clear();
+
+    for(size_t i=0; i<mMapPoints.mvpItems.size(); i++)
+        delete mMapPoints.mvpItems[i];
 
-    for(set<KeyFrame*>::iterator sit=mspKeyFrames.begin(), send=mspKeyFrames.end(); sit!=send; sit++)
-        delete *sit;
+    for(size_t i=0; i<mKeyFrames.mvpItems.size(); i++)
+        delete mKeyFrames.mvpItems[i];
 
-    mspMapPoints.clear();
-    mspKeyFrames.clear();
+    mMapPoints.clear();
+    mKeyFrames.clear();
     mnMaxKFid = 0;
     mvpReferenceMapPoints.clear();
     mvpKeyFrameOrigins.clear();
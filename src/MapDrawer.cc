@@ -43,28 +43,31 @@ MapDrawer::MapDrawer(Map* pMap, const string &strSettingPath):mpMap(pMap)
 
 void MapDrawer::DrawMapPoints()
 {
-    const vector<MapPoint*> &vpMPs = mpMap->GetAllMapPoints();
     const vector<MapPoint*> &vpRefMPs = mpMap->GetReferenceMapPoints();
 
     set<MapPoint*> spRefMPs(vpRefMPs.begin(), vpRefMPs.end());
 
-    if(vpMPs.empty())
+    // Collect the positions with the map locked and draw them after releasing it
+    vector<float> &vPositions = mvPointPositions;
+    vPositions.clear();
+    mpMap->ForEachMapPoint([&](MapPoint* pMP)
+    {
+        if(pMP->isBad() || spRefMPs.count(pMP))
+            return;
+        cv::Mat pos = pMP->GetWorldPos();
+        vPositions.push_back(pos.at<float>(0));
+        vPositions.push_back(pos.at<float>(1));
+        vPositions.push_back(pos.at<float>(2));
+    });
+
+    if(vPositions.empty() && spRefMPs.empty())
         return;
 
     glPointSize(mPointSize);
     glBegin(GL_POINTS);
     glColor3f(0.0,0.0,0.0);
-    std::stringstream print_points;         //zzz
-    for(size_t i=0, iend=vpMPs.size(); i<iend;i++)
-    {
-        if(vpMPs[i]->isBad() || spRefMPs.count(vpMPs[i]))
-            continue;
-        cv::Mat pos = vpMPs[i]->GetWorldPos();
-        glVertex3f(pos.at<float>(0),pos.at<float>(1),pos.at<float>(2));
-        
-        // print_points << pos.at<float>(0) << ","    << pos.at<float>(1) << "," << pos.at<float>(2) << std::endl;   //zzz
-    }
-    // std::cout << print_points.str();    //zzz
+    for(size_t i=0, iend=vPositions.size(); i<iend; i+=3)
+        glVertex3f(vPositions[i],vPositions[i+1],vPositions[i+2]);
     glEnd();
 
     glPointSize(mPointSize);
@@ -0,0 +1,526 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MapJournal.h"
+#include "Map.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+
+#include <iostream>
+#include <cstdio>
+#include <algorithm>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+static const char JOURNAL_MAGIC[8] = {'O','R','B','S','2','J','N','L'};
+static const uint32_t BATCH_MAGIC = 0x48435442; // "BTCH"
+
+// Sequence numbers of the snapshots and journals in the directory
+static void ListSequences(const string &strDirectory, vector<unsigned long> &vSnapshots, vector<unsigned long> &vJournals)
+{
+    DIR* pDir = opendir(strDirectory.c_str());
+    if(!pDir)
+        return;
+
+    while(dirent* pEntry = readdir(pDir))
+    {
+        unsigned long nSeq;
+        int nChars = 0;
+        if(sscanf(pEntry->d_name,"snapshot_%lu.bin%n",&nSeq,&nChars)==1 && pEntry->d_name[nChars]=='\0')
+            vSnapshots.push_back(nSeq);
+        else if(sscanf(pEntry->d_name,"journal_%lu.bin%n",&nSeq,&nChars)==1 && pEntry->d_name[nChars]=='\0')
+            vJournals.push_back(nSeq);
+    }
+    closedir(pDir);
+
+    sort(vSnapshots.begin(),vSnapshots.end());
+    sort(vJournals.begin(),vJournals.end());
+}
+
+static string SequenceFileName(const string &strDirectory, const char* prefix, const unsigned long nSeq)
+{
+    char name[64];
+    snprintf(name,sizeof(name),"%s_%08lu.bin",prefix,nSeq);
+    return strDirectory+"/"+name;
+}
+
+MapJournal::MapJournal(Map* pMap, KeyFrameDatabase* pKFDB, ORBVocabulary* pVoc, const int sensor,
+                       const string &strDirectory, const float flushInterval, const float snapshotInterval):
+    mpMap(pMap), mSerializer(pMap,pKFDB,pVoc), mSensor(sensor), mStrDirectory(strDirectory),
+    mFlushInterval((long)(flushInterval*1000)), mSnapshotInterval((long)(snapshotInterval*1000)),
+    mbCleared(true), mpJournalFile(static_cast<MapWriter*>(NULL)), mnFirstSeq(1), mnSeq(1), mnObsoleteSeq(0),
+    mbSnapshotRequested(false), mbFinishRequested(false), mbFinished(true)
+{
+    mkdir(mStrDirectory.c_str(),0755);
+
+    // A new session continues after the files left by previous ones, so they can still be recovered
+    vector<unsigned long> vSnapshots, vJournals;
+    ListSequences(mStrDirectory,vSnapshots,vJournals);
+    if(!vSnapshots.empty())
+        mnSeq = max(mnSeq,vSnapshots.back()+1);
+    if(!vJournals.empty())
+        mnSeq = max(mnSeq,vJournals.back()+1);
+    mnFirstSeq = mnSeq;
+}
+
+void MapJournal::Run()
+{
+    mbFinished = false;
+
+    chrono::steady_clock::time_point tLastSnapshot = chrono::steady_clock::now();
+
+    while(1)
+    {
+        bool bSnapshot, bFinish;
+        {
+            unique_lock<mutex> lock(mMutexFinish);
+            mcvRequests.wait_for(lock,mFlushInterval,[this]{ return mbFinishRequested || mbSnapshotRequested; });
+            bSnapshot = mbSnapshotRequested;
+            bFinish = mbFinishRequested;
+            mbSnapshotRequested = false;
+        }
+
+        if(bSnapshot || chrono::steady_clock::now()-tLastSnapshot>=mSnapshotInterval)
+        {
+            Snapshot();
+            tLastSnapshot = chrono::steady_clock::now();
+        }
+        else
+            Flush();
+
+        if(bFinish)
+            break;
+    }
+
+    CloseJournal();
+
+    SetFinish();
+}
+
+void MapJournal::InformKeyFrameAdded(KeyFrame* pKF)
+{
+    unique_lock<mutex> lock(mMutexChanges);
+    mspNewKeyFrames.insert(pKF);
+}
+
+void MapJournal::InformMapPointAdded(MapPoint* pMP)
+{
+    unique_lock<mutex> lock(mMutexChanges);
+    mspNewMapPoints.insert(pMP);
+}
+
+void MapJournal::InformChanged(KeyFrame* pKF)
+{
+    unique_lock<mutex> lock(mMutexChanges);
+    mspChangedKeyFrames.insert(pKF);
+}
+
+void MapJournal::InformChanged(MapPoint* pMP)
+{
+    unique_lock<mutex> lock(mMutexChanges);
+    mspChangedMapPoints.insert(pMP);
+}
+
+void MapJournal::InformMapCleared()
+{
+    unique_lock<mutex> lock(mMutexWrite);
+    unique_lock<mutex> lock2(mMutexChanges);
+    mspNewKeyFrames.clear();
+    mspNewMapPoints.clear();
+    mspChangedKeyFrames.clear();
+    mspChangedMapPoints.clear();
+    mspKnownKeyFrames.clear();
+    mspKnownMapPoints.clear();
+    mbCleared = true;
+}
+
+void MapJournal::RequestSnapshot()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    mbSnapshotRequested = true;
+    mcvRequests.notify_one();
+}
+
+void MapJournal::Flush()
+{
+    unique_lock<mutex> lock(mMutexWrite);
+    WriteBatch();
+}
+
+void MapJournal::WriteBatch()
+{
+    set<KeyFrame*> spNewKFs, spChangedKFs;
+    set<MapPoint*> spNewMPs, spChangedMPs;
+    {
+        unique_lock<mutex> lock2(mMutexChanges);
+        spNewKFs.swap(mspNewKeyFrames);
+        spChangedKFs.swap(mspChangedKeyFrames);
+        spNewMPs.swap(mspNewMapPoints);
+        spChangedMPs.swap(mspChangedMapPoints);
+    }
+
+    mBatch.Clear();
+
+    if(mbCleared)
+        mBatch.Write<uint8_t>(CLEAR);
+
+    // Keyframes erased before they were ever written are skipped
+    for(set<KeyFrame*>::iterator sit=spNewKFs.begin(), send=spNewKFs.end(); sit!=send; sit++)
+    {
+        KeyFrame* pKF = *sit;
+        if(pKF->isBad())
+            continue;
+        mBatch.Write<uint8_t>(KEYFRAME);
+        mSerializer.WriteKeyFrame(mBatch,pKF);
+        mspKnownKeyFrames.insert(pKF);
+    }
+
+    for(set<KeyFrame*>::iterator sit=spChangedKFs.begin(), send=spChangedKFs.end(); sit!=send; sit++)
+    {
+        KeyFrame* pKF = *sit;
+        if(spNewKFs.count(pKF) || !mspKnownKeyFrames.count(pKF))
+            continue;
+
+        if(pKF->isBad())
+        {
+            mBatch.Write<uint8_t>(KEYFRAME_ERASE);
+            mBatch.Write<uint64_t>(pKF->mnId);
+            mspKnownKeyFrames.erase(pKF);
+        }
+        else
+        {
+            mBatch.Write<uint8_t>(KEYFRAME_UPDATE);
+            mSerializer.WriteKeyFrameUpdate(mBatch,pKF);
+        }
+    }
+
+    for(set<MapPoint*>::iterator sit=spNewMPs.begin(), send=spNewMPs.end(); sit!=send; sit++)
+    {
+        MapPoint* pMP = *sit;
+        if(pMP->isBad())
+            continue;
+        mBatch.Write<uint8_t>(MAPPOINT);
+        mSerializer.WriteMapPoint(mBatch,pMP);
+        mspKnownMapPoints.insert(pMP);
+    }
+
+    // Map points are small, a changed one is written again in full
+    for(set<MapPoint*>::iterator sit=spChangedMPs.begin(), send=spChangedMPs.end(); sit!=send; sit++)
+    {
+        MapPoint* pMP = *sit;
+        if(spNewMPs.count(pMP) || !mspKnownMapPoints.count(pMP))
+            continue;
+
+        if(pMP->isBad())
+        {
+            mBatch.Write<uint8_t>(MAPPOINT_ERASE);
+            mBatch.Write<uint64_t>(pMP->mnId);
+            mspKnownMapPoints.erase(pMP);
+        }
+        else
+        {
+            mBatch.Write<uint8_t>(MAPPOINT);
+            mSerializer.WriteMapPoint(mBatch,pMP);
+        }
+    }
+
+    const vector<char> &vData = mBatch.Data();
+    if(vData.empty())
+        return;
+
+    if(!mpJournalFile && !OpenJournal())
+        return;
+
+    // A batch is applied only if it was completely written
+    mpJournalFile->Write<uint32_t>(BATCH_MAGIC);
+    mpJournalFile->Write<uint64_t>(vData.size());
+    mpJournalFile->WriteBytes(&vData[0],vData.size());
+    if(!mpJournalFile->Flush())
+    {
+        cerr << "Map journal: failed to write " << FileName("journal",mnSeq) << endl;
+        return;
+    }
+
+    mbCleared = false;
+
+    // The last snapshot has a journal on top, the files before it are no longer needed
+    if(mnObsoleteSeq>0)
+    {
+        RemoveOlderThan(mnObsoleteSeq);
+        mnObsoleteSeq = 0;
+    }
+}
+
+void MapJournal::Snapshot()
+{
+    MapWriter snapshot;
+    unsigned long nSeq;
+    {
+        // No thread changes the map while mMutexMapUpdate is held: the map is copied in memory and
+        // the file written after the lock is released. Same lock order as a map cleared under
+        // mMutexMapUpdate (InformMapCleared).
+        unique_lock<mutex> lockMap(mpMap->mMutexMapUpdate);
+        unique_lock<mutex> lock(mMutexWrite);
+
+        // The changes up to here end the current journal, so the previous snapshot and its journal
+        // still rebuild the map if the new snapshot can not be written or read
+        WriteBatch();
+        CloseJournal();
+
+        // The snapshot holds everything changed up to here, the changes made from now on go to the
+        // next journal. Entities in the map from now on are known, their changes are journaled.
+        {
+            unique_lock<mutex> lock2(mMutexChanges);
+            mspNewKeyFrames.clear();
+            mspNewMapPoints.clear();
+            mspChangedKeyFrames.clear();
+            mspChangedMapPoints.clear();
+        }
+
+        const vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
+        const vector<MapPoint*> vpMPs = mpMap->GetAllMapPoints();
+        mspKnownKeyFrames = set<KeyFrame*>(vpKFs.begin(),vpKFs.end());
+        mspKnownMapPoints = set<MapPoint*>(vpMPs.begin(),vpMPs.end());
+        mbCleared = false;
+
+        mSerializer.Save(snapshot,mSensor);
+        nSeq = ++mnSeq;
+    }
+
+    const string strSnapshot = FileName("snapshot",nSeq);
+    const string strTmp = strSnapshot+".tmp";
+    bool bOK = snapshot.good() && !snapshot.Data().empty();
+    if(bOK)
+    {
+        MapWriter file(strTmp);
+        file.WriteBytes(&snapshot.Data()[0],snapshot.Data().size());
+        bOK = file.Close() && rename(strTmp.c_str(),strSnapshot.c_str())==0;
+    }
+
+    if(!bOK)
+    {
+        cerr << "Map journal: failed to write " << strSnapshot << endl;
+        remove(strTmp.c_str());
+
+        // The new journal starts over with the whole map. It may have been cleared meanwhile, so the
+        // entities are taken again from the map.
+        unique_lock<mutex> lockMap(mpMap->mMutexMapUpdate);
+        unique_lock<mutex> lock(mMutexWrite);
+        unique_lock<mutex> lock2(mMutexChanges);
+        const vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
+        const vector<MapPoint*> vpMPs = mpMap->GetAllMapPoints();
+        mspNewKeyFrames.insert(vpKFs.begin(),vpKFs.end());
+        mspNewMapPoints.insert(vpMPs.begin(),vpMPs.end());
+        mspKnownKeyFrames.clear();
+        mspKnownMapPoints.clear();
+        mbCleared = true;
+        return;
+    }
+
+    // The snapshot replaces everything before it, which is removed once the first batch on top of
+    // it is flushed
+    unique_lock<mutex> lock(mMutexWrite);
+    mnObsoleteSeq = nSeq;
+}
+
+bool MapJournal::OpenJournal()
+{
+    const string strJournal = FileName("journal",mnSeq);
+    mpJournalFile = new MapWriter(strJournal);
+    if(!mpJournalFile->good())
+    {
+        cerr << "Map journal: failed to open " << strJournal << endl;
+        delete mpJournalFile;
+        mpJournalFile = static_cast<MapWriter*>(NULL);
+        return false;
+    }
+
+    mSerializer.WriteHeader(*mpJournalFile,JOURNAL_MAGIC,mSensor,0,0);
+    return true;
+}
+
+void MapJournal::CloseJournal()
+{
+    if(!mpJournalFile)
+        return;
+    mpJournalFile->Close();
+    delete mpJournalFile;
+    mpJournalFile = static_cast<MapWriter*>(NULL);
+}
+
+string MapJournal::FileName(const char* prefix, const unsigned long nSeq) const
+{
+    return SequenceFileName(mStrDirectory,prefix,nSeq);
+}
+
+void MapJournal::RemoveOlderThan(const unsigned long nSeq)
+{
+    vector<unsigned long> vSnapshots, vJournals;
+    ListSequences(mStrDirectory,vSnapshots,vJournals);
+
+    for(size_t i=0; i<vSnapshots.size(); i++)
+        if(vSnapshots[i]<nSeq)
+            remove(FileName("snapshot",vSnapshots[i]).c_str());
+
+    for(size_t i=0; i<vJournals.size(); i++)
+        if(vJournals[i]<nSeq)
+            remove(FileName("journal",vJournals[i]).c_str());
+}
+
+bool MapJournal::Recover(const string &strDirectory, MapSerializer &serializer, const int sensor,
+                         const unsigned long nEndSeq)
+{
+    vector<unsigned long> vSnapshots, vJournals;
+    ListSequences(strDirectory,vSnapshots,vJournals);
+
+    MapSerializer::Staging staging;
+    bool bFound = false;
+    unsigned long nStartSeq = 0;
+
+    // Latest readable snapshot. If it is damaged the previous one and its journal are still there
+    // until the first batch on top of the new snapshot is flushed, they end where the new snapshot
+    // starts so the journals after it replay on them.
+    for(vector<unsigned long>::reverse_iterator rit=vSnapshots.rbegin(); rit!=vSnapshots.rend(); rit++)
+    {
+        if(*rit>=nEndSeq)
+            continue;
+
+        staging.Clear();
+        staging.bSameVocabulary = true;
+        if(serializer.Read(SequenceFileName(strDirectory,"snapshot",*rit),sensor,staging))
+        {
+            bFound = true;
+            nStartSeq = *rit;
+            break;
+        }
+    }
+
+    if(!bFound)
+    {
+        staging.Clear();
+        staging.bSameVocabulary = true;
+    }
+
+    for(size_t i=0; i<vJournals.size(); i++)
+    {
+        if(vJournals[i]<nStartSeq || vJournals[i]>=nEndSeq)
+            continue;
+
+        // The last batch of a journal may have been cut by a crash, the next journal starts from
+        // a snapshot or a CLEAR so replay goes on
+        if(!ReplayJournal(SequenceFileName(strDirectory,"journal",vJournals[i]),serializer,sensor,staging))
+            cerr << "Map journal: " << SequenceFileName(strDirectory,"journal",vJournals[i])
+                 << " is truncated, replayed up to the last complete batch" << endl;
+        bFound = true;
+    }
+
+    if(!bFound)
+    {
+        cerr << "No map snapshot or journal found in: " << strDirectory << endl;
+        return false;
+    }
+
+    serializer.Publish(staging);
+    return true;
+}
+
+bool MapJournal::ReplayJournal(const string &filename, MapSerializer &serializer, const int sensor,
+                               MapSerializer::Staging &staging)
+{
+    MapReader reader(filename);
+    if(!reader.good())
+        return false;
+
+    uint64_t nKeyFrames, nMapPoints;
+    if(!serializer.ReadHeader(reader,JOURNAL_MAGIC,sensor,nKeyFrames,nMapPoints,staging))
+        return false;
+
+    while(!reader.AtEnd())
+    {
+        const uint32_t magic = reader.Read<uint32_t>();
+        const uint64_t nSize = reader.Read<uint64_t>();
+        if(!reader.good() || magic!=BATCH_MAGIC || nSize>reader.Remaining())
+            return false;
+
+        const size_t nEnd = reader.Tell()+nSize;
+        while(reader.good() && reader.Tell()<nEnd)
+        {
+            bool bOK = true;
+            switch(reader.Read<uint8_t>())
+            {
+            case KEYFRAME:
+                bOK = serializer.ReadKeyFrame(reader,staging);
+                break;
+            case KEYFRAME_UPDATE:
+                bOK = serializer.ReadKeyFrameUpdate(reader,staging);
+                break;
+            case KEYFRAME_ERASE:
+                staging.EraseKeyFrame(reader.Read<uint64_t>());
+                break;
+            case MAPPOINT:
+                bOK = serializer.ReadMapPoint(reader,staging);
+                break;
+            case MAPPOINT_ERASE:
+                staging.EraseMapPoint(reader.Read<uint64_t>());
+                break;
+            case CLEAR:
+                staging.Clear();
+                break;
+            default:
+                bOK = false;
+            }
+
+            if(!bOK)
+                return false;
+        }
+
+        if(!reader.good() || reader.Tell()!=nEnd)
+            return false;
+    }
+
+    return true;
+}
+
+void MapJournal::RequestFinish()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    mbFinishRequested = true;
+    mcvRequests.notify_one();
+}
+
+void MapJournal::SetFinish()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    mbFinished = true;
+}
+
+bool MapJournal::isFinished()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    return mbFinished;
+}
+
+} //namespace ORB_SLAM
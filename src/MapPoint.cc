@@ -20,6 +20,7 @@
 
 #include "MapPoint.h"
 #include "ORBmatcher.h"
+#include "MapSerializer.h"
 
 #include<mutex>
 
@@ -27,7 +28,8 @@ namespace ORB_SLAM2
 {
 
 long unsigned int MapPoint::nNextId=0;
-mutex MapPoint::mGlobalMutex;
+mutex MapPoint::mMutexPositionBatch;
+atomic<unsigned long> MapPoint::mnPositionEpoch(0);
 
 MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map* pMap):
     mnFirstKFid(pRefKF->mnId), mnFirstFrame(pRefKF->mnFrameId), nObs(0), mnTrackReferenceForFrame(0),
@@ -37,6 +39,7 @@ MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map* pMap):
 {
     Pos.copyTo(mWorldPos);
     mNormalVector = cv::Mat::zeros(3,1,CV_32F);
+    PublishPosition();
 
     // MapPoints can be created from Tracking and Local Mapping. This mutex avoid conflicts with id.
     unique_lock<mutex> lock(mpMap->mMutexPointCreation);
@@ -53,6 +56,7 @@ MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF
     cv::Mat Ow = pFrame->GetCameraCenter();
     mNormalVector = mWorldPos - Ow;
     mNormalVector = mNormalVector/cv::norm(mNormalVector);
+    PublishPosition();
 
     cv::Mat PC = Pos - Ow;
     const float dist = cv::norm(PC);
@@ -70,23 +74,86 @@ MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF
     mnId=nNextId++;
 }
 
+MapPoint::MapPoint(MapReader &reader, Map* pMap):
+    mnId(reader.Read<uint64_t>()), mnFirstKFid(reader.Read<int64_t>()), mnFirstFrame(reader.Read<int64_t>()), nObs(0),
+    mnTrackReferenceForFrame(0), mnLastFrameSeen(0), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0),
+    mnCorrectedByKF(0), mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(static_cast<KeyFrame*>(NULL)),
+    mbBad(false), mpReplaced(static_cast<MapPoint*>(NULL)), mpMap(pMap)
+{
+    mWorldPos = reader.ReadMat();
+    mNormalVector = reader.ReadMat();
+    PublishPosition();
+    mDescriptor = reader.ReadMat();
+    mnVisible = reader.Read<int32_t>();
+    mnFound = reader.Read<int32_t>();
+    mfMinDistance = reader.Read<float>();
+    mfMaxDistance = reader.Read<float>();
+}
+
+void MapPoint::Write(MapWriter &writer)
+{
+    writer.Write<uint64_t>(mnId);
+    writer.Write<int64_t>(mnFirstKFid);
+    writer.Write<int64_t>(mnFirstFrame);
+    writer.WriteMat(GetWorldPos());
+    writer.WriteMat(GetNormal());
+    writer.WriteMat(GetDescriptor());
+
+    unique_lock<mutex> lock(mMutexFeatures);
+    unique_lock<mutex> lock2(mMutexPos);
+    writer.Write<int32_t>(mnVisible);
+    writer.Write<int32_t>(mnFound);
+    writer.Write<float>(mfMinDistance);
+    writer.Write<float>(mfMaxDistance);
+}
+
 void MapPoint::SetWorldPos(const cv::Mat &Pos)
 {
-    unique_lock<mutex> lock2(mGlobalMutex);
     unique_lock<mutex> lock(mMutexPos);
     Pos.copyTo(mWorldPos);
+    PublishPosition();
+    mpMap->InformChanged(this);
+    mpMap->InformMoved(this,mWorldPos);
 }
 
 cv::Mat MapPoint::GetWorldPos()
 {
-    unique_lock<mutex> lock(mMutexPos);
-    return mWorldPos.clone();
+    const PositionSnapshot snapshot = mPositionSnapshot.Load();
+    return (cv::Mat_<float>(3,1) << snapshot.pos[0], snapshot.pos[1], snapshot.pos[2]);
 }
 
 cv::Mat MapPoint::GetNormal()
 {
-    unique_lock<mutex> lock(mMutexPos);
-    return mNormalVector.clone();
+    const PositionSnapshot snapshot = mPositionSnapshot.Load();
+    return (cv::Mat_<float>(3,1) << snapshot.normal[0], snapshot.normal[1], snapshot.normal[2]);
+}
+
+void MapPoint::PublishPosition()
+{
+    PositionSnapshot snapshot;
+    for(int i=0; i<3; i++)
+    {
+        snapshot.pos[i] = mWorldPos.empty() ? 0.0f : mWorldPos.at<float>(i);
+        snapshot.normal[i] = mNormalVector.empty() ? 0.0f : mNormalVector.at<float>(i);
+    }
+    mPositionSnapshot.Store(snapshot);
+}
+
+MapPoint::PositionBatch::PositionBatch()
+{
+    mMutexPositionBatch.lock();
+    mnPositionEpoch++;
+}
+
+MapPoint::PositionBatch::~PositionBatch()
+{
+    mnPositionEpoch++;
+    mMutexPositionBatch.unlock();
+}
+
+unsigned long MapPoint::GetPositionEpoch()
+{
+    return mnPositionEpoch;
 }
 
 KeyFrame* MapPoint::GetReferenceKeyFrame()
@@ -101,11 +168,14 @@ void MapPoint::AddObservation(KeyFrame* pKF, size_t idx)
     if(mObservations.count(pKF))
         return;
     mObservations[pKF]=idx;
+    AddObservationSlot(pKF,idx);
 
     if(pKF->mvuRight[idx]>=0)
         nObs+=2;
     else
         nObs++;
+
+    mpMap->InformChanged(this);
 }
 
 void MapPoint::EraseObservation(KeyFrame* pKF)
@@ -122,6 +192,7 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
                 nObs--;
 
             mObservations.erase(pKF);
+            EraseObservationSlot(pKF);
 
             if(mpRefKF==pKF)
                 mpRefKF=mObservations.begin()->first;
@@ -132,6 +203,8 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
         }
     }
 
+    mpMap->InformChanged(this);
+
     if(bBad)
         SetBadFlag();
 }
@@ -157,6 +230,7 @@ void MapPoint::SetBadFlag()
         mbBad=true;
         obs = mObservations;
         mObservations.clear();
+        ClearObservationSlots();
     }
     for(map<KeyFrame*,size_t>::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
     {
@@ -186,6 +260,7 @@ void MapPoint::Replace(MapPoint* pMP)
         unique_lock<mutex> lock2(mMutexPos);
         obs=mObservations;
         mObservations.clear();
+        ClearObservationSlots();
         mbBad=true;
         nvisible = mnVisible;
         nfound = mnFound;
@@ -239,71 +314,121 @@ float MapPoint::GetFoundRatio()
     return static_cast<float>(mnFound)/mnVisible;
 }
 
-void MapPoint::ComputeDistinctiveDescriptors()
+void MapPoint::AddObservationSlot(KeyFrame* pKF, size_t idx)
 {
-    // Retrieve all observed descriptors
-    vector<cv::Mat> vDescriptors;
+    const cv::Mat d = pKF->mDescriptors.row(idx);
+    const int level = pKF->mvKeysUn[idx].octave;
+
+    // Distances from the new descriptor to the ones already observed
+    vector<int> vDists;
+    int sum = 0;
+    int nRedundant = 0;
+    if(!mvpObsKFs.empty())
+    {
+        ORBmatcher::DescriptorDistances(d,mObsDescriptors,vDists);
+        for(size_t i=0; i<vDists.size(); i++)
+        {
+            mvObsDistanceSum[i]+=vDists[i];
+            sum+=vDists[i];
 
-    map<KeyFrame*,size_t> observations;
+            if(level<=mvObsLevels[i]+1)
+                mvObsRedundancy[i]++;
+            if(mvObsLevels[i]<=level+1)
+                nRedundant++;
+        }
+    }
+
+    mObsDescriptors.push_back(d);
+    mvpObsKFs.push_back(pKF);
+    mvObsDistanceSum.push_back(sum);
+    mvObsLevels.push_back(level);
+    mvObsRedundancy.push_back(nRedundant);
+}
 
+void MapPoint::EraseObservationSlot(KeyFrame* pKF)
+{
+    const size_t N = mvpObsKFs.size();
+    size_t idx = N;
+    for(size_t i=0; i<N; i++)
     {
-        unique_lock<mutex> lock1(mMutexFeatures);
-        if(mbBad)
-            return;
-        observations=mObservations;
+        if(mvpObsKFs[i]==pKF)
+        {
+            idx=i;
+            break;
+        }
     }
 
-    if(observations.empty())
+    if(idx==N)
         return;
 
-    vDescriptors.reserve(observations.size());
-
-    for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    vector<int> vDists;
+    ORBmatcher::DescriptorDistances(mObsDescriptors.row(idx),mObsDescriptors,vDists);
+    const int level = mvObsLevels[idx];
+    for(size_t i=0; i<N; i++)
     {
-        KeyFrame* pKF = mit->first;
-
-        if(!pKF->isBad())
-            vDescriptors.push_back(pKF->mDescriptors.row(mit->second));
+        mvObsDistanceSum[i]-=vDists[i];
+        if(i!=idx && level<=mvObsLevels[i]+1)
+            mvObsRedundancy[i]--;
     }
 
-    if(vDescriptors.empty())
-        return;
+    // Move the last entry into the erased slot
+    const size_t last = N-1;
+    if(idx!=last)
+    {
+        mObsDescriptors.row(last).copyTo(mObsDescriptors.row(idx));
+        mvpObsKFs[idx] = mvpObsKFs[last];
+        mvObsDistanceSum[idx] = mvObsDistanceSum[last];
+        mvObsLevels[idx] = mvObsLevels[last];
+        mvObsRedundancy[idx] = mvObsRedundancy[last];
+    }
+    mObsDescriptors.pop_back();
+    mvpObsKFs.pop_back();
+    mvObsDistanceSum.pop_back();
+    mvObsLevels.pop_back();
+    mvObsRedundancy.pop_back();
+}
 
-    // Compute distances between them
-    const size_t N = vDescriptors.size();
+void MapPoint::ClearObservationSlots()
+{
+    mObsDescriptors.release();
+    mvpObsKFs.clear();
+    mvObsDistanceSum.clear();
+    mvObsLevels.clear();
+    mvObsRedundancy.clear();
+}
 
-    float Distances[N][N];
-    for(size_t i=0;i<N;i++)
+int MapPoint::GetRedundantObservations(KeyFrame *pKF)
+{
+    unique_lock<mutex> lock(mMutexFeatures);
+    for(size_t i=0, iend=mvpObsKFs.size(); i<iend; i++)
     {
-        Distances[i][i]=0;
-        for(size_t j=i+1;j<N;j++)
-        {
-            int distij = ORBmatcher::DescriptorDistance(vDescriptors[i],vDescriptors[j]);
-            Distances[i][j]=distij;
-            Distances[j][i]=distij;
-        }
+        if(mvpObsKFs[i]==pKF)
+            return mvObsRedundancy[i];
     }
+    return -1;
+}
 
-    // Take the descriptor with least median distance to the rest
-    int BestMedian = INT_MAX;
+void MapPoint::ComputeDistinctiveDescriptors()
+{
+    // The distance sums are maintained by AddObservation/EraseObservation, so selecting the
+    // descriptor with least total distance to the rest (the medoid) is a linear scan.
+    unique_lock<mutex> lock(mMutexFeatures);
+    if(mbBad || mvObsDistanceSum.empty())
+        return;
+
+    int BestSum = INT_MAX;
     int BestIdx = 0;
-    for(size_t i=0;i<N;i++)
+    for(size_t i=0, iend=mvObsDistanceSum.size(); i<iend; i++)
     {
-        vector<int> vDists(Distances[i],Distances[i]+N);
-        sort(vDists.begin(),vDists.end());
-        int median = vDists[0.5*(N-1)];
-
-        if(median<BestMedian)
+        if(mvObsDistanceSum[i]<BestSum)
         {
-            BestMedian = median;
+            BestSum = mvObsDistanceSum[i];
             BestIdx = i;
         }
     }
 
-    {
-        unique_lock<mutex> lock(mMutexFeatures);
-        mDescriptor = vDescriptors[BestIdx].clone();
-    }
+    mDescriptor = mObsDescriptors.row(BestIdx).clone();
+    mpMap->InformChanged(this);
 }
 
 cv::Mat MapPoint::GetDescriptor()
@@ -367,7 +492,10 @@ void MapPoint::UpdateNormalAndDepth()
         mfMaxDistance = dist*levelScaleFactor;
         mfMinDistance = mfMaxDistance/pRefKF->mvScaleFactors[nLevels-1];
         mNormalVector = normal/n;
+        PublishPosition();
     }
+
+    mpMap->InformChanged(this);
 }
 
 float MapPoint::GetMinDistanceInvariance()
@@ -399,7 +527,7 @@ int MapPoint::PredictScale(const float &currentDist, KeyFrame* pKF)
     return nScale;
 }
 
-int MapPoint::PredictScale(const float &currentDist, Frame* pF)
+int MapPoint::PredictScale(const float &currentDist, const Frame* pF)
 {
     float ratio;
     {
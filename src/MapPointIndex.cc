@@ -0,0 +1,279 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MapPointIndex.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+MapPointIndex::MapPointIndex(const float voxelSize):
+    mfVoxelSize(voxelSize), mfInvVoxelSize(1.0f/voxelSize)
+{
+}
+
+int MapPointIndex::Cell(const float v) const
+{
+    return floor(v*mfInvVoxelSize);
+}
+
+MapPointIndex::VoxelKey MapPointIndex::Key(const int x, const int y, const int z)
+{
+    VoxelKey key;
+    key.x = x;
+    key.y = y;
+    key.z = z;
+    return key;
+}
+
+size_t MapPointIndex::VoxelKeyHash::operator()(const VoxelKey &key) const
+{
+    // Each axis is multiplied by a large odd constant and the products are mixed, so that
+    // neighbouring voxels do not fall in neighbouring buckets
+    uint64_t h = (uint64_t)(uint32_t)key.x*0x9E3779B97F4A7C15ULL;
+    h ^= (uint64_t)(uint32_t)key.y*0xC2B2AE3D27D4EB4FULL;
+    h ^= (uint64_t)(uint32_t)key.z*0x165667B19E3779F9ULL;
+    h ^= h >> 29;
+    return (size_t)h;
+}
+
+void MapPointIndex::Insert(MapPoint* pMP, const cv::Mat &Pos)
+{
+    Entry entry;
+    entry.pMP = pMP;
+    entry.x = Pos.at<float>(0);
+    entry.y = Pos.at<float>(1);
+    entry.z = Pos.at<float>(2);
+
+    const VoxelKey key = Key(Cell(entry.x),Cell(entry.y),Cell(entry.z));
+
+    unique_lock<mutex> lock(mMutex);
+    if(!mPointVoxels.insert(make_pair(pMP,key)).second)
+        return;
+
+    mVoxels[key].vEntries.push_back(entry);
+}
+
+void MapPointIndex::Erase(MapPoint* pMP)
+{
+    unique_lock<mutex> lock(mMutex);
+    unordered_map<MapPoint*,VoxelKey>::iterator it = mPointVoxels.find(pMP);
+    if(it==mPointVoxels.end())
+        return;
+
+    EraseFromVoxel(it->second,pMP);
+    mPointVoxels.erase(it);
+}
+
+void MapPointIndex::Move(MapPoint* pMP, const cv::Mat &Pos)
+{
+    const float x = Pos.at<float>(0);
+    const float y = Pos.at<float>(1);
+    const float z = Pos.at<float>(2);
+    const VoxelKey key = Key(Cell(x),Cell(y),Cell(z));
+
+    unique_lock<mutex> lock(mMutex);
+    unordered_map<MapPoint*,VoxelKey>::iterator it = mPointVoxels.find(pMP);
+    if(it==mPointVoxels.end())
+        return;
+
+    if(it->second==key)
+    {
+        // Still in the same voxel, most moves after an optimization are small
+        vector<Entry> &vEntries = mVoxels[key].vEntries;
+        for(size_t i=0; i<vEntries.size(); i++)
+        {
+            if(vEntries[i].pMP==pMP)
+            {
+                vEntries[i].x = x;
+                vEntries[i].y = y;
+                vEntries[i].z = z;
+                break;
+            }
+        }
+        return;
+    }
+
+    EraseFromVoxel(it->second,pMP);
+    it->second = key;
+
+    Entry entry;
+    entry.pMP = pMP;
+    entry.x = x;
+    entry.y = y;
+    entry.z = z;
+
+    mVoxels[key].vEntries.push_back(entry);
+}
+
+void MapPointIndex::EraseFromVoxel(const VoxelKey key, MapPoint* pMP)
+{
+    unordered_map<VoxelKey,Voxel,VoxelKeyHash>::iterator vit = mVoxels.find(key);
+    if(vit==mVoxels.end())
+        return;
+
+    vector<Entry> &vEntries = vit->second.vEntries;
+    for(size_t i=0; i<vEntries.size(); i++)
+    {
+        if(vEntries[i].pMP==pMP)
+        {
+            vEntries[i] = vEntries.back();
+            vEntries.pop_back();
+            break;
+        }
+    }
+
+    if(vEntries.empty())
+        mVoxels.erase(vit);
+}
+
+void MapPointIndex::Clear()
+{
+    unique_lock<mutex> lock(mMutex);
+    mVoxels.clear();
+    mPointVoxels.clear();
+}
+
+size_t MapPointIndex::Size()
+{
+    unique_lock<mutex> lock(mMutex);
+    return mPointVoxels.size();
+}
+
+template<class Test>
+void MapPointIndex::Collect(const float min[3], const float max[3], Test test, vector<MapPoint*> &vpMPs)
+{
+    const int minX = Cell(min[0]), minY = Cell(min[1]), minZ = Cell(min[2]);
+    const int maxX = Cell(max[0]), maxY = Cell(max[1]), maxZ = Cell(max[2]);
+
+    const double nCells = double(maxX-minX+1)*double(maxY-minY+1)*double(maxZ-minZ+1);
+
+    if(nCells<=mVoxels.size())
+    {
+        for(int x=minX; x<=maxX; x++)
+            for(int y=minY; y<=maxY; y++)
+                for(int z=minZ; z<=maxZ; z++)
+                {
+                    unordered_map<VoxelKey,Voxel,VoxelKeyHash>::const_iterator vit = mVoxels.find(Key(x,y,z));
+                    if(vit==mVoxels.end())
+                        continue;
+                    const vector<Entry> &vEntries = vit->second.vEntries;
+                    for(size_t i=0; i<vEntries.size(); i++)
+                        if(test(vEntries[i]))
+                            vpMPs.push_back(vEntries[i].pMP);
+                }
+    }
+    else
+    {
+        // The box is larger than the occupied space, visit the occupied voxels instead
+        for(unordered_map<VoxelKey,Voxel,VoxelKeyHash>::const_iterator vit=mVoxels.begin(); vit!=mVoxels.end(); vit++)
+        {
+            const VoxelKey &key = vit->first;
+            if(key.x<minX || key.x>maxX || key.y<minY || key.y>maxY || key.z<minZ || key.z>maxZ)
+                continue;
+            const Voxel &voxel = vit->second;
+            for(size_t i=0; i<voxel.vEntries.size(); i++)
+                if(test(voxel.vEntries[i]))
+                    vpMPs.push_back(voxel.vEntries[i].pMP);
+        }
+    }
+}
+
+vector<MapPoint*> MapPointIndex::GetPointsInRadius(const cv::Mat &x3Dw, const float r)
+{
+    const float cx = x3Dw.at<float>(0);
+    const float cy = x3Dw.at<float>(1);
+    const float cz = x3Dw.at<float>(2);
+    const float r2 = r*r;
+
+    const float min[3] = {cx-r, cy-r, cz-r};
+    const float max[3] = {cx+r, cy+r, cz+r};
+
+    vector<MapPoint*> vpMPs;
+    unique_lock<mutex> lock(mMutex);
+    Collect(min,max,[&](const Entry &e)
+    {
+        const float dx = e.x-cx, dy = e.y-cy, dz = e.z-cz;
+        return dx*dx+dy*dy+dz*dz<=r2;
+    },vpMPs);
+
+    return vpMPs;
+}
+
+vector<MapPoint*> MapPointIndex::GetPointsInFrustum(const cv::Mat &Tcw, const float fx, const float fy,
+                                                    const float cx, const float cy, const float minX,
+                                                    const float minY, const float maxX, const float maxY,
+                                                    const float maxDepth)
+{
+    const cv::Mat Rcw = Tcw.rowRange(0,3).colRange(0,3);
+    const cv::Mat tcw = Tcw.rowRange(0,3).col(3);
+    const cv::Mat Rwc = Rcw.t();
+    const cv::Mat Ow = -Rwc*tcw;
+
+    // Bounding box of the camera center and the image corners at the maximum depth
+    float min[3], max[3];
+    for(int k=0; k<3; k++)
+        min[k] = max[k] = Ow.at<float>(k);
+
+    const float us[2] = {minX, maxX};
+    const float vs[2] = {minY, maxY};
+    for(int i=0; i<2; i++)
+    {
+        for(int j=0; j<2; j++)
+        {
+            cv::Mat xc = (cv::Mat_<float>(3,1) << (us[i]-cx)/fx*maxDepth, (vs[j]-cy)/fy*maxDepth, maxDepth);
+            const cv::Mat xw = Rwc*xc+Ow;
+            for(int k=0; k<3; k++)
+            {
+                min[k] = std::min(min[k],xw.at<float>(k));
+                max[k] = std::max(max[k],xw.at<float>(k));
+            }
+        }
+    }
+
+    float R[9], t[3];
+    for(int i=0; i<3; i++)
+    {
+        for(int j=0; j<3; j++)
+            R[3*i+j] = Rcw.at<float>(i,j);
+        t[i] = tcw.at<float>(i);
+    }
+
+    vector<MapPoint*> vpMPs;
+    unique_lock<mutex> lock(mMutex);
+    Collect(min,max,[&](const Entry &e)
+    {
+        const float z = R[6]*e.x+R[7]*e.y+R[8]*e.z+t[2];
+        if(z<=0 || z>maxDepth)
+            return false;
+        const float invz = 1.0f/z;
+        const float u = fx*(R[0]*e.x+R[1]*e.y+R[2]*e.z+t[0])*invz+cx;
+        const float v = fy*(R[3]*e.x+R[4]*e.y+R[5]*e.z+t[1])*invz+cy;
+        return u>=minX && u<=maxX && v>=minY && v<=maxY;
+    },vpMPs);
+
+    return vpMPs;
+}
+
+} //namespace ORB_SLAM
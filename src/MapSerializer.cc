@@ -0,0 +1,707 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MapSerializer.h"
+#include "Map.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+#include "KeyFrameDatabase.h"
+#include "Frame.h"
+
+#include <iostream>
+#include <algorithm>
+#include <set>
+#include <mutex>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+static const char MAP_MAGIC[8] = {'O','R','B','S','2','M','A','P'};
+// Version 1 stored the links of all records in a separate section after them, version 2 stores them
+// inline with each record (shared with the journal). Older versions are rejected.
+static const uint32_t MAP_VERSION = 2;
+
+MapWriter::MapWriter(): mbGood(true)
+{
+}
+
+MapWriter::MapWriter(const string &filename): mvBuffer(1<<20), mbGood(false)
+{
+    mFile.rdbuf()->pubsetbuf(&mvBuffer[0],mvBuffer.size());
+    mFile.open(filename.c_str(),ios::out | ios::binary | ios::trunc);
+    mbGood = mFile.is_open();
+}
+
+bool MapWriter::Flush()
+{
+    if(mFile.is_open())
+    {
+        mFile.flush();
+        mbGood = mbGood && mFile.good();
+    }
+    return mbGood;
+}
+
+bool MapWriter::Close()
+{
+    if(mFile.is_open())
+    {
+        mFile.close();
+        mbGood = mbGood && !mFile.fail();
+    }
+    return mbGood;
+}
+
+void MapWriter::WriteBytes(const void* p, size_t n)
+{
+    if(!mbGood)
+        return;
+
+    if(!mFile.is_open())
+    {
+        const char* pc = static_cast<const char*>(p);
+        mvData.insert(mvData.end(),pc,pc+n);
+        return;
+    }
+
+    mFile.write(static_cast<const char*>(p),n);
+    mbGood = mFile.good();
+}
+
+void MapWriter::WriteMat(const cv::Mat &M)
+{
+    Write<int32_t>(M.rows);
+    Write<int32_t>(M.cols);
+    Write<int32_t>(M.type());
+    const size_t rowBytes = M.cols*M.elemSize();
+    for(int i=0; i<M.rows; i++)
+        WriteBytes(M.ptr(i),rowBytes);
+}
+
+void MapWriter::WriteKeyPoints(const vector<cv::KeyPoint> &vKeys)
+{
+    Write<uint32_t>(vKeys.size());
+    for(size_t i=0; i<vKeys.size(); i++)
+    {
+        const cv::KeyPoint &kp = vKeys[i];
+        const float v[5] = {kp.pt.x, kp.pt.y, kp.size, kp.angle, kp.response};
+        WriteBytes(v,sizeof(v));
+        Write<int32_t>(kp.octave);
+    }
+}
+
+void MapWriter::WriteBowVector(const DBoW2::BowVector &v)
+{
+    Write<uint32_t>(v.size());
+    for(DBoW2::BowVector::const_iterator vit=v.begin(), vend=v.end(); vit!=vend; vit++)
+    {
+        Write<uint32_t>(vit->first);
+        Write<double>(vit->second);
+    }
+}
+
+void MapWriter::WriteFeatureVector(const DBoW2::FeatureVector &v)
+{
+    Write<uint32_t>(v.size());
+    for(DBoW2::FeatureVector::const_iterator fit=v.begin(), fend=v.end(); fit!=fend; ++fit)
+    {
+        Write<uint32_t>(fit->first);
+        Write<uint32_t>(fit->second.size());
+        if(!fit->second.empty())
+            WriteBytes(fit->second.begin(),fit->second.size()*sizeof(unsigned int));
+    }
+}
+
+MapReader::MapReader(const string &filename): mpData(NULL), mnSize(0), mnPos(0), mbGood(false), mbMapped(false)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd<0)
+        return;
+
+    struct stat st;
+    if(fstat(fd,&st)!=0 || st.st_size==0)
+    {
+        close(fd);
+        return;
+    }
+
+    void* mapping = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(mapping==MAP_FAILED)
+        return;
+
+    // The file is read once from start to end
+    madvise(mapping,st.st_size,MADV_SEQUENTIAL);
+
+    mpData = static_cast<const unsigned char*>(mapping);
+    mnSize = st.st_size;
+    mbGood = true;
+    mbMapped = true;
+}
+
+MapReader::MapReader(const char* pData, size_t size):
+    mpData(reinterpret_cast<const unsigned char*>(pData)), mnSize(size), mnPos(0), mbGood(pData!=NULL), mbMapped(false)
+{
+}
+
+MapReader::~MapReader()
+{
+    if(mbMapped)
+        munmap(const_cast<unsigned char*>(mpData),mnSize);
+}
+
+bool MapReader::Require(size_t n, size_t size)
+{
+    if(mbGood && (size==0 || n<=(mnSize-mnPos)/size))
+        return true;
+    mbGood = false;
+    return false;
+}
+
+bool MapReader::ReadBytes(void* p, size_t n)
+{
+    if(!Require(n,1))
+        return false;
+    memcpy(p,mpData+mnPos,n);
+    mnPos += n;
+    return true;
+}
+
+cv::Mat MapReader::ReadMat()
+{
+    const int rows = Read<int32_t>();
+    const int cols = Read<int32_t>();
+    const int type = Read<int32_t>();
+    if(rows<=0 || cols<=0)
+        return cv::Mat();
+
+    cv::Mat M;
+    M.create(rows,cols,type);
+    if(!Require(M.total(),M.elemSize()))
+        return cv::Mat();
+    ReadBytes(M.data,M.total()*M.elemSize());
+    return M;
+}
+
+vector<cv::KeyPoint> MapReader::ReadKeyPoints()
+{
+    const uint32_t n = Read<uint32_t>();
+    vector<cv::KeyPoint> vKeys;
+    if(!Require(n,5*sizeof(float)+sizeof(int32_t)))
+        return vKeys;
+
+    vKeys.resize(n);
+    for(uint32_t i=0; i<n; i++)
+    {
+        float v[5];
+        ReadBytes(v,sizeof(v));
+        cv::KeyPoint &kp = vKeys[i];
+        kp.pt.x = v[0];
+        kp.pt.y = v[1];
+        kp.size = v[2];
+        kp.angle = v[3];
+        kp.response = v[4];
+        kp.octave = Read<int32_t>();
+        kp.class_id = -1;
+    }
+    return vKeys;
+}
+
+void MapReader::ReadBowVector(DBoW2::BowVector &v)
+{
+    v.clear();
+    const uint32_t n = Read<uint32_t>();
+    if(!Require(n,sizeof(uint32_t)+sizeof(double)))
+        return;
+
+    // Entries were written in word id order
+    v.reserve(n);
+    for(uint32_t i=0; i<n; i++)
+    {
+        const DBoW2::WordId id = Read<uint32_t>();
+        const DBoW2::WordValue value = Read<double>();
+        v.push_back(make_pair(id,value));
+    }
+}
+
+void MapReader::ReadFeatureVector(DBoW2::FeatureVector &v)
+{
+    v.clear();
+    const uint32_t nNodes = Read<uint32_t>();
+    if(!Require(nNodes,2*sizeof(uint32_t)))
+        return;
+
+    vector<pair<DBoW2::NodeId,unsigned int> > vPairs;
+    for(uint32_t i=0; i<nNodes && mbGood; i++)
+    {
+        const DBoW2::NodeId id = Read<uint32_t>();
+        const uint32_t n = Read<uint32_t>();
+        if(!Require(n,sizeof(unsigned int)))
+            return;
+        for(uint32_t j=0; j<n; j++)
+            vPairs.push_back(make_pair(id,Read<unsigned int>()));
+    }
+    v.create(vPairs);
+}
+
+void MapSerializer::Staging::Clear()
+{
+    for(map<uint64_t,StagedMapPoint>::iterator mit=mMapPoints.begin(), mend=mMapPoints.end(); mit!=mend; mit++)
+        delete mit->second.pMP;
+    for(map<uint64_t,StagedKeyFrame>::iterator mit=mKeyFrames.begin(), mend=mKeyFrames.end(); mit!=mend; mit++)
+        delete mit->second.pKF;
+    mMapPoints.clear();
+    mKeyFrames.clear();
+    vOrigins.clear();
+}
+
+void MapSerializer::Staging::EraseKeyFrame(uint64_t nId)
+{
+    map<uint64_t,StagedKeyFrame>::iterator mit = mKeyFrames.find(nId);
+    if(mit==mKeyFrames.end())
+        return;
+    delete mit->second.pKF;
+    mKeyFrames.erase(mit);
+}
+
+void MapSerializer::Staging::EraseMapPoint(uint64_t nId)
+{
+    map<uint64_t,StagedMapPoint>::iterator mit = mMapPoints.find(nId);
+    if(mit==mMapPoints.end())
+        return;
+    delete mit->second.pMP;
+    mMapPoints.erase(mit);
+}
+
+MapSerializer::MapSerializer(Map* pMap, KeyFrameDatabase* pKFDB, ORBVocabulary* pVoc):
+    mpMap(pMap), mpKeyFrameDB(pKFDB), mpVocabulary(pVoc)
+{
+}
+
+bool MapSerializer::Save(const string &filename, const int sensor)
+{
+    MapWriter writer(filename);
+    if(!writer.good())
+        return false;
+
+    Save(writer,sensor);
+    return writer.Close();
+}
+
+bool MapSerializer::Save(MapWriter &writer, const int sensor)
+{
+    vector<KeyFrame*> vpKFs;
+    {
+        vector<KeyFrame*> vpAllKFs = mpMap->GetAllKeyFrames();
+        for(size_t i=0; i<vpAllKFs.size(); i++)
+            if(!vpAllKFs[i]->isBad())
+                vpKFs.push_back(vpAllKFs[i]);
+    }
+    sort(vpKFs.begin(),vpKFs.end(),KeyFrame::lId);
+
+    vector<MapPoint*> vpMPs;
+    {
+        vector<MapPoint*> vpAllMPs = mpMap->GetAllMapPoints();
+        for(size_t i=0; i<vpAllMPs.size(); i++)
+            if(!vpAllMPs[i]->isBad())
+                vpMPs.push_back(vpAllMPs[i]);
+    }
+    sort(vpMPs.begin(),vpMPs.end(),[](MapPoint* pMP1, MapPoint* pMP2){ return pMP1->mnId<pMP2->mnId; });
+
+    WriteHeader(writer,MAP_MAGIC,sensor,vpKFs.size(),vpMPs.size());
+
+    for(size_t i=0; i<vpKFs.size(); i++)
+        WriteKeyFrame(writer,vpKFs[i]);
+
+    for(size_t i=0; i<vpMPs.size(); i++)
+        WriteMapPoint(writer,vpMPs[i]);
+
+    vector<uint64_t> vOrigins;
+    for(size_t i=0; i<mpMap->mvpKeyFrameOrigins.size(); i++)
+        vOrigins.push_back(mpMap->mvpKeyFrameOrigins[i]->mnId);
+    writer.WriteVector(vOrigins);
+
+    return writer.good();
+}
+
+bool MapSerializer::Load(const string &filename, const int sensor)
+{
+    Staging staging;
+    if(!Read(filename,sensor,staging))
+        return false;
+
+    Publish(staging);
+    return true;
+}
+
+bool MapSerializer::Read(const string &filename, const int sensor, Staging &staging)
+{
+    MapReader reader(filename);
+    if(!reader.good())
+    {
+        cerr << "Failed to open map file at: " << filename << endl;
+        return false;
+    }
+
+    uint64_t nKeyFrames, nMapPoints;
+    if(!ReadHeader(reader,MAP_MAGIC,sensor,nKeyFrames,nMapPoints,staging))
+        return false;
+
+    bool bOK = true;
+    for(uint64_t i=0; i<nKeyFrames && bOK; i++)
+        bOK = ReadKeyFrame(reader,staging);
+
+    for(uint64_t i=0; i<nMapPoints && bOK; i++)
+        bOK = ReadMapPoint(reader,staging);
+
+    const vector<uint64_t> vOrigins = reader.ReadVector<uint64_t>();
+    staging.vOrigins.insert(staging.vOrigins.end(),vOrigins.begin(),vOrigins.end());
+
+    if(!bOK || !reader.good() || !reader.AtEnd())
+    {
+        cerr << "Map loading failure: the map file is truncated or corrupt." << endl;
+        return false;
+    }
+
+    return true;
+}
+
+void MapSerializer::WriteHeader(MapWriter &writer, const char* magic, const int sensor, uint64_t nKeyFrames, uint64_t nMapPoints)
+{
+    Header header;
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,magic,sizeof(header.magic));
+    header.version = MAP_VERSION;
+    header.sensor = sensor;
+    header.vocabularyWords = mpVocabulary->size();
+    header.vocabularyLevels = mpVocabulary->getDepthLevels();
+    header.nKeyFrames = nKeyFrames;
+    header.nMapPoints = nMapPoints;
+    writer.Write(header);
+}
+
+bool MapSerializer::ReadHeader(MapReader &reader, const char* magic, const int sensor, uint64_t &nKeyFrames,
+                               uint64_t &nMapPoints, Staging &staging)
+{
+    const Header header = reader.Read<Header>();
+    if(!reader.good() || memcmp(header.magic,magic,sizeof(header.magic))!=0)
+    {
+        cerr << "Map loading failure: This is not a correct map file!" << endl;
+        return false;
+    }
+
+    if(header.version!=MAP_VERSION)
+    {
+        cerr << "Map loading failure: the file has format version " << header.version << ", this build reads version "
+             << MAP_VERSION << ". The map must be built and saved again." << endl;
+        return false;
+    }
+
+    if(header.sensor!=sensor)
+    {
+        cerr << "Map loading failure: the map was built with a different input sensor." << endl;
+        return false;
+    }
+
+    // Stored BoW vectors use the word ids of the vocabulary the map was built with
+    if(header.vocabularyWords!=mpVocabulary->size() || header.vocabularyLevels!=mpVocabulary->getDepthLevels())
+        staging.bSameVocabulary = false;
+
+    nKeyFrames = header.nKeyFrames;
+    nMapPoints = header.nMapPoints;
+    return true;
+}
+
+void MapSerializer::WriteKeyFrame(MapWriter &writer, KeyFrame* pKF)
+{
+    pKF->Write(writer);
+    WriteKeyFrameLinks(writer,pKF);
+}
+
+void MapSerializer::WriteKeyFrameUpdate(MapWriter &writer, KeyFrame* pKF)
+{
+    writer.Write<uint64_t>(pKF->mnId);
+    writer.WriteMat(pKF->GetPose());
+    WriteKeyFrameLinks(writer,pKF);
+}
+
+void MapSerializer::WriteKeyFrameLinks(MapWriter &writer, KeyFrame* pKF)
+{
+    KeyFrame* pParent = pKF->GetParent();
+    writer.Write<int64_t>(pParent ? (int64_t)pParent->mnId : -1);
+
+    vector<pair<uint64_t,int32_t> > vConnections;
+    {
+        unique_lock<mutex> lock(pKF->mMutexConnections);
+        vConnections.reserve(pKF->mConnectedKeyFrameWeights.size());
+        for(map<KeyFrame*,int>::const_iterator mit=pKF->mConnectedKeyFrameWeights.begin(), mend=pKF->mConnectedKeyFrameWeights.end(); mit!=mend; mit++)
+            vConnections.push_back(make_pair(mit->first->mnId,mit->second));
+    }
+
+    writer.Write<uint32_t>(vConnections.size());
+    for(size_t i=0; i<vConnections.size(); i++)
+    {
+        writer.Write<uint64_t>(vConnections[i].first);
+        writer.Write<int32_t>(vConnections[i].second);
+    }
+
+    const set<KeyFrame*> spLoopEdges = pKF->GetLoopEdges();
+    vector<uint64_t> vLoopEdges;
+    for(set<KeyFrame*>::const_iterator sit=spLoopEdges.begin(), send=spLoopEdges.end(); sit!=send; sit++)
+        vLoopEdges.push_back((*sit)->mnId);
+    writer.WriteVector(vLoopEdges);
+}
+
+void MapSerializer::ReadKeyFrameLinks(MapReader &reader, StagedKeyFrame &skf)
+{
+    skf.nParentId = reader.Read<int64_t>();
+
+    const uint32_t nConnections = reader.Read<uint32_t>();
+    skf.vConnections.clear();
+    for(uint32_t i=0; i<nConnections && reader.good(); i++)
+    {
+        const uint64_t nId = reader.Read<uint64_t>();
+        const int32_t weight = reader.Read<int32_t>();
+        skf.vConnections.push_back(make_pair(nId,weight));
+    }
+
+    skf.vLoopEdges = reader.ReadVector<uint64_t>();
+}
+
+bool MapSerializer::ReadKeyFrame(MapReader &reader, Staging &staging)
+{
+    StagedKeyFrame skf;
+    skf.pKF = new KeyFrame(reader,mpMap,mpKeyFrameDB,mpVocabulary);
+    ReadKeyFrameLinks(reader,skf);
+
+    KeyFrame* pKF = skf.pKF;
+    const bool bConsistent = (int)pKF->mvKeys.size()==pKF->N && (int)pKF->mvKeysUn.size()==pKF->N &&
+                             (int)pKF->mvuRight.size()==pKF->N && (int)pKF->mvDepth.size()==pKF->N &&
+                             pKF->mDescriptors.rows==pKF->N && (int)pKF->mGrid.size()==pKF->mnGridCols &&
+                             !pKF->Tcw.empty();
+    if(!reader.good() || !bConsistent)
+    {
+        delete pKF;
+        return false;
+    }
+
+    staging.EraseKeyFrame(pKF->mnId);
+    staging.mKeyFrames[pKF->mnId] = skf;
+    return true;
+}
+
+bool MapSerializer::ReadKeyFrameUpdate(MapReader &reader, Staging &staging)
+{
+    const uint64_t nId = reader.Read<uint64_t>();
+    const cv::Mat Tcw = reader.ReadMat();
+    StagedKeyFrame skf;
+    ReadKeyFrameLinks(reader,skf);
+    if(!reader.good())
+        return false;
+
+    map<uint64_t,StagedKeyFrame>::iterator mit = staging.mKeyFrames.find(nId);
+    if(mit==staging.mKeyFrames.end())
+        return true;
+
+    if(Tcw.rows==4 && Tcw.cols==4 && Tcw.type()==CV_32F)
+        mit->second.pKF->SetPose(Tcw);
+    mit->second.nParentId = skf.nParentId;
+    mit->second.vConnections.swap(skf.vConnections);
+    mit->second.vLoopEdges.swap(skf.vLoopEdges);
+    return true;
+}
+
+void MapSerializer::WriteMapPoint(MapWriter &writer, MapPoint* pMP)
+{
+    pMP->Write(writer);
+
+    KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
+    writer.Write<int64_t>(pRefKF ? (int64_t)pRefKF->mnId : -1);
+
+    const map<KeyFrame*,size_t> observations = pMP->GetObservations();
+    writer.Write<uint32_t>(observations.size());
+    for(map<KeyFrame*,size_t>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    {
+        writer.Write<uint64_t>(mit->first->mnId);
+        writer.Write<uint32_t>(mit->second);
+    }
+}
+
+bool MapSerializer::ReadMapPoint(MapReader &reader, Staging &staging)
+{
+    StagedMapPoint smp;
+    smp.pMP = new MapPoint(reader,mpMap);
+    smp.nRefKFId = reader.Read<int64_t>();
+
+    const uint32_t nObs = reader.Read<uint32_t>();
+    for(uint32_t i=0; i<nObs && reader.good(); i++)
+    {
+        const uint64_t nKFId = reader.Read<uint64_t>();
+        const uint32_t idx = reader.Read<uint32_t>();
+        smp.vObservations.push_back(make_pair(nKFId,idx));
+    }
+
+    MapPoint* pMP = smp.pMP;
+    const bool bConsistent = pMP->mWorldPos.rows==3 && pMP->mNormalVector.rows==3 && !pMP->mDescriptor.empty();
+    if(!reader.good() || !bConsistent)
+    {
+        delete pMP;
+        return false;
+    }
+
+    staging.EraseMapPoint(pMP->mnId);
+    staging.mMapPoints[pMP->mnId] = smp;
+    return true;
+}
+
+void MapSerializer::Publish(Staging &staging)
+{
+    auto getKeyFrame = [&](int64_t nId) -> KeyFrame*
+    {
+        map<uint64_t,StagedKeyFrame>::iterator mit = staging.mKeyFrames.find(nId);
+        if(nId<0 || mit==staging.mKeyFrames.end())
+            return static_cast<KeyFrame*>(NULL);
+        return mit->second.pKF;
+    };
+
+    // Observations. A keypoint claimed by two map points (possible in a journal cut by a crash)
+    // keeps the first one.
+    vector<MapPoint*> vpMPs;
+    vpMPs.reserve(staging.mMapPoints.size());
+    for(map<uint64_t,StagedMapPoint>::iterator mit=staging.mMapPoints.begin(), mend=staging.mMapPoints.end(); mit!=mend; mit++)
+    {
+        StagedMapPoint &smp = mit->second;
+        MapPoint* pMP = smp.pMP;
+        for(size_t i=0; i<smp.vObservations.size(); i++)
+        {
+            KeyFrame* pKF = getKeyFrame(smp.vObservations[i].first);
+            const uint32_t idx = smp.vObservations[i].second;
+            if(!pKF || idx>=(uint32_t)pKF->N || pKF->GetMapPoint(idx))
+                continue;
+
+            pKF->AddMapPoint(pMP,idx);
+            pMP->AddObservation(pKF,idx);
+        }
+
+        map<KeyFrame*,size_t> observations = pMP->GetObservations();
+        if(observations.empty())
+        {
+            delete pMP;
+            continue;
+        }
+
+        KeyFrame* pRefKF = getKeyFrame(smp.nRefKFId);
+        if(!pRefKF || !observations.count(pRefKF))
+            pRefKF = observations.begin()->first;
+        pMP->mpRefKF = pRefKF;
+
+        vpMPs.push_back(pMP);
+    }
+
+    // Spanning tree, covisibility graph and loop edges
+    vector<KeyFrame*> vpKFs;
+    vpKFs.reserve(staging.mKeyFrames.size());
+    for(map<uint64_t,StagedKeyFrame>::iterator mit=staging.mKeyFrames.begin(), mend=staging.mKeyFrames.end(); mit!=mend; mit++)
+    {
+        StagedKeyFrame &skf = mit->second;
+        KeyFrame* pKF = skf.pKF;
+
+        KeyFrame* pParent = getKeyFrame(skf.nParentId);
+        if(pParent && pParent!=pKF)
+            pKF->ChangeParent(pParent);
+
+        // Set all weights first, the ordered covisibility list is built once
+        {
+            unique_lock<mutex> lock(pKF->mMutexConnections);
+            for(size_t i=0; i<skf.vConnections.size(); i++)
+            {
+                KeyFrame* pKF2 = getKeyFrame(skf.vConnections[i].first);
+                if(pKF2 && pKF2!=pKF)
+                    pKF->mConnectedKeyFrameWeights[pKF2] = skf.vConnections[i].second;
+            }
+        }
+        pKF->UpdateBestCovisibles();
+
+        for(size_t i=0; i<skf.vLoopEdges.size(); i++)
+        {
+            KeyFrame* pKF2 = getKeyFrame(skf.vLoopEdges[i]);
+            if(pKF2 && pKF2!=pKF)
+                pKF->AddLoopEdge(pKF2);
+        }
+
+        vpKFs.push_back(pKF);
+    }
+
+    for(size_t i=0; i<staging.vOrigins.size(); i++)
+    {
+        KeyFrame* pKF = getKeyFrame(staging.vOrigins[i]);
+        if(pKF && find(mpMap->mvpKeyFrameOrigins.begin(),mpMap->mvpKeyFrameOrigins.end(),pKF)==mpMap->mvpKeyFrameOrigins.end())
+            mpMap->mvpKeyFrameOrigins.push_back(pKF);
+    }
+    if(mpMap->mvpKeyFrameOrigins.empty() && !vpKFs.empty())
+        mpMap->mvpKeyFrameOrigins.push_back(vpKFs.front());
+
+    // The map, the database and the journal now own them
+    staging.mKeyFrames.clear();
+    staging.mMapPoints.clear();
+    staging.vOrigins.clear();
+
+    if(!staging.bSameVocabulary)
+        cout << "The map was built with a different vocabulary, recomputing BoW vectors..." << endl;
+
+    long unsigned int nMaxKFid = 0;
+    long unsigned int nMaxFrameId = 0;
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(!staging.bSameVocabulary)
+        {
+            pKF->mBowVec.clear();
+            pKF->mFeatVec.clear();
+            pKF->ComputeBoW();
+        }
+
+        mpMap->AddKeyFrame(pKF);
+        mpKeyFrameDB->add(pKF);
+        nMaxKFid = max(nMaxKFid,pKF->mnId);
+        nMaxFrameId = max(nMaxFrameId,pKF->mnFrameId);
+    }
+
+    long unsigned int nMaxMPid = 0;
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        mpMap->AddMapPoint(vpMPs[i]);
+        nMaxMPid = max(nMaxMPid,vpMPs[i]->mnId);
+    }
+
+    // New keyframes, map points and frames continue after the loaded ids
+    KeyFrame::nNextId = vpKFs.empty() ? 0 : nMaxKFid+1;
+    MapPoint::nNextId = vpMPs.empty() ? 0 : nMaxMPid+1;
+    Frame::nNextId = vpKFs.empty() ? 0 : nMaxFrameId+1;
+}
+
+} //namespace ORB_SLAM
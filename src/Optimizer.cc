@@ -31,12 +31,41 @@
 #include<Eigen/StdVector>
 
 #include "Converter.h"
+#include "PoseSolver.h"
+#include "OptimizerContext.h"
 
 #include<mutex>
 
 namespace ORB_SLAM2
 {
 
+typedef OptimizerContext<g2o::BlockSolver_6_3, g2o::LinearSolverEigen<g2o::BlockSolver_6_3::PoseMatrixType> > LocalBAContext;
+typedef OptimizerContext<g2o::BlockSolver_7_3, g2o::LinearSolverEigen<g2o::BlockSolver_7_3::PoseMatrixType> > EssentialGraphContext;
+typedef OptimizerContext<g2o::BlockSolverX, g2o::LinearSolverDense<g2o::BlockSolverX::PoseMatrixType> > Sim3Context;
+
+ThreadPool* Optimizer::mpThreadPool = NULL;
+int Optimizer::mnWorkers = 1;
+
+void Optimizer::SetThreadPool(ThreadPool* pThreadPool, const int nWorkers)
+{
+    mpThreadPool = pThreadPool;
+    mnWorkers = nWorkers;
+}
+
+void Optimizer::SetParallel(g2o::SparseOptimizer &optimizer)
+{
+    if(!mpThreadPool || mnWorkers<=1)
+    {
+        optimizer.setParallelFor(g2o::SparseOptimizer::ParallelFor(),1);
+        return;
+    }
+
+    ThreadPool* pThreadPool = mpThreadPool;
+    optimizer.setParallelFor([pThreadPool](int n, const std::function<void(int)> &f)
+    {
+        pThreadPool->ParallelFor(n,[&f](size_t i){ f(i); });
+    }, mnWorkers);
+}
 
 void Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
 {
@@ -45,9 +74,151 @@ void Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopF
     BundleAdjustment(vpKFs,vpMP,nIterations,pbStopFlag, nLoopKF, bRobust);
 }
 
+bool Optimizer::IncrementalBundleAdjustment(Map* pMap, const set<KeyFrame*> &spAffectedKFs, int nIterations, bool* pbStopFlag,
+                                            const unsigned long nLoopKF, const bool bRobust)
+{
+    // Affected keyframes and their best covisibles are optimized, so that the correction
+    // fades out towards the fixed keyframes around them
+    set<KeyFrame*> spFreeKFs;
+    for(set<KeyFrame*>::const_iterator sit=spAffectedKFs.begin(), send=spAffectedKFs.end(); sit!=send; sit++)
+    {
+        KeyFrame* pKF = *sit;
+        if(pKF->isBad())
+            continue;
+        spFreeKFs.insert(pKF);
+
+        const vector<KeyFrame*> vpNeighKFs = pKF->GetBestCovisibilityKeyFrames(10); //param
+        for(vector<KeyFrame*>::const_iterator vit=vpNeighKFs.begin(), vend=vpNeighKFs.end(); vit!=vend; vit++)
+        {
+            if(!(*vit)->isBad())
+                spFreeKFs.insert(*vit);
+        }
+    }
+
+    if(spFreeKFs.empty())
+        return false;
+
+    // Points seen by the optimized keyframes, with all their observations
+    set<MapPoint*> spMPs;
+    for(set<KeyFrame*>::iterator sit=spFreeKFs.begin(), send=spFreeKFs.end(); sit!=send; sit++)
+    {
+        const vector<MapPoint*> vpMPs = (*sit)->GetMapPointMatches();
+        for(vector<MapPoint*>::const_iterator vit=vpMPs.begin(), vend=vpMPs.end(); vit!=vend; vit++)
+        {
+            MapPoint* pMP = *vit;
+            if(pMP && !pMP->isBad())
+                spMPs.insert(pMP);
+        }
+    }
+
+    // The other keyframes observing them are fixed. Keyframes that see none of the points would have
+    // no edges and are left out, so the graph grows with the affected region and not with the map.
+    set<KeyFrame*> spKFs(spFreeKFs);
+    for(set<MapPoint*>::iterator sit=spMPs.begin(), send=spMPs.end(); sit!=send; sit++)
+    {
+        const map<KeyFrame*,size_t> observations = (*sit)->GetObservations();
+        for(map<KeyFrame*,size_t>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        {
+            if(!mit->first->isBad())
+                spKFs.insert(mit->first);
+        }
+    }
+
+    vector<KeyFrame*> vpKFs(spKFs.begin(),spKFs.end());
+    vector<MapPoint*> vpMP(spMPs.begin(),spMPs.end());
+    BundleAdjustment(vpKFs,vpMP,nIterations,pbStopFlag,nLoopKF,bRobust,&spFreeKFs);
+
+    // The result is propagated from the map origins through the spanning tree, the keyframes out of
+    // the graph follow their parent. The origins keep their pose if they were left out.
+    if(nLoopKF!=0)
+    {
+        for(size_t i=0; i<pMap->mvpKeyFrameOrigins.size(); i++)
+        {
+            KeyFrame* pKF = pMap->mvpKeyFrameOrigins[i];
+            if(spKFs.count(pKF))
+                continue;
+            pKF->mTcwGBA = pKF->GetPose();
+            pKF->mnBAGlobalForKF = nLoopKF;
+        }
+    }
+
+    return true;
+}
+
+void Optimizer::DetectAffectedKeyFrames(Map* pMap, set<KeyFrame*> &spAffectedKFs)
+{
+    const vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
+    vector<char> vbAffected(vpKFs.size(),false);
+
+    // Each keyframe only reads its own observations, keyframes are checked in parallel
+    auto checkKeyFrame = [&vpKFs,&vbAffected](size_t i)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(pKF->isBad())
+            return;
+
+        const cv::Mat Rcw = pKF->GetRotation();
+        const cv::Mat tcw = pKF->GetTranslation();
+        const vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
+
+        int nObs = 0;
+        int nBad = 0;
+        for(size_t j=0; j<vpMPs.size(); j++)
+        {
+            MapPoint* pMP = vpMPs[j];
+            if(!pMP || pMP->isBad())
+                continue;
+            nObs++;
+
+            const cv::Mat x3Dc = Rcw*pMP->GetWorldPos()+tcw;
+            const float z = x3Dc.at<float>(2);
+            if(z<=0)
+            {
+                nBad++;
+                continue;
+            }
+
+            const float invz = 1.0f/z;
+            const float u = pKF->fx*x3Dc.at<float>(0)*invz+pKF->cx;
+            const float v = pKF->fy*x3Dc.at<float>(1)*invz+pKF->cy;
+            const cv::KeyPoint &kpUn = pKF->mvKeysUn[j];
+            const float ex = kpUn.pt.x-u;
+            const float ey = kpUn.pt.y-v;
+            float e2 = ex*ex+ey*ey;
+            float th = 5.991;
+
+            const float kp_ur = pKF->mvuRight[j];
+            if(kp_ur>=0)
+            {
+                const float er = kp_ur-(u-pKF->mbf*invz);
+                e2 += er*er;
+                th = 7.815;
+            }
+
+            if(e2*pKF->mvInvLevelSigma2[kpUn.octave]>th)
+                nBad++;
+        }
+
+        vbAffected[i] = nObs>0 && nBad>0.1f*nObs; //param
+    };
+
+    if(mpThreadPool)
+        mpThreadPool->ParallelFor(vpKFs.size(),checkKeyFrame);
+    else
+        for(size_t i=0, iend=vpKFs.size(); i<iend; i++)
+            checkKeyFrame(i);
+
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        if(vbAffected[i])
+            spAffectedKFs.insert(vpKFs[i]);
+    }
+}
+
 
 void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<MapPoint *> &vpMP,
-                                 int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
+                                 int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust,
+                                 const set<KeyFrame*> *pspFreeKFs)
 {
     vector<bool> vbNotIncludedMP;
     vbNotIncludedMP.resize(vpMP.size());
@@ -61,6 +232,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
 
     g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
     optimizer.setAlgorithm(solver);
+    SetParallel(optimizer);
 
     if(pbStopFlag)
         optimizer.setForceStopFlag(pbStopFlag);
@@ -76,7 +248,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
         vSE3->setEstimate(Converter::toSE3Quat(pKF->GetPose()));
         vSE3->setId(pKF->mnId);
-        vSE3->setFixed(pKF->mnId==0);
+        vSE3->setFixed(pKF->mnId==0 || (pspFreeKFs && !pspFreeKFs->count(pKF)));
         optimizer.addVertex(vSE3);
         if(pKF->mnId>maxKFid)
             maxKFid=pKF->mnId;
@@ -106,7 +278,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         {
 
             KeyFrame* pKF = mit->first;
-            if(pKF->isBad() || pKF->mnId>maxKFid)
+            if(pKF->isBad() || pKF->mnId>maxKFid || !optimizer.vertex(pKF->mnId))
                 continue;
 
             nEdges++;
@@ -238,127 +410,63 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
 
 int Optimizer::PoseOptimization(Frame *pFrame)
 {
-    g2o::SparseOptimizer optimizer;
-    g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
-
-    linearSolver = new g2o::LinearSolverDense<g2o::BlockSolver_6_3::PoseMatrixType>();
-
-    g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
+    cv::Mat Tcw = pFrame->mTcw.clone();
+    const int nGood = PoseOptimization(*pFrame,Tcw,pFrame->mvpMapPoints,pFrame->mvbOutlier);
+    pFrame->SetPose(Tcw);
+    return nGood;
+}
 
-    g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
-    optimizer.setAlgorithm(solver);
+int Optimizer::PoseOptimization(const Frame &F, cv::Mat &Tcw, vector<MapPoint*> &vpMapPoints, vector<bool> &vbOutlier)
+{
+    // A single pose with fixed points: solved by the dedicated solver instead of a g2o graph
+    PoseSolver solver(F.fx,F.fy,F.cx,F.cy,F.mbf);
 
     int nInitialCorrespondences=0;
 
-    // Set Frame vertex
-    g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
-    vSE3->setEstimate(Converter::toSE3Quat(pFrame->mTcw));
-    vSE3->setId(0);
-    vSE3->setFixed(false);
-    optimizer.addVertex(vSE3);
-
-    // Set MapPoint vertices
-    const int N = pFrame->N;
-
-    vector<g2o::EdgeSE3ProjectXYZOnlyPose*> vpEdgesMono;
-    vector<size_t> vnIndexEdgeMono;
-    vpEdgesMono.reserve(N);
-    vnIndexEdgeMono.reserve(N);
-
-    vector<g2o::EdgeStereoSE3ProjectXYZOnlyPose*> vpEdgesStereo;
-    vector<size_t> vnIndexEdgeStereo;
-    vpEdgesStereo.reserve(N);
-    vnIndexEdgeStereo.reserve(N);
-
-    const float deltaMono = sqrt(5.991);
-    const float deltaStereo = sqrt(7.815);
+    // Set MapPoint observations
+    const int N = F.N;
 
+    vector<size_t> vnIndexObs;
+    vnIndexObs.reserve(N);
+    solver.Reserve(N);
 
+    // Positions of the matched points, all from the same epoch. Read again if an optimization
+    // published new positions meanwhile (a few attempts, the mapping threads are never waited for).
+    vector<float> vXw(3*N);
+    for(int attempt=0; attempt<3; attempt++)
     {
-    unique_lock<mutex> lock(MapPoint::mGlobalMutex);
+        const unsigned long epoch = MapPoint::GetPositionEpoch();
+        for(int i=0; i<N; i++)
+        {
+            MapPoint* pMP = vpMapPoints[i];
+            if(!pMP)
+                continue;
+            const cv::Mat Xw = pMP->GetWorldPos();
+            vXw[3*i] = Xw.at<float>(0);
+            vXw[3*i+1] = Xw.at<float>(1);
+            vXw[3*i+2] = Xw.at<float>(2);
+        }
+        if(!(epoch & 1) && epoch==MapPoint::GetPositionEpoch())
+            break;
+    }
 
     for(int i=0; i<N; i++)
     {
-        MapPoint* pMP = pFrame->mvpMapPoints[i];
+        MapPoint* pMP = vpMapPoints[i];
         if(pMP)
         {
-            // Monocular observation
-            if(pFrame->mvuRight[i]<0)
-            {
-                nInitialCorrespondences++;
-                pFrame->mvbOutlier[i] = false;
-
-                Eigen::Matrix<double,2,1> obs;
-                const cv::KeyPoint &kpUn = pFrame->mvKeysUn[i];
-                obs << kpUn.pt.x, kpUn.pt.y;
+            // Monocular observation if mvuRight<0, stereo otherwise
+            nInitialCorrespondences++;
+            vbOutlier[i] = false;
 
-                g2o::EdgeSE3ProjectXYZOnlyPose* e = new g2o::EdgeSE3ProjectXYZOnlyPose();
+            const cv::KeyPoint &kpUn = F.mvKeysUn[i];
+            const float invSigma2 = F.mvInvLevelSigma2[kpUn.octave];
+            solver.AddObservation(vXw[3*i],vXw[3*i+1],vXw[3*i+2],kpUn.pt.x,kpUn.pt.y,F.mvuRight[i],invSigma2);
 
-                e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(0)));
-                e->setMeasurement(obs);
-                const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
-                e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
-
-                g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                e->setRobustKernel(rk);
-                rk->setDelta(deltaMono);
-
-                e->fx = pFrame->fx;
-                e->fy = pFrame->fy;
-                e->cx = pFrame->cx;
-                e->cy = pFrame->cy;
-                cv::Mat Xw = pMP->GetWorldPos();
-                e->Xw[0] = Xw.at<float>(0);
-                e->Xw[1] = Xw.at<float>(1);
-                e->Xw[2] = Xw.at<float>(2);
-
-                optimizer.addEdge(e);
-
-                vpEdgesMono.push_back(e);
-                vnIndexEdgeMono.push_back(i);
-            }
-            else  // Stereo observation
-            {
-                nInitialCorrespondences++;
-                pFrame->mvbOutlier[i] = false;
-
-                //SET EDGE
-                Eigen::Matrix<double,3,1> obs;
-                const cv::KeyPoint &kpUn = pFrame->mvKeysUn[i];
-                const float &kp_ur = pFrame->mvuRight[i];
-                obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
-
-                g2o::EdgeStereoSE3ProjectXYZOnlyPose* e = new g2o::EdgeStereoSE3ProjectXYZOnlyPose();
-
-                e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(0)));
-                e->setMeasurement(obs);
-                const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
-                Eigen::Matrix3d Info = Eigen::Matrix3d::Identity()*invSigma2;
-                e->setInformation(Info);
-
-                g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                e->setRobustKernel(rk);
-                rk->setDelta(deltaStereo);
-
-                e->fx = pFrame->fx;
-                e->fy = pFrame->fy;
-                e->cx = pFrame->cx;
-                e->cy = pFrame->cy;
-                e->bf = pFrame->mbf;
-                cv::Mat Xw = pMP->GetWorldPos();
-                e->Xw[0] = Xw.at<float>(0);
-                e->Xw[1] = Xw.at<float>(1);
-                e->Xw[2] = Xw.at<float>(2);
-
-                optimizer.addEdge(e);
-
-                vpEdgesStereo.push_back(e);
-                vnIndexEdgeStereo.push_back(i);
-            }
+            vnIndexObs.push_back(i);
         }
 
     }
-    }
 
 
     if(nInitialCorrespondences<3) // param
@@ -370,82 +478,51 @@ int Optimizer::PoseOptimization(Frame *pFrame)
     const float chi2Stereo[4]={7.815,7.815,7.815, 7.815};
     const int its[4]={10,10,10,10}; //param
 
+    const Eigen::Matrix3d Rcw = Converter::toMatrix3d(Tcw.rowRange(0,3).colRange(0,3));
+    const Eigen::Vector3d tcw = Converter::toVector3d(Tcw.rowRange(0,3).col(3));
+
+    Eigen::Quaterniond q;
+    Eigen::Vector3d t;
+    vector<double> vChi2;
+
     int nBad=0;
     for(size_t it=0; it<4; it++)
     {
-
-        vSE3->setEstimate(Converter::toSE3Quat(pFrame->mTcw));
-        optimizer.initializeOptimization(0);
-        optimizer.optimize(its[it]);
+        q = Eigen::Quaterniond(Rcw);
+        t = tcw;
+        solver.Optimize(q,t,its[it]);
+        solver.ComputeChi2(q,t,vChi2);
 
         nBad=0;
-        for(size_t i=0, iend=vpEdgesMono.size(); i<iend; i++)
+        for(size_t i=0, iend=vnIndexObs.size(); i<iend; i++)
         {
-            g2o::EdgeSE3ProjectXYZOnlyPose* e = vpEdgesMono[i];
-
-            const size_t idx = vnIndexEdgeMono[i];
-
-            if(pFrame->mvbOutlier[idx])
-            {
-                e->computeError();
-            }
+            const size_t idx = vnIndexObs[i];
 
-            const float chi2 = e->chi2();
+            const float chi2 = vChi2[i];
+            const float th = F.mvuRight[idx]<0 ? chi2Mono[it] : chi2Stereo[it];
 
-            if(chi2>chi2Mono[it])
+            if(chi2>th)
             {
-                pFrame->mvbOutlier[idx]=true;
-                e->setLevel(1);
+                vbOutlier[idx]=true;
+                solver.SetActive(i,false);
                 nBad++;
             }
             else
             {
-                pFrame->mvbOutlier[idx]=false;
-                e->setLevel(0);
+                vbOutlier[idx]=false;
+                solver.SetActive(i,true);
             }
-
-            if(it==2)
-                e->setRobustKernel(0);
         }
 
-        for(size_t i=0, iend=vpEdgesStereo.size(); i<iend; i++)
-        {
-            g2o::EdgeStereoSE3ProjectXYZOnlyPose* e = vpEdgesStereo[i];
-
-            const size_t idx = vnIndexEdgeStereo[i];
-
-            if(pFrame->mvbOutlier[idx])
-            {
-                e->computeError();
-            }
-
-            const float chi2 = e->chi2();
-
-            if(chi2>chi2Stereo[it])
-            {
-                pFrame->mvbOutlier[idx]=true;
-                e->setLevel(1);
-                nBad++;
-            }
-            else
-            {
-                e->setLevel(0);
-                pFrame->mvbOutlier[idx]=false;
-            }
-
-            if(it==2)
-                e->setRobustKernel(0);
-        }
+        if(it==2)
+            solver.SetRobust(false);
 
-        if(optimizer.edges().size()<10) //param
+        if(nInitialCorrespondences<10) //param
             break;
     }
 
     // Recover optimized pose and return number of inliers
-    g2o::VertexSE3Expmap* vSE3_recov = static_cast<g2o::VertexSE3Expmap*>(optimizer.vertex(0));
-    g2o::SE3Quat SE3quat_recov = vSE3_recov->estimate();
-    cv::Mat pose = Converter::toCvMat(SE3quat_recov);
-    pFrame->SetPose(pose);
+    Tcw = Converter::toCvSE3(q.toRotationMatrix(),t);
 
     return nInitialCorrespondences-nBad;
 }
@@ -503,16 +580,10 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
         }
     }
 
-    // Setup optimizer
-    g2o::SparseOptimizer optimizer;
-    g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
-
-    linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolver_6_3::PoseMatrixType>();
-
-    g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
-
-    g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
-    optimizer.setAlgorithm(solver);
+    // Setup optimizer, kept by this thread between calls with its vertices and edges
+    LocalBAContext::Session session;
+    g2o::SparseOptimizer &optimizer = session.Optimizer();
+    SetParallel(optimizer);
 
     if(pbStopFlag)
         optimizer.setForceStopFlag(pbStopFlag);
@@ -523,7 +594,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
     for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
     {
         KeyFrame* pKFi = *lit;
-        g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
+        g2o::VertexSE3Expmap * vSE3 = session.New<g2o::VertexSE3Expmap>();
         vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose()));
         vSE3->setId(pKFi->mnId);
         vSE3->setFixed(pKFi->mnId==0);
@@ -536,7 +607,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
     for(list<KeyFrame*>::iterator lit=lFixedCameras.begin(), lend=lFixedCameras.end(); lit!=lend; lit++)
     {
         KeyFrame* pKFi = *lit;
-        g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
+        g2o::VertexSE3Expmap * vSE3 = session.New<g2o::VertexSE3Expmap>();
         vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose()));
         vSE3->setId(pKFi->mnId);
         vSE3->setFixed(true);
@@ -572,7 +643,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
     for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
     {
         MapPoint* pMP = *lit;
-        g2o::VertexSBAPointXYZ* vPoint = new g2o::VertexSBAPointXYZ();
+        g2o::VertexSBAPointXYZ* vPoint = session.New<g2o::VertexSBAPointXYZ>();
         vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos()));
         int id = pMP->mnId+maxKFid+1;
         vPoint->setId(id);
@@ -596,7 +667,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
                     Eigen::Matrix<double,2,1> obs;
                     obs << kpUn.pt.x, kpUn.pt.y;
 
-                    g2o::EdgeSE3ProjectXYZ* e = new g2o::EdgeSE3ProjectXYZ();
+                    g2o::EdgeSE3ProjectXYZ* e = session.New<g2o::EdgeSE3ProjectXYZ>();
 
                     e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
                     e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)));
@@ -604,9 +675,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
                     const float &invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave];
                     e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
 
-                    g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                    e->setRobustKernel(rk);
-                    rk->setDelta(thHuberMono);
+                    LocalBAContext::SetHuber(e,thHuberMono);
 
                     e->fx = pKFi->fx;
                     e->fy = pKFi->fy;
@@ -624,7 +693,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
                     const float kp_ur = pKFi->mvuRight[mit->second];
                     obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
 
-                    g2o::EdgeStereoSE3ProjectXYZ* e = new g2o::EdgeStereoSE3ProjectXYZ();
+                    g2o::EdgeStereoSE3ProjectXYZ* e = session.New<g2o::EdgeStereoSE3ProjectXYZ>();
 
                     e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
                     e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)));
@@ -633,9 +702,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
                     Eigen::Matrix3d Info = Eigen::Matrix3d::Identity()*invSigma2;
                     e->setInformation(Info);
 
-                    g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                    e->setRobustKernel(rk);
-                    rk->setDelta(thHuberStereo);
+                    LocalBAContext::SetHuber(e,thHuberStereo);
 
                     e->fx = pKFi->fx;
                     e->fy = pKFi->fy;
@@ -756,25 +823,328 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
         }
     }
 
-    // Recover optimized data
-
-    //Keyframes
-    for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
+    // Recover optimized data, published as one epoch
     {
-        KeyFrame* pKF = *lit;
-        g2o::VertexSE3Expmap* vSE3 = static_cast<g2o::VertexSE3Expmap*>(optimizer.vertex(pKF->mnId));
-        g2o::SE3Quat SE3quat = vSE3->estimate();
-        pKF->SetPose(Converter::toCvMat(SE3quat));
+        MapPoint::PositionBatch batch;
+
+        //Keyframes
+        for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
+        {
+            KeyFrame* pKF = *lit;
+            g2o::VertexSE3Expmap* vSE3 = static_cast<g2o::VertexSE3Expmap*>(optimizer.vertex(pKF->mnId));
+            g2o::SE3Quat SE3quat = vSE3->estimate();
+            pKF->SetPose(Converter::toCvMat(SE3quat));
+        }
+
+        //Points
+        for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
+        {
+            MapPoint* pMP = *lit;
+            g2o::VertexSBAPointXYZ* vPoint = static_cast<g2o::VertexSBAPointXYZ*>(optimizer.vertex(pMP->mnId+maxKFid+1));
+            pMP->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
+        }
     }
 
-    //Points
     for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
+        (*lit)->UpdateNormalAndDepth();
+}
+
+void Optimizer::SlidingWindowBundleAdjustment(KeyFrame *pKF, SlidingWindow &window, Map* pMap)
+{
+    window.Update(pKF,pMap);
+
+    const vector<KeyFrame*> &vpWindowKFs = window.KeyFrames();
+    if(vpWindowKFs.size()<2)
+        return;
+
+    // Local MapPoints: seen by at least two keyframes of the window with observations not in the prior.
+    // Points marginalized before are fixed, one observation is enough for them.
+    vector<MapPoint*> vpLocalMapPoints;
+    map<MapPoint*,int> mnWindowObs;
+    for(size_t i=0; i<vpWindowKFs.size(); i++)
     {
-        MapPoint* pMP = *lit;
-        g2o::VertexSBAPointXYZ* vPoint = static_cast<g2o::VertexSBAPointXYZ*>(optimizer.vertex(pMP->mnId+maxKFid+1));
-        pMP->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
-        pMP->UpdateNormalAndDepth();
+        KeyFrame* pKFi = vpWindowKFs[i];
+        const vector<MapPoint*> vpMPs = pKFi->GetMapPointMatches();
+        for(size_t j=0; j<vpMPs.size(); j++)
+        {
+            MapPoint* pMP = vpMPs[j];
+            if(!pMP || pMP->isBad() || window.IsMarginalized(pKFi,pMP))
+                continue;
+            if(mnWindowObs[pMP]++==0)
+                vpLocalMapPoints.push_back(pMP);
+        }
     }
+
+    // Setup optimizer, kept by this thread between calls with its vertices and edges
+    LocalBAContext::Session session;
+    g2o::SparseOptimizer &optimizer = session.Optimizer();
+    SetParallel(optimizer);
+
+    // Start from the damping where the previous window stopped
+    if(window.Lambda()>0)
+        session.Algorithm()->setUserLambdaInit(window.Lambda());
+
+    unsigned long maxKFid = 0;
+
+    // Set window KeyFrame vertices, the oldest are fixed
+    for(size_t i=0; i<vpWindowKFs.size(); i++)
+    {
+        KeyFrame* pKFi = vpWindowKFs[i];
+        pKFi->mnBALocalForKF = pKF->mnId;
+        g2o::VertexSE3Expmap * vSE3 = session.New<g2o::VertexSE3Expmap>();
+        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose()));
+        vSE3->setId(pKFi->mnId);
+        vSE3->setFixed(i<window.FixedKeyFrames() || pKFi->mnId==0);
+        optimizer.addVertex(vSE3);
+        if(pKFi->mnId>maxKFid)
+            maxKFid=pKFi->mnId;
+    }
+
+    // Prior of the marginalized keyframes, six rows per edge
+    vector<KeyFrame*> vpPriorKFs;
+    SlidingWindow::PoseVector vT0;
+    Eigen::MatrixXd Jprior;
+    Eigen::VectorXd r0prior;
+    map<KeyFrame*,int> mPriorIndex;
+    if(window.GetPrior(vpPriorKFs,vT0,Jprior,r0prior))
+    {
+        const int nPriorKFs = vpPriorKFs.size();
+        for(int k=0; k<nPriorKFs; k++)
+            mPriorIndex[vpPriorKFs[k]] = k;
+
+        for(int row=0; row<Jprior.rows(); row+=6)
+        {
+            const int nRows = min(6,(int)Jprior.rows()-row);
+
+            g2o::EdgeSE3LinearPrior* e = session.New<g2o::EdgeSE3LinearPrior>();
+            e->resize(nPriorKFs);
+            e->r0.setZero();
+            e->r0.head(nRows) = r0prior.segment(row,nRows);
+            for(int k=0; k<nPriorKFs; k++)
+            {
+                e->setVertex(k, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(vpPriorKFs[k]->mnId)));
+                e->J[k].setZero();
+                e->J[k].topRows(nRows) = Jprior.block(row,6*k,nRows,6);
+                e->T0[k] = vT0[k];
+            }
+            e->setInformation(g2o::Matrix6d::Identity());
+            optimizer.addEdge(e);
+        }
+    }
+
+    // Set MapPoint vertices
+    const int nExpectedSize = vpWindowKFs.size()*vpLocalMapPoints.size();
+
+    vector<g2o::EdgeSE3ProjectXYZ*> vpEdgesMono;
+    vpEdgesMono.reserve(nExpectedSize);
+
+    vector<KeyFrame*> vpEdgeKFMono;
+    vpEdgeKFMono.reserve(nExpectedSize);
+
+    vector<MapPoint*> vpMapPointEdgeMono;
+    vpMapPointEdgeMono.reserve(nExpectedSize);
+
+    vector<g2o::EdgeStereoSE3ProjectXYZ*> vpEdgesStereo;
+    vpEdgesStereo.reserve(nExpectedSize);
+
+    vector<KeyFrame*> vpEdgeKFStereo;
+    vpEdgeKFStereo.reserve(nExpectedSize);
+
+    vector<MapPoint*> vpMapPointEdgeStereo;
+    vpMapPointEdgeStereo.reserve(nExpectedSize);
+
+    const float thHuberMono = sqrt(5.991);
+    const float thHuberStereo = sqrt(7.815);
+
+    vector<MapPoint*> vpOptimizedMapPoints;
+    vpOptimizedMapPoints.reserve(vpLocalMapPoints.size());
+
+    for(size_t i=0; i<vpLocalMapPoints.size(); i++)
+    {
+        MapPoint* pMP = vpLocalMapPoints[i];
+        const bool bFixed = window.IsMarginalized(pMP);
+        if(!bFixed && mnWindowObs[pMP]<2)
+            continue;
+
+        g2o::VertexSBAPointXYZ* vPoint = session.New<g2o::VertexSBAPointXYZ>();
+        vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos()));
+        int id = pMP->mnId+maxKFid+1;
+        vPoint->setId(id);
+        if(bFixed)
+            vPoint->setFixed(true);
+        else
+            vPoint->setMarginalized(true);
+        optimizer.addVertex(vPoint);
+        if(!bFixed)
+            vpOptimizedMapPoints.push_back(pMP);
+
+        const map<KeyFrame*,size_t> observations = pMP->GetObservations();
+
+        //Set edges, only from the window
+        for(map<KeyFrame*,size_t>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        {
+            KeyFrame* pKFi = mit->first;
+
+            if(pKFi->mnBALocalForKF!=pKF->mnId || pKFi->isBad() || window.IsMarginalized(pKFi,pMP))
+                continue;
+
+            const cv::KeyPoint &kpUn = pKFi->mvKeysUn[mit->second];
+
+            // Keyframes in the prior keep its linearization point for their Jacobians
+            map<KeyFrame*,int>::const_iterator itPrior = mPriorIndex.find(pKFi);
+            const bool bFEJ = itPrior!=mPriorIndex.end();
+
+            // Monocular observation
+            if(pKFi->mvuRight[mit->second]<0)
+            {
+                Eigen::Matrix<double,2,1> obs;
+                obs << kpUn.pt.x, kpUn.pt.y;
+
+                g2o::EdgeSE3ProjectXYZ* e;
+                if(bFEJ)
+                {
+                    g2o::EdgeSE3ProjectXYZFEJ* eFEJ = session.New<g2o::EdgeSE3ProjectXYZFEJ>();
+                    eFEJ->Tlin = vT0[itPrior->second];
+                    e = eFEJ;
+                }
+                else
+                    e = session.New<g2o::EdgeSE3ProjectXYZ>();
+
+                e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
+                e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)));
+                e->setMeasurement(obs);
+                const float &invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave];
+                e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
+
+                LocalBAContext::SetHuber(e,thHuberMono);
+
+                e->fx = pKFi->fx;
+                e->fy = pKFi->fy;
+                e->cx = pKFi->cx;
+                e->cy = pKFi->cy;
+
+                optimizer.addEdge(e);
+                vpEdgesMono.push_back(e);
+                vpEdgeKFMono.push_back(pKFi);
+                vpMapPointEdgeMono.push_back(pMP);
+            }
+            else // Stereo observation
+            {
+                Eigen::Matrix<double,3,1> obs;
+                const float kp_ur = pKFi->mvuRight[mit->second];
+                obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
+
+                g2o::EdgeStereoSE3ProjectXYZ* e;
+                if(bFEJ)
+                {
+                    g2o::EdgeStereoSE3ProjectXYZFEJ* eFEJ = session.New<g2o::EdgeStereoSE3ProjectXYZFEJ>();
+                    eFEJ->Tlin = vT0[itPrior->second];
+                    e = eFEJ;
+                }
+                else
+                    e = session.New<g2o::EdgeStereoSE3ProjectXYZ>();
+
+                e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
+                e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)));
+                e->setMeasurement(obs);
+                const float &invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave];
+                Eigen::Matrix3d Info = Eigen::Matrix3d::Identity()*invSigma2;
+                e->setInformation(Info);
+
+                LocalBAContext::SetHuber(e,thHuberStereo);
+
+                e->fx = pKFi->fx;
+                e->fy = pKFi->fy;
+                e->cx = pKFi->cx;
+                e->cy = pKFi->cy;
+                e->bf = pKFi->mbf;
+
+                optimizer.addEdge(e);
+                vpEdgesStereo.push_back(e);
+                vpEdgeKFStereo.push_back(pKFi);
+                vpMapPointEdgeStereo.push_back(pMP);
+            }
+        }
+    }
+
+    // Single pass, the window is small and starts from the previous solution. It is not aborted by new
+    // keyframes so that every keyframe gets the same optimization.
+    optimizer.initializeOptimization();
+    optimizer.optimize(window.Iterations());
+
+    window.SetLambda(session.Algorithm()->currentLambda());
+
+    vector<pair<KeyFrame*,MapPoint*> > vToErase;
+    vToErase.reserve(vpEdgesMono.size()+vpEdgesStereo.size());
+
+    // Check inlier observations
+    for(size_t i=0, iend=vpEdgesMono.size(); i<iend;i++)
+    {
+        g2o::EdgeSE3ProjectXYZ* e = vpEdgesMono[i];
+        MapPoint* pMP = vpMapPointEdgeMono[i];
+
+        if(pMP->isBad())
+            continue;
+
+        if(e->chi2()>5.991 || !e->isDepthPositive())
+        {
+            KeyFrame* pKFi = vpEdgeKFMono[i];
+            vToErase.push_back(make_pair(pKFi,pMP));
+        }
+    }
+
+    for(size_t i=0, iend=vpEdgesStereo.size(); i<iend;i++)
+    {
+        g2o::EdgeStereoSE3ProjectXYZ* e = vpEdgesStereo[i];
+        MapPoint* pMP = vpMapPointEdgeStereo[i];
+
+        if(pMP->isBad())
+            continue;
+
+        if(e->chi2()>7.815 || !e->isDepthPositive())
+        {
+            KeyFrame* pKFi = vpEdgeKFStereo[i];
+            vToErase.push_back(make_pair(pKFi,pMP));
+        }
+    }
+
+    // Get Map Mutex
+    unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+
+    if(!vToErase.empty())
+    {
+        for(size_t i=0;i<vToErase.size();i++)
+        {
+            KeyFrame* pKFi = vToErase[i].first;
+            MapPoint* pMPi = vToErase[i].second;
+            pKFi->EraseMapPointMatch(pMPi);
+            pMPi->EraseObservation(pKFi);
+        }
+    }
+
+    // Recover optimized data, published as one epoch
+    {
+        MapPoint::PositionBatch batch;
+
+        //Keyframes
+        for(size_t i=0; i<vpWindowKFs.size(); i++)
+        {
+            KeyFrame* pKFi = vpWindowKFs[i];
+            g2o::VertexSE3Expmap* vSE3 = static_cast<g2o::VertexSE3Expmap*>(optimizer.vertex(pKFi->mnId));
+            pKFi->SetPose(Converter::toCvMat(vSE3->estimate()));
+        }
+
+        //Points
+        for(size_t i=0; i<vpOptimizedMapPoints.size(); i++)
+        {
+            MapPoint* pMP = vpOptimizedMapPoints[i];
+            g2o::VertexSBAPointXYZ* vPoint = static_cast<g2o::VertexSBAPointXYZ*>(optimizer.vertex(pMP->mnId+maxKFid+1));
+            pMP->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
+        }
+    }
+
+    for(size_t i=0; i<vpOptimizedMapPoints.size(); i++)
+        vpOptimizedMapPoints[i]->UpdateNormalAndDepth();
 }
 
 
@@ -783,16 +1153,12 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3,
                                        const map<KeyFrame *, set<KeyFrame *> > &LoopConnections, const bool &bFixScale)
 {
-    // Setup optimizer
-    g2o::SparseOptimizer optimizer;
+    // Setup optimizer, kept by this thread between calls with its vertices and edges
+    EssentialGraphContext::Session session;
+    g2o::SparseOptimizer &optimizer = session.Optimizer();
     optimizer.setVerbose(false);
-    g2o::BlockSolver_7_3::LinearSolverType * linearSolver =
-           new g2o::LinearSolverEigen<g2o::BlockSolver_7_3::PoseMatrixType>();
-    g2o::BlockSolver_7_3 * solver_ptr= new g2o::BlockSolver_7_3(linearSolver);
-    g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
-
-    solver->setUserLambdaInit(1e-16);
-    optimizer.setAlgorithm(solver);
+    SetParallel(optimizer);
+    session.Algorithm()->setUserLambdaInit(1e-16);
 
     const vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
     const vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
@@ -811,7 +1177,7 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
         KeyFrame* pKF = vpKFs[i];
         if(pKF->isBad())
             continue;
-        g2o::VertexSim3Expmap* VSim3 = new g2o::VertexSim3Expmap();
+        g2o::VertexSim3Expmap* VSim3 = session.New<g2o::VertexSim3Expmap>();
 
         const int nIDi = pKF->mnId;
 
@@ -866,7 +1232,7 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
             const g2o::Sim3 Sjw = vScw[nIDj];
             const g2o::Sim3 Sji = Sjw * Swi;
 
-            g2o::EdgeSim3* e = new g2o::EdgeSim3();
+            g2o::EdgeSim3* e = session.New<g2o::EdgeSim3>();
             e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDj)));
             e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDi)));
             e->setMeasurement(Sji);
@@ -913,7 +1279,7 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
 
             g2o::Sim3 Sji = Sjw * Swi;
 
-            g2o::EdgeSim3* e = new g2o::EdgeSim3();
+            g2o::EdgeSim3* e = session.New<g2o::EdgeSim3>();
             e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDj)));
             e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDi)));
             e->setMeasurement(Sji);
@@ -939,7 +1305,7 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
                     Slw = vScw[pLKF->mnId];
 
                 g2o::Sim3 Sli = Slw * Swi;
-                g2o::EdgeSim3* el = new g2o::EdgeSim3();
+                g2o::EdgeSim3* el = session.New<g2o::EdgeSim3>();
                 el->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pLKF->mnId)));
                 el->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDi)));
                 el->setMeasurement(Sli);
@@ -971,7 +1337,7 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
 
                     g2o::Sim3 Sni = Snw * Swi;
 
-                    g2o::EdgeSim3* en = new g2o::EdgeSim3();
+                    g2o::EdgeSim3* en = session.New<g2o::EdgeSim3>();
                     en->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFn->mnId)));
                     en->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDi)));
                     en->setMeasurement(Sni);
@@ -988,72 +1354,75 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
 
     unique_lock<mutex> lock(pMap->mMutexMapUpdate);
 
-    // SE3 Pose Recovering. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
-    for(size_t i=0;i<vpKFs.size();i++)
+    // Corrected poses and points are published as one epoch
     {
-        KeyFrame* pKFi = vpKFs[i];
+        MapPoint::PositionBatch batch;
 
-        const int nIDi = pKFi->mnId;
-
-        g2o::VertexSim3Expmap* VSim3 = static_cast<g2o::VertexSim3Expmap*>(optimizer.vertex(nIDi));
-        g2o::Sim3 CorrectedSiw =  VSim3->estimate();
-        vCorrectedSwc[nIDi]=CorrectedSiw.inverse();
-        Eigen::Matrix3d eigR = CorrectedSiw.rotation().toRotationMatrix();
-        Eigen::Vector3d eigt = CorrectedSiw.translation();
-        double s = CorrectedSiw.scale();
-
-        eigt *=(1./s); //[R t/s;0 1]
+        // SE3 Pose Recovering. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
+        for(size_t i=0;i<vpKFs.size();i++)
+        {
+            KeyFrame* pKFi = vpKFs[i];
 
-        cv::Mat Tiw = Converter::toCvSE3(eigR,eigt);
+            const int nIDi = pKFi->mnId;
 
-        pKFi->SetPose(Tiw);
-    }
+            g2o::VertexSim3Expmap* VSim3 = static_cast<g2o::VertexSim3Expmap*>(optimizer.vertex(nIDi));
+            g2o::Sim3 CorrectedSiw =  VSim3->estimate();
+            vCorrectedSwc[nIDi]=CorrectedSiw.inverse();
+            Eigen::Matrix3d eigR = CorrectedSiw.rotation().toRotationMatrix();
+            Eigen::Vector3d eigt = CorrectedSiw.translation();
+            double s = CorrectedSiw.scale();
 
-    // Correct points. Transform to "non-optimized" reference keyframe pose and transform back with optimized pose
-    for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
-    {
-        MapPoint* pMP = vpMPs[i];
+            eigt *=(1./s); //[R t/s;0 1]
 
-        if(pMP->isBad())
-            continue;
+            cv::Mat Tiw = Converter::toCvSE3(eigR,eigt);
 
-        int nIDr;
-        if(pMP->mnCorrectedByKF==pCurKF->mnId)
-        {
-            nIDr = pMP->mnCorrectedReference;
+            pKFi->SetPose(Tiw);
         }
-        else
+
+        // Correct points. Transform to "non-optimized" reference keyframe pose and transform back with optimized pose
+        for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
         {
-            KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
-            nIDr = pRefKF->mnId;
-        }
+            MapPoint* pMP = vpMPs[i];
+
+            if(pMP->isBad())
+                continue;
+
+            int nIDr;
+            if(pMP->mnCorrectedByKF==pCurKF->mnId)
+            {
+                nIDr = pMP->mnCorrectedReference;
+            }
+            else
+            {
+                KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
+                nIDr = pRefKF->mnId;
+            }
 
 
-        g2o::Sim3 Srw = vScw[nIDr];
-        g2o::Sim3 correctedSwr = vCorrectedSwc[nIDr];
+            g2o::Sim3 Srw = vScw[nIDr];
+            g2o::Sim3 correctedSwr = vCorrectedSwc[nIDr];
 
-        cv::Mat P3Dw = pMP->GetWorldPos();
-        Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(P3Dw);
-        Eigen::Matrix<double,3,1> eigCorrectedP3Dw = correctedSwr.map(Srw.map(eigP3Dw));
+            cv::Mat P3Dw = pMP->GetWorldPos();
+            Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(P3Dw);
+            Eigen::Matrix<double,3,1> eigCorrectedP3Dw = correctedSwr.map(Srw.map(eigP3Dw));
 
-        cv::Mat cvCorrectedP3Dw = Converter::toCvMat(eigCorrectedP3Dw);
-        pMP->SetWorldPos(cvCorrectedP3Dw);
+            cv::Mat cvCorrectedP3Dw = Converter::toCvMat(eigCorrectedP3Dw);
+            pMP->SetWorldPos(cvCorrectedP3Dw);
+        }
+    }
 
-        pMP->UpdateNormalAndDepth();
+    for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
+    {
+        if(!vpMPs[i]->isBad())
+            vpMPs[i]->UpdateNormalAndDepth();
     }
 }
 
 int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &vpMatches1, g2o::Sim3 &g2oS12, const float th2, const bool bFixScale)
 {
-    g2o::SparseOptimizer optimizer;
-    g2o::BlockSolverX::LinearSolverType * linearSolver;
-
-    linearSolver = new g2o::LinearSolverDense<g2o::BlockSolverX::PoseMatrixType>();
-
-    g2o::BlockSolverX * solver_ptr = new g2o::BlockSolverX(linearSolver);
-
-    g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
-    optimizer.setAlgorithm(solver);
+    // Setup optimizer, kept by this thread between calls with its vertices and edges
+    Sim3Context::Session session;
+    g2o::SparseOptimizer &optimizer = session.Optimizer();
 
     // Calibration
     const cv::Mat &K1 = pKF1->mK;
@@ -1066,7 +1435,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
     const cv::Mat t2w = pKF2->GetTranslation();
 
     // Set Sim3 vertex
-    g2o::VertexSim3Expmap * vSim3 = new g2o::VertexSim3Expmap();
+    g2o::VertexSim3Expmap * vSim3 = session.New<g2o::VertexSim3Expmap>();
     vSim3->_fix_scale=bFixScale;
     vSim3->setEstimate(g2oS12);
     vSim3->setId(0);
@@ -1113,7 +1482,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         {
             if(!pMP1->isBad() && !pMP2->isBad() && i2>=0)
             {
-                g2o::VertexSBAPointXYZ* vPoint1 = new g2o::VertexSBAPointXYZ();
+                g2o::VertexSBAPointXYZ* vPoint1 = session.New<g2o::VertexSBAPointXYZ>();
                 cv::Mat P3D1w = pMP1->GetWorldPos();
                 cv::Mat P3D1c = R1w*P3D1w + t1w;
                 vPoint1->setEstimate(Converter::toVector3d(P3D1c));
@@ -1121,7 +1490,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
                 vPoint1->setFixed(true);
                 optimizer.addVertex(vPoint1);
 
-                g2o::VertexSBAPointXYZ* vPoint2 = new g2o::VertexSBAPointXYZ();
+                g2o::VertexSBAPointXYZ* vPoint2 = session.New<g2o::VertexSBAPointXYZ>();
                 cv::Mat P3D2w = pMP2->GetWorldPos();
                 cv::Mat P3D2c = R2w*P3D2w + t2w;
                 vPoint2->setEstimate(Converter::toVector3d(P3D2c));
@@ -1142,16 +1511,14 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         const cv::KeyPoint &kpUn1 = pKF1->mvKeysUn[i];
         obs1 << kpUn1.pt.x, kpUn1.pt.y;
 
-        g2o::EdgeSim3ProjectXYZ* e12 = new g2o::EdgeSim3ProjectXYZ();
+        g2o::EdgeSim3ProjectXYZ* e12 = session.New<g2o::EdgeSim3ProjectXYZ>();
         e12->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id2)));
         e12->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(0)));
         e12->setMeasurement(obs1);
         const float &invSigmaSquare1 = pKF1->mvInvLevelSigma2[kpUn1.octave];
         e12->setInformation(Eigen::Matrix2d::Identity()*invSigmaSquare1);
 
-        g2o::RobustKernelHuber* rk1 = new g2o::RobustKernelHuber;
-        e12->setRobustKernel(rk1);
-        rk1->setDelta(deltaHuber);
+        Sim3Context::SetHuber(e12,deltaHuber);
         optimizer.addEdge(e12);
 
         // Set edge x2 = S21*X1
@@ -1159,7 +1526,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         const cv::KeyPoint &kpUn2 = pKF2->mvKeysUn[i2];
         obs2 << kpUn2.pt.x, kpUn2.pt.y;
 
-        g2o::EdgeInverseSim3ProjectXYZ* e21 = new g2o::EdgeInverseSim3ProjectXYZ();
+        g2o::EdgeInverseSim3ProjectXYZ* e21 = session.New<g2o::EdgeInverseSim3ProjectXYZ>();
 
         e21->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id1)));
         e21->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(0)));
@@ -1167,9 +1534,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         float invSigmaSquare2 = pKF2->mvInvLevelSigma2[kpUn2.octave];
         e21->setInformation(Eigen::Matrix2d::Identity()*invSigmaSquare2);
 
-        g2o::RobustKernelHuber* rk2 = new g2o::RobustKernelHuber;
-        e21->setRobustKernel(rk2);
-        rk2->setDelta(deltaHuber);
+        Sim3Context::SetHuber(e21,deltaHuber);
         optimizer.addEdge(e21);
 
         vpEdges12.push_back(e12);
@@ -1194,8 +1559,9 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         {
             size_t idx = vnIndexEdge[i];
             vpMatches1[idx]=static_cast<MapPoint*>(NULL);
-            optimizer.removeEdge(e12);
-            optimizer.removeEdge(e21);
+            // Left out of the next optimization (the edges belong to the pool, they are not removed)
+            e12->setLevel(1);
+            e21->setLevel(1);
             vpEdges12[i]=static_cast<g2o::EdgeSim3ProjectXYZ*>(NULL);
             vpEdges21[i]=static_cast<g2o::EdgeInverseSim3ProjectXYZ*>(NULL);
             nBad++;
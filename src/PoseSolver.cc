@@ -0,0 +1,305 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PoseSolver.h"
+
+#include <Eigen/Cholesky>
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+PoseSolver::PoseSolver(const double fx_, const double fy_, const double cx_, const double cy_, const double bf_):
+    fx(fx_), fy(fy_), cx(cx_), cy(cy_), bf(bf_), mbRobust(true)
+{
+}
+
+void PoseSolver::Reserve(const size_t n)
+{
+    mvX.reserve(n); mvY.reserve(n); mvZ.reserve(n);
+    mvU.reserve(n); mvV.reserve(n); mvUr.reserve(n);
+    mvInfo.reserve(n); mvStereo.reserve(n); mvDelta2.reserve(n); mvActive.reserve(n);
+}
+
+void PoseSolver::AddObservation(const double X, const double Y, const double Z, const double u, const double v,
+                                const double ur, const double invSigma2)
+{
+    const bool bStereo = ur>=0;
+
+    mvX.push_back(X);
+    mvY.push_back(Y);
+    mvZ.push_back(Z);
+    mvU.push_back(u);
+    mvV.push_back(v);
+    mvUr.push_back(bStereo ? ur : 0.0);
+    mvInfo.push_back(invSigma2);
+    mvStereo.push_back(bStereo ? 1.0 : 0.0);
+    mvDelta2.push_back(bStereo ? 7.815 : 5.991); //param
+    mvActive.push_back(1.0);
+}
+
+double PoseSolver::ComputeErrors(const Eigen::Quaterniond &q, const Eigen::Vector3d &t)
+{
+    const size_t n = mvX.size();
+    mvXc.resize(n); mvYc.resize(n); mvInvZ.resize(n);
+    mvEu.resize(n); mvEv.resize(n); mvEr.resize(n);
+    mvChi2.resize(n);
+
+    const Eigen::Matrix3d R = q.toRotationMatrix();
+    const double r00=R(0,0), r01=R(0,1), r02=R(0,2);
+    const double r10=R(1,0), r11=R(1,1), r12=R(1,2);
+    const double r20=R(2,0), r21=R(2,1), r22=R(2,2);
+    const double t0=t[0], t1=t[1], t2=t[2];
+
+    const double* X = mvX.data();
+    const double* Y = mvY.data();
+    const double* Z = mvZ.data();
+    const double* U = mvU.data();
+    const double* V = mvV.data();
+    const double* Ur = mvUr.data();
+    const double* info = mvInfo.data();
+    const double* stereo = mvStereo.data();
+    double* xc = mvXc.data();
+    double* yc = mvYc.data();
+    double* invz = mvInvZ.data();
+    double* eu = mvEu.data();
+    double* ev = mvEv.data();
+    double* er = mvEr.data();
+    double* chi2 = mvChi2.data();
+
+    // Reprojection errors, no branches so that the loop is vectorized
+    for(size_t i=0; i<n; i++)
+    {
+        const double x = r00*X[i]+r01*Y[i]+r02*Z[i]+t0;
+        const double y = r10*X[i]+r11*Y[i]+r12*Z[i]+t1;
+        const double iz = 1.0/(r20*X[i]+r21*Y[i]+r22*Z[i]+t2);
+        const double pu = fx*x*iz+cx;
+        const double pv = fy*y*iz+cy;
+        xc[i] = x;
+        yc[i] = y;
+        invz[i] = iz;
+        eu[i] = U[i]-pu;
+        ev[i] = V[i]-pv;
+        er[i] = stereo[i]*(Ur[i]-(pu-bf*iz));
+        chi2[i] = info[i]*(eu[i]*eu[i]+ev[i]*ev[i]+er[i]*er[i]);
+    }
+
+    // Robust cost of the active observations
+    const double* delta2 = mvDelta2.data();
+    const double* active = mvActive.data();
+    double sum = 0;
+    for(size_t i=0; i<n; i++)
+    {
+        const double e2 = chi2[i];
+        const double rho = (mbRobust && e2>delta2[i]) ? 2.0*sqrt(e2*delta2[i])-delta2[i] : e2;
+        sum += active[i]*rho;
+    }
+
+    return sum;
+}
+
+void PoseSolver::BuildSystem(Eigen::Matrix<double,6,6> &H, Eigen::Matrix<double,6,1> &b) const
+{
+    // Upper triangle of H and b as plain accumulators
+    double h[21] = {};
+    double g[6] = {};
+
+    const size_t n = mvX.size();
+    for(size_t i=0; i<n; i++)
+    {
+        if(mvActive[i]==0.0)
+            continue;
+
+        // Huber weight (first derivative of the kernel, as g2o)
+        double w = mvInfo[i];
+        if(mbRobust && mvChi2[i]>mvDelta2[i])
+            w *= sqrt(mvDelta2[i]/mvChi2[i]);
+
+        const double x = mvXc[i];
+        const double y = mvYc[i];
+        const double invz = mvInvZ[i];
+        const double invz_2 = invz*invz;
+
+        // Jacobian of the error w.r.t. the update [rotation translation]
+        double J[3][6] = {{x*y*invz_2*fx, -(1+x*x*invz_2)*fx, y*invz*fx, -invz*fx, 0, x*invz_2*fx},
+                          {(1+y*y*invz_2)*fy, -x*y*invz_2*fy, -x*invz*fy, 0, -invz*fy, y*invz_2*fy},
+                          {0, 0, 0, 0, 0, 0}};
+        const double e[3] = {mvEu[i], mvEv[i], mvEr[i]};
+
+        int nRows = 2;
+        if(mvStereo[i]!=0.0)
+        {
+            for(int k=0; k<6; k++)
+                J[2][k] = J[0][k];
+            J[2][0] -= bf*y*invz_2;
+            J[2][1] += bf*x*invz_2;
+            J[2][5] -= bf*invz_2;
+            nRows = 3;
+        }
+
+        for(int r=0; r<nRows; r++)
+        {
+            const double* Jr = J[r];
+            const double we = w*e[r];
+            for(int k=0, idx=0; k<6; k++)
+            {
+                const double wj = w*Jr[k];
+                g[k] -= we*Jr[k];
+                for(int l=k; l<6; l++, idx++)
+                    h[idx] += wj*Jr[l];
+            }
+        }
+    }
+
+    for(int k=0, idx=0; k<6; k++)
+    {
+        b[k] = g[k];
+        for(int l=k; l<6; l++, idx++)
+        {
+            H(k,l) = h[idx];
+            H(l,k) = h[idx];
+        }
+    }
+}
+
+// Exponential map of SE3 as g2o::SE3Quat::exp, update is [rotation translation]
+static void Exp(const Eigen::Matrix<double,6,1> &update, Eigen::Quaterniond &q, Eigen::Vector3d &t)
+{
+    const Eigen::Vector3d omega = update.head<3>();
+    const Eigen::Vector3d upsilon = update.tail<3>();
+
+    const double theta = omega.norm();
+    Eigen::Matrix3d Omega;
+    Omega << 0, -omega[2], omega[1],
+             omega[2], 0, -omega[0],
+             -omega[1], omega[0], 0;
+
+    Eigen::Matrix3d R, V;
+    if(theta<0.00001)
+    {
+        R = Eigen::Matrix3d::Identity()+Omega+Omega*Omega;
+        V = R;
+    }
+    else
+    {
+        const Eigen::Matrix3d Omega2 = Omega*Omega;
+        R = Eigen::Matrix3d::Identity()+sin(theta)/theta*Omega+(1-cos(theta))/(theta*theta)*Omega2;
+        V = Eigen::Matrix3d::Identity()+(1-cos(theta))/(theta*theta)*Omega+(theta-sin(theta))/(theta*theta*theta)*Omega2;
+    }
+
+    q = Eigen::Quaterniond(R);
+    q.normalize();
+    t = V*upsilon;
+}
+
+void PoseSolver::Optimize(Eigen::Quaterniond &q, Eigen::Vector3d &t, const int nIterations)
+{
+    bool bAnyActive = false;
+    for(size_t i=0; i<mvActive.size() && !bAnyActive; i++)
+        bAnyActive = mvActive[i]!=0.0;
+    if(!bAnyActive)
+        return;
+
+    Eigen::Matrix<double,6,6> H;
+    Eigen::Matrix<double,6,1> b;
+
+    double lambda = 0;
+    double ni = 2;
+    int nBad = 0;
+
+    for(int it=0; it<nIterations; it++)
+    {
+        double currentChi = ComputeErrors(q,t);
+        const double iniChi = currentChi;
+        BuildSystem(H,b);
+
+        if(it==0)
+        {
+            lambda = 1e-5*H.diagonal().cwiseAbs().maxCoeff();
+            ni = 2;
+            nBad = 0;
+        }
+
+        // Levenberg-Marquardt step, the damping grows until the cost decreases
+        double rho = 0;
+        int nTrials = 0;
+        do
+        {
+            Eigen::Matrix<double,6,6> Hl = H;
+            Hl.diagonal().array() += lambda;
+            Eigen::LDLT<Eigen::Matrix<double,6,6> > ldlt(Hl);
+            const bool bOk = ldlt.isPositive();
+            const Eigen::Matrix<double,6,1> dx = bOk ? Eigen::Matrix<double,6,1>(ldlt.solve(b)) : Eigen::Matrix<double,6,1>::Zero();
+
+            Eigen::Quaterniond dq;
+            Eigen::Vector3d dt;
+            Exp(dx,dq,dt);
+            Eigen::Quaterniond qNew = dq*q;
+            qNew.normalize();
+            const Eigen::Vector3d tNew = dt+dq*t;
+
+            const double tempChi = bOk ? ComputeErrors(qNew,tNew) : numeric_limits<double>::max();
+
+            rho = (currentChi-tempChi)/(dx.dot(lambda*dx+b)+1e-3);
+
+            if(rho>0 && std::isfinite(tempChi))
+            {
+                const double alpha = min(1.0-pow(2*rho-1,3),2.0/3.0);
+                lambda *= max(1.0/3.0,alpha);
+                ni = 2;
+                currentChi = tempChi;
+                q = qNew;
+                t = tNew;
+            }
+            else
+            {
+                lambda *= ni;
+                ni *= 2;
+            }
+            nTrials++;
+        }
+        while(rho<0 && nTrials<10);
+
+        if(nTrials==10 || rho==0)
+            break;
+
+        // Stop after three iterations without significant improvement
+        if((iniChi-currentChi)*1e3<iniChi)
+            nBad++;
+        else
+            nBad = 0;
+
+        if(nBad>=3)
+            break;
+    }
+}
+
+void PoseSolver::ComputeChi2(const Eigen::Quaterniond &q, const Eigen::Vector3d &t, vector<double> &vChi2)
+{
+    ComputeErrors(q,t);
+    vChi2 = mvChi2;
+}
+
+} //namespace ORB_SLAM
@@ -28,14 +28,13 @@
 #include "KeyFrame.h"
 #include "ORBmatcher.h"
 
-#include "Thirdparty/DBoW2/DUtils/Random.h"
-
 namespace ORB_SLAM2
 {
 
 
-Sim3Solver::Sim3Solver(KeyFrame *pKF1, KeyFrame *pKF2, const vector<MapPoint *> &vpMatched12, const bool bFixScale):
-    mnIterations(0), mnBestInliers(0), mbFixScale(bFixScale)
+Sim3Solver::Sim3Solver(KeyFrame *pKF1, KeyFrame *pKF2, const vector<MapPoint *> &vpMatched12, const bool bFixScale,
+                       const unsigned int nSeed):
+    mnIterations(0), mnBestInliers(0), mbFixScale(bFixScale), mRandom(nSeed)
 {
     mpKF1 = pKF1;
     mpKF2 = pKF2;
@@ -165,7 +164,8 @@ cv::Mat Sim3Solver::iterate(int nIterations, bool &bNoMore, vector<bool> &vbInli
         // Get min set of points
         for(short i = 0; i < 3; ++i)
         {
-            int randi = DUtils::Random::RandomInt(0, vAvailableIndices.size()-1);
+            std::uniform_int_distribution<int> random(0, vAvailableIndices.size()-1);
+            int randi = random(mRandom);
 
             int idx = vAvailableIndices[randi];
 
@@ -0,0 +1,411 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SlidingWindow.h"
+
+#include "KeyFrame.h"
+#include "MapPoint.h"
+#include "Map.h"
+#include "Converter.h"
+
+#include <Eigen/Eigenvalues>
+
+#include <map>
+#include <algorithm>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+typedef Eigen::Matrix<double,6,6> Matrix6d;
+typedef Eigen::Matrix<double,6,1> Vector6d;
+typedef Eigen::Matrix<double,6,3> Matrix63d;
+
+// Inverse restricted to the directions with non negligible information
+static Matrix6d PseudoInverse(const Matrix6d &H)
+{
+    Eigen::SelfAdjointEigenSolver<Matrix6d> es(H);
+    const Vector6d S = es.eigenvalues();
+    const double eps = 1e-8*max(S.maxCoeff(),0.0);
+    Vector6d Sinv;
+    for(int i=0; i<6; i++)
+        Sinv[i] = S[i]>eps ? 1.0/S[i] : 0.0;
+    return es.eigenvectors()*Sinv.asDiagonal()*es.eigenvectors().transpose();
+}
+
+static Eigen::Matrix3d Skew(const Eigen::Vector3d &v)
+{
+    Eigen::Matrix3d S;
+    S << 0, -v[2], v[1],
+         v[2], 0, -v[0],
+         -v[1], v[0], 0;
+    return S;
+}
+
+SlidingWindow::SlidingWindow(const int nSize, const int nIterations, const bool bMonocular):
+    mnSize(max(nSize,3)), mnIterations(nIterations), mbMonocular(bMonocular), mnLastBigChangeIdx(0), mLambda(0)
+{
+}
+
+void SlidingWindow::Update(KeyFrame *pKF, Map *pMap)
+{
+    // Poses were corrected (loop closure, global BA), the prior no longer holds
+    const int nBigChangeIdx = pMap->GetLastBigChangeIdx();
+    if(nBigChangeIdx!=mnLastBigChangeIdx)
+    {
+        Reset();
+        mnLastBigChangeIdx = nBigChangeIdx;
+    }
+
+    // Keyframes removed by the keyframe culling
+    vector<KeyFrame*> vpBad;
+    for(size_t i=0; i<mvpKeyFrames.size(); i++)
+        if(mvpKeyFrames[i]->isBad())
+            vpBad.push_back(mvpKeyFrames[i]);
+    for(size_t i=0; i<vpBad.size(); i++)
+        Remove(vpBad[i]);
+
+    if(!pKF->isBad() && find(mvpKeyFrames.begin(),mvpKeyFrames.end(),pKF)==mvpKeyFrames.end())
+        mvpKeyFrames.push_back(pKF);
+
+    while((int)mvpKeyFrames.size()>mnSize)
+        MarginalizeOldest();
+}
+
+void SlidingWindow::Reset()
+{
+    mvpKeyFrames.clear();
+    mvpPriorKFs.clear();
+    mvT0.clear();
+    mH.resize(0,0);
+    mg.resize(0);
+    msMarginalizedObs.clear();
+    mMarginalizedPoints.clear();
+    mLambda = 0;
+}
+
+bool SlidingWindow::IsMarginalized(KeyFrame *pKF, MapPoint *pMP) const
+{
+    return msMarginalizedObs.count(make_pair(pKF,pMP))>0;
+}
+
+bool SlidingWindow::IsMarginalized(MapPoint *pMP) const
+{
+    return mMarginalizedPoints.count(pMP)>0;
+}
+
+bool SlidingWindow::GetPrior(vector<KeyFrame*> &vpKFs, PoseVector &vT0, Eigen::MatrixXd &J, Eigen::VectorXd &r0) const
+{
+    if(mvpPriorKFs.empty())
+        return false;
+
+    // H = J'*J and g = J'*r0, from the eigen decomposition of H (it has the gauge freedom as null space)
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(mH);
+    const Eigen::VectorXd S = es.eigenvalues();
+    const double maxS = S.maxCoeff();
+    if(maxS<=0)
+        return false;
+
+    const double eps = 1e-8*maxS;
+    int nRows = 0;
+    for(int i=0; i<S.size(); i++)
+        if(S[i]>eps)
+            nRows++;
+
+    J.resize(nRows,mH.cols());
+    r0.resize(nRows);
+    for(int i=0, row=0; i<S.size(); i++)
+    {
+        if(S[i]<=eps)
+            continue;
+        const double sqrtS = sqrt(S[i]);
+        J.row(row) = sqrtS*es.eigenvectors().col(i).transpose();
+        r0[row] = es.eigenvectors().col(i).dot(mg)/sqrtS;
+        row++;
+    }
+
+    vpKFs = mvpPriorKFs;
+    vT0 = mvT0;
+    return true;
+}
+
+void SlidingWindow::MarginalizeOldest()
+{
+    KeyFrame* pKFm = mvpKeyFrames.front();
+    const int N = mvpKeyFrames.size();
+
+    map<KeyFrame*,int> mIndex;
+    PoseVector vTcw(N);
+    for(int i=0; i<N; i++)
+    {
+        mIndex[mvpKeyFrames[i]] = i;
+        vTcw[i] = Converter::toSE3Quat(mvpKeyFrames[i]->GetPose());
+    }
+
+    // Jacobians are evaluated at the linearization point of the keyframes already in the prior
+    PoseVector vTlin = vTcw;
+
+    Eigen::MatrixXd H = Eigen::MatrixXd::Zero(6*N,6*N);
+    Eigen::VectorXd g = Eigen::VectorXd::Zero(6*N);
+
+    // Previous prior, with its gradient at the current estimate
+    const int P = mvpPriorKFs.size();
+    vector<int> vPriorIndex(P);
+    if(P>0)
+    {
+        Eigen::VectorXd delta(6*P);
+        for(int p=0; p<P; p++)
+        {
+            vPriorIndex[p] = mIndex[mvpPriorKFs[p]];
+            delta.segment<6>(6*p) = (vTcw[vPriorIndex[p]]*mvT0[p].inverse()).log();
+            vTlin[vPriorIndex[p]] = mvT0[p];
+        }
+        const Eigen::VectorXd gCur = mg+mH*delta;
+
+        for(int a=0; a<P; a++)
+        {
+            const int ia = vPriorIndex[a];
+            g.segment<6>(6*ia) += gCur.segment<6>(6*a);
+            for(int b=0; b<P; b++)
+                H.block<6,6>(6*ia,6*vPriorIndex[b]) += mH.block<6,6>(6*a,6*b);
+        }
+    }
+
+    // Points observed by the keyframe that leaves, with all their observations in the window
+    const vector<MapPoint*> vpMPs = pKFm->GetMapPointMatches();
+    set<MapPoint*> sDone;
+
+    vector<int> vIdx;
+    vector<Matrix6d,Eigen::aligned_allocator<Matrix6d> > vHxx;
+    vector<Vector6d,Eigen::aligned_allocator<Vector6d> > vgx;
+    vector<Matrix63d,Eigen::aligned_allocator<Matrix63d> > vHxp;
+    vector<KeyFrame*> vpObsKFs;
+
+    for(size_t iMP=0; iMP<vpMPs.size(); iMP++)
+    {
+        MapPoint* pMP = vpMPs[iMP];
+        if(!pMP || pMP->isBad() || !sDone.insert(pMP).second || IsMarginalized(pKFm,pMP))
+            continue;
+
+        // A point marginalized before is a constant, its observations only constrain the poses
+        const bool bFixed = IsMarginalized(pMP);
+
+        const Eigen::Vector3d Xw = Converter::toVector3d(pMP->GetWorldPos());
+        const map<KeyFrame*,size_t> observations = pMP->GetObservations();
+
+        Eigen::Matrix3d Hpp = Eigen::Matrix3d::Zero();
+        Eigen::Vector3d gp = Eigen::Vector3d::Zero();
+        vIdx.clear(); vHxx.clear(); vgx.clear(); vHxp.clear(); vpObsKFs.clear();
+
+        for(map<KeyFrame*,size_t>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        {
+            KeyFrame* pKFi = mit->first;
+            map<KeyFrame*,int>::const_iterator itIdx = mIndex.find(pKFi);
+            if(itIdx==mIndex.end() || pKFi->isBad() || IsMarginalized(pKFi,pMP))
+                continue;
+
+            const Eigen::Vector3d Xc = vTcw[itIdx->second].map(Xw);
+            const g2o::SE3Quat &Tlin = vTlin[itIdx->second];
+            const Eigen::Vector3d Xlin = Tlin.map(Xw);
+            if(Xc[2]<=0 || Xlin[2]<=0)
+                continue;
+            const cv::KeyPoint &kpUn = pKFi->mvKeysUn[mit->second];
+            const float ur = pKFi->mvuRight[mit->second];
+            const bool bStereo = ur>=0;
+            const int nRows = bStereo ? 3 : 2;
+
+            // Reprojection error at the current estimate, and its derivative w.r.t. the point in
+            // camera coordinates at the linearization point
+            Eigen::Vector3d e;
+            const double invz = 1.0/Xc[2];
+            const double u = pKFi->fx*Xc[0]*invz+pKFi->cx;
+            e[0] = kpUn.pt.x-u;
+            e[1] = kpUn.pt.y-(pKFi->fy*Xc[1]*invz+pKFi->cy);
+            e[2] = bStereo ? ur-(u-pKFi->mbf*invz) : 0;
+
+            Eigen::Matrix3d Jproj;
+            const double invzl = 1.0/Xlin[2];
+            const double invzl_2 = invzl*invzl;
+            Jproj << pKFi->fx*invzl, 0, -pKFi->fx*Xlin[0]*invzl_2,
+                     0, pKFi->fy*invzl, -pKFi->fy*Xlin[1]*invzl_2,
+                     pKFi->fx*invzl, 0, -pKFi->fx*Xlin[0]*invzl_2+pKFi->mbf*invzl_2;
+
+            const double info = pKFi->mvInvLevelSigma2[kpUn.octave];
+            const double chi2 = info*e.head(nRows).squaredNorm();
+            if(chi2>(bStereo ? 7.815 : 5.991))
+                continue;
+
+            // Error w.r.t. the pose (left-multiplied update [rotation translation]) and the point
+            Eigen::Matrix<double,3,6> Jx;
+            Jx.leftCols<3>() = Jproj*Skew(Xlin);
+            Jx.rightCols<3>() = -Jproj;
+            Eigen::Matrix3d Jp = -Jproj*Tlin.rotation().toRotationMatrix();
+            if(!bStereo)
+            {
+                Jx.row(2).setZero();
+                Jp.row(2).setZero();
+            }
+
+            vIdx.push_back(itIdx->second);
+            vHxx.push_back(info*Jx.transpose()*Jx);
+            vgx.push_back(info*Jx.transpose()*e);
+            vHxp.push_back(info*Jx.transpose()*Jp);
+            vpObsKFs.push_back(pKFi);
+            Hpp += info*Jp.transpose()*Jp;
+            gp += info*Jp.transpose()*e;
+        }
+
+        if(bFixed)
+        {
+            for(size_t a=0; a<vIdx.size(); a++)
+            {
+                H.block<6,6>(6*vIdx[a],6*vIdx[a]) += vHxx[a];
+                g.segment<6>(6*vIdx[a]) += vgx[a];
+                AddMarginalizedObservation(vpObsKFs[a],pMP);
+            }
+            continue;
+        }
+
+        // The point must be constrained by the observations, otherwise they are just dropped
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> esP(Hpp);
+        if(vIdx.empty() || esP.eigenvalues()[0]<=1e-8*esP.eigenvalues()[2])
+            continue;
+
+        const Eigen::Matrix3d HppInv = Hpp.inverse();
+        for(size_t a=0; a<vIdx.size(); a++)
+        {
+            const int ia = vIdx[a];
+            const Matrix63d HxpHppInv = vHxp[a]*HppInv;
+            H.block<6,6>(6*ia,6*ia) += vHxx[a];
+            g.segment<6>(6*ia) += vgx[a]-HxpHppInv*gp;
+            for(size_t b=0; b<vIdx.size(); b++)
+                H.block<6,6>(6*ia,6*vIdx[b]) -= HxpHppInv*vHxp[b].transpose();
+
+            AddMarginalizedObservation(vpObsKFs[a],pMP);
+        }
+    }
+
+    // Keyframe that leaves
+    MarginalizeBlock(H,g,0);
+
+    // New prior on the rest of the window. Keyframes already in the prior keep their linearization point.
+    const int M = N-1;
+    PoseVector vT0(M);
+    Eigen::VectorXd delta = Eigen::VectorXd::Zero(6*M);
+    for(int i=0; i<M; i++)
+    {
+        vT0[i] = vTcw[i+1];
+        for(int p=0; p<P; p++)
+        {
+            if(mvpPriorKFs[p]==mvpKeyFrames[i+1])
+            {
+                vT0[i] = mvT0[p];
+                delta.segment<6>(6*i) = (vTcw[i+1]*mvT0[p].inverse()).log();
+                break;
+            }
+        }
+    }
+
+    mH = 0.5*(H+H.transpose());
+    mg = g-mH*delta;
+    mvT0 = vT0;
+    mvpPriorKFs.assign(mvpKeyFrames.begin()+1,mvpKeyFrames.end());
+
+    ForgetObservations(pKFm);
+    mvpKeyFrames.erase(mvpKeyFrames.begin());
+}
+
+void SlidingWindow::Remove(KeyFrame *pKF)
+{
+    vector<KeyFrame*>::iterator it = find(mvpKeyFrames.begin(),mvpKeyFrames.end(),pKF);
+    if(it!=mvpKeyFrames.end())
+        mvpKeyFrames.erase(it);
+
+    for(size_t p=0; p<mvpPriorKFs.size(); p++)
+    {
+        if(mvpPriorKFs[p]==pKF)
+        {
+            MarginalizeBlock(mH,mg,p);
+            mvpPriorKFs.erase(mvpPriorKFs.begin()+p);
+            mvT0.erase(mvT0.begin()+p);
+            break;
+        }
+    }
+
+    ForgetObservations(pKF);
+}
+
+void SlidingWindow::AddMarginalizedObservation(KeyFrame *pKF, MapPoint *pMP)
+{
+    if(msMarginalizedObs.insert(make_pair(pKF,pMP)).second)
+        mMarginalizedPoints[pMP]++;
+}
+
+void SlidingWindow::ForgetObservations(KeyFrame *pKF)
+{
+    set<pair<KeyFrame*,MapPoint*> >::iterator it = msMarginalizedObs.lower_bound(make_pair(pKF,static_cast<MapPoint*>(NULL)));
+    while(it!=msMarginalizedObs.end() && it->first==pKF)
+    {
+        map<MapPoint*,int>::iterator itMP = mMarginalizedPoints.find(it->second);
+        if(itMP!=mMarginalizedPoints.end() && --itMP->second==0)
+            mMarginalizedPoints.erase(itMP);
+        msMarginalizedObs.erase(it++);
+    }
+}
+
+void SlidingWindow::MarginalizeBlock(Eigen::MatrixXd &H, Eigen::VectorXd &g, const int i)
+{
+    const int n = H.rows()/6;
+    if(n<=1)
+    {
+        H.resize(0,0);
+        g.resize(0);
+        return;
+    }
+
+    Eigen::MatrixXd Hrr(6*(n-1),6*(n-1));
+    Eigen::MatrixXd Hrm(6*(n-1),6);
+    Eigen::VectorXd gr(6*(n-1));
+    for(int a=0, ra=0; a<n; a++)
+    {
+        if(a==i)
+            continue;
+        gr.segment<6>(6*ra) = g.segment<6>(6*a);
+        Hrm.block<6,6>(6*ra,0) = H.block<6,6>(6*a,6*i);
+        for(int b=0, rb=0; b<n; b++)
+        {
+            if(b==i)
+                continue;
+            Hrr.block<6,6>(6*ra,6*rb) = H.block<6,6>(6*a,6*b);
+            rb++;
+        }
+        ra++;
+    }
+
+    const Eigen::MatrixXd HrmHmmInv = Hrm*PseudoInverse(H.block<6,6>(6*i,6*i));
+    const Vector6d gm = g.segment<6>(6*i);
+
+    H = Hrr-HrmHmmInv*Hrm.transpose();
+    H = 0.5*(H+H.transpose());
+    g = gr-HrmHmmInv*gm;
+}
+
+} //namespace ORB_SLAM
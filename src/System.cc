@@ -22,15 +22,21 @@
 
 #include "System.h"
 #include "Converter.h"
+#include "Optimizer.h"
+#include "MapSerializer.h"
+#include "MapJournal.h"
 #include <thread>
 #include <pangolin/pangolin.h>
 #include <iomanip>
+#include <climits>
+#include <sys/stat.h>
 
 namespace ORB_SLAM2
 {
 
 System::System(const string &strVocFile, const string &strSettingsFile, const eSensor sensor,
-               const bool bUseViewer):mSensor(sensor), mpViewer(static_cast<Viewer*>(NULL)), mbReset(false),mbActivateLocalizationMode(false),
+               const bool bUseViewer):mSensor(sensor), mpViewer(static_cast<Viewer*>(NULL)),
+        mpJournal(static_cast<MapJournal*>(NULL)), mbReset(false),mbActivateLocalizationMode(false),
         mbDeactivateLocalizationMode(false)
 {
     // Output welcome message
@@ -62,7 +68,13 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     cout << endl << "Loading ORB Vocabulary. This could take a while..." << endl;
 
     mpVocabulary = new ORBVocabulary();
-    bool bVocLoad = mpVocabulary->loadFromTextFile(strVocFile);
+    bool bVocLoad = false;
+    const string strBinExt(".bin");
+    if(strVocFile.size()>strBinExt.size() &&
+       strVocFile.compare(strVocFile.size()-strBinExt.size(),strBinExt.size(),strBinExt)==0)
+        bVocLoad = mpVocabulary->loadFromBinaryFile(strVocFile);
+    else
+        bVocLoad = mpVocabulary->loadFromTextFile(strVocFile);
     if(!bVocLoad)
     {
         cerr << "Wrong path to vocabulary. " << endl;
@@ -71,12 +83,29 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     }
     cout << "Vocabulary loaded!" << endl << endl;
 
+    //Create the worker pool (ThreadPool.nThreads<=0 or missing uses all hardware threads)
+    int nThreads = fsSettings["ThreadPool.nThreads"];
+    mpThreadPool = new ThreadPool(nThreads);
+
+    //Optimizations split their edges in Optimizer.nWorkers tasks on the pool
+    //(<=0 or missing uses one task per pool thread plus the calling thread)
+    int nOptimizerWorkers = fsSettings["Optimizer.nWorkers"];
+    if(nOptimizerWorkers<=0)
+        nOptimizerWorkers = mpThreadPool->NumThreads()+1;
+    Optimizer::SetThreadPool(mpThreadPool,nOptimizerWorkers);
+
     //Create KeyFrame Database
     mpKeyFrameDatabase = new KeyFrameDatabase(*mpVocabulary);
 
     //Create the Map
     mpMap = new Map();
 
+    //Spatial index over the map points (only if SpatialIndex.VoxelSize is set, in map units: meters for stereo and
+    //RGB-D, median depths of the initial scene for monocular)
+    const float voxelSize = fsSettings["SpatialIndex.VoxelSize"];
+    if(voxelSize>0)
+        mpMap->EnableSpatialIndex(voxelSize);
+
     //Create Drawers. These are used by the Viewer
     mpFrameDrawer = new FrameDrawer(mpMap);
     mpMapDrawer = new MapDrawer(mpMap, strSettingsFile);
@@ -88,10 +117,28 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
 
     //Initialize the Local Mapping thread and launch
     mpLocalMapper = new LocalMapping(mpMap, mSensor==MONOCULAR);
+
+    //Sliding-window local BA (only if LocalMapping.WindowSize is set)
+    const int nWindowSize = fsSettings["LocalMapping.WindowSize"];
+    if(nWindowSize>0)
+    {
+        int nWindowIterations = fsSettings["LocalMapping.WindowIterations"];
+        if(nWindowIterations<=0)
+            nWindowIterations = 5;
+        mpLocalMapper->EnableSlidingWindow(nWindowSize,nWindowIterations);
+    }
+
     mptLocalMapping = new thread(&ORB_SLAM2::LocalMapping::Run,mpLocalMapper);
 
     //Initialize the Loop Closing thread and launch
     mpLoopCloser = new LoopClosing(mpMap, mpKeyFrameDatabase, mpVocabulary, mSensor!=MONOCULAR);
+
+    //Incremental global BA after a loop closure (only if LoopClosing.IncrementalGBA is set).
+    //Each loop solves its affected part from scratch (no iSAM2 reuse) and finding that part is O(map).
+    const int nIncrementalGBA = fsSettings["LoopClosing.IncrementalGBA"];
+    if(nIncrementalGBA)
+        mpLoopCloser->EnableIncrementalGBA();
+
     mptLoopClosing = new thread(&ORB_SLAM2::LoopClosing::Run, mpLoopCloser);
 
     //Initialize the Viewer thread and launch
@@ -105,12 +152,36 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     //Set pointers between threads
     mpTracker->SetLocalMapper(mpLocalMapper);
     mpTracker->SetLoopClosing(mpLoopCloser);
+    mpTracker->SetThreadPool(mpThreadPool);
 
     mpLocalMapper->SetTracker(mpTracker);
     mpLocalMapper->SetLoopCloser(mpLoopCloser);
+    mpLocalMapper->SetThreadPool(mpThreadPool);
 
     mpLoopCloser->SetTracker(mpTracker);
     mpLoopCloser->SetLocalMapper(mpLocalMapper);
+    mpLoopCloser->SetThreadPool(mpThreadPool);
+
+    //Initialize the Map Journal thread and launch (only if Journal.Directory is set)
+    string strJournalDir;
+    cv::FileNode nodeJournal = fsSettings["Journal.Directory"];
+    if(!nodeJournal.empty())
+        strJournalDir = (string)nodeJournal;
+    if(!strJournalDir.empty())
+    {
+        float flushInterval = fsSettings["Journal.FlushInterval"];
+        float snapshotInterval = fsSettings["Journal.SnapshotInterval"];
+        if(flushInterval<=0)
+            flushInterval = 1.0f;
+        if(snapshotInterval<=0)
+            snapshotInterval = 300.0f;
+
+        mpJournal = new MapJournal(mpMap, mpKeyFrameDatabase, mpVocabulary, mSensor, strJournalDir,
+                                   flushInterval, snapshotInterval);
+        mpMap->SetJournal(mpJournal);
+        mptJournal = new thread(&ORB_SLAM2::MapJournal::Run, mpJournal);
+        cout << "Map journal in " << strJournalDir << endl;
+    }
 }
 
 cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp)
@@ -323,6 +394,14 @@ void System::Shutdown()
         usleep(5000);
     }
 
+    // The journal writes what the other threads left pending
+    if(mpJournal)
+    {
+        mpJournal->RequestFinish();
+        while(!mpJournal->isFinished())
+            usleep(5000);
+    }
+
     if(mpViewer)
         pangolin::BindToContext("ORB-SLAM2: Map Viewer");
 }
@@ -479,6 +558,54 @@ void System::SaveTrajectoryKITTI(const string &filename)
     cout << endl << "trajectory saved!" << endl;
 }
 
+bool System::SaveMap(const string &filename)
+{
+    cout << endl << "Saving map to " << filename << " ..." << endl;
+
+    unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+    MapSerializer serializer(mpMap,mpKeyFrameDatabase,mpVocabulary);
+    if(!serializer.Save(filename,mSensor))
+    {
+        cerr << "ERROR: could not write the map to " << filename << endl;
+        return false;
+    }
+
+    cout << endl << "map saved!" << endl;
+    return true;
+}
+
+bool System::LoadMap(const string &filename)
+{
+    cout << endl << "Loading map from " << filename << " ..." << endl;
+
+    if(mpMap->KeyFramesInMap()>0)
+        mpTracker->Reset();
+
+    unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+    MapSerializer serializer(mpMap,mpKeyFrameDatabase,mpVocabulary);
+
+    // A directory is a journal, files of the current session are not part of the recovered map
+    struct stat st;
+    bool bLoaded = false;
+    if(stat(filename.c_str(),&st)==0 && S_ISDIR(st.st_mode))
+        bLoaded = MapJournal::Recover(filename,serializer,mSensor,
+                                      mpJournal ? mpJournal->FirstSequence() : ULONG_MAX);
+    else
+        bLoaded = serializer.Load(filename,mSensor);
+    if(!bLoaded)
+        return false;
+
+    mpTracker->InformMapLoaded();
+    mpMap->InformNewBigChange();
+
+    // Checkpoint the loaded map instead of journaling it record by record
+    if(mpJournal)
+        mpJournal->RequestSnapshot();
+
+    cout << "map loaded: " << mpMap->KeyFramesInMap() << " keyframes, " << mpMap->MapPointsInMap() << " map points" << endl;
+    return true;
+}
+
 int System::GetTrackingState()
 {
     unique_lock<mutex> lock(mMutexState);
@@ -0,0 +1,135 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace ORB_SLAM2
+{
+
+ThreadPool::ThreadPool(int nThreads): mbFinish(false)
+{
+    if(nThreads<=0)
+        nThreads = std::max(1u,std::thread::hardware_concurrency());
+
+    mvThreads.reserve(nThreads);
+    for(int i=0; i<nThreads; i++)
+        mvThreads.push_back(std::thread(&ThreadPool::Run,this));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutexTasks);
+        mbFinish = true;
+    }
+    mCondTasks.notify_all();
+
+    for(size_t i=0; i<mvThreads.size(); i++)
+        mvThreads[i].join();
+}
+
+int ThreadPool::NumThreads() const
+{
+    return mvThreads.size();
+}
+
+void ThreadPool::Run()
+{
+    while(1)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mMutexTasks);
+            mCondTasks.wait(lock, [this]{ return mbFinish || !mqTasks.empty(); });
+            if(mqTasks.empty())
+                return;
+            task = std::move(mqTasks.front());
+            mqTasks.pop();
+        }
+        task();
+    }
+}
+
+namespace
+{
+// Shared between the caller and the helper tasks, which may start after the caller has returned
+struct ParallelForState
+{
+    ParallelForState(size_t n, const std::function<void(size_t)> &f): N(n), func(f), next(0), nDone(0) {}
+
+    // Takes indices until none is left. Returns the number of processed indices.
+    void Work()
+    {
+        size_t nProcessed = 0;
+        for(size_t i=next++; i<N; i=next++)
+        {
+            func(i);
+            nProcessed++;
+        }
+
+        if(nProcessed>0 && (nDone+=nProcessed)==N)
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCond.notify_all();
+        }
+    }
+
+    const size_t N;
+    const std::function<void(size_t)> func;
+    std::atomic<size_t> next;
+    std::atomic<size_t> nDone;
+    std::mutex mMutex;
+    std::condition_variable mCond;
+};
+}
+
+void ThreadPool::ParallelFor(size_t n, const std::function<void(size_t)> &f)
+{
+    if(n==0)
+        return;
+
+    if(n==1 || mvThreads.empty())
+    {
+        for(size_t i=0; i<n; i++)
+            f(i);
+        return;
+    }
+
+    std::shared_ptr<ParallelForState> pState = std::make_shared<ParallelForState>(n,f);
+
+    const size_t nHelpers = std::min(n-1,mvThreads.size());
+    {
+        std::unique_lock<std::mutex> lock(mMutexTasks);
+        for(size_t i=0; i<nHelpers; i++)
+            mqTasks.push([pState]{ pState->Work(); });
+    }
+    mCondTasks.notify_all();
+
+    pState->Work();
+
+    std::unique_lock<std::mutex> lock(pState->mMutex);
+    pState->mCond.wait(lock, [&pState]{ return pState->nDone==pState->N; });
+}
+
+} //namespace ORB_SLAM
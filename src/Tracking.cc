@@ -25,6 +25,7 @@
 #include<opencv2/features2d/features2d.hpp>
 
 #include"ORBmatcher.h"
+#include"FrameArena.h"
 #include"FrameDrawer.h"
 #include"Converter.h"
 #include"Map.h"
@@ -34,6 +35,8 @@
 #include"PnPsolver.h"
 
 #include<iostream>
+#include<algorithm>
+#include<climits>
 
 #include<mutex>
 
@@ -44,9 +47,11 @@ namespace ORB_SLAM2
 {
 
 Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer, MapDrawer *pMapDrawer, Map *pMap, KeyFrameDatabase* pKFDB, const string &strSettingPath, const int sensor):
-    mState(NO_IMAGES_YET), mSensor(sensor), mbOnlyTracking(false), mbVO(false), mpORBVocabulary(pVoc),
-    mpKeyFrameDB(pKFDB), mpInitializer(static_cast<Initializer*>(NULL)), mpSystem(pSys), mpViewer(NULL),
-    mpFrameDrawer(pFrameDrawer), mpMapDrawer(pMapDrawer), mpMap(pMap), mnLastRelocFrameId(0)
+    mState(NO_IMAGES_YET), mSensor(sensor), mbOnlyTracking(false), mbVO(false), mpThreadPool(NULL), mpORBVocabulary(pVoc),
+    mpKeyFrameDB(pKFDB), mpInitializer(static_cast<Initializer*>(NULL)), mnCovisibleLocalMapPoints(0),
+    mnLocalMapPointsFrame(ULONG_MAX), mpSpatialDepthKF(static_cast<KeyFrame*>(NULL)), mfSpatialDepthScale(1.0f), mpSystem(pSys), mpViewer(NULL),
+    mpFrameDrawer(pFrameDrawer), mpMapDrawer(pMapDrawer), mpMap(pMap),
+    mpTileCache(static_cast<LocalizationTileCache*>(NULL)), mnLastRelocFrameId(0), mdLastTrackedTimeStamp(0), mfLastTrackedSpeed(0)
     , mfSettings(strSettingPath, cv::FileStorage::READ)
     , mnAmountTrackedMapPoints(0)
     , mnAmountTrackedMapPointsKF(0)
@@ -54,6 +59,12 @@ Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer,
     , mTriggerRelocalization("Trigger Relocalization", false, false, ParameterGroup::MAIN, []{})
     , mVisualizeTracking("Show Tracking", false, true, ParameterGroup::MAIN, []{})
     , mVisualizeRelocalization("Show Relocalization", false, true, ParameterGroup::MAIN, []{})
+    , mUseRelocalizationPrior("Use motion prior", true, true, ParameterGroup::RELOCALIZATION, []{})
+    , mfRelocalizationPriorRadius("Prior min radius", 1.0f, 0.0f, 100.0f, ParameterGroup::RELOCALIZATION, []{})
+    , mfRelocalizationPriorTimeout("Prior timeout [s]", 10.0f, 0.0f, 120.0f, ParameterGroup::RELOCALIZATION, []{})
+    , mnMaxLocalKeyFrames("Max local keyframes", 80, 5, 500, ParameterGroup::TRACKING, []{})
+    , mnMaxLocalMapPoints("Max local points", 8000, 500, 50000, ParameterGroup::TRACKING, []{})
+    , mfSpatialLocalMapDepth("Spatial local map depth", 20.0f, 1.0f, 200.0f, ParameterGroup::TRACKING, []{})
 {
     // Load camera parameters from settings file
 
@@ -171,6 +182,25 @@ Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer,
             mDepthMapFactor = 1.0f/mDepthMapFactor;
     }
 
+    cv::FileNode tileCacheNode = mfSettings["Localization.TileCache.File"];
+    if(!tileCacheNode.empty() && !((string)tileCacheNode).empty())
+    {
+        float tileSize = mfSettings["Localization.TileCache.TileSize"];
+        int nRadius = mfSettings["Localization.TileCache.Radius"];
+        if(tileSize<=0)
+            tileSize = 20.0f;
+        if(nRadius<=0)
+            nRadius = 1;
+
+        mpTileCache = new LocalizationTileCache(mpMap,(string)tileCacheNode,tileSize,nRadius);
+        if(!mpTileCache->good())
+        {
+            delete mpTileCache;
+            mpTileCache = static_cast<LocalizationTileCache*>(NULL);
+        }
+        else
+            cout << endl << "Localization tile cache: " << tileSize << " m tiles, radius " << nRadius << endl;
+    }
 }
 
 void Tracking::SetLocalMapper(LocalMapping *pLocalMapper)
@@ -188,6 +218,11 @@ void Tracking::SetViewer(Viewer *pViewer)
     mpViewer=pViewer;
 }
 
+void Tracking::SetThreadPool(ThreadPool *pThreadPool)
+{
+    mpThreadPool=pThreadPool;
+}
+
 
 cv::Mat Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRectRight, const double &timestamp)
 {
@@ -296,6 +331,9 @@ cv::Mat Tracking::GrabImageMonocular(const cv::Mat &im, const double &timestamp)
 
 void Tracking::Track()
 {
+    // Scratch containers of this frame are released at the end
+    FrameArena::Scope scope;
+
     if(mState==NO_IMAGES_YET)
     {
         mState = NOT_INITIALIZED;
@@ -323,7 +361,12 @@ void Tracking::Track()
         // System is initialized. Track Frame.
         bool bOK = false;
 
-        if(mVisualizeTracking())
+        // Only Tracking reads keyframe features while the map is not modified, far ones are paged out
+        if(mpTileCache && mbOnlyTracking && mpLocalMapper->isStopped() && mpLoopClosing->isIdle() &&
+           !mpLoopClosing->isRunningGBA())
+            mpTileCache->Update(mLastTrackedCenter);
+
+        if(mVisualizeTracking() && mpReferenceKF)
         {
             mnAmountTrackedMapPoints = 0;
             mnAmountTrackedMapPointsKF = 0;
@@ -492,10 +535,17 @@ void Tracking::Track()
                 mLastFrame.GetRotationInverse().copyTo(LastTwc.rowRange(0,3).colRange(0,3));
                 mLastFrame.GetCameraCenter().copyTo(LastTwc.rowRange(0,3).col(3));
                 mVelocity = mCurrentFrame.mTcw*LastTwc;
+
+                const double dt = mCurrentFrame.mTimeStamp-mLastFrame.mTimeStamp;
+                if(dt>0)
+                    mfLastTrackedSpeed = cv::norm(mVelocity.rowRange(0,3).col(3))/dt;
             }
             else
                 mVelocity = cv::Mat();
 
+            mLastTrackedCenter = mCurrentFrame.GetCameraCenter();
+            mdLastTrackedTimeStamp = mCurrentFrame.mTimeStamp;
+
             mpMapDrawer->SetCurrentCameraPose(mCurrentFrame.mTcw);
 
             // Clean VO matches
@@ -562,9 +612,9 @@ void Tracking::Track()
         mlFrameTimes.push_back(mCurrentFrame.mTimeStamp);
         mlbLost.push_back(mState==LOST);
     }
-    else
+    else if(!mlRelativeFramePoses.empty())
     {
-        // This can happen if tracking is lost
+        // This can happen if tracking is lost (a loaded map starts lost, before any frame is stored)
         mlRelativeFramePoses.push_back(mlRelativeFramePoses.back());
         mlpReferences.push_back(mlpReferences.back());
         mlFrameTimes.push_back(mlFrameTimes.back());
@@ -584,6 +634,9 @@ void Tracking::StereoInitialization()
         // Create KeyFrame
         KeyFrame* pKFini = new KeyFrame(mCurrentFrame,mpMap,mpKeyFrameDB);
 
+        // Keyframes in the map have their BoW vectors (the map journal writes them)
+        pKFini->ComputeBoW();
+
         // Insert KeyFrame in the map
         mpMap->AddKeyFrame(pKFini);
 
@@ -851,6 +904,7 @@ bool Tracking::TrackReferenceKeyFrame()
     ORBmatcher matcher(0.7,true); //param
     vector<MapPoint*> vpMapPointMatches;
 
+    mpReferenceKF->PageIn();
     int nmatches = matcher.SearchByBoW(mpReferenceKF,mCurrentFrame,vpMapPointMatches);
 
     DLOG_IF(INFO, mVisualizeTracking()) << "Matched " << nmatches << "/" << mnAmountTrackedMapPointsKF
@@ -1348,34 +1402,130 @@ void Tracking::UpdateLocalMap() //param
 
 void Tracking::UpdateLocalPoints()
 {
-    mvpLocalMapPoints.clear();
+    // Most frames see the same local keyframes as the previous one, with the same matches
+    bool bChanged = mvpLocalKeyFrames!=mvpLastLocalKeyFrames;
 
     for(vector<KeyFrame*>::const_iterator itKF=mvpLocalKeyFrames.begin(), itEndKF=mvpLocalKeyFrames.end(); itKF!=itEndKF; itKF++)
     {
         KeyFrame* pKF = *itKF;
-        const vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
 
-        for(vector<MapPoint*>::const_iterator itMP=vpMPs.begin(), itEndMP=vpMPs.end(); itMP!=itEndMP; itMP++)
+        // A change after this read is seen in the next frame
+        const long unsigned int nVersion = pKF->GetMatchesVersion();
+
+        unordered_map<KeyFrame*,LocalKeyFrame>::iterator it = mLocalKeyFrameCache.find(pKF);
+        const bool bNew = it==mLocalKeyFrameCache.end();
+        if(bNew)
+            it = mLocalKeyFrameCache.insert(make_pair(pKF,LocalKeyFrame())).first;
+
+        LocalKeyFrame &entry = it->second;
+        entry.nLastFrame = mCurrentFrame.mnId;
+
+        if(bNew || entry.nVersion!=nVersion)
         {
-            MapPoint* pMP = *itMP;
-            if(!pMP)
-                continue;
-            if(pMP->mnTrackReferenceForFrame==mCurrentFrame.mnId)
-                continue;
-            if(!pMP->isBad())
+            // Read in place, the entry keeps its capacity from the previous refresh
+            vector<MapPoint*> &vpMPs = entry.vpMapPoints;
+            vpMPs.clear();
+            entry.nVersion = pKF->ForEachMapPointMatch([&](MapPoint* pMP)
             {
-                mvpLocalMapPoints.push_back(pMP);
-                pMP->mnTrackReferenceForFrame=mCurrentFrame.mnId;
+                if(pMP)
+                    vpMPs.push_back(pMP);
+            });
+            bChanged = true;
+        }
+    }
+
+    if(bChanged)
+    {
+        mvpLastLocalKeyFrames = mvpLocalKeyFrames;
+
+        // Keyframes that left the local map
+        for(unordered_map<KeyFrame*,LocalKeyFrame>::iterator it=mLocalKeyFrameCache.begin(); it!=mLocalKeyFrameCache.end(); )
+        {
+            if(it->second.nLastFrame!=mCurrentFrame.mnId)
+                it = mLocalKeyFrameCache.erase(it);
+            else
+                it++;
+        }
+
+        // Local keyframes are sorted by shared points, the cap drops the points of the least covisible ones
+        const size_t nMaxMapPoints = mnMaxLocalMapPoints();
+        mvpLocalMapPoints.clear();
+
+        for(vector<KeyFrame*>::const_iterator itKF=mvpLocalKeyFrames.begin(), itEndKF=mvpLocalKeyFrames.end(); itKF!=itEndKF; itKF++)
+        {
+            const vector<MapPoint*> &vpMPs = mLocalKeyFrameCache[*itKF].vpMapPoints;
+
+            for(vector<MapPoint*>::const_iterator itMP=vpMPs.begin(), itEndMP=vpMPs.end(); itMP!=itEndMP; itMP++)
+            {
+                MapPoint* pMP = *itMP;
+                if(pMP->mnTrackReferenceForFrame==mCurrentFrame.mnId)
+                    continue;
+                if(!pMP->isBad())
+                {
+                    mvpLocalMapPoints.push_back(pMP);
+                    pMP->mnTrackReferenceForFrame=mCurrentFrame.mnId;
+                }
             }
+
+            if(mvpLocalMapPoints.size()>=nMaxMapPoints)
+                break;
         }
+
+        mnCovisibleLocalMapPoints = mvpLocalMapPoints.size();
+        mnLocalMapPointsFrame = mCurrentFrame.mnId;
     }
+
+    if(mpMap->HasSpatialIndex())
+        AddSpatialLocalPoints();
 }
 
+void Tracking::AddSpatialLocalPoints()
+{
+    // The points of the previous frame's frustum are dropped, the covisible ones are kept
+    mvpLocalMapPoints.resize(mnCovisibleLocalMapPoints);
+
+    const size_t nMaxMapPoints = mnMaxLocalMapPoints();
+    if(mvpLocalMapPoints.size()>=nMaxMapPoints)
+        return;
+
+    // A monocular map has no metric scale, the depth is relative to the scene in front of the reference keyframe
+    float maxDepth = mfSpatialLocalMapDepth();
+    if(mSensor==System::MONOCULAR)
+    {
+        if(!mpReferenceKF || mpReferenceKF->isBad())
+            return;
+        if(mpReferenceKF!=mpSpatialDepthKF)
+        {
+            mpSpatialDepthKF = mpReferenceKF;
+            mfSpatialDepthScale = mpReferenceKF->ComputeSceneMedianDepth(2);
+        }
+        maxDepth *= mfSpatialDepthScale;
+    }
+
+    // Points in front of the camera that no local keyframe observes, for instance a place
+    // revisited before the loop is closed. The covisible points still carry the frame in which
+    // they were collected, the ones added here are marked with the current frame.
+    const vector<MapPoint*> vpMPs = mpMap->GetMapPointsInFrustum(mCurrentFrame,maxDepth);
+    for(vector<MapPoint*>::const_iterator itMP=vpMPs.begin(), itEndMP=vpMPs.end(); itMP!=itEndMP; itMP++)
+    {
+        MapPoint* pMP = *itMP;
+        if(pMP->mnTrackReferenceForFrame==mCurrentFrame.mnId || pMP->mnTrackReferenceForFrame==mnLocalMapPointsFrame)
+            continue;
+        if(!pMP->isBad())
+        {
+            mvpLocalMapPoints.push_back(pMP);
+            pMP->mnTrackReferenceForFrame=mCurrentFrame.mnId;
+            if(mvpLocalMapPoints.size()>=nMaxMapPoints)
+                break;
+        }
+    }
+}
 
 void Tracking::UpdateLocalKeyFrames()
 {
     // Each map point vote for the keyframes in which it has been observed
-    map<KeyFrame*,int> keyframeCounter;
+    FrameArena::Scope scope;
+    ArenaMap<KeyFrame*,int> keyframeCounter;
     for(int i=0; i<mCurrentFrame.N; i++)
     {
         if(mCurrentFrame.mvpMapPoints[i])
@@ -1383,9 +1533,10 @@ void Tracking::UpdateLocalKeyFrames()
             MapPoint* pMP = mCurrentFrame.mvpMapPoints[i];
             if(!pMP->isBad())
             {
-                const map<KeyFrame*,size_t> observations = pMP->GetObservations();
-                for(map<KeyFrame*,size_t>::const_iterator it=observations.begin(), itend=observations.end(); it!=itend; it++)
-                    keyframeCounter[it->first]++;
+                pMP->ForEachObservation([&](KeyFrame* pKF, size_t)
+                {
+                    keyframeCounter[pKF]++;
+                });
             }
             else
             {
@@ -1397,39 +1548,44 @@ void Tracking::UpdateLocalKeyFrames()
     if(keyframeCounter.empty())
         return;
 
-    int max=0;
-    KeyFrame* pKFmax= static_cast<KeyFrame*>(NULL);
+    // The keyframes that share most points come first, so the cap drops the least covisible ones
+    ArenaVector<pair<int,KeyFrame*> > vVotes;
+    vVotes.reserve(keyframeCounter.size());
+    for(ArenaMap<KeyFrame*,int>::const_iterator it=keyframeCounter.begin(), itEnd=keyframeCounter.end(); it!=itEnd; it++)
+    {
+        if(!it->first->isBad())
+            vVotes.push_back(make_pair(it->second,it->first));
+    }
 
-    mvpLocalKeyFrames.clear();
-    mvpLocalKeyFrames.reserve(3*keyframeCounter.size());
+    if(vVotes.empty())
+        return;
 
-    // All keyframes that observe a map point are included in the local map. Also check which keyframe shares most points
-    for(map<KeyFrame*,int>::const_iterator it=keyframeCounter.begin(), itEnd=keyframeCounter.end(); it!=itEnd; it++)
+    sort(vVotes.begin(),vVotes.end(),[](const pair<int,KeyFrame*> &a, const pair<int,KeyFrame*> &b)
     {
-        KeyFrame* pKF = it->first;
-
-        if(pKF->isBad())
-            continue;
+        return a.first>b.first || (a.first==b.first && a.second->mnId<b.second->mnId);
+    });
 
-        if(it->second>max)
-        {
-            max=it->second;
-            pKFmax=pKF;
-        }
+    const size_t nMaxKeyFrames = mnMaxLocalKeyFrames();
+    KeyFrame* pKFmax = vVotes.front().second;
 
-        mvpLocalKeyFrames.push_back(it->first);
+    // All keyframes that observe a map point are included in the local map, up to the cap
+    mvpLocalKeyFrames.clear();
+    for(size_t i=0; i<vVotes.size() && i<nMaxKeyFrames; i++)
+    {
+        KeyFrame* pKF = vVotes[i].second;
+        mvpLocalKeyFrames.push_back(pKF);
         pKF->mnTrackReferenceForFrame = mCurrentFrame.mnId;
     }
 
-
     // Include also some not-already-included keyframes that are neighbors to already-included keyframes
-    for(vector<KeyFrame*>::const_iterator itKF=mvpLocalKeyFrames.begin(), itEndKF=mvpLocalKeyFrames.end(); itKF!=itEndKF; itKF++)
+    const size_t nVoted = mvpLocalKeyFrames.size();
+    for(size_t iKF=0; iKF<nVoted; iKF++)
     {
         // Limit the number of keyframes
-        if(mvpLocalKeyFrames.size()>80) //param
+        if(mvpLocalKeyFrames.size()>=nMaxKeyFrames)
             break;
 
-        KeyFrame* pKF = *itKF;
+        KeyFrame* pKF = mvpLocalKeyFrames[iKF];
 
         const vector<KeyFrame*> vNeighs = pKF->GetBestCovisibilityKeyFrames(10); //param
 
@@ -1475,11 +1631,8 @@ void Tracking::UpdateLocalKeyFrames()
 
     }
 
-    if(pKFmax)
-    {
-        mpReferenceKF = pKFmax;
-        mCurrentFrame.mpReferenceKF = mpReferenceKF;
-    }
+    mpReferenceKF = pKFmax;
+    mCurrentFrame.mpReferenceKF = mpReferenceKF;
 }
 
 bool Tracking::Relocalization()
@@ -1490,9 +1643,44 @@ bool Tracking::Relocalization()
     mCurrentFrame.ComputeBoW();
 
     // Relocalization is performed when tracking is lost
+    // First restrict the candidates to an area around the last tracked pose. The radius grows with the
+    // time since tracking was lost, relative to the last known speed. This avoids relocalizations somewhere
+    // completely different and reduces the search cost.
+    //TODO : heading INFO from imu would also help to exclude keyframes
+    vector<KeyFrame*> vpPriorCandidateKFs;
+    const double elapsed = mCurrentFrame.mTimeStamp-mdLastTrackedTimeStamp;
+    // The minimum radius is in meters, in monocular the map has no metric scale and it is taken in
+    // median scene depths of the last reference keyframe instead
+    float minRadius = mfRelocalizationPriorRadius();
+    if(mSensor==System::MONOCULAR)
+        minRadius = (mpReferenceKF && !mpReferenceKF->isBad()) ? minRadius*mpReferenceKF->ComputeSceneMedianDepth(2) : -1.0f;
+
+    if(mUseRelocalizationPrior() && !mLastTrackedCenter.empty() && minRadius>=0 && elapsed<=mfRelocalizationPriorTimeout())
+    {
+        const float radius = minRadius+2.0f*mfLastTrackedSpeed*elapsed; //param
+        vpPriorCandidateKFs = mpKeyFrameDB->DetectRelocalizationCandidates(&mCurrentFrame,mLastTrackedCenter,radius);
+
+        DLOG_IF(INFO, mVisualizeRelocalization()) << "Found " << vpPriorCandidateKFs.size() << " candidates"
+                                                  << " within " << radius << " of the last tracked pose.";
+        if(!vpPriorCandidateKFs.empty() && RelocalizeWithCandidates(vpPriorCandidateKFs))
+            return true;
+    }
+
     // Track Lost: Query KeyFrame Database for keyframe candidates for relocalisation
     vector<KeyFrame*> vpCandidateKFs = mpKeyFrameDB->DetectRelocalizationCandidates(&mCurrentFrame);
 
+    // Do not verify again the candidates that already failed within the prior area
+    if(!vpPriorCandidateKFs.empty())
+    {
+        set<KeyFrame*> spTried(vpPriorCandidateKFs.begin(),vpPriorCandidateKFs.end());
+        vector<KeyFrame*> vpRemaining;
+        vpRemaining.reserve(vpCandidateKFs.size());
+        for(size_t i=0; i<vpCandidateKFs.size(); i++)
+            if(!spTried.count(vpCandidateKFs[i]))
+                vpRemaining.push_back(vpCandidateKFs[i]);
+        vpCandidateKFs.swap(vpRemaining);
+    }
+
     if(vpCandidateKFs.empty())
     {
         DLOG_IF(INFO, mVisualizeRelocalization()) << "Relocalization impossible, database returned "
@@ -1500,189 +1688,192 @@ bool Tracking::Relocalization()
         return false;
     }
 
+    DLOG_IF(INFO, mVisualizeRelocalization()) << "Found " << vpCandidateKFs.size() << " candidates for relocalization";
+
+    return RelocalizeWithCandidates(vpCandidateKFs);
+}
+
+bool Tracking::RelocalizeWithCandidates(const vector<KeyFrame*> &vpCandidateKFs)
+{
     const int nKFs = vpCandidateKFs.size();
-    DLOG_IF(INFO, mVisualizeRelocalization()) << "Found " << nKFs << " candidates for relocalization";
 
-    // We perform first an ORB matching with each candidate
-    // If enough matches are found we setup a PnP solver
-    ORBmatcher matcher(0.75,true); //param
+    // The candidates are verified concurrently on the thread pool, each one with its own pose and
+    // matches on the shared current frame. When a candidate passes, the ones with a higher index
+    // stop, so the accepted pose always comes from the lowest-index candidate that passes.
+    vector<cv::Mat> vTcw(nKFs);
+    vector<vector<MapPoint*> > vvpMapPoints(nKFs);
+    vector<vector<bool> > vvbOutlier(nKFs);
+    atomic<int> nAccepted(nKFs);
 
-    vector<PnPsolver*> vpPnPsolvers;
-    vpPnPsolvers.resize(nKFs);
+    auto verifyCandidate = [&](size_t i)
+    {
+        const int nCandidate = i;
+        if(!VerifyRelocalizationCandidate(vpCandidateKFs[i],nCandidate,nAccepted,vTcw[i],vvpMapPoints[i],vvbOutlier[i]))
+            return;
 
-    vector<vector<MapPoint*> > vvpMapPointMatches;
-    vvpMapPointMatches.resize(nKFs);
+        int nPrevious = nAccepted;
+        while(nCandidate<nPrevious && !nAccepted.compare_exchange_weak(nPrevious,nCandidate))
+            ;
+    };
 
-    vector<bool> vbDiscarded;
-    vbDiscarded.resize(nKFs);
+    if(mpThreadPool)
+        mpThreadPool->ParallelFor(nKFs,verifyCandidate);
+    else
+        for(int i=0; i<nKFs && nAccepted==nKFs; i++)
+            verifyCandidate(i);
 
-    int nCandidates=0;
-    int numMapPointsTrackedInCandidate = 0;
+    if(nAccepted==nKFs)
+    {
+        DLOG_IF(INFO, mVisualizeRelocalization()) << "Relocalization failed, no candidate had"
+                                                  << " enough matches with current frame.";
+        return false;
+    }
+    else
+    {
+        const int nBest = nAccepted;
+        mCurrentFrame.SetPose(vTcw[nBest]);
+        mCurrentFrame.mvpMapPoints = vvpMapPoints[nBest];
+        mCurrentFrame.mvbOutlier = vvbOutlier[nBest];
 
-    //TODO : if last velocities were known this could check keyframes in an area
-    //that increases with time relative to the last known velocity
-    //might avoid relocalizations somwhere completely different and reduce search cost
-    //heading INFO from imu would also help to exclude keyframes
+        mnLastRelocFrameId = mCurrentFrame.mnId;
+        DLOG_IF(INFO, mVisualizeRelocalization()) << "Relocalization successful with candidate " << nBest << ".";
+        return true;
+    }
 
-    //search matches between the candidate keyframes' mappoints and current frames keypoints
+}
+
+bool Tracking::VerifyRelocalizationCandidate(KeyFrame* pKF, const int nCandidate, atomic<int> &nAccepted,
+                                             cv::Mat &Tcw, vector<MapPoint*> &vpMapPoints, vector<bool> &vbOutlier)
+{
+    if(pKF->isBad())
+        return false;
+
+    pKF->PageIn();
+
+    // We perform first an ORB matching with the candidate
+    // If enough matches are found we setup a PnP solver
+    ORBmatcher matcher(0.75,true); //param
+
+    //search matches between the candidate keyframe's mappoints and current frames keypoints
     //TODO : One could probably filter all candidates which track less than 50 map points, since in
     // the end at lest 50 matches have to be found for relocalization anyway.
-    for(int i=0; i<nKFs; i++)
+    vector<MapPoint*> vpMapPointMatches;
+    int nmatches = matcher.SearchByBoW(pKF,mCurrentFrame,vpMapPointMatches);
+    // if less than 15 keypoints are matched consider the frame to be a mismatch
+    if(nmatches<15) //param
+        return false;
+
+    if(mVisualizeRelocalization())
     {
-        KeyFrame* pKF = vpCandidateKFs[i];
-        if(pKF->isBad())
-            vbDiscarded[i] = true;
-        else
+        int numMapPointsTrackedInCandidate = 0;
+        for(auto& mapPoint : pKF->GetMapPointMatches())
         {
-            int nmatches = matcher.SearchByBoW(pKF,mCurrentFrame,vvpMapPointMatches[i]);
-            // if less than 15 keypoints are matched consider the frame to be a mismatch
-            if(nmatches<15) //param
+            if(mapPoint)
             {
-                vbDiscarded[i] = true;
-                continue;
-            }
-            else
-            {
-                if(mVisualizeRelocalization())
-                {
-                    numMapPointsTrackedInCandidate = 0;
-                    for(auto& mapPoint : pKF->GetMapPointMatches())
-                    {
-                        if(mapPoint)
-                        {
-                            numMapPointsTrackedInCandidate++;
-                        }
-                    }
-                }
-                DLOG_IF(INFO, mVisualizeRelocalization()) << "Keyframe " << i << " accepted as "
-                                                          << "candidate, was able to match "
-                                                          << nmatches << "/"
-                                                          << numMapPointsTrackedInCandidate
-                                                          << " of it's" << " tracked map points.";
-                PnPsolver* pSolver = new PnPsolver(mCurrentFrame,vvpMapPointMatches[i]);
-                pSolver->SetRansacParameters(0.99,10,300,4,0.5,5.991); //param
-                vpPnPsolvers[i] = pSolver;
-                nCandidates++;
+                numMapPointsTrackedInCandidate++;
             }
         }
+        DLOG(INFO) << "Keyframe " << nCandidate << " accepted as "
+                   << "candidate, was able to match "
+                   << nmatches << "/"
+                   << numMapPointsTrackedInCandidate
+                   << " of it's" << " tracked map points.";
     }
-    DLOG_IF(INFO, mVisualizeRelocalization()) << nCandidates << "/" << nKFs << " had more than 15"
-                                              << " matches with current frame, rest discarded.";
 
-    // Alternatively perform some iterations of P4P RANSAC
+    // The current frame is shared by all candidates and only read. Each candidate works on its own
+    // pose, matches and outlier flags (the output arguments), and seeds the RANSAC with its index so
+    // that its result does not depend on the scheduling.
+    const Frame &F = mCurrentFrame;
+    vpMapPoints = F.mvpMapPoints;
+    vbOutlier = F.mvbOutlier;
+
+    PnPsolver solver(F,vpMapPointMatches,nCandidate);
+    solver.SetRansacParameters(0.99,10,300,4,0.5,5.991); //param
+
+    // Perform some iterations of P4P RANSAC
     // Until we found a camera pose supported by enough inliers
-    bool bMatch = false;
     ORBmatcher matcher2(0.9,true); //param
 
-    while(nCandidates>0 && !bMatch)
+    bool bNoMore = false;
+    while(!bNoMore && nAccepted>nCandidate)
     {
-        for(int i=0; i<nKFs; i++)
-        {
-            if(vbDiscarded[i])
-                continue;
+        // Perform 5 Ransac Iterations
+        vector<bool> vbInliers;
+        int nInliers;
 
-            // Perform 5 Ransac Iterations
-            vector<bool> vbInliers;
-            int nInliers;
-            bool bNoMore;
+        cv::Mat Tcwi = solver.iterate(5,bNoMore,vbInliers,nInliers); //param
 
-            PnPsolver* pSolver = vpPnPsolvers[i];
-            cv::Mat Tcw = pSolver->iterate(5,bNoMore,vbInliers,nInliers); //param
+        // If a Camera Pose is computed, optimize
+        if(Tcwi.empty())
+            continue;
 
-            // If Ransac reachs max. iterations discard keyframe
-            if(bNoMore)
-            {
-                vbDiscarded[i]=true;
-                nCandidates--;
-            }
+        Tcw = Tcwi.clone();
 
-            // If a Camera Pose is computed, optimize
-            if(!Tcw.empty())
-            {
-                Tcw.copyTo(mCurrentFrame.mTcw);
+        set<MapPoint*> sFound;
 
-                set<MapPoint*> sFound;
+        const int np = vbInliers.size();
 
-                const int np = vbInliers.size();
+        for(int j=0; j<np; j++)
+        {
+            if(vbInliers[j])
+            {
+                vpMapPoints[j]=vpMapPointMatches[j];
+                sFound.insert(vpMapPointMatches[j]);
+            }
+            else
+                vpMapPoints[j]=NULL;
+        }
 
-                for(int j=0; j<np; j++)
-                {
-                    if(vbInliers[j])
-                    {
-                        mCurrentFrame.mvpMapPoints[j]=vvpMapPointMatches[i][j];
-                        sFound.insert(vvpMapPointMatches[i][j]);
-                    }
-                    else
-                        mCurrentFrame.mvpMapPoints[j]=NULL;
-                }
+        int nGood = Optimizer::PoseOptimization(F,Tcw,vpMapPoints,vbOutlier);
 
-                int nGood = Optimizer::PoseOptimization(&mCurrentFrame);
+        if(nGood<10) //param
+            continue;
 
-                if(nGood<10) //param
-                    continue;
+        for(int io =0; io<F.N; io++)
+            if(vbOutlier[io])
+                vpMapPoints[io]=static_cast<MapPoint*>(NULL);
 
-                for(int io =0; io<mCurrentFrame.N; io++)
-                    if(mCurrentFrame.mvbOutlier[io])
-                        mCurrentFrame.mvpMapPoints[io]=static_cast<MapPoint*>(NULL);
+        // If few inliers, search by projection in a coarse window and optimize again
+        if(nGood<50) //param
+        {
+            int nadditional =matcher2.SearchByProjection(F,Tcw,vpMapPoints,pKF,sFound,10,100); //param
 
-                // If few inliers, search by projection in a coarse window and optimize again
-                if(nGood<50) //param
-                {
-                    int nadditional =matcher2.SearchByProjection(mCurrentFrame,vpCandidateKFs[i],sFound,10,100); //param
+            if(nadditional+nGood>=50) //param
+            {
+                nGood = Optimizer::PoseOptimization(F,Tcw,vpMapPoints,vbOutlier);
 
-                        if(nadditional+nGood>=50) //param
+                // If many inliers but still not enough, search by projection again in a narrower window
+                // the camera has been already optimized with many points
+                if(nGood>30 && nGood<50) //param
+                {
+                    sFound.clear();
+                    for(int ip =0; ip<F.N; ip++)
+                        if(vpMapPoints[ip])
+                            sFound.insert(vpMapPoints[ip]);
+                    nadditional =matcher2.SearchByProjection(F,Tcw,vpMapPoints,pKF,sFound,3,64); //param
+
+                    // Final optimization
+                    if(nGood+nadditional>=50) //param
                     {
-                        nGood = Optimizer::PoseOptimization(&mCurrentFrame);
+                        nGood = Optimizer::PoseOptimization(F,Tcw,vpMapPoints,vbOutlier);
 
-                        // If many inliers but still not enough, search by projection again in a narrower window
-                        // the camera has been already optimized with many points
-                        if(nGood>30 && nGood<50) //param
-                        {
-                            sFound.clear();
-                            for(int ip =0; ip<mCurrentFrame.N; ip++)
-                                if(mCurrentFrame.mvpMapPoints[ip])
-                                    sFound.insert(mCurrentFrame.mvpMapPoints[ip]);
-                            nadditional =matcher2.SearchByProjection(mCurrentFrame,vpCandidateKFs[i],sFound,3,64); //param
-
-                            // Final optimization
-                            if(nGood+nadditional>=50) //param
-                            {
-                                nGood = Optimizer::PoseOptimization(&mCurrentFrame);
-
-                                for(int io =0; io<mCurrentFrame.N; io++)
-                                    if(mCurrentFrame.mvbOutlier[io])
-                                        mCurrentFrame.mvpMapPoints[io]=NULL;
-                            }
-                        }
+                        for(int io =0; io<F.N; io++)
+                            if(vbOutlier[io])
+                                vpMapPoints[io]=NULL;
                     }
                 }
-
-
-                DLOG_IF(INFO, mVisualizeRelocalization()) << "Candidate " << i << " scored "
-                                                          << nGood << " matches.";
-                // If the pose is supported by enough inliers stop ransacs and continue
-                if(nGood>=50) //param
-                {
-                    bMatch = true;
-                    break;
-                }
             }
         }
-    }
 
-    if(!bMatch)
-    {
-        DLOG_IF(INFO, mVisualizeRelocalization()) << "Relocalization failed, no candidate had"
-                                                  << " enough matches with current frame.";
-        return false;
-    }
-    else
-    {
-        mnLastRelocFrameId = mCurrentFrame.mnId;
-        DLOG_IF(INFO, mVisualizeRelocalization()) << "Relocalization successful.";
-        return true;
+
+        DLOG_IF(INFO, mVisualizeRelocalization()) << "Candidate " << nCandidate << " scored "
+                                                  << nGood << " matches.";
+        // If the pose is supported by enough inliers stop ransacs and continue
+        if(nGood>=50) //param
+            return true;
     }
 
+    return false;
 }
 
 void Tracking::Reset()
@@ -1712,11 +1903,22 @@ void Tracking::Reset()
 
     // Clear Map (this erase MapPoints and KeyFrames)
     mpMap->clear();
+    if(mpTileCache)
+        mpTileCache->Reset();
+    mLocalKeyFrameCache.clear();
+    mvpLastLocalKeyFrames.clear();
+    mnCovisibleLocalMapPoints = 0;
+    mnLocalMapPointsFrame = ULONG_MAX;
+    mpSpatialDepthKF = static_cast<KeyFrame*>(NULL);
 
     KeyFrame::nNextId = 0;
     Frame::nNextId = 0;
     mnLastRelocFrameId = 0;
     mState = NO_IMAGES_YET;
+    mVelocity = cv::Mat();
+    mLastTrackedCenter = cv::Mat();
+    mdLastTrackedTimeStamp = 0;
+    mfLastTrackedSpeed = 0;
 
     if(mpInitializer)
     {
@@ -1767,9 +1969,34 @@ void Tracking::ChangeCalibration(const string &strSettingPath)
 
 void Tracking::InformOnlyTracking(const bool &flag)
 {
+    // Local Mapping resumes after this, every keyframe must have its features
+    if(!flag && mpTileCache)
+        mpTileCache->PageInAll();
+
     mbOnlyTracking = flag;
 }
 
+void Tracking::InformMapLoaded()
+{
+    mState = LOST;
+    mpReferenceKF = static_cast<KeyFrame*>(NULL);
+    mpLastKeyFrame = static_cast<KeyFrame*>(NULL);
+    mnLastKeyFrameId = Frame::nNextId;
+    mnLastRelocFrameId = 0;
+    mbVO = false;
+    mVelocity = cv::Mat();
+    mLastTrackedCenter = cv::Mat();
+    mdLastTrackedTimeStamp = 0;
+    mfLastTrackedSpeed = 0;
+    mvpLocalKeyFrames.clear();
+    mvpLocalMapPoints.clear();
+    mLocalKeyFrameCache.clear();
+    mvpLastLocalKeyFrames.clear();
+    mnCovisibleLocalMapPoints = 0;
+    mnLocalMapPointsFrame = ULONG_MAX;
+    mpSpatialDepthKF = static_cast<KeyFrame*>(NULL);
+}
+
 
 
 } //namespace ORB_SLAM
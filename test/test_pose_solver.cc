@@ -0,0 +1,288 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Motion-only bundle adjustment: Optimizer::PoseOptimization runs the dedicated PoseSolver, which
+// must give the pose and the inliers of the g2o graph it replaces (VertexSE3Expmap with
+// EdgeSE3ProjectXYZOnlyPose and EdgeStereoSE3ProjectXYZOnlyPose edges, four rounds of outlier
+// rejection). Both run on the same synthetic monocular and stereo frames, with a fifth of the
+// matches moved away.
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+
+#include "Thirdparty/g2o/g2o/core/block_solver.h"
+#include "Thirdparty/g2o/g2o/core/optimization_algorithm_levenberg.h"
+#include "Thirdparty/g2o/g2o/solvers/linear_solver_dense.h"
+#include "Thirdparty/g2o/g2o/types/types_six_dof_expmap.h"
+#include "Thirdparty/g2o/g2o/core/robust_kernel_impl.h"
+
+#include "Frame.h"
+#include "MapPoint.h"
+#include "Map.h"
+#include "Optimizer.h"
+#include "Converter.h"
+
+using namespace std;
+using namespace ORB_SLAM2;
+
+namespace
+{
+
+int nFailures = 0;
+
+void Check(const bool bCondition, const char* strWhat)
+{
+    cout << (bCondition ? "[ OK ] " : "[FAIL] ") << strWhat << endl;
+    if(!bCondition)
+        nFailures++;
+}
+
+// The g2o graph solved by PoseOptimization before PoseSolver, with the same rounds and thresholds
+int ReferencePoseOptimization(const Frame &F, cv::Mat &Tcw, const vector<MapPoint*> &vpMapPoints, vector<bool> &vbOutlier)
+{
+    g2o::SparseOptimizer optimizer;
+    g2o::BlockSolver_6_3::LinearSolverType * linearSolver = new g2o::LinearSolverDense<g2o::BlockSolver_6_3::PoseMatrixType>();
+    g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
+    optimizer.setAlgorithm(new g2o::OptimizationAlgorithmLevenberg(solver_ptr));
+
+    g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
+    vSE3->setEstimate(Converter::toSE3Quat(Tcw));
+    vSE3->setId(0);
+    optimizer.addVertex(vSE3);
+
+    vector<g2o::OptimizableGraph::Edge*> vpEdges;
+    vector<size_t> vnIndexEdge;
+    int nInitialCorrespondences=0;
+
+    for(int i=0; i<F.N; i++)
+    {
+        MapPoint* pMP = vpMapPoints[i];
+        if(!pMP)
+            continue;
+
+        nInitialCorrespondences++;
+        vbOutlier[i] = false;
+
+        const cv::KeyPoint &kpUn = F.mvKeysUn[i];
+        const float invSigma2 = F.mvInvLevelSigma2[kpUn.octave];
+        const cv::Mat Xw = pMP->GetWorldPos();
+        g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+
+        if(F.mvuRight[i]<0)
+        {
+            g2o::EdgeSE3ProjectXYZOnlyPose* e = new g2o::EdgeSE3ProjectXYZOnlyPose();
+            e->setVertex(0, optimizer.vertex(0));
+            e->setMeasurement(Eigen::Vector2d(kpUn.pt.x,kpUn.pt.y));
+            e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
+            rk->setDelta(sqrt(5.991));
+            e->setRobustKernel(rk);
+            e->fx = F.fx;
+            e->fy = F.fy;
+            e->cx = F.cx;
+            e->cy = F.cy;
+            e->Xw = Converter::toVector3d(Xw);
+            optimizer.addEdge(e);
+            vpEdges.push_back(e);
+        }
+        else
+        {
+            g2o::EdgeStereoSE3ProjectXYZOnlyPose* e = new g2o::EdgeStereoSE3ProjectXYZOnlyPose();
+            e->setVertex(0, optimizer.vertex(0));
+            e->setMeasurement(Eigen::Vector3d(kpUn.pt.x,kpUn.pt.y,F.mvuRight[i]));
+            e->setInformation(Eigen::Matrix3d::Identity()*invSigma2);
+            rk->setDelta(sqrt(7.815));
+            e->setRobustKernel(rk);
+            e->fx = F.fx;
+            e->fy = F.fy;
+            e->cx = F.cx;
+            e->cy = F.cy;
+            e->bf = F.mbf;
+            e->Xw = Converter::toVector3d(Xw);
+            optimizer.addEdge(e);
+            vpEdges.push_back(e);
+        }
+        vnIndexEdge.push_back(i);
+    }
+
+    int nBad=0;
+    for(size_t it=0; it<4; it++)
+    {
+        vSE3->setEstimate(Converter::toSE3Quat(Tcw));
+        optimizer.initializeOptimization(0);
+        optimizer.optimize(10);
+
+        nBad=0;
+        for(size_t i=0; i<vpEdges.size(); i++)
+        {
+            g2o::OptimizableGraph::Edge* e = vpEdges[i];
+            const size_t idx = vnIndexEdge[i];
+
+            if(vbOutlier[idx])
+                e->computeError();
+
+            const float th = F.mvuRight[idx]<0 ? 5.991 : 7.815;
+            if(e->chi2()>th)
+            {
+                vbOutlier[idx]=true;
+                e->setLevel(1);
+                nBad++;
+            }
+            else
+            {
+                vbOutlier[idx]=false;
+                e->setLevel(0);
+            }
+
+            if(it==2)
+                e->setRobustKernel(0);
+        }
+    }
+
+    Tcw = Converter::toCvMat(vSE3->estimate());
+    return nInitialCorrespondences-nBad;
+}
+
+double MaxDifference(const cv::Mat &T1, const cv::Mat &T2)
+{
+    return cv::norm(T1.rowRange(0,3),T2.rowRange(0,3),cv::NORM_INF);
+}
+
+// Frame observing N points from pose Tcw, with pixel noise, and a fifth of the observations
+// moved far from the projection of their point
+void MakeFrame(const bool bStereo, const cv::Mat &Tcw, Map* pMap, cv::RNG &rng, Frame &F)
+{
+    const int N = 300;
+    const int nLevels = 8;
+
+    F.fx = 500.0f; F.fy = 500.0f; F.cx = 320.0f; F.cy = 240.0f;
+    F.invfx = 1.0f/F.fx; F.invfy = 1.0f/F.fy;
+    F.mbf = bStereo ? 40.0f : 0.0f;
+    F.mnId = 0;
+    F.N = N;
+    F.mnScaleLevels = nLevels;
+    F.mvScaleFactors.resize(nLevels);
+    F.mvInvLevelSigma2.resize(nLevels);
+    for(int l=0; l<nLevels; l++)
+    {
+        F.mvScaleFactors[l] = pow(1.2f,l);
+        F.mvInvLevelSigma2[l] = 1.0f/(F.mvScaleFactors[l]*F.mvScaleFactors[l]);
+    }
+    F.mDescriptors = cv::Mat::zeros(N,32,CV_8U);
+    F.mvKeysUn.resize(N);
+    F.mvuRight.resize(N);
+    F.mvbOutlier.assign(N,false);
+    F.mvpMapPoints.assign(N,static_cast<MapPoint*>(NULL));
+    F.SetPose(Tcw);
+
+    const cv::Mat Rwc = Tcw.rowRange(0,3).colRange(0,3).t();
+    const cv::Mat Ow = F.GetCameraCenter();
+
+    for(int i=0; i<N; i++)
+    {
+        const float u = rng.uniform(0.0f,640.0f);
+        const float v = rng.uniform(0.0f,480.0f);
+        const float z = rng.uniform(2.0f,10.0f);
+        const int level = rng.uniform(0,4);
+
+        const cv::Mat x3Dc = (cv::Mat_<float>(3,1) << (u-F.cx)*z/F.fx, (v-F.cy)*z/F.fy, z);
+        const cv::Mat x3Dw = Rwc*x3Dc+Ow;
+
+        cv::KeyPoint &kp = F.mvKeysUn[i];
+        kp.octave = level;
+        kp.pt.x = u+rng.gaussian(0.5*F.mvScaleFactors[level]);
+        kp.pt.y = v+rng.gaussian(0.5*F.mvScaleFactors[level]);
+        F.mvuRight[i] = bStereo ? kp.pt.x-F.mbf/z : -1.0f;
+
+        if(i%5==0)
+        {
+            kp.pt.x += rng.uniform(20.0f,40.0f);
+            kp.pt.y -= rng.uniform(20.0f,40.0f);
+            if(bStereo)
+                F.mvuRight[i] += rng.uniform(20.0f,40.0f);
+        }
+
+        F.mvpMapPoints[i] = new MapPoint(x3Dw,pMap,&F,i);
+    }
+}
+
+void Compare(const bool bStereo, const char* strSensor)
+{
+    cv::RNG rng(bStereo ? 2 : 1);
+    Map map;
+
+    // True pose, and the initial guess the tracking would give (motion model)
+    cv::Mat Tcw = cv::Mat::eye(4,4,CV_32F);
+    cv::Mat Rcw;
+    cv::Rodrigues((cv::Mat_<float>(3,1) << 0.1f, -0.2f, 0.05f),Rcw);
+    Rcw.copyTo(Tcw.rowRange(0,3).colRange(0,3));
+    Tcw.at<float>(0,3) = 0.5f;
+    Tcw.at<float>(1,3) = -0.2f;
+    Tcw.at<float>(2,3) = 1.0f;
+
+    Frame F;
+    MakeFrame(bStereo,Tcw,&map,rng,F);
+
+    cv::Mat Tini = Tcw.clone();
+    cv::Mat dR;
+    cv::Rodrigues((cv::Mat_<float>(3,1) << 0.01f, 0.02f, -0.01f),dR);
+    cv::Mat Rini = dR*Tcw.rowRange(0,3).colRange(0,3);
+    Rini.copyTo(Tini.rowRange(0,3).colRange(0,3));
+    Tini.at<float>(0,3) += 0.05f;
+    Tini.at<float>(2,3) -= 0.05f;
+
+    cv::Mat Tsolver = Tini.clone();
+    vector<MapPoint*> vpMPs = F.mvpMapPoints;
+    vector<bool> vbOutlierSolver(F.N,false);
+    const int nGoodSolver = Optimizer::PoseOptimization(F,Tsolver,vpMPs,vbOutlierSolver);
+
+    cv::Mat Tg2o = Tini.clone();
+    vector<bool> vbOutlierG2o(F.N,false);
+    const int nGoodG2o = ReferencePoseOptimization(F,Tg2o,F.mvpMapPoints,vbOutlierG2o);
+
+    int nOutliersFound = 0;
+    for(int i=0; i<F.N; i+=5)
+        nOutliersFound += vbOutlierSolver[i] ? 1 : 0;
+
+    cout << strSensor << ": " << nGoodSolver << " inliers (g2o " << nGoodG2o << "), pose difference "
+         << MaxDifference(Tsolver,Tg2o) << endl;
+
+    Check(nGoodSolver==nGoodG2o,"same number of inliers as g2o");
+    Check(vbOutlierSolver==vbOutlierG2o,"same outliers as g2o");
+    Check(MaxDifference(Tsolver,Tg2o)<1e-4,"same pose as g2o");
+    Check(nOutliersFound==F.N/5,"moved observations are outliers");
+    Check(MaxDifference(Tsolver,Tcw)<1e-2,"true pose is recovered");
+
+    for(int i=0; i<F.N; i++)
+        delete F.mvpMapPoints[i];
+}
+
+}
+
+int main()
+{
+    Compare(false,"monocular");
+    Compare(true,"stereo");
+
+    return nFailures==0 ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Relocalization with a motion prior: Tracking first queries the KeyFrameDatabase for candidates
+// within a radius of the last tracked pose, then falls back to a global query for the same frame.
+// A keyframe outside the radius must be rejected by the first query and still found by the second.
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "ORBVocabulary.h"
+#include "ORBextractor.h"
+#include "Frame.h"
+#include "KeyFrame.h"
+#include "KeyFrameDatabase.h"
+#include "Map.h"
+
+using namespace std;
+using namespace ORB_SLAM2;
+
+namespace
+{
+
+int nFailures = 0;
+
+void Check(const bool bCondition, const char* strWhat)
+{
+    cout << (bCondition ? "[ OK ] " : "[FAIL] ") << strWhat << endl;
+    if(!bCondition)
+        nFailures++;
+}
+
+bool Contains(const vector<KeyFrame*> &vpKFs, KeyFrame* pKF)
+{
+    return find(vpKFs.begin(),vpKFs.end(),pKF)!=vpKFs.end();
+}
+
+}
+
+int main()
+{
+    // Textured synthetic image, the keyframe and the query frame see the same scene
+    cv::Mat im(480,640,CV_8U);
+    cv::RNG rng(1);
+    rng.fill(im,cv::RNG::UNIFORM,0,255);
+    cv::GaussianBlur(im,im,cv::Size(5,5),1.5);
+
+    ORBextractor extractor(1000,1.2f,8,20,7,vector<vector<int> >());
+
+    // Small vocabulary trained on the image itself
+    vector<cv::KeyPoint> vKeys;
+    cv::Mat descriptors;
+    extractor(im,cv::Mat(),vKeys,descriptors);
+    vector<vector<cv::Mat> > vvFeatures(1);
+    for(int i=0; i<descriptors.rows; i++)
+        vvFeatures[0].push_back(descriptors.row(i));
+    ORBVocabulary voc(5,3,DBoW2::TF_IDF,DBoW2::L1_NORM);
+    voc.create(vvFeatures);
+
+    cv::Mat K = (cv::Mat_<float>(3,3) << 500,0,320, 0,500,240, 0,0,1);
+    cv::Mat distCoef = cv::Mat::zeros(4,1,CV_32F);
+
+    Map map;
+    KeyFrameDatabase database(voc);
+
+    // Keyframe 10 m away from the origin
+    Frame frameKF(im,0.0,&extractor,&voc,K,distCoef,0.0f,0.0f);
+    cv::Mat Tcw = cv::Mat::eye(4,4,CV_32F);
+    Tcw.at<float>(0,3) = -10.0f;
+    frameKF.SetPose(Tcw);
+    frameKF.ComputeBoW();
+    KeyFrame* pKF = new KeyFrame(frameKF,&map,&database);
+    pKF->ComputeBoW();
+    database.add(pKF);
+
+    Frame frame(im,1.0,&extractor,&voc,K,distCoef,0.0f,0.0f);
+    frame.ComputeBoW();
+
+    const cv::Mat Ow = cv::Mat::zeros(3,1,CV_32F);
+
+    // Same sequence of queries as Tracking::Relocalization
+    const vector<KeyFrame*> vpPrior = database.DetectRelocalizationCandidates(&frame,Ow,1.0f);
+    Check(!Contains(vpPrior,pKF),"keyframe outside the prior radius is rejected");
+
+    const vector<KeyFrame*> vpGlobal = database.DetectRelocalizationCandidates(&frame);
+    Check(Contains(vpGlobal,pKF),"global fallback query finds the keyframe rejected by the prior query");
+
+    const vector<KeyFrame*> vpNear = database.DetectRelocalizationCandidates(&frame,pKF->GetCameraCenter(),1.0f);
+    Check(Contains(vpNear,pKF),"keyframe inside the prior radius is found");
+
+    delete pKF;
+
+    return nFailures==0 ? 0 : 1;
+}
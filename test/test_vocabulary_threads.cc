@@ -0,0 +1,141 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Vocabulary training: every branch of the hierarchical kmeans draws from its own generator, so the
+// tree built with several threads must be the same as the one built with a single thread, and so
+// must the vocabulary pruned from it.
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+
+#include "ORBVocabulary.h"
+#include "Thirdparty/DBoW2/DUtils/Random.h"
+
+using namespace std;
+using namespace ORB_SLAM2;
+
+namespace
+{
+
+int nFailures = 0;
+
+void Check(const bool bCondition, const char* strWhat)
+{
+    cout << (bCondition ? "[ OK ] " : "[FAIL] ") << strWhat << endl;
+    if(!bCondition)
+        nFailures++;
+}
+
+// Same words, with the same weights, descriptors and ancestors
+bool SameTree(const ORBVocabulary &voc1, const ORBVocabulary &voc2)
+{
+    if(voc1.size()!=voc2.size() || voc1.getDepthLevels()!=voc2.getDepthLevels())
+        return false;
+
+    for(unsigned int wid=0; wid<voc1.size(); wid++)
+    {
+        if(voc1.getWordWeight(wid)!=voc2.getWordWeight(wid))
+            return false;
+
+        const cv::Mat d1 = voc1.getWord(wid);
+        const cv::Mat d2 = voc2.getWord(wid);
+        if(memcmp(d1.ptr<unsigned char>(),d2.ptr<unsigned char>(),DBoW2::FORB::L)!=0)
+            return false;
+
+        for(int l=1; l<=voc1.getDepthLevels(); l++)
+            if(voc1.getParentNode(wid,l)!=voc2.getParentNode(wid,l))
+                return false;
+    }
+    return true;
+}
+
+// Same words and direct index for every training image
+bool SameTransform(const ORBVocabulary &voc1, const ORBVocabulary &voc2, const vector<vector<cv::Mat> > &vvFeatures)
+{
+    for(size_t i=0; i<vvFeatures.size(); i++)
+    {
+        DBoW2::BowVector v1, v2;
+        DBoW2::FeatureVector fv1, fv2;
+        voc1.transform(vvFeatures[i],v1,fv1,1);
+        voc2.transform(vvFeatures[i],v2,fv2,1);
+        if(v1!=v2 || fv1.size()!=fv2.size())
+            return false;
+        for(DBoW2::FeatureVector::const_iterator it1=fv1.begin(), it2=fv2.begin(); it1!=fv1.end(); ++it1, ++it2)
+            if(it1->first!=it2->first || it1->second.size()!=it2->second.size() ||
+               !equal(it1->second.begin(),it1->second.end(),it2->second.begin()))
+                return false;
+    }
+    return true;
+}
+
+ORBVocabulary Train(const vector<vector<cv::Mat> > &vvFeatures, const int nThreads)
+{
+    // The root seed of the tree is drawn from DUtils::Random, which create would otherwise seed
+    // from the clock the first time
+    DUtils::Random::SeedRandOnce(7);
+    DUtils::Random::SeedRand(7);
+    ORBVocabulary voc(6,3,DBoW2::TF_IDF,DBoW2::L1_NORM);
+    voc.setTrainingThreads(nThreads);
+    voc.create(vvFeatures);
+    return voc;
+}
+
+}
+
+int main()
+{
+    // Fixed descriptors: noisy copies of a few hundred random centers, so that the clusters are not trivial
+    cv::RNG rng(1);
+    cv::Mat centers(300,DBoW2::FORB::L,CV_8U);
+    rng.fill(centers,cv::RNG::UNIFORM,0,256);
+
+    vector<vector<cv::Mat> > vvFeatures(30);
+    for(size_t i=0; i<vvFeatures.size(); i++)
+    {
+        for(int j=0; j<200; j++)
+        {
+            cv::Mat d = centers.row(rng.uniform(0,centers.rows)).clone();
+            unsigned char* p = d.ptr<unsigned char>();
+            for(int b=0; b<8; b++)
+                p[rng.uniform(0,DBoW2::FORB::L)] ^= (unsigned char)(1 << rng.uniform(0,8));
+            vvFeatures[i].push_back(d);
+        }
+    }
+
+    ORBVocabulary voc1 = Train(vvFeatures,1);
+    ORBVocabulary vocN = Train(vvFeatures,4);
+
+    Check(!voc1.empty(),"vocabulary is trained");
+    Check(SameTree(voc1,vocN),"tree built with 4 threads is the tree built with 1 thread");
+    Check(SameTransform(voc1,vocN,vvFeatures),"both trees transform the training features the same way");
+
+    const vector<vector<cv::Mat> > vvPrune(vvFeatures.begin(),vvFeatures.begin()+5);
+    const unsigned int nRemoved1 = voc1.prune(vvPrune,2,true);
+    const unsigned int nRemovedN = vocN.prune(vvPrune,2,true);
+    Check(nRemoved1>0 && nRemoved1==nRemovedN,"pruning removes the same number of words");
+    Check(SameTree(voc1,vocN),"pruned trees are the same");
+    Check(SameTransform(voc1,vocN,vvFeatures),"pruned trees transform the training features the same way");
+
+    return nFailures==0 ? 0 : 1;
+}
@@ -0,0 +1,314 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Trains a site-specific ORB vocabulary from image directories, or prunes an
+// existing vocabulary to the words used by a deployment's images. Features are
+// extracted with the ORBextractor settings of a regular ORB-SLAM2 settings file,
+// so the vocabulary sees the same descriptors as the running system.
+// Vocabularies whose file name ends in ".bin" are read and written in binary form.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <dirent.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "ORBVocabulary.h"
+#include "ORBextractor.h"
+#include "Converter.h"
+
+using namespace std;
+
+namespace
+{
+
+void Usage()
+{
+    cerr << endl << "Usage:" << endl
+         << "  ./build_vocabulary train path_to_settings path_to_output_vocabulary image_dir [image_dir ...]" << endl
+         << "                     [-k branching_factor] [-L depth_levels] [-threads n] [-step n] [-seed n]" << endl
+         << "  ./build_vocabulary prune path_to_settings path_to_vocabulary path_to_output_vocabulary image_dir [image_dir ...]" << endl
+         << "                     [-minHits n] [-reweight] [-threads n] [-step n]" << endl
+         << endl
+         << "  -k, -L     tree shape of a trained vocabulary (default 10 and 4)" << endl
+         << "  -threads   worker threads, 0 uses all hardware threads (default 0)" << endl
+         << "  -step      use one image out of every n (default 1)" << endl
+         << "  -seed      seed of the kmeans++ initialization (default: time)" << endl
+         << "  -minHits   words hit by fewer features are removed (default 1)" << endl
+         << "  -reweight  recompute the idf weights from the given images" << endl;
+}
+
+bool HasBinaryExtension(const string &strFile)
+{
+    const string strBinExt(".bin");
+    return strFile.size()>strBinExt.size() &&
+           strFile.compare(strFile.size()-strBinExt.size(),strBinExt.size(),strBinExt)==0;
+}
+
+bool IsImageFile(string strFile)
+{
+    transform(strFile.begin(),strFile.end(),strFile.begin(),::tolower);
+    const char* vExt[] = {".png",".jpg",".jpeg",".pgm",".ppm",".bmp"};
+    for(size_t i=0; i<sizeof(vExt)/sizeof(vExt[0]); i++)
+    {
+        const string strExt(vExt[i]);
+        if(strFile.size()>strExt.size() &&
+           strFile.compare(strFile.size()-strExt.size(),strExt.size(),strExt)==0)
+            return true;
+    }
+    return false;
+}
+
+void ListImages(const string &strDir, vector<string> &vstrImages)
+{
+    DIR* pDir = opendir(strDir.c_str());
+    if(!pDir)
+    {
+        cerr << "Could not open image directory: " << strDir << endl;
+        return;
+    }
+
+    vector<string> vstrFiles;
+    while(dirent* pEntry = readdir(pDir))
+    {
+        const string strName(pEntry->d_name);
+        if(IsImageFile(strName))
+            vstrFiles.push_back(strDir+"/"+strName);
+    }
+    closedir(pDir);
+
+    sort(vstrFiles.begin(),vstrFiles.end());
+    vstrImages.insert(vstrImages.end(),vstrFiles.begin(),vstrFiles.end());
+}
+
+// Extracts the ORB descriptors of every image, nThreads images at a time
+void ExtractFeatures(const string &strSettingsFile, const vector<string> &vstrImages, int nThreads,
+                     vector<vector<cv::Mat> > &vvFeatures)
+{
+    cv::FileStorage fsSettings(strSettingsFile.c_str(), cv::FileStorage::READ);
+    if(!fsSettings.isOpened())
+    {
+        cerr << "Failed to open settings file at: " << strSettingsFile << endl;
+        exit(-1);
+    }
+
+    int nFeatures = fsSettings["ORBextractor.nFeatures"];
+    float fScaleFactor = fsSettings["ORBextractor.scaleFactor"];
+    int nLevels = fsSettings["ORBextractor.nLevels"];
+    int fIniThFAST = fsSettings["ORBextractor.iniThFAST"];
+    int fMinThFAST = fsSettings["ORBextractor.minThFAST"];
+
+    // Extractors register their parameters globally, so they are created here, one per thread
+    vector<ORB_SLAM2::ORBextractor*> vpExtractors;
+    for(int i=0; i<nThreads; i++)
+        vpExtractors.push_back(new ORB_SLAM2::ORBextractor(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST,
+                                                           vector<vector<int> >()));
+
+    vvFeatures.assign(vstrImages.size(),vector<cv::Mat>());
+    atomic<size_t> nNext(0);
+    atomic<size_t> nDone(0);
+
+    auto worker = [&](ORB_SLAM2::ORBextractor* pExtractor)
+    {
+        for(size_t i=nNext++; i<vstrImages.size(); i=nNext++)
+        {
+            cv::Mat im = cv::imread(vstrImages[i],cv::IMREAD_GRAYSCALE);
+            if(im.empty())
+            {
+                cerr << "Failed to load image at: " << vstrImages[i] << endl;
+                continue;
+            }
+
+            vector<cv::KeyPoint> vKeys;
+            cv::Mat descriptors;
+            (*pExtractor)(im,cv::Mat(),vKeys,descriptors);
+            vvFeatures[i] = ORB_SLAM2::Converter::toDescriptorVector(descriptors);
+
+            const size_t n = ++nDone;
+            if(n%100==0)
+                cout << "  " << n << "/" << vstrImages.size() << " images" << endl;
+        }
+    };
+
+    vector<thread> vThreads;
+    for(int i=1; i<nThreads; i++)
+        vThreads.push_back(thread(worker,vpExtractors[i]));
+    worker(vpExtractors[0]);
+    for(size_t i=0; i<vThreads.size(); i++)
+        vThreads[i].join();
+
+    for(size_t i=0; i<vpExtractors.size(); i++)
+        delete vpExtractors[i];
+}
+
+bool SaveVocabulary(ORB_SLAM2::ORBVocabulary &voc, const string &strFile)
+{
+    if(HasBinaryExtension(strFile))
+        return voc.saveToBinaryFile(strFile);
+
+    voc.saveToTextFile(strFile);
+    return true;
+}
+
+double Seconds(const chrono::steady_clock::time_point &t0)
+{
+    return chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now()-t0).count();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if(argc < 2)
+    {
+        Usage();
+        return 1;
+    }
+
+    const string strMode(argv[1]);
+    const int nFixedArgs = strMode=="train" ? 4 : 5;
+    if((strMode!="train" && strMode!="prune") || argc <= nFixedArgs)
+    {
+        Usage();
+        return 1;
+    }
+
+    int k = 10;
+    int L = 4;
+    int nThreads = 0;
+    int nStep = 1;
+    int nSeed = -1;
+    unsigned int nMinHits = 1;
+    bool bReweight = false;
+    vector<string> vstrDirs;
+
+    for(int i=nFixedArgs; i<argc; i++)
+    {
+        const string strArg(argv[i]);
+        const bool bHasValue = i+1<argc;
+        if(strArg=="-k" && bHasValue)
+            k = atoi(argv[++i]);
+        else if(strArg=="-L" && bHasValue)
+            L = atoi(argv[++i]);
+        else if(strArg=="-threads" && bHasValue)
+            nThreads = atoi(argv[++i]);
+        else if(strArg=="-step" && bHasValue)
+            nStep = max(1,atoi(argv[++i]));
+        else if(strArg=="-seed" && bHasValue)
+            nSeed = atoi(argv[++i]);
+        else if(strArg=="-minHits" && bHasValue)
+            nMinHits = max(1,atoi(argv[++i]));
+        else if(strArg=="-reweight")
+            bReweight = true;
+        else if(!strArg.empty() && strArg[0]=='-')
+        {
+            Usage();
+            return 1;
+        }
+        else
+            vstrDirs.push_back(strArg);
+    }
+
+    // Same limits as TemplatedVocabulary::loadFromTextFile, except that a single level would leave only
+    // the root to group the features for SearchByBoW (see FeatureVectorLevelsUp)
+    if(k<2 || k>20 || L<2 || L>10)
+    {
+        cerr << "The branching factor must be in [2,20] and the depth in [2,10]" << endl;
+        return 1;
+    }
+
+    if(nThreads<=0)
+        nThreads = max(1u,thread::hardware_concurrency());
+
+    const string strSettingsFile(argv[2]);
+
+    vector<string> vstrAllImages, vstrImages;
+    for(size_t i=0; i<vstrDirs.size(); i++)
+        ListImages(vstrDirs[i],vstrAllImages);
+    for(size_t i=0; i<vstrAllImages.size(); i+=nStep)
+        vstrImages.push_back(vstrAllImages[i]);
+
+    if(vstrImages.empty())
+    {
+        cerr << "No images found" << endl;
+        return 1;
+    }
+
+    cout << "Extracting features from " << vstrImages.size() << " images with " << nThreads << " threads..." << endl;
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    vector<vector<cv::Mat> > vvFeatures;
+    ExtractFeatures(strSettingsFile,vstrImages,nThreads,vvFeatures);
+    size_t nDescriptors = 0;
+    for(size_t i=0; i<vvFeatures.size(); i++)
+        nDescriptors += vvFeatures[i].size();
+    cout << nDescriptors << " descriptors in " << Seconds(t0) << " s" << endl;
+
+    ORB_SLAM2::ORBVocabulary voc(k,L,DBoW2::TF_IDF,DBoW2::L1_NORM);
+    voc.setTrainingThreads(nThreads);
+
+    if(strMode=="train")
+    {
+        if(nSeed>=0)
+            DUtils::Random::SeedRandOnce(nSeed);
+
+        cout << "Training a vocabulary with k = " << k << ", L = " << L << "..." << endl;
+        t0 = chrono::steady_clock::now();
+        voc.create(vvFeatures);
+        cout << "Trained in " << Seconds(t0) << " s: " << voc << endl;
+
+        if(!SaveVocabulary(voc,argv[3]))
+        {
+            cerr << "Failed to write vocabulary at: " << argv[3] << endl;
+            return 1;
+        }
+        cout << "Vocabulary saved at " << argv[3] << endl;
+    }
+    else
+    {
+        const string strVocFile(argv[3]);
+        const bool bVocLoad = HasBinaryExtension(strVocFile) ? voc.loadFromBinaryFile(strVocFile)
+                                                             : voc.loadFromTextFile(strVocFile);
+        if(!bVocLoad)
+        {
+            cerr << "Failed to load vocabulary at: " << strVocFile << endl;
+            return 1;
+        }
+        cout << "Loaded " << voc << endl;
+
+        const unsigned int nRemoved = voc.prune(vvFeatures,nMinHits,bReweight);
+        cout << "Removed " << nRemoved << " words: " << voc << endl;
+
+        if(!SaveVocabulary(voc,argv[4]))
+        {
+            cerr << "Failed to write vocabulary at: " << argv[4] << endl;
+            return 1;
+        }
+        cout << "Vocabulary saved at " << argv[4] << endl;
+    }
+
+    return 0;
+}